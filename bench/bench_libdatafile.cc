@@ -0,0 +1,1011 @@
+/*! \file bench_libdatafile.cc
+ *
+ * Benchmarks of libdatafile I/O paths.
+ *
+ * Usage: bench_libdatafile [--scale FACTOR] [--json FILE] [--label TEXT]
+ *		[--list] [BENCHMARK ...]
+ *
+ * Each benchmark writes synthetic recordings, generated from a fixed seed,
+ * so that every run measures the same data. `--scale` multiplies the
+ * length of each recording, `--json` writes every measurement to a file
+ * for comparison across versions of the library, and naming benchmarks
+ * runs only those.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "../include/datafile.h"
+#include "../include/hidensfile.h"
+#include "../include/readplan.h"
+#include "../include/blockiterator.h"
+#include "../include/snipfile.h"
+#include "../include/extractor.h"
+#include "../include/noisesampler.h"
+#include "../include/rechunk.h"
+#include "../include/recordingset.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace datafile;
+
+/* Name of the scratch file written by each benchmark */
+const std::string BenchFilename = "bench-libdatafile.h5";
+
+/* Samples per block passed to each setData() call */
+const int BenchBlockSize = 1000;
+
+/* Number of blocks written by each write benchmark, at unit scale */
+const int BenchNumBlocks = 2000;
+
+/* Settings from the command line */
+struct BenchOptions {
+	double scale = 1.0;				// Factor applied to the length of each recording
+	std::string json;				// File to which results are written, if any
+	std::string label;				// Label for the results, e.g., a commit
+};
+static BenchOptions benchOptions;
+
+/* One measurement made by a benchmark */
+struct Measurement {
+	std::string metric;
+	double value;
+	std::string unit;
+};
+
+/* Every measurement made so far, with the name of its benchmark */
+static std::vector<std::pair<std::string, Measurement> > benchResults;
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/* Return the number of samples in the given number of seconds of HiDens
+ * data, scaled by the --scale option, and at least one block.
+ */
+static int benchSamples(double duration)
+{
+	return std::max(BlockSize, static_cast<int>(
+			duration * hidensfile::SampleRate * benchOptions.scale));
+}
+
+/* Print the measurements of one benchmark on a line, and keep them for
+ * the JSON results.
+ */
+static void report(const std::string& benchmark, const std::vector<Measurement>& measurements)
+{
+	std::cout << benchmark << ":";
+	for (size_t i = 0; i < measurements.size(); i++) {
+		auto& m = measurements[i];
+		std::cout << (i ? ", " : " ") << m.metric << " " << m.value;
+		if (!m.unit.empty()) {
+			std::cout << " " << m.unit;
+		}
+		benchResults.push_back({ benchmark, m });
+	}
+	std::cout << std::endl;
+}
+
+/* Quote a string for JSON */
+static std::string jsonString(const std::string& value)
+{
+	std::ostringstream out;
+	out << '"';
+	for (auto c : value) {
+		if ( (c == '"') || (c == '\\') ) {
+			out << '\\' << c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+					<< static_cast<int>(c) << std::dec;
+		} else {
+			out << c;
+		}
+	}
+	out << '"';
+	return out.str();
+}
+
+/* Write every measurement to a JSON file, as
+ * { "label": ..., "scale": ..., "results": [ { "benchmark": ..., "metric": ...,
+ * "value": ..., "unit": ... }, ... ] }. Values which are not finite are null.
+ */
+static void writeJson(const std::string& filename)
+{
+	std::ofstream out(filename);
+	if (!out) {
+		throw std::runtime_error("Could not write benchmark results to " + filename);
+	}
+	out << std::setprecision(9);
+	out << "{\n\t\"label\": " << jsonString(benchOptions.label) << ",\n"
+			<< "\t\"scale\": " << benchOptions.scale << ",\n"
+			<< "\t\"results\": [";
+	for (size_t i = 0; i < benchResults.size(); i++) {
+		auto& m = benchResults[i].second;
+		out << (i ? ",\n" : "\n") << "\t\t{ \"benchmark\": " << jsonString(benchResults[i].first)
+				<< ", \"metric\": " << jsonString(m.metric) << ", \"value\": ";
+		if (std::isfinite(m.value)) {
+			out << m.value;
+		} else {
+			out << "null";
+		}
+		out << ", \"unit\": " << jsonString(m.unit) << " }";
+	}
+	out << "\n\t]\n}\n";
+}
+
+/* Create synthetic MEA-like data: Gaussian noise on every channel, plus
+ * sparse, stereotyped negative-going spikes. The same seed always gives
+ * the same data.
+ */
+static arma::Mat<int16_t> syntheticData(int nsamples, int nchannels, unsigned seed = 0)
+{
+	std::mt19937 rng(seed);
+	std::normal_distribution<double> noise(0.0, 12.0);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	const double spikeRate = 20.0 / hidensfile::SampleRate;
+	const int spikeWidth = 30;
+
+	arma::Mat<int16_t> data(nsamples, nchannels);
+	for (int c = 0; c < nchannels; c++) {
+		auto column = data.colptr(c);
+		for (int i = 0; i < nsamples; i++) {
+			column[i] = static_cast<int16_t>(noise(rng));
+		}
+		for (int i = 0; i < nsamples - spikeWidth; i++) {
+			if (uniform(rng) < spikeRate) {
+				auto amplitude = 100.0 + 200.0 * uniform(rng);
+				for (int j = 0; j < spikeWidth; j++) {
+					auto t = static_cast<double>(j) / spikeWidth;
+					column[i + j] += static_cast<int16_t>(
+							-amplitude * std::sin(M_PI * t) * std::exp(-4 * t));
+				}
+				i += spikeWidth;
+			}
+		}
+	}
+	return data;
+}
+
+/* Write and read back synthetic data with the given filters, and report
+ * the compression ratio and throughput.
+ */
+static void benchCompression(const std::string& name, 
+		const DataFileOptions& options, const arma::Mat<int16_t>& data)
+{
+	std::remove(BenchFilename.c_str());
+	double megabytes = static_cast<double>(data.n_elem * sizeof(int16_t)) / (1 << 20);
+
+	auto start = Clock::now();
+	{
+		DataFile file(BenchFilename, hidensfile::DefaultArray, data.n_cols, options);
+		file.setGain(1.0);
+		file.setOffset(0.0);
+		file.setDate("unknown");
+		for (arma::uword i = 0; i < data.n_rows; i += BlockSize) {
+			auto end = std::min(i + BlockSize, data.n_rows);
+			file.setData(i, end, data.rows(i, end - 1).eval());
+		}
+	}
+	auto writeTime = seconds(start);
+
+	hsize_t stored = 0;
+	{
+		H5::H5File file(BenchFilename, H5F_ACC_RDONLY);
+		stored = file.openDataSet("data").getStorageSize();
+	}
+
+	start = Clock::now();
+	{
+		DataFile file(BenchFilename);
+		arma::Mat<int16_t> read;
+		file.data(0, file.nsamples(), read);
+	}
+	auto readTime = seconds(start);
+	std::remove(BenchFilename.c_str());
+
+	report("compression/" + name, {
+			{ "ratio", (data.n_elem * sizeof(int16_t)) / static_cast<double>(stored), "" },
+			{ "write", megabytes / writeTime, "MB/s" },
+			{ "read", megabytes / readTime, "MB/s" } });
+}
+
+static void benchCompression()
+{
+	auto data = syntheticData(benchSamples(10), hidensfile::NumChannels);
+	DataFileOptions options;
+	benchCompression("none", options, data);
+	options.deflate = 1;
+	benchCompression("deflate-1", options, data);
+	options.shuffle = true;
+	benchCompression("shuffle+deflate-1", options, data);
+	options.deflate = 4;
+	benchCompression("shuffle+deflate-4", options, data);
+	options.deflate = 0;
+	for (auto filter : { FilterLZ4, FilterBlosc }) {
+		if (filterAvailable(filter)) {
+			options.filter = filter;
+			benchCompression("shuffle+filter-" + std::to_string(filter), options, data);
+		}
+	}
+}
+
+/* Report the rate at which `convert` produces voltages from raw samples */
+template<class Function>
+static void reportConversion(const std::string& name, size_t nsamples, 
+		int repeats, Function convert)
+{
+	auto start = Clock::now();
+	for (int i = 0; i < repeats; i++) {
+		convert();
+	}
+	auto elapsed = seconds(start);
+	report("conversion/" + name, { { "rate", (nsamples * repeats) / elapsed / 1e6, "Msamples/s" } });
+}
+
+/* Compare converting raw samples to voltages with Armadillo expressions,
+ * as the library used to, against the fused conversion kernels, both
+ * in memory and when reading from a file.
+ */
+static void benchConversion()
+{
+	const int repeats = 20;
+	auto raw = syntheticData(benchSamples(1), NumChannels);
+	const float gain = 0.1, offset = -1.0;
+
+	arma::mat doubles(raw.n_rows, raw.n_cols);
+	arma::fmat floats(raw.n_rows, raw.n_cols);
+	reportConversion("memory/arma-expression", raw.n_elem, repeats, [&]() {
+			doubles = gain * arma::conv_to<arma::mat>::from(raw) + offset;
+		});
+	reportConversion("memory/kernel-double", raw.n_elem, repeats, [&]() {
+			scaleSamples(raw.memptr(), doubles.memptr(), raw.n_elem, gain, offset);
+		});
+	reportConversion("memory/kernel-float", raw.n_elem, repeats, [&]() {
+			scaleSamples(raw.memptr(), floats.memptr(), raw.n_elem, gain, offset);
+		});
+
+	std::remove(BenchFilename.c_str());
+	{
+		DataFile file(BenchFilename, DefaultArray, NumChannels);
+		file.setGain(gain);
+		file.setOffset(offset);
+		file.setDate("unknown");
+		file.setData(0, raw.n_rows, raw);
+	}
+	{
+		DataFile file(BenchFilename);
+		auto n = file.nsamples();
+		reportConversion("file/read-then-scale", raw.n_elem, repeats, [&]() {
+				arma::mat tmp;
+				file.data(0, n, tmp);
+				doubles = tmp * file.gain() + file.offset();
+			});
+		reportConversion("file/dataScaled-double", raw.n_elem, repeats, [&]() {
+				file.dataScaled(0, n, doubles);
+			});
+		reportConversion("file/dataScaled-float", raw.n_elem, repeats, [&]() {
+				file.dataScaled(0, n, floats);
+			});
+	}
+	std::remove(BenchFilename.c_str());
+}
+
+/* Read many overlapping per-channel windows, one request at a time and
+ * through a ReadPlan, and report the time taken by each.
+ */
+static void benchReadPlan()
+{
+	const int nwindows = 50, windowSize = 2000, step = 500;
+	auto raw = syntheticData(nwindows * step + windowSize, NumChannels);
+	std::remove(BenchFilename.c_str());
+	{
+		DataFile file(BenchFilename, DefaultArray, NumChannels);
+		file.setGain(1.0);
+		file.setOffset(0.0);
+		file.setDate("unknown");
+		file.setData(0, raw.n_rows, raw);
+	}
+
+	DataFile file(BenchFilename);
+	DataFile::ReadPlan plan(file);
+	for (int w = 0; w < nwindows; w++) {
+		for (int c = 0; c < file.nchannels(); c++) {
+			plan.add(c, c + 1, w * step, w * step + windowSize);
+		}
+	}
+
+	auto start = Clock::now();
+	arma::Mat<int16_t> window;
+	for (int w = 0; w < nwindows; w++) {
+		for (int c = 0; c < file.nchannels(); c++) {
+			file.data(c, c + 1, w * step, w * step + windowSize, window);
+		}
+	}
+	auto individual = seconds(start);
+
+	std::vector<arma::Mat<int16_t> > windows;
+	start = Clock::now();
+	plan.execute(windows);
+	auto planned = seconds(start);
+
+	ThreadPool pool;
+	start = Clock::now();
+	plan.execute(windows, &pool);
+	auto pooled = seconds(start);
+	std::remove(BenchFilename.c_str());
+
+	report("readPlan", {
+			{ "requests", static_cast<double>(plan.size()), "" },
+			{ "chunks", static_cast<double>(plan.chunks()), "" },
+			{ "individual", individual * 1e3, "ms" },
+			{ "planned", planned * 1e3, "ms" },
+			{ "planned on pool", pooled * 1e3, "ms" },
+			{ "threads", static_cast<double>(pool.size()), "" } });
+}
+
+/* Stand-in for per-block computation, e.g. spike detection */
+static double processBlock(const arma::Mat<int16_t>& block)
+{
+	double total = 0;
+	for (int repeat = 0; repeat < 10; repeat++) {
+		for (arma::uword i = 0; i < block.n_elem; i++) {
+			total += std::abs(block(i));
+		}
+	}
+	return total;
+}
+
+/* Scan a recording block by block with a synchronous read before each
+ * block's computation, and with a BlockIterator reading ahead.
+ */
+static void benchBlockIterator()
+{
+	auto raw = syntheticData(benchSamples(30), NumChannels);
+	std::remove(BenchFilename.c_str());
+	{
+		DataFile file(BenchFilename, DefaultArray, NumChannels);
+		file.setGain(1.0);
+		file.setOffset(0.0);
+		file.setDate("unknown");
+		file.setData(0, raw.n_rows, raw);
+	}
+
+	DataFile file(BenchFilename);
+	double result = 0;
+	auto start = Clock::now();
+	arma::Mat<int16_t> block;
+	for (int64_t i = 0; i < file.nsamples(); i += BlockSize) {
+		file.data(i, std::min(i + BlockSize, file.nsamples()), block);
+		result += processBlock(block);
+	}
+	auto synchronous = seconds(start);
+
+	start = Clock::now();
+	DataFile::BlockIterator<int16_t> blocks(file);
+	for (auto& b : blocks) {
+		result += processBlock(b.data);
+	}
+	auto prefetched = seconds(start);
+	auto counters = blocks.counters();
+	std::remove(BenchFilename.c_str());
+
+	/* Keep the computation from being optimized away */
+	volatile double sink = result;
+	(void) sink;
+
+	report("blockScan", {
+			{ "blocks", static_cast<double>(blocks.nblocks()), "" },
+			{ "synchronous", synchronous * 1e3, "ms" },
+			{ "read-ahead", prefetched * 1e3, "ms" },
+			{ "stalled", counters.stallSeconds * 1e3, "ms" },
+			{ "throughput", counters.throughput / 1e6, "Msamples/s" } });
+}
+
+/* Draw a zoomed-out view of a recording, reading all of its samples and
+ * from its summary levels, and report the time taken by each.
+ */
+static void benchSummary()
+{
+	auto raw = syntheticData(benchSamples(60), NumChannels);
+	const int pixels = 1000;
+	std::remove(BenchFilename.c_str());
+	double writeTime = 0;
+	{
+		DataFileOptions options;
+		options.summaryFactors = DefaultSummaryFactors;
+		DataFile file(BenchFilename, DefaultArray, NumChannels, options);
+		file.setGain(1.0);
+		file.setOffset(0.0);
+		file.setDate("unknown");
+		auto start = Clock::now();
+		for (arma::uword i = 0; i < raw.n_rows; i += BlockSize) {
+			auto end = std::min(i + BlockSize, raw.n_rows);
+			file.setData(i, end, raw.rows(i, end - 1).eval());
+		}
+		writeTime = seconds(start);
+	}
+
+	DataFile file(BenchFilename);
+	auto start = Clock::now();
+	arma::Mat<int16_t> all;
+	file.data(0, file.nsamples(), all);
+	arma::Mat<int16_t> envelope(pixels, file.nchannels());
+	auto width = all.n_rows / pixels;
+	for (arma::uword c = 0; c < all.n_cols; c++) {
+		for (int p = 0; p < pixels; p++) {
+			envelope(p, c) = all.submat(p * width, c, (p + 1) * width - 1, c).eval().max();
+		}
+	}
+	auto fromData = seconds(start);
+
+	start = Clock::now();
+	auto summary = file.summary(0, file.nchannels(), 0, file.nsamples(), pixels);
+	auto fromSummary = seconds(start);
+	std::remove(BenchFilename.c_str());
+
+	report("summary", {
+			{ "samples", static_cast<double>(file.nsamples()), "" },
+			{ "pixels", static_cast<double>(pixels), "" },
+			{ "write with summary", writeTime * 1e3, "ms" },
+			{ "envelope from data", fromData * 1e3, "ms" },
+			{ "envelope from summary", fromSummary * 1e3, "ms" },
+			{ "level", static_cast<double>(summary.factor), "" } });
+}
+
+/* Write the same snippets from many channels in each snippet file layout,
+ * and report the rate at which they are written and loaded.
+ */
+static void benchSnippetLayouts()
+{
+	const arma::uword nchannels = 1024, nsnips = 200, snipsize = 53;
+	const std::string snipFilename = "bench-libdatafile.snip";
+	std::remove(BenchFilename.c_str());
+	DataFile source(BenchFilename, DefaultArray, NumChannels);
+	source.setGain(1.0);
+	source.setOffset(0.0);
+	source.setDate("unknown");
+
+	std::vector<arma::uvec> idx(nchannels);
+	std::vector<arma::Mat<short> > snips(nchannels);
+	arma::uvec channels(nchannels);
+	for (arma::uword c = 0; c < nchannels; c++) {
+		channels(c) = c;
+		idx[c].set_size(nsnips);
+		snips[c].set_size(snipsize, nsnips);
+		for (arma::uword i = 0; i < nsnips; i++) {
+			idx[c](i) = 100 * i + c;
+		}
+		for (arma::uword i = 0; i < snips[c].n_elem; i++) {
+			snips[c](i) = static_cast<short>((i * 2654435761u + c) >> 20);
+		}
+	}
+
+	double megabytes = static_cast<double>(nchannels * nsnips *
+			(snipsize * sizeof(short) + sizeof(arma::uword))) / (1 << 20);
+	for (auto layout : { snipfile::SnipLayout::ChannelGroups, snipfile::SnipLayout::Columnar }) {
+		std::remove(snipFilename.c_str());
+		auto start = Clock::now();
+		{
+			snipfile::SnipFile file(snipFilename, source, snipfile::NUM_SAMPLES_BEFORE,
+					snipfile::NUM_SAMPLES_AFTER, 0, layout);
+			file.setChannels(channels);
+			file.setThresholds(arma::vec(nchannels, arma::fill::ones));
+			file.writeSpikeSnips(idx, snips);
+		}
+		auto written = seconds(start);
+		snipfile::SnipFile file(snipFilename);
+		std::vector<arma::uvec> readIdx;
+		std::vector<arma::Mat<short> > readSnips;
+		start = Clock::now();
+		file.spikeSnips(readIdx, readSnips);
+		auto read = seconds(start);
+		report(std::string("spikeSnips/") + 
+				(layout == snipfile::SnipLayout::Columnar ? "columnar" : "channel-groups"), {
+				{ "channels", static_cast<double>(nchannels), "" },
+				{ "write", megabytes / written, "MB/s" },
+				{ "read", megabytes / read, "MB/s" },
+				{ "read time", read * 1e3, "ms" } });
+	}
+	std::remove(snipFilename.c_str());
+	std::remove(BenchFilename.c_str());
+}
+
+/* Append compressed snippets from many channels, and report the time to
+ * load all of them serially and on a thread pool.
+ */
+static void benchParallelSnippets()
+{
+	const arma::uword nchannels = 128, nsnips = 5000, snipsize = 53;
+	const std::string snipFilename = "bench-libdatafile.snip";
+	std::remove(BenchFilename.c_str());
+	std::remove(snipFilename.c_str());
+	DataFile source(BenchFilename, DefaultArray, NumChannels);
+	source.setGain(1.0);
+	source.setOffset(0.0);
+	source.setDate("unknown");
+	{
+		auto noise = syntheticData(static_cast<int>(nsnips * snipsize), 1);
+		snipfile::SnipFile file(snipFilename, source, snipfile::NUM_SAMPLES_BEFORE,
+				snipfile::NUM_SAMPLES_AFTER, 4);
+		arma::uvec channels(nchannels);
+		for (arma::uword c = 0; c < nchannels; c++) {
+			channels(c) = c;
+		}
+		file.setChannels(channels);
+		file.setThresholds(arma::vec(nchannels, arma::fill::ones));
+		arma::Mat<short> snips(noise.memptr(), snipsize, nsnips);
+		arma::uvec idx(nsnips);
+		for (arma::uword i = 0; i < nsnips; i++) {
+			idx(i) = 100 * i;
+		}
+		for (arma::uword c = 0; c < nchannels; c++) {
+			file.appendSpikeSnips(c, idx, snips);
+		}
+	}
+
+	snipfile::SnipFile file(snipFilename);
+	std::vector<arma::uvec> idx;
+	std::vector<arma::Mat<short> > snips;
+	auto start = Clock::now();
+	file.spikeSnips(idx, snips);
+	auto serial = seconds(start);
+	ThreadPool pool;
+	start = Clock::now();
+	file.spikeSnips(idx, snips, pool);
+	auto parallel = seconds(start);
+	std::remove(snipFilename.c_str());
+	std::remove(BenchFilename.c_str());
+
+	report("spikeSnips/compressed", {
+			{ "channels", static_cast<double>(nchannels), "" },
+			{ "serial", serial * 1e3, "ms" },
+			{ "pool", parallel * 1e3, "ms" },
+			{ "threads", static_cast<double>(pool.size()), "" } });
+}
+
+/* Extract spikes from a minute of synthetic data, with one thread and with
+ * one per hardware thread, and report the rate per thread.
+ */
+static void benchExtractor()
+{
+	const int nchannels = 64, nblocks = 6;
+	const int blockSamples = benchSamples(10);
+	const std::string snipFilename = "bench-libdatafile.snip";
+	std::remove(BenchFilename.c_str());
+	DataFile file(BenchFilename, DefaultArray, nchannels);
+	file.setGain(1.0);
+	file.setOffset(0.0);
+	file.setDate("unknown");
+	auto block = syntheticData(blockSamples, nchannels);
+	for (int i = 0; i < nblocks; i++) {
+		file.setData(i * blockSamples, (i + 1) * blockSamples, block);
+	}
+
+	for (auto parallel : { false, true }) {
+		auto nthreads = parallel ?
+				static_cast<size_t>(std::max(1u, std::thread::hardware_concurrency())) : 1;
+		std::remove(snipFilename.c_str());
+		snipfile::ExtractorOptions options;
+		options.nthreads = nthreads;
+		snipfile::Extractor extractor(file, options);
+		snipfile::SnipFile snipFile(snipFilename, file);
+		auto counters = extractor.run(snipFile);
+		report(std::string("extractor/") + (parallel ? "all-threads" : "one-thread"), {
+				{ "threads", static_cast<double>(nthreads), "" },
+				{ "spikes", static_cast<double>(counters.spikes), "" },
+				{ "rate", counters.throughput / nthreads / 1e6, "Msamples/s/thread" } });
+	}
+	std::remove(snipFilename.c_str());
+	std::remove(BenchFilename.c_str());
+}
+
+/* Draw random noise snippets from every channel, by reading each snippet
+ * separately and through a NoiseSampler.
+ */
+static void benchNoiseSampler()
+{
+	const int nchannels = 64;
+	const int nsamples = benchSamples(60);
+	const auto count = snipfile::NUM_RANDOM_SNIPPETS;
+	const auto nbefore = snipfile::NUM_SAMPLES_BEFORE, nafter = snipfile::NUM_SAMPLES_AFTER;
+	std::remove(BenchFilename.c_str());
+	DataFile file(BenchFilename, DefaultArray, nchannels);
+	file.setGain(1.0);
+	file.setOffset(0.0);
+	file.setDate("unknown");
+	file.setData(0, nsamples, syntheticData(nsamples, nchannels));
+
+	snipfile::NoiseSampler sampler(file);
+	auto idx = sampler.indices(count, nbefore, nafter);
+	arma::Mat<int16_t> snip;
+	auto start = Clock::now();
+	for (int c = 0; c < nchannels; c++) {
+		for (auto sample : idx) {
+			file.data(c, c + 1, static_cast<int>(sample - nbefore), 
+					static_cast<int>(sample + nafter + 1), snip);
+		}
+	}
+	auto naive = seconds(start);
+
+	arma::uvec channels(nchannels);
+	for (int c = 0; c < nchannels; c++) {
+		channels(c) = c;
+	}
+	std::vector<arma::uvec> sampledIdx;
+	std::vector<arma::Mat<short> > snips;
+	start = Clock::now();
+	sampler.sample(channels, count, nbefore, nafter, sampledIdx, snips);
+	auto sampled = seconds(start);
+	std::remove(BenchFilename.c_str());
+
+	report("noiseSnippets", {
+			{ "channels", static_cast<double>(nchannels), "" },
+			{ "snippets per channel", static_cast<double>(count), "" },
+			{ "per-snippet reads", naive * 1e3, "ms" },
+			{ "NoiseSampler", sampled * 1e3, "ms" } });
+}
+
+/* Band-pass filter HiDens-sized blocks of synthetic data, with the IIR and
+ * FIR filters, and report the speed relative to real time.
+ */
+static void benchFilter()
+{
+	const int nchannels = hidensfile::NumChannels, nblocks = 20;
+	const int blockSamples = BlockSize;
+	auto block = syntheticData(blockSamples, nchannels);
+	arma::fmat filtered;
+	for (auto filter : { Filter::bandpass(300, 5000, hidensfile::SampleRate),
+			Filter::firBandpass(300, 5000, hidensfile::SampleRate, 31) }) {
+		auto start = Clock::now();
+		for (int i = 0; i < nblocks; i++) {
+			filter.process(block, filtered);
+		}
+		auto elapsed = seconds(start);
+		report(std::string("filter/") + (filter.isFir() ? "fir" : "iir"), {
+				{ "channels", static_cast<double>(nchannels), "" },
+				{ "speed", (nblocks * blockSamples / hidensfile::SampleRate) / elapsed,
+						"x real time" } });
+	}
+}
+
+/* Convert a recording laid out for time windows into one laid out for
+ * channel scans, by copying it through DataFile block by block and with
+ * rechunk(), and report the time taken by each.
+ */
+static void benchRechunk()
+{
+	const int nchannels = 64;
+	const int nsamples = benchSamples(60);
+	const std::string rechunkedFilename = "bench-libdatafile-rechunked.h5";
+	std::remove(BenchFilename.c_str());
+	{
+		DataFile file(BenchFilename, DefaultArray, nchannels,
+				recommendOptions(AccessPattern::TimeWindow, nchannels));
+		file.setGain(1.0);
+		file.setOffset(0.0);
+		file.setDate("unknown");
+		file.setData(0, nsamples, syntheticData(nsamples, nchannels));
+	}
+
+	auto options = recommendOptions(AccessPattern::ChannelScan, nchannels);
+	options.shuffle = true;
+	options.deflate = 4;
+	std::remove(rechunkedFilename.c_str());
+	auto start = Clock::now();
+	{
+		DataFile source(BenchFilename);
+		DataFile copy(rechunkedFilename, DefaultArray, nchannels, options);
+		copy.setGain(1.0);
+		copy.setOffset(0.0);
+		copy.setDate("unknown");
+		arma::Mat<int16_t> block;
+		for (int i = 0; i < nsamples; i += BlockSize) {
+			auto end = std::min(nsamples, i + BlockSize);
+			source.data(i, end, block);
+			copy.setData(i, end, block);
+		}
+	}
+	auto copied = seconds(start);
+
+	std::remove(rechunkedFilename.c_str());
+	start = Clock::now();
+	rechunk(BenchFilename, rechunkedFilename, options);
+	auto rechunked = seconds(start);
+	std::remove(rechunkedFilename.c_str());
+	std::remove(BenchFilename.c_str());
+
+	report("rechunk", {
+			{ "samples", static_cast<double>(nsamples), "" },
+			{ "DataFile copy", copied * 1e3, "ms" },
+			{ "rechunk", rechunked * 1e3, "ms" } });
+}
+
+/* Open a small recording repeatedly, as when scanning a directory of
+ * recordings, as a DataFile, with peek(), and with array(), and report
+ * the time taken by each open.
+ */
+static void benchOpenLatency()
+{
+	const int nopens = 500;
+	std::remove(BenchFilename.c_str());
+	{
+		DataFile file(BenchFilename, DefaultArray, datafile::NumChannels,
+				recommendOptions(AccessPattern::Mixed));
+		file.setGain(1.0);
+		file.setOffset(0.0);
+		file.setDate("unknown");
+		file.setData(0, BlockSize, syntheticData(BlockSize, datafile::NumChannels));
+	}
+
+	auto start = Clock::now();
+	for (int i = 0; i < nopens; i++) {
+		DataFile file(BenchFilename);
+	}
+	auto opened = seconds(start);
+	start = Clock::now();
+	for (int i = 0; i < nopens; i++) {
+		peek(BenchFilename);
+	}
+	auto peeked = seconds(start);
+	start = Clock::now();
+	for (int i = 0; i < nopens; i++) {
+		datafile::array(BenchFilename);
+	}
+	auto arrays = seconds(start);
+	std::remove(BenchFilename.c_str());
+
+	report("openLatency", {
+			{ "DataFile", opened / nopens * 1e6, "us" },
+			{ "peek", peeked / nopens * 1e6, "us" },
+			{ "array", arrays / nopens * 1e6, "us" } });
+}
+
+/* Read windows spanning the boundaries of a segmented recording, by
+ * concatenating reads of each file, through a RecordingSet with and
+ * without a pool, and through a virtual file, and report the time per window.
+ */
+static void benchRecordingSet()
+{
+	const int nfiles = 4;
+	const int nchannels = 64;
+	const int fileSamples = benchSamples(30);
+	const int windowSamples = fileSamples;
+	const int nwindows = 2 * (nfiles - 1);
+	const std::string virtualFilename = "bench-libdatafile-virtual.h5";
+	std::vector<std::string> filenames;
+	auto data = syntheticData(fileSamples, nchannels);
+	for (int i = 0; i < nfiles; i++) {
+		filenames.push_back("bench-libdatafile-" + std::to_string(i) + ".h5");
+		std::remove(filenames.back().c_str());
+		DataFile file(filenames.back(), DefaultArray, nchannels,
+				recommendOptions(AccessPattern::TimeWindow, nchannels));
+		file.setGain(1.0);
+		file.setOffset(0.0);
+		file.setDate("unknown");
+		file.setData(0, fileSamples, data);
+	}
+
+	/* Windows straddle each boundary, half in each file */
+	std::vector<int> starts;
+	for (int i = 0; i < nwindows; i++) {
+		starts.push_back((i % (nfiles - 1) + 1) * fileSamples - windowSamples / 2);
+	}
+
+	arma::Mat<int16_t> window;
+	double concatenated = 0;
+	{
+		std::vector<std::unique_ptr<DataFile> > files;
+		for (auto& name : filenames) {
+			files.emplace_back(new DataFile(name));
+		}
+		auto start = Clock::now();
+		for (auto first : starts) {
+			auto index = first / fileSamples;
+			arma::Mat<int16_t> head, tail;
+			files[index]->data(first - index * fileSamples, fileSamples, head);
+			files[index + 1]->data(0, first + windowSamples - (index + 1) * fileSamples, tail);
+			window = arma::join_cols(head, tail);
+		}
+		concatenated = seconds(start);
+	}
+
+	RecordingSet set(filenames);
+	auto start = Clock::now();
+	ThreadPool pool(2);
+	for (auto first : starts) {
+		set.data(first, first + windowSamples, window);
+	}
+	auto serial = seconds(start);
+	start = Clock::now();
+	for (auto first : starts) {
+		set.data(first, first + windowSamples, window, &pool);
+	}
+	auto parallel = seconds(start);
+
+	std::remove(virtualFilename.c_str());
+	set.writeVirtual(virtualFilename);
+	start = Clock::now();
+	{
+		DataFile file(virtualFilename);
+		for (auto first : starts) {
+			file.data(first, first + windowSamples, window);
+		}
+	}
+	auto virtualRead = seconds(start);
+	std::remove(virtualFilename.c_str());
+	for (auto& name : filenames) {
+		std::remove(name.c_str());
+	}
+
+	report("recordingSet", {
+			{ "window", static_cast<double>(windowSamples), "samples" },
+			{ "concatenated", concatenated / nwindows * 1e3, "ms" },
+			{ "set", serial / nwindows * 1e3, "ms" },
+			{ "set with pool", parallel / nwindows * 1e3, "ms" },
+			{ "virtual file", virtualRead / nwindows * 1e3, "ms" } });
+}
+
+/* Write a recording block by block, with or without deferring writes
+ * of the number of samples, and report the write rate.
+ */
+static void benchSetData(const std::string& array, int nchannels, bool defer)
+{
+	std::remove(BenchFilename.c_str());
+	auto block = syntheticData(BenchBlockSize, nchannels);
+	auto nblocks = std::max(1, static_cast<int>(BenchNumBlocks * benchOptions.scale));
+	double elapsed = 0;
+	{
+		DataFile file(BenchFilename, array, nchannels);
+		file.setDeferNumSamples(defer);
+		auto start = Clock::now();
+		for (int i = 0; i < nblocks; i++) {
+			file.setData(i * BenchBlockSize, (i + 1) * BenchBlockSize, block);
+		}
+		file.flush();
+		elapsed = seconds(start);
+	}
+	std::remove(BenchFilename.c_str());
+	double megabytes = static_cast<double>(nblocks) * block.n_elem * sizeof(int16_t) / (1 << 20);
+	report("setData/" + array + (defer ? "/deferred" : "/immediate"), {
+			{ "channels", static_cast<double>(nchannels), "" },
+			{ "rate", nblocks / elapsed, "blocks/s" },
+			{ "throughput", megabytes / elapsed, "MB/s" } });
+}
+
+static void benchSetData()
+{
+	for (auto defer : { false, true }) {
+		benchSetData(DefaultArray, datafile::NumChannels, defer);
+		benchSetData(hidensfile::DefaultArray, hidensfile::NumChannels, defer);
+	}
+}
+
+/* Read windows of several sizes from one channel at a time and from all
+ * channels, and report the rate at which data is read into matrices of T.
+ * Windows longer than the recording are skipped.
+ */
+template<class T>
+static void benchReadWindows(const DataFile& file, const std::string& type)
+{
+	const int nreads = 50;
+	for (auto all : { false, true }) {
+		std::vector<Measurement> rates;
+		for (int64_t window : { 100, 1000, 10000, 100000 }) {
+			if (window > file.nsamples()) {
+				continue;
+			}
+			auto step = (file.nsamples() - window) / nreads;
+			auto nchannels = all ? file.nchannels() : 1;
+			arma::Mat<T> mat;
+			auto start = Clock::now();
+			for (int i = 0; i < nreads; i++) {
+				auto chan = all ? 0 : i % file.nchannels();
+				file.data(chan, chan + nchannels, i * step, i * step + window, mat);
+			}
+			auto elapsed = seconds(start);
+			double megabytes = static_cast<double>(nreads * window * nchannels * 
+					sizeof(T)) / (1 << 20);
+			rates.push_back({ std::to_string(window) + " samples", megabytes / elapsed, "MB/s" });
+		}
+		report("data/" + type + (all ? "/all-channels" : "/single-channel"), rates);
+	}
+}
+
+static void benchReadWindows()
+{
+	std::remove(BenchFilename.c_str());
+	{
+		DataFile file(BenchFilename, hidensfile::DefaultArray, hidensfile::NumChannels);
+		file.setGain(1.0);
+		file.setOffset(0.0);
+		file.setDate("unknown");
+		auto raw = syntheticData(benchSamples(30), hidensfile::NumChannels);
+		file.setData(0, raw.n_rows, raw);
+	}
+	DataFile file(BenchFilename);
+	benchReadWindows<int16_t>(file, "int16");
+	benchReadWindows<double>(file, "double");
+	std::remove(BenchFilename.c_str());
+}
+
+/* Every benchmark, by the name used to select it */
+static const std::vector<std::pair<std::string, std::function<void()> > > Benchmarks = {
+	{ "setData", [](){ benchSetData(); } },
+	{ "data", [](){ benchReadWindows(); } },
+	{ "compression", [](){ benchCompression(); } },
+	{ "conversion", benchConversion },
+	{ "readPlan", benchReadPlan },
+	{ "blockScan", benchBlockIterator },
+	{ "summary", benchSummary },
+	{ "spikeSnips", [](){ benchSnippetLayouts(); benchParallelSnippets(); } },
+	{ "extractor", benchExtractor },
+	{ "noiseSnippets", benchNoiseSampler },
+	{ "filter", benchFilter },
+	{ "rechunk", benchRechunk },
+	{ "openLatency", benchOpenLatency },
+	{ "recordingSet", benchRecordingSet },
+};
+
+static int usage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [--scale FACTOR] [--json FILE] "
+			<< "[--label TEXT] [--list] [BENCHMARK ...]" << std::endl;
+	return 1;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<std::string> selected;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--list") {
+			for (auto& bench : Benchmarks) {
+				std::cout << bench.first << std::endl;
+			}
+			return 0;
+		} else if ( (arg == "--scale") && (i + 1 < argc) ) {
+			benchOptions.scale = std::atof(argv[++i]);
+			if (!(benchOptions.scale > 0)) {
+				return usage(argv[0]);
+			}
+		} else if ( (arg == "--json") && (i + 1 < argc) ) {
+			benchOptions.json = argv[++i];
+		} else if ( (arg == "--label") && (i + 1 < argc) ) {
+			benchOptions.label = argv[++i];
+		} else if (std::find_if(Benchmarks.begin(), Benchmarks.end(),
+				[&arg](const std::pair<std::string, std::function<void()> >& bench) {
+					return bench.first == arg;
+				}) != Benchmarks.end()) {
+			selected.push_back(arg);
+		} else {
+			return usage(argv[0]);
+		}
+	}
+
+	for (auto& bench : Benchmarks) {
+		if (selected.empty() ||
+				(std::find(selected.begin(), selected.end(), bench.first) != selected.end())) {
+			bench.second();
+		}
+	}
+	if (!benchOptions.json.empty()) {
+		writeJson(benchOptions.json);
+	}
+	return 0;
+}
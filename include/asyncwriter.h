@@ -0,0 +1,186 @@
+/*! \file asyncwriter.h
+ *
+ * Asynchronous, double-buffered writer which moves HDF5 writes of raw
+ * data off of the acquisition thread.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _ASYNCWRITER_H_
+#define _ASYNCWRITER_H_
+
+#include "datafile.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace datafile {
+
+/*! Default number of buffers in an AsyncWriter's ring. */
+const size_t AsyncWriterBuffers = 8;
+
+/*! Largest size of each buffer in an AsyncWriter's ring, in bytes.
+ * Buffers smaller than a chunk hold a divisor of the chunk length where
+ * one of at least half this size exists. Otherwise they hold exactly this
+ * many bytes of samples, and writes from them may straddle chunk boundaries.
+ */
+const size_t AsyncWriterBufferBytes = 1 << 24;
+
+/*! The AsyncWriter class appends blocks of data to a DataFile from a
+ * dedicated I/O thread.
+ *
+ * Blocks passed to append() are copied into a bounded, single-producer
+ * single-consumer ring of pre-allocated buffers, each of which holds up to
+ * one HDF5 chunk worth of samples from every channel. When a buffer fills, it
+ * is handed to the I/O thread, which writes it with a single hyperslab write.
+ * The producer never blocks on HDF5.
+ *
+ * Because every buffer spans all channels, chunks which are long in time
+ * would make very large buffers: a file with recommendOptions(ChannelScan)
+ * and 1024 channels has 512 MiB of samples per chunk length. Buffers are
+ * therefore limited to AsyncWriterBufferBytes, so the ring allocates at most
+ * nbuffers * AsyncWriterBufferBytes. A buffer holds a whole chunk, or else
+ * the largest divisor of the chunk length that fits, and its writes then
+ * never straddle a chunk boundary. The exception is a chunk length with no
+ * divisor between half and all of the limit, such as a prime one: buffers
+ * then hold the limit itself, and their writes may straddle chunk boundaries,
+ * which is correct but slower, as HDF5 must update those chunks partially.
+ *
+ * If the I/O thread falls behind and the ring fills up, the writer either
+ * waits for space (OverflowPolicy::Block) or drops the incoming samples
+ * (OverflowPolicy::Drop). Dropped samples still advance the write position,
+ * so later data lands at the correct sample offset and the gap reads back
+ * as zeros.
+ *
+ * While an AsyncWriter is alive, the DataFile must not be written through
+ * any other path, and DataFile::nsamples() is only guaranteed to be current
+ * after a call to flush(). The DataFile must outlive the writer.
+ */
+class DataFile::AsyncWriter {
+
+	public:
+
+		/*! Behavior when the ring of buffers is full. */
+		enum class OverflowPolicy {
+			Block,	// Wait for the I/O thread to free a buffer
+			Drop	// Discard incoming samples and count them
+		};
+
+		/*! Snapshot of the writer's counters. */
+		struct Counters {
+			uint64_t blocksAppended;	// Blocks passed to append()
+			uint64_t samplesAppended;	// Samples passed to append()
+			uint64_t samplesWritten;	// Samples written to the file
+			uint64_t samplesDropped;	// Samples discarded when the ring was full
+			uint64_t writes;			// Hyperslab writes issued by the I/O thread
+			uint64_t stalls;			// Times append() found the ring full
+			size_t highWater;			// Most buffers ever waiting to be written
+			size_t capacity;			// Number of buffers in the ring
+		};
+
+		/*! Construct a writer appending to the given file.
+		 * \param file The DataFile to write. It must not be read-only.
+		 * \param nbuffers The number of buffers in the ring.
+		 * \param policy What to do when the ring is full.
+		 *
+		 * Writing starts at the current end of the file's data.
+		 *
+		 * Exceptions:
+		 * This throws a std::logic_error if the file is read-only or if
+		 * fewer than two buffers are requested.
+		 */
+		AsyncWriter(DataFile& file, size_t nbuffers = AsyncWriterBuffers,
+				OverflowPolicy policy = OverflowPolicy::Block);
+		AsyncWriter(const AsyncWriter& other) = delete;
+		AsyncWriter& operator=(const AsyncWriter& other) = delete;
+
+		/*! Destroy the writer, writing any buffered data and flushing the file.
+		 * Errors are reported on std::cerr, never thrown.
+		 */
+		~AsyncWriter();
+
+		/*! Append a block of data to the file.
+		 * \param block Data with shape (nsamples, nchannels).
+		 * \return true if all samples were buffered, false if any were dropped.
+		 *
+		 * Exceptions:
+		 * This throws a std::logic_error if the block has the wrong number of
+		 * channels, and rethrows any error previously raised on the I/O thread.
+		 */
+		bool append(const arma::Mat<int16_t>& block);
+
+		/*! Write all buffered data and flush the file to disk.
+		 * This blocks until the I/O thread has written everything appended
+		 * so far, and rethrows any error raised on the I/O thread.
+		 */
+		void flush();
+
+		/*! Return the sample index at which the next appended block will be written. */
+		uint64_t position() const;
+
+		/*! Return the number of buffers waiting to be written. */
+		size_t pending() const;
+
+		/*! Return a snapshot of the writer's counters. */
+		Counters counters() const;
+
+	private:
+
+		/* One buffer of m_slotSamples samples. Samples [begin, end) of the buffer
+		 * are written to samples [start + begin, start + end) of the file.
+		 */
+		struct Slot {
+			arma::Mat<int16_t> buffer;
+			uint64_t start;
+			size_t begin;
+			size_t end;
+		};
+
+		void run();						// I/O thread loop
+		void writeSlot(const Slot& slot);
+		void publish();					// Hand the current slot to the I/O thread
+		bool acquire();					// Reserve the current slot, false if ring full
+		void rethrow();					// Rethrow an error from the I/O thread
+		void drain();					// Publish and wait until the ring is empty
+
+		DataFile& m_file;
+		OverflowPolicy m_policy;
+		size_t m_slotSamples;			// Samples in each buffer, dividing a chunk if possible
+		std::vector<Slot> m_slots;
+
+		/* Ring indices. m_head counts slots published by the producer,
+		 * m_tail counts slots written by the consumer.
+		 */
+		std::atomic<uint64_t> m_head;
+		std::atomic<uint64_t> m_tail;
+		bool m_slotOpen;				// Producer holds slot m_head % capacity
+		uint64_t m_position;			// Next sample to be appended
+
+		/* Wake-up signalling only; the ring itself is lock-free. */
+		std::mutex m_mutex;
+		std::condition_variable m_dataReady;
+		std::condition_variable m_spaceReady;
+		std::atomic<bool> m_stop;
+		std::exception_ptr m_error;
+		std::atomic<bool> m_failed;
+
+		std::atomic<uint64_t> m_blocksAppended;
+		std::atomic<uint64_t> m_samplesAppended;
+		std::atomic<uint64_t> m_samplesWritten;
+		std::atomic<uint64_t> m_samplesDropped;
+		std::atomic<uint64_t> m_writes;
+		std::atomic<uint64_t> m_stalls;
+		std::atomic<size_t> m_highWater;
+
+		std::thread m_thread;
+
+}; // end AsyncWriter class
+
+}; // end datafile namespace
+
+#endif
+
@@ -0,0 +1,321 @@
+/*! \file blockiterator.h
+ *
+ * Iterator over successive blocks of a recording, which reads ahead on a
+ * background thread so that computation and I/O overlap.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _BLOCKITERATOR_H_
+#define _BLOCKITERATOR_H_
+
+#include "datafile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace datafile {
+
+/*! Default number of blocks a BlockIterator reads ahead of its consumer. */
+const size_t BlockIteratorReadAhead = 2;
+
+/*! The BlockIterator class walks a recording front to back in blocks of
+ * samples from all channels, reading upcoming blocks on a background thread.
+ *
+ * It is a single-pass range, usable in a range-based for loop:
+ *
+ *		DataFile::BlockIterator<int16_t> blocks(file, BlockSize, overlap);
+ *		for (auto& block : blocks) {
+ *			process(block.start, block.data);
+ *		}
+ *
+ * Successive blocks begin `blockSize - overlap` samples apart, so the last
+ * `overlap` samples of one block are the first of the next. The final block
+ * may be shorter than the others.
+ *
+ * The background thread fills a fixed set of readAhead + 1 buffers, which
+ * are recycled as the consumer moves on, so no memory is allocated once the
+ * iterator is running. A block is only valid until the iterator is advanced.
+ *
+ * The DataFile must outlive the iterator, and must not be written while
+ * the iterator is alive.
+ */
+template<class T>
+class DataFile::BlockIterator {
+
+	public:
+
+		/*! One block of data. */
+		struct Block {
+			int64_t start;			// First sample of the block in the file
+			int64_t end;			// One past the last sample of the block
+			arma::Mat<T> data;		// Data with shape (end - start, nchannels)
+		};
+
+		/*! Snapshot of the iterator's counters. */
+		struct Counters {
+			uint64_t blocks;		// Blocks handed to the consumer
+			uint64_t samples;		// Samples read by the background thread
+			uint64_t stalls;		// Times the consumer waited for a block
+			double stallSeconds;	// Total time the consumer spent waiting
+			double readSeconds;		// Total time spent reading from the file
+			double elapsedSeconds;	// Time since the iterator was created
+			double throughput;		// Samples read per second of elapsed time
+		};
+
+		/*! Input iterator over the blocks. */
+		class Iterator : public std::iterator<std::input_iterator_tag, Block> {
+			public:
+				Iterator(BlockIterator* owner = nullptr) : m_owner(owner) { }
+				const Block& operator*() const { return m_owner->current(); }
+				const Block* operator->() const { return &m_owner->current(); }
+				Iterator& operator++() 
+				{
+					if (!m_owner->advance())
+						m_owner = nullptr;
+					return *this;
+				}
+				bool operator==(const Iterator& other) const { return m_owner == other.m_owner; }
+				bool operator!=(const Iterator& other) const { return m_owner != other.m_owner; }
+			private:
+				BlockIterator* m_owner;
+		};
+
+		/*! Start reading blocks from the given file.
+		 * \param file The file to read.
+		 * \param blockSize The number of samples in each block.
+		 * \param overlap The number of samples shared by successive blocks.
+		 * \param readAhead The number of blocks to read ahead of the consumer.
+		 * \param startSample The first sample to read.
+		 * \param endSample One past the last sample to read. If negative,
+		 * blocks are read up to the current end of the file.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the block size or overlap are
+		 * invalid or readAhead is zero, and a std::logic_error if the sample
+		 * range is outside the file.
+		 */
+		BlockIterator(const DataFile& file, int blockSize = BlockSize, 
+				int overlap = 0, size_t readAhead = BlockIteratorReadAhead,
+				int64_t startSample = 0, int64_t endSample = -1)
+			: m_file(file),
+			  m_blockSize(blockSize),
+			  m_step(blockSize - overlap),
+			  m_startSample(startSample),
+			  m_endSample(endSample < 0 ? file.nsamples() : endSample),
+			  m_buffers(readAhead + 1),
+			  m_current(NoBlock),
+			  m_started(false),
+			  m_produced(0),
+			  m_stop(false),
+			  m_created(std::chrono::steady_clock::now()),
+			  m_blocks(0),
+			  m_samples(0),
+			  m_stalls(0),
+			  m_stallSeconds(0),
+			  m_readSeconds(0)
+		{
+			if ( (blockSize <= 0) || (overlap < 0) || (overlap >= blockSize) ) {
+				throw std::invalid_argument("Invalid block size and overlap: (" +
+						std::to_string(blockSize) + ", " + std::to_string(overlap) + ")");
+			}
+			if (readAhead == 0) {
+				throw std::invalid_argument("A BlockIterator must read at least one block ahead");
+			}
+			if ( (m_startSample < 0) || (m_endSample > file.nsamples()) ||
+					(m_startSample > m_endSample) ) {
+				throw std::logic_error("Requested sample range invalid: (" +
+						std::to_string(m_startSample) + " - " + 
+						std::to_string(m_endSample) + ")");
+			}
+			for (size_t i = 0; i < m_buffers.size(); i++) {
+				m_free.push_back(i);
+			}
+			m_thread = std::thread(&BlockIterator::run, this);
+		}
+
+		BlockIterator(const BlockIterator& other) = delete;
+		BlockIterator& operator=(const BlockIterator& other) = delete;
+
+		/*! Stop the background thread. Unread blocks are discarded. */
+		~BlockIterator()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_bufferFree.notify_all();
+			m_thread.join();
+		}
+
+		/*! Return an iterator to the next unread block.
+		 * Because the range is single-pass, this moves to the first block
+		 * only the first time it is called.
+		 *
+		 * Exceptions:
+		 * This rethrows any error raised while reading.
+		 */
+		Iterator begin()
+		{
+			if (!m_started) {
+				m_started = true;
+				if (!advance())
+					return end();
+			}
+			return Iterator(m_current == NoBlock ? nullptr : this);
+		}
+
+		/*! Return the iterator past the last block. */
+		Iterator end() { return Iterator(); }
+
+		/*! Return the total number of blocks in the range. */
+		int64_t nblocks() const
+		{
+			auto n = m_endSample - m_startSample;
+			if (n <= 0)
+				return 0;
+			return 1 + (std::max<int64_t>(n - m_blockSize, 0) + m_step - 1) / m_step;
+		}
+
+		/*! Return a snapshot of the iterator's counters. */
+		Counters counters() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			Counters c;
+			c.blocks = m_blocks;
+			c.samples = m_samples;
+			c.stalls = m_stalls;
+			c.stallSeconds = m_stallSeconds;
+			c.readSeconds = m_readSeconds;
+			c.elapsedSeconds = seconds(m_created);
+			c.throughput = (c.elapsedSeconds > 0) ? m_samples / c.elapsedSeconds : 0;
+			return c;
+		}
+
+	private:
+
+		static const size_t NoBlock = static_cast<size_t>(-1);
+
+		static double seconds(std::chrono::steady_clock::time_point start)
+		{
+			return std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count();
+		}
+
+		const Block& current() const { return m_buffers[m_current]; }
+
+		/* Recycle the current block and wait for the next one. Returns false
+		 * at the end of the range.
+		 */
+		bool advance()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_current != NoBlock) {
+				m_free.push_back(m_current);
+				m_current = NoBlock;
+				m_bufferFree.notify_one();
+			}
+			auto finished = [this]() { 
+				return m_error || (m_produced == nblocks()); 
+			};
+			if (m_ready.empty() && !finished()) {
+				m_stalls++;
+				auto start = std::chrono::steady_clock::now();
+				m_blockReady.wait(lock, [&]() { return !m_ready.empty() || finished(); });
+				m_stallSeconds += seconds(start);
+			}
+			if (m_ready.empty()) {
+				if (m_error) {
+					std::rethrow_exception(m_error);
+				}
+				return false;
+			}
+			m_current = m_ready.front();
+			m_ready.pop_front();
+			m_blocks++;
+			return true;
+		}
+
+		/* Background thread reading blocks into free buffers */
+		void run()
+		{
+			for (int64_t b = 0; b < nblocks(); b++) {
+				size_t index;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_bufferFree.wait(lock, [this]() { return m_stop || !m_free.empty(); });
+					if (m_stop)
+						return;
+					index = m_free.front();
+					m_free.pop_front();
+				}
+
+				auto& block = m_buffers[index];
+				block.start = m_startSample + b * m_step;
+				block.end = std::min(block.start + m_blockSize, m_endSample);
+				auto start = std::chrono::steady_clock::now();
+				try {
+					m_file.data(block.start, block.end, block.data);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_error = std::current_exception();
+					m_blockReady.notify_one();
+					return;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_readSeconds += seconds(start);
+					m_samples += block.end - block.start;
+					m_ready.push_back(index);
+					m_produced++;
+				}
+				m_blockReady.notify_one();
+			}
+		}
+
+		const DataFile& m_file;
+		int m_blockSize;
+		int m_step;
+		int64_t m_startSample;
+		int64_t m_endSample;
+
+		/* Buffers move from m_free, to m_ready once read, to m_current
+		 * while the consumer holds them, and back to m_free.
+		 */
+		std::vector<Block> m_buffers;
+		std::deque<size_t> m_free;
+		std::deque<size_t> m_ready;
+		size_t m_current;
+		bool m_started;
+		int64_t m_produced;
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_blockReady;
+		std::condition_variable m_bufferFree;
+		bool m_stop;
+		std::exception_ptr m_error;
+
+		std::chrono::steady_clock::time_point m_created;
+		uint64_t m_blocks;
+		uint64_t m_samples;
+		uint64_t m_stalls;
+		double m_stallSeconds;
+		double m_readSeconds;
+
+		std::thread m_thread;
+
+}; // end BlockIterator class
+
+}; // end datafile namespace
+
+#endif
+
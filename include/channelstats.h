@@ -0,0 +1,109 @@
+/*! \file channelstats.h
+ *
+ * Streaming per-channel statistics of the raw data in a recording.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _CHANNELSTATS_H_
+#define _CHANNELSTATS_H_
+
+#include <armadillo>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace datafile {
+
+/*! The ChannelStats struct holds running statistics of each channel of a
+ * recording, in the raw units of the file.
+ *
+ * Data is accumulated a block at a time. The statistics of each block are
+ * computed in two tight passes, which the compiler can vectorize, and then
+ * merged into the running totals with the parallel form of Welford's
+ * algorithm (Chan et al.), so the mean and variance stay accurate over
+ * arbitrarily long recordings.
+ *
+ * Clip counts are the number of samples at or beyond the lowest and
+ * highest values representable in the file, i.e., at the rails of the ADC.
+ */
+struct ChannelStats {
+
+	/*! Construct empty statistics */
+	ChannelStats();
+
+	uint64_t count;			// Samples accumulated from each channel
+	bool complete;			// Each sample of the file was accumulated exactly once
+	arma::vec mean;			// Mean of each channel
+	arma::vec m2;			// Sum of squared deviations from the mean
+	arma::vec min;			// Smallest value of each channel
+	arma::vec max;			// Largest value of each channel
+	arma::uvec clipLow;		// Samples at or below the lower rail
+	arma::uvec clipHigh;	// Samples at or above the upper rail
+
+	/*! Return the unbiased variance of each channel */
+	arma::vec variance() const;
+
+	/*! Return the standard deviation of each channel */
+	arma::vec stddev() const;
+
+	/*! Discard all statistics, and prepare to accumulate `nchannels` channels */
+	void reset(size_t nchannels);
+
+	/*! Accumulate a block of samples from all channels.
+	 * \param data The first sample of the first channel.
+	 * \param nsamples The number of samples from each channel.
+	 * \param nchannels The number of channels.
+	 * \param stride The distance between the first samples of successive
+	 * channels, which is nsamples for a whole Armadillo matrix.
+	 * \param lowRail Samples at or below this are counted as clipped.
+	 * \param highRail Samples at or above this are counted as clipped.
+	 */
+	template<class T>
+	void accumulate(const T* data, size_t nsamples, size_t nchannels, size_t stride,
+			double lowRail, double highRail)
+	{
+		if (nsamples == 0) {
+			return;
+		}
+		if (mean.n_elem != nchannels) {
+			reset(nchannels);
+		}
+		for (size_t c = 0; c < nchannels; c++) {
+			auto column = data + c * stride;
+			double sum = 0;
+			double lo = std::numeric_limits<double>::infinity();
+			double hi = -std::numeric_limits<double>::infinity();
+			uint64_t low = 0, high = 0;
+			for (size_t i = 0; i < nsamples; i++) {
+				double value = static_cast<double>(column[i]);
+				sum += value;
+				lo = std::min(lo, value);
+				hi = std::max(hi, value);
+				low += (value <= lowRail);
+				high += (value >= highRail);
+			}
+			double blockMean = sum / nsamples;
+			double blockM2 = 0;
+			for (size_t i = 0; i < nsamples; i++) {
+				double delta = static_cast<double>(column[i]) - blockMean;
+				blockM2 += delta * delta;
+			}
+			merge(c, nsamples, blockMean, blockM2, lo, hi, low, high);
+		}
+		count += nsamples;
+	}
+
+	/*! Merge the statistics of a block of `n` samples of one channel into
+	 * the running statistics. `count` is not updated.
+	 */
+	void merge(size_t channel, uint64_t n, double blockMean, double blockM2,
+			double blockMin, double blockMax, uint64_t low, uint64_t high);
+
+};
+
+}; // end datafile namespace
+
+#endif
+
@@ -0,0 +1,94 @@
+/*! \file chunkreader.h
+ *
+ * Reading of whole chunked datasets by fetching their stored chunks
+ * directly, and decoding them outside of the HDF5 library.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _CHUNKREADER_H_
+#define _CHUNKREADER_H_
+
+#include "H5Cpp.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace datafile {
+
+/*! The DirectChunkReader class reads a whole dataset, in two steps.
+ *
+ * fetch() reads each stored chunk of the dataset as raw, still-compressed
+ * bytes, with H5Dread_chunk(). decode() then decompresses and unshuffles
+ * the chunks into the caller's buffer, without calling into HDF5 at all.
+ * When the HDF5 library is serialized, by an HDF5Gate or by the library's
+ * own global lock, only the fetch need be serialized, and the much more
+ * expensive decoding of many datasets can run in parallel.
+ *
+ * Only datasets of rank 1 or 2, which are chunked, whose file type
+ * matches the memory type, and whose filters are any of shuffle and
+ * deflate, can be read directly. supported() returns false for others,
+ * which should be read through HDF5 as usual.
+ *
+ * Data is decoded in the dataset's row-major order, which for a rank 2
+ * dataset of shape (n, m) is the column-major order of an Armadillo
+ * matrix of shape (m, n).
+ */
+class DirectChunkReader {
+
+	public:
+
+		/*! Inspect the layout and filters of a dataset, to be read into
+		 * memory of the given type.
+		 */
+		DirectChunkReader(const H5::DataSet& dataset, const H5::DataType& memtype);
+
+		/*! Return true if the dataset can be read directly */
+		bool supported() const;
+
+		/*! Return the number of elements in the dataset */
+		size_t size() const;
+
+		/*! Read each stored chunk of the dataset, without decoding it.
+		 * This calls into HDF5, and must be serialized with other calls.
+		 *
+		 * Exceptions:
+		 * This throws a std::runtime_error if a chunk cannot be read.
+		 */
+		void fetch();
+
+		/*! Decode the fetched chunks into `buf`, which must hold size() 
+		 * elements, and release them. This makes no calls into HDF5.
+		 *
+		 * Exceptions:
+		 * This throws a std::runtime_error if a chunk cannot be decoded.
+		 */
+		void decode(void* buf);
+
+	private:
+
+		/* A stored chunk, as read from the file */
+		struct Chunk {
+			hsize_t offset[2];		// Offset of the chunk in the dataset
+			uint32_t filterMask;	// Filters skipped when the chunk was written
+			std::vector<unsigned char> bytes;
+		};
+
+		/* Undo the filters applied to a chunk, returning the decoded bytes */
+		const std::vector<unsigned char>& decodeChunk(Chunk& chunk, 
+				std::vector<unsigned char>& scratch) const;
+
+		hid_t m_dataset;					// Not owned, valid while fetching
+		bool m_supported;
+		size_t m_elementSize;				// Bytes per element
+		hsize_t m_dims[2];					// Shape, with trailing 1 for rank 1
+		hsize_t m_chunkDims[2];				// Chunk shape, likewise
+		std::vector<H5Z_filter_t> m_filters;	// Filters, in the order applied
+		std::vector<Chunk> m_chunks;
+
+}; // end DirectChunkReader class
+
+}; // end datafile namespace
+
+#endif
+
@@ -0,0 +1,51 @@
+/*! \file conversion.h
+ *
+ * Fused kernels converting raw 16-bit samples to floating-point voltages.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _CONVERSION_H_
+#define _CONVERSION_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace datafile {
+
+/*! Convert raw samples to floating point, computing `gain * src + offset`
+ * in a single pass directly into `dst`.
+ * \param src The raw samples.
+ * \param dst The destination, which must hold `n` values and must not
+ * overlap `src`.
+ * \param n The number of samples to convert.
+ * \param gain The gain applied to each sample.
+ * \param offset The offset added to each sample after the gain.
+ *
+ * These use AVX2 or SSE2 instructions when the library is compiled with
+ * support for them, and a scalar loop otherwise.
+ */
+void scaleSamples(const int16_t* src, float* dst, size_t n,
+		float gain, float offset = 0.0f);
+void scaleSamples(const int16_t* src, double* dst, size_t n,
+		double gain, double offset = 0.0);
+
+/*! Convert raw samples to floating point in place.
+ * \param buf A buffer large enough to hold `n` values of the destination
+ * type, whose first `n * sizeof(int16_t)` bytes hold the raw samples.
+ * \param n The number of samples to convert.
+ * \param gain The gain applied to each sample.
+ * \param offset The offset added to each sample after the gain.
+ *
+ * This allows raw data to be read straight into the memory of a floating
+ * point matrix, and widened there, with no intermediate buffer. The
+ * conversion runs from the end of the buffer backwards, so each value is
+ * read before it can be overwritten.
+ */
+void scaleSamplesInPlace(float* buf, size_t n, float gain, float offset = 0.0f);
+void scaleSamplesInPlace(double* buf, size_t n, double gain, double offset = 0.0);
+
+}; // end datafile namespace
+
+#endif
+
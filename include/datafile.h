@@ -12,9 +12,19 @@
 #include "H5Cpp.h"
 #include <armadillo>
 
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include "channelstats.h"
+#include "conversion.h"
+#include "filter.h"
+#include "iostats.h"
+#include "summary.h"
+
 /*! The datafile namespace contains classes and constants related
  * to the file format for storing data from Baccus lab experiments.
  */
@@ -46,6 +56,14 @@ const float SampleRate = 10000;
 /*! Number of chunks to request the HDF5 library keep cached. */
 const unsigned int ChunkCacheSize = 5;
 
+/*! Default interval, in seconds, at which the number of samples is
+ * written to the file when metadata writes are deferred.
+ */
+const double MetadataFlushInterval = 5.0;
+
+/*! Interval, in seconds, at which DataFile::waitForSamples() checks for new data */
+const double SwmrPollInterval = 0.01;
+
 /*! Default dimensions of the dataset */
 const hsize_t DatasetDefaultDims[DatasetRank] = { NumChannels, BlockSize };
 
@@ -64,72 +82,239 @@ const char DateFormat[] = "%Y-%m-%dT%H:%M:%S";
 /*! Default array to use when creating a new recording */
 const std::string DefaultArray = "mcs";
 
+/*! Default chunk preemption policy for the raw data chunk cache.
+ * This is the HDF5 library's own default.
+ */
+const double ChunkCacheW0 = 0.75;
+
+/*! HDF5 filter identifiers registered for LZ4 and Blosc. These filters are
+ * not built into the HDF5 library, but can be used with DataFileOptions
+ * if the corresponding plugin is installed.
+ */
+const H5Z_filter_t FilterLZ4 = 32004;
+const H5Z_filter_t FilterBlosc = 32001;
+
+/*! Return true if the given HDF5 filter is available for compression,
+ * loading it from the plugin path if needed.
+ */
+bool filterAvailable(H5Z_filter_t filter);
+
+/*! Expected pattern of reads from a recording, used to recommend
+ * a chunk shape for its dataset.
+ */
+enum class AccessPattern {
+	ChannelScan,	// Long reads from one or a few channels
+	TimeWindow,		// Short reads from all channels
+	Mixed			// Some of each
+};
+
+/*! How a DataFile opens an existing recording */
+enum class OpenMode {
+	ReadOnly,	// Read data and metadata, with the file opened read-only
+	Update,		// Also store derived data, e.g., with setMeans() or buildSummary()
+	SwmrRead	// Read-only, following data appended by a SWMR writer
+};
+
+/*! Options controlling the layout and caching of a DataFile's dataset.
+ *
+ * The chunk shape and filters are only used when creating a file, since the
+ * layout of an existing dataset is fixed. The cache settings are used both when
+ * creating and when opening a file. Any cache value left as 0 is computed from
+ * the chunk shape of the dataset, so that the cache holds ChunkCacheSize chunks.
+ *
+ * Filters are applied to each chunk in the order shuffle, deflate, then any
+ * other filter. Compression is transparent to readers of the file.
+ *
+ * If summary factors are given, a summary of the data at each of those
+ * decimation factors (e.g., DefaultSummaryFactors) is kept up to date as
+ * data is written. See DataFile::summary().
+ *
+ * Files created with `swmr` set use the latest HDF5 file format, which is
+ * required for DataFile::startSwmrWrite(), and can only be read by HDF5
+ * 1.10 or later.
+ *
+ * If `ioStats` is set, statistics of the file's I/O are collected from the
+ * moment it is opened, including the reads of its header. See
+ * DataFile::ioStats().
+ */
+struct DataFileOptions {
+	/*! Construct the default options, which use DatasetChunkDims. */
+	DataFileOptions();
+
+	hsize_t chunkChannels;		// Channels in each chunk
+	hsize_t chunkSamples;		// Samples in each chunk
+	size_t chunkCacheBytes;		// Size of the raw data chunk cache
+	size_t chunkCacheSlots;		// Hash table slots in the chunk cache
+	double chunkCacheW0;		// Chunk cache preemption policy, in [0, 1]
+	size_t metadataCacheBytes;	// Initial metadata cache size, 0 for library default
+
+	bool shuffle;				// Byte-shuffle each chunk before compressing
+	unsigned int deflate;		// Deflate (gzip) level, 0 for no deflate
+	H5Z_filter_t filter;		// Another registered filter, e.g., FilterLZ4, or 0
+	std::vector<unsigned int> filterValues;	// Parameters for that filter
+
+	std::vector<int> summaryFactors;	// Decimation factors of summary levels, or empty
+
+	bool swmr;					// Create the file so that SWMR writing can be started
+	bool ioStats;				// Collect I/O statistics from the start
+};
+
+/*! Return options with a chunk shape suited to the given access pattern.
+ * \param pattern How the recording will mostly be read.
+ * \param nchannels The number of channels in the recording.
+ *
+ * Channel scans get chunks holding a long stretch of a single channel, so
+ * that reading one channel never touches data from others. Time windows get
+ * chunks spanning every channel over a short stretch of time. Mixed access
+ * splits the difference. All chunks hold about the same number of bytes.
+ */
+DataFileOptions recommendOptions(AccessPattern pattern, 
+		hsize_t nchannels = NumChannels);
+
 /*! Type aliases for data from arrays */
 using samples = arma::mat; 				// true voltage units
 using ssamples = arma::Mat<int16_t>;	// data from MCS arrays
 using usamples = arma::Mat<uint8_t>;	// data from HiDens arrays
 
-/*! Public method used to read array type from the given data file. */
+/*! Public method used to read array type from the given data file.
+ * This returns an empty string if the file cannot be read.
+ */
 std::string array(const std::string& filename);
 
+/*! Header information of a recording, as returned by peek(). */
+struct DataFileInfo {
+	std::string filename;		// Name of the file
+	std::string array;			// Array from which the data was recorded
+	std::string date;			// Date of recording
+	std::string room;			// Location of recording
+	uint64_t nchannels;			// Number of channels
+	uint64_t nsamples;			// Number of samples, as stored in the file
+	uint64_t analogOutputSize;	// Size of any analog output
+	float sampleRate;			// Sample rate of the data
+	float gain;					// Gain of A/D conversion
+	float offset;				// Offset of A/D conversion
+	bool nsamplesStale;			// The writer died before storing nsamples
+};
+
+/*! Read the header information of a recording, without opening it as a
+ * DataFile.
+ * \param filename The name of the recording.
+ *
+ * The file is opened read-only, and all attributes of the data are read
+ * in a single pass over them, without opening the dataset itself. This is
+ * much faster than constructing a DataFile, and is suited to scanning many
+ * recordings. Files written before the number of channels was stored as
+ * an attribute fall back to opening the dataset for its size.
+ *
+ * The number of samples is that stored in the file. Unlike a DataFile,
+ * this does not scan the data to recover it when `nsamplesStale` is set.
+ *
+ * Exceptions:
+ * This throws a std::invalid_argument if the file cannot be opened, is not
+ * a recording, or lacks any required attribute.
+ */
+DataFileInfo peek(const std::string& filename);
+
 /* Template methods for determining H5 datatype from the datatype of
  * and Armadillo matrix or vector. These are used to enable correct 
  * conversion of data to/from the file and in-memory matrices of
  * various data types. These allow compile-time creation of the 
  * correct HDF5 datatype, rather than runtime selection. Add more
  * overloads returning the correct HDF5 datatype if needed.
+ *
+ * They return the library's predefined types by reference, so that no
+ * HDF5 type is created or released outside of an HDF5Gate.
  */
 template<class T>
-H5::DataType dtypeForMat(const arma::Mat<T>& /* mat */, 
+const H5::PredType& dtypeForMat(const arma::Mat<T>& /* mat */, 
 		typename std::enable_if<std::is_same<T, double>::value>::type* = nullptr)
 {
 	return H5::PredType::IEEE_F64LE;
 }
 
 template<class T>
-H5::DataType dtypeForMat(const arma::Mat<T>& /* mat */, 
+const H5::PredType& dtypeForMat(const arma::Mat<T>& /* mat */, 
 		typename std::enable_if<std::is_same<T, float>::value>::type* = nullptr)
 {
 	return H5::PredType::IEEE_F32LE;
 }
 
 template<class T>
-H5::DataType dtypeForMat(const arma::Mat<T>& /* mat */,
+const H5::PredType& dtypeForMat(const arma::Mat<T>& /* mat */,
 		typename std::enable_if<std::is_same<T, int16_t>::value>::type* = nullptr)
 {
 	return H5::PredType::STD_I16LE;
 }
 
 template<class T>
-H5::DataType dtypeForMat(const arma::Mat<T>& /* mat */,
+const H5::PredType& dtypeForMat(const arma::Mat<T>& /* mat */,
 		typename std::enable_if<std::is_same<T, uint8_t>::value>::type* = nullptr)
 {
 	return H5::PredType::STD_U8LE;
 }
 
 template<class T>
-H5::DataType dtypeForMat(const arma::Mat<T>& /* mat */,
+const H5::PredType& dtypeForMat(const arma::Mat<T>& /* mat */,
 		typename std::enable_if<std::is_same<T, int>::value>::type* = nullptr)
 {
 	return H5::PredType::NATIVE_INT;
 }
 
 template<class T>
-H5::DataType dtypeForMat(const arma::Mat<T>& /* mat */,
+const H5::PredType& dtypeForMat(const arma::Mat<T>& /* mat */,
 		typename std::enable_if<std::is_same<T, uint32_t>::value>::type* = nullptr)
 {
 	return H5::PredType::STD_U32LE;
 }
 
 template<class T>
-H5::DataType dtypeForMat(const arma::Mat<T>& /* mat */,
+const H5::PredType& dtypeForMat(const arma::Mat<T>& /* mat */,
 		typename std::enable_if<std::is_same<T, uint16_t>::value>::type* = nullptr)
 {
 	return H5::PredType::STD_U16LE;
 }
 
+/*! The HDF5Gate class serializes calls into the HDF5 library across
+ * threads, when the library was not built thread-safe.
+ *
+ * An HDF5Gate holds a single, process-wide gate for its lifetime, since the
+ * HDF5 library's state is global rather than per-file. When the library is
+ * thread-safe, the gate is never taken and creating one costs nothing.
+ * Gates are recursive, so a thread holding one may create another.
+ */
+class HDF5Gate {
+
+	public:
+		/*! Take the gate, blocking until it is free, if the library is
+		 * not thread-safe.
+		 */
+		HDF5Gate();
+		HDF5Gate(const HDF5Gate& other) = delete;
+		HDF5Gate& operator=(const HDF5Gate& other) = delete;
+
+		/*! Release the gate */
+		~HDF5Gate();
+
+		/*! Return true if the HDF5 library was built thread-safe */
+		static bool libraryThreadSafe();
+
+	private:
+		bool m_locked;
+
+}; // end HDF5Gate class
+
 /*! The DataFile class is the heart of libdatafile. It provides functionality
  * for reading, writing, and modifying an HDF5 recording file in the Baccus Lab.
+ *
+ * Concurrent reads:
+ * The const methods reading data (data() and dataScaled()) may be called
+ * from any number of threads at once on the same DataFile. Each call
+ * selects data through its own copy of the dataspace, and calls into HDF5
+ * are serialized through an HDF5Gate if the library is not thread-safe.
+ * This shares one file handle and one chunk cache among all readers. 
+ * Reads must not overlap with writes or any other modification of the file.
+ * A DataFile::ReaderPool (see readerpool.h) fans a single large read out
+ * across worker threads.
  */
 class DataFile {
 
@@ -140,14 +325,56 @@ class DataFile {
 		 * \param filename The name of the file to create or open.
 		 * \param array The type of array the written data will come from.
 		 * \param nchannels The number of channels to be written to the dataset.
+		 * \param options Chunk shape and cache settings for the dataset.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the chunk shape is invalid,
+		 * or if a requested filter is not available.
 		 */
 		DataFile(const std::string& filename, 
 				const std::string& array = DefaultArray,
-				const hsize_t nchannels = NumChannels);
+				const hsize_t nchannels = NumChannels,
+				const DataFileOptions& options = DataFileOptions());
+
+		/*! Open an existing recording.
+		 * \param filename The name of the file to open.
+		 * \param mode Whether the file is opened read-only, or for update.
+		 * \param options Cache settings for the dataset.
+		 *
+		 * Read-only files may be opened on read-only file systems, and
+		 * alongside other readers of the file. Only files opened for update
+		 * may store derived data, with setMeans(), buildSummary(),
+		 * computeStats() or writeFiltered(). The raw data and its attributes
+		 * can never be changed once a file is closed.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the file does not exist or
+		 * is not a valid recording.
+		 */
+		DataFile(const std::string& filename, OpenMode mode,
+				const DataFileOptions& options = DataFileOptions());
 
 		/*! Destroy a DataFile, flushing and closing the underlying file */
 		virtual ~DataFile();
 
+		/*! Writer which appends data from a background I/O thread.
+		 * Defined in asyncwriter.h.
+		 */
+		class AsyncWriter;
+
+		/*! Pool of threads reading blocks of channels concurrently.
+		 * Defined in readerpool.h.
+		 */
+		class ReaderPool;
+
+		/*! Batch of reads coalesced by chunk. Defined in readplan.h. */
+		class ReadPlan;
+
+		/*! Range over successive blocks of data, read ahead on a
+		 * background thread. Defined in blockiterator.h.
+		 */
+		template<class T> class BlockIterator;
+
 		/*! Return the full pathname of the file */
 		std::string filename() const;
 		
@@ -158,7 +385,7 @@ class DataFile {
 		double length() const;
 
 		/*! Return the total number of samples in the recording */
-		int nsamples() const;
+		int64_t nsamples() const;
 
 		/*! Return the number of channels in the data file */
 		int nchannels() const;
@@ -188,7 +415,7 @@ class DataFile {
 		std::string room() const;
 
 		/*! Return the size of any analog output used in this recording. */
-		int analogOutputSize() const;
+		int64_t analogOutputSize() const;
 
 		/*! Return the analog output used in this recording.
 		 * If there was no analog output, the returned vector will be empty.
@@ -213,6 +440,14 @@ class DataFile {
 		 * files do not currently support analog output, but that
 		 * may change in the future.
 		 */
+		virtual void setAnalogOutputSize(int64_t sz);
+
+		/*! Set the size of any analog output, given as an int.
+		 * \deprecated Use setAnalogOutputSize(int64_t). This forwards to
+		 * it, and is kept so that subclasses which override the int
+		 * version still override a base class method. Arguments of other
+		 * integer types, such as size_t, must be cast to int64_t.
+		 */
 		virtual void setAnalogOutputSize(int sz);
 
 		/*! Return data from all channels over the given sample rate.
@@ -229,7 +464,7 @@ class DataFile {
 		 * This will throw a std::logic_error if either the requested channels
 		 * or samples are outside of the range for the file.
 		 */
-		samples data(int start, int end) const;
+		samples data(int64_t start, int64_t end) const;
 
 		/*! Return data from the given channel.
 		 * Data is returned in true voltage units of the ADC.
@@ -242,7 +477,7 @@ class DataFile {
 		 * This will throw a std::logic_error if either the requested channels
 		 * or samples are outside of the range for the file.
 		 */
-		arma::vec data(int channel, int start, int end) const;
+		arma::vec data(int channel, int64_t start, int64_t end) const;
 
 		/* Read data from a contiguous set of channels into the given matrix.
 		 * \param startChan The first channel to read
@@ -262,12 +497,12 @@ class DataFile {
 		 */
 		template<class T>
 		void data(int startChan, int endChan, 
-				int startSample, int endSample, arma::Mat<T>& mat) const
+				int64_t startSample, int64_t endSample, arma::Mat<T>& mat) const
 		{
 			verifyReadRequest(startChan, endChan, startSample, endSample);
-			auto memspace = setupRead(startChan, endChan, startSample, endSample);
 			mat.set_size(endSample - startSample, endChan - startChan);
-			m_dataset.read(mat.memptr(), dtypeForMat(mat), memspace, m_dataspace);
+			readRaw(startChan, endChan, startSample, endSample, 
+					mat.memptr(), dtypeForMat(mat));
 		}
 
 		/* Read data from a contiguous set of channels into the given matrix.
@@ -285,14 +520,108 @@ class DataFile {
 		 * or samples are outside of the range for the file.
 		 */
 		template<class T>
-		void data(int startSample, int endSample, arma::Mat<T>& mat) const
+		void data(int64_t startSample, int64_t endSample, arma::Mat<T>& mat) const
 		{
 			verifyReadRequest(0, nchannels(), startSample, endSample);
-			auto memspace = setupRead(0, nchannels(), startSample, endSample);
 			mat.set_size(endSample - startSample, nchannels());
-			m_dataset.read(mat.memptr(), dtypeForMat(mat), memspace, m_dataspace);
+			readRaw(0, nchannels(), startSample, endSample, 
+					mat.memptr(), dtypeForMat(mat));
 		}
 
+		/*! Read data from a contiguous set of channels into a range of rows
+		 * of an existing matrix, leaving its other rows untouched.
+		 * \param startChan The first channel to read
+		 * \param endChan The last channel to read
+		 * \param startSample The first sample to read.
+		 * \param endSample The last sample to read.
+		 * \param mat The matrix to fill, which must already have one column
+		 * for each channel requested.
+		 * \param row The row of `mat` receiving the first sample.
+		 *
+		 * This assembles several reads, e.g., from consecutive files of a
+		 * RecordingSet, in one matrix without copying them.
+		 *
+		 * Exceptions:
+		 * This will throw a std::logic_error if either the requested channels
+		 * or samples are outside of the range for the file, or if they do
+		 * not fit in `mat` at the given row.
+		 */
+		template<class T>
+		void dataInto(int startChan, int endChan, int64_t startSample, 
+				int64_t endSample, arma::Mat<T>& mat, arma::uword row) const
+		{
+			verifyReadRequest(startChan, endChan, startSample, endSample);
+			verifyDestination(endChan - startChan, endSample - startSample,
+					mat.n_rows, mat.n_cols, row);
+			readRaw(startChan, endChan, startSample, endSample,
+					mat.memptr(), dtypeForMat(mat), row, mat.n_rows);
+		}
+
+		/*! Read data from a contiguous set of channels, converted to true
+		 * voltage units in single or double precision.
+		 * \param startChan The first channel to read
+		 * \param endChan The last channel to read
+		 * \param startSample The first sample to read.
+		 * \param endSample The last sample to read.
+		 * \param mat The matrix to fill, of floats or doubles.
+		 *
+		 * Values are computed as `gain() * raw + offset()`. Raw samples are
+		 * read directly into the memory of `mat` and converted there in a
+		 * single pass, without any temporary matrices. Unlike the overloads
+		 * of data() returning voltages, this also applies the offset.
+		 * 
+		 * NOTE: Data is returned in an Armadillo matrix with size (nsamples, nchannels).
+		 *
+		 * Exceptions:
+		 * This will throw a std::logic_error if either the requested channels
+		 * or samples are outside of the range for the file.
+		 */
+		template<class T>
+		void dataScaled(int startChan, int endChan,
+				int64_t startSample, int64_t endSample, arma::Mat<T>& mat) const
+		{
+			readScaled(startChan, endChan, startSample, endSample, mat,
+					static_cast<T>(gain()), static_cast<T>(offset()));
+		}
+
+		/*! Read data from all channels, converted to true voltage units in
+		 * single or double precision.
+		 * \param startSample The first sample to read.
+		 * \param endSample The last sample to read.
+		 * \param mat The matrix to fill, of floats or doubles.
+		 *
+		 * See the overload above for details.
+		 */
+		template<class T>
+		void dataScaled(int64_t startSample, int64_t endSample, arma::Mat<T>& mat) const
+		{
+			dataScaled(0, nchannels(), startSample, endSample, mat);
+		}
+
+		/*! Return min/max/mean/RMS envelopes of a block of data, at a
+		 * resolution of about `pixels` values per channel.
+		 * \param startChan The first channel to summarize.
+		 * \param endChan The last channel to summarize.
+		 * \param startSample The first sample to summarize.
+		 * \param endSample The last sample to summarize.
+		 * \param pixels The number of values to return for each channel.
+		 *
+		 * This uses the coarsest summary level which still has at least
+		 * one bin per pixel, so the cost is proportional to the number of
+		 * pixels rather than samples. Each pixel covers a whole number of
+		 * that level's bins, so pixel boundaries are only exact to within
+		 * one bin. Bins only partly within the samples, samples not yet
+		 * covered by a level, and files with no summary are summarized
+		 * from the raw data, so no sample outside the range contributes.
+		 *
+		 * Exceptions:
+		 * This will throw a std::logic_error if either the requested channels
+		 * or samples are outside of the range for the file, and a 
+		 * std::invalid_argument if pixels is not positive.
+		 */
+		Summary summary(int startChan, int endChan, int64_t startSample, 
+				int64_t endSample, int pixels) const;
+
 		/* Write data to the file.
 		 * \param startSample The first sample to write.
 		 * \param endSample The last sample to write.
@@ -309,11 +638,15 @@ class DataFile {
 		 * largest multiple of the BLOCK_SIZE required to accommodate the data.
 		 */
 		template<class T>
-		void setData(int startSample, int endSample, 
+		void setData(int64_t startSample, int64_t endSample, 
 				const arma::Mat<T>& mat, bool flush = false) { 
 			verifyWriteRequest(startSample, endSample);
 			auto memspace = setupWrite(startSample, endSample);
-			m_dataset.write(mat.memptr(), dtypeForMat(mat), memspace, m_dataspace);
+			{
+				IOTimer timer(m_ioCounters, IOOperation::Write, mat.n_elem * sizeof(T));
+				m_dataset.write(mat.memptr(), dtypeForMat(mat), memspace, m_dataspace);
+			}
+			recordWrite(startSample, endSample, mat.memptr(), mat.n_rows);
 			if (flush)
 				this->flush();
 		}
@@ -344,19 +677,204 @@ class DataFile {
 		/*! Write a dataset containing the mean value of each channel's data.
 		 * This is computed and saved while running the `extract` program, which
 		 * extracts candidate spike snippets, and used during spike sorting.
+		 *
+		 * Exceptions:
+		 * This throws a std::logic_error if an existing file was not opened
+		 * with OpenMode::Update.
 		 */
 		void setMeans(const arma::vec& means);
 
+		/*! Build the summary levels of all data in the file, replacing any
+		 * that exist. Like setMeans(), this may be used on existing files
+		 * opened for update, e.g., to add a summary to recordings made
+		 * without one.
+		 * \param factors The decimation factor of each level.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the factors are not greater
+		 * than 1, increasing, and each a divisor of the next, and a
+		 * std::logic_error as setMeans() does.
+		 */
+		void buildSummary(const std::vector<int>& factors = DefaultSummaryFactors);
+
 		/*! Read the mean values stored for each channel.
 		 * An empty vector is returned if the mean values have not yet been computed.
 		 */
 		arma::vec means() const;
 
+		/*! Return the running statistics of each channel's raw data.
+		 *
+		 * These are accumulated as data is written, so that the mean and
+		 * variance of a recording are known when acquisition finishes,
+		 * without reading it again. They are written to the file on flush()
+		 * and on destruction, along with the channel means (see means()),
+		 * and loaded when an existing file is opened. Files written before
+		 * statistics were kept have empty statistics, until computeStats()
+		 * is called.
+		 *
+		 * Each sample is counted the first time it is written. If samples
+		 * are overwritten, or written out of order, the statistics are
+		 * marked as incomplete, since they no longer describe exactly the
+		 * data in the file.
+		 */
+		const ChannelStats& stats() const;
+
+		/*! Compute the statistics of all data in the file, replacing any
+		 * that exist, and write them and the channel means to the file.
+		 * Like setMeans(), this may be used on existing files opened for
+		 * update.
+		 */
+		void computeStats();
+
+		/*! Filter all data in the file, and store the result in a derived
+		 * dataset of the same file, replacing any of the same name.
+		 * \param filter The filter, which is reset before use.
+		 * \param zeroPhase If true, filter forwards and then backwards, as
+		 * Filter::filtfilt() does, over the whole recording.
+		 * \param name The name of the derived dataset.
+		 *
+		 * The data is filtered a block at a time. The derived dataset has
+		 * the shape and chunks of the raw data, and holds single-precision
+		 * values in raw units. The filter's sections or taps are stored with
+		 * it, as the "filter-sections" or "filter-taps" attribute, along with
+		 * a "zero-phase" attribute. Like setMeans(), this may be used on
+		 * existing files opened for update.
+		 */
+		void writeFiltered(Filter& filter, bool zeroPhase = false,
+				const std::string& name = FilteredDataset);
+
+		/*! Read data from a derived dataset written by writeFiltered().
+		 * \param startChan The first channel to read.
+		 * \param endChan One past the last channel to read.
+		 * \param startSample The first sample to read.
+		 * \param endSample One past the last sample to read.
+		 * \param out Filled with the filtered data, with shape
+		 * (nsamples, nchannels), as returned from data().
+		 * \param name The name of the derived dataset.
+		 *
+		 * Exceptions:
+		 * This throws a std::logic_error if the channels or samples are
+		 * outside the range for the file, or a std::invalid_argument if the
+		 * file has no derived dataset of that name.
+		 */
+		void filtered(int startChan, int endChan, int64_t startSample, int64_t endSample,
+				arma::fmat& out, const std::string& name = FilteredDataset) const;
+
+		/*! Defer writing the number of samples to the file.
+		 * \param defer If true, the `nsamples` attribute is no longer rewritten
+		 * on every call to setData(). It is kept in memory, and only written by
+		 * flush(), when the file is destroyed, or periodically.
+		 * \param interval The minimum time in seconds between periodic writes
+		 * of the attribute from setData(). If this is not positive, the
+		 * attribute is only written by flush() and on destruction.
+		 *
+		 * While writes are deferred, the file is marked as having a stale sample
+		 * count. If the process dies before the count is written, the next
+		 * DataFile opening the file recovers it from the dataset itself.
+		 */
+		void setDeferNumSamples(bool defer, double interval = MetadataFlushInterval);
+
+		/*! Return true if writes of the number of samples are deferred. */
+		bool deferNumSamples() const;
+
+		/*! Return the chunk shape, filters and cache settings in effect for 
+		 * this file. For an existing file, the chunk shape and filters are
+		 * those of its dataset.
+		 */
+		const DataFileOptions& options() const;
+
+		/*! Return true if the dataset is stored in chunks. A finalized or
+		 * other contiguous dataset is not, and options() then reports its
+		 * whole extent as the chunk shape.
+		 */
+		bool chunked() const;
+
+		/*! Flush all data and any deferred metadata to disk. */
+		void flush();
+
+		/*! Return true if derived data may be stored in the file, i.e., if
+		 * it was created or opened with OpenMode::Update.
+		 */
+		bool updatable() const;
+
+		/*! Start single-writer/multiple-reader (SWMR) access to a new file,
+		 * so that other processes may read it while data is appended.
+		 *
+		 * The file must have been created with DataFileOptions::swmr set.
+		 * This is called once all metadata, such as the gain, date and any
+		 * HiDens configuration, is written, since no attributes or other
+		 * objects may be created afterwards, though existing attributes may
+		 * be changed. From then on, the extent of the dataset is exactly the
+		 * number of samples written, and each write is flushed to the file,
+		 * where readers opened with OpenMode::SwmrRead find it. The channel
+		 * statistics and means are written when the file is closed. Until
+		 * then, the file's `nsamples` is marked stale, so that it is
+		 * recovered if the writer dies.
+		 *
+		 * Exceptions:
+		 * This throws a std::logic_error if the file was not created with
+		 * DataFileOptions::swmr, and a std::runtime_error if HDF5 could not
+		 * start SWMR writing.
+		 */
+		void startSwmrWrite();
+
+		/*! Return true if the file is being written or read with SWMR access */
+		bool swmr() const;
+
+		/*! Check for data appended by a SWMR writer, and return the number
+		 * of samples now in the file.
+		 *
+		 * For files opened with OpenMode::SwmrRead, this refreshes the
+		 * extent of the dataset, which is the number of samples the writer
+		 * has flushed. Summary levels and attributes are not refreshed. For
+		 * other files, this just returns nsamples(). It must not be called
+		 * concurrently with reads.
+		 */
+		int64_t refresh();
+
+		/*! Wait for a SWMR writer to append data.
+		 * \param nsamples The number of samples to wait for.
+		 * \param timeout The longest time to wait, in seconds.
+		 *
+		 * This calls refresh() every SwmrPollInterval seconds until the file
+		 * holds at least `nsamples` samples, and returns true if it does, or
+		 * false if the timeout elapses first.
+		 */
+		bool waitForSamples(int64_t nsamples, double timeout);
+
+		/*! Start or stop collecting statistics of the file's I/O.
+		 *
+		 * While enabled, every read and write of the raw data, extension of
+		 * the dataset, read or write of an attribute, and flush is counted
+		 * and timed, by any thread. Disabled statistics cost almost nothing,
+		 * and they are disabled unless DataFileOptions::ioStats is set.
+		 */
+		void setIOStatsEnabled(bool enable);
+
+		/*! Return true if statistics of the file's I/O are being collected */
+		bool ioStatsEnabled() const;
+
+		/*! Return a snapshot of the statistics of the file's I/O since they
+		 * were last reset, with the state of the HDF5 library's caches.
+		 */
+		IOStats ioStats() const;
+
+		/*! Set the statistics of the file's I/O, and the hit rate of its
+		 * metadata cache, back to zero.
+		 */
+		void resetIOStats();
+
 	protected:
-		void flush();			// Flush the file to disk
+
+		/* Open an existing file in the given mode, or create it if it
+		 * does not exist and `create` is true.
+		 */
+		DataFile(const std::string& filename, const std::string& array,
+				hsize_t nchannels, const DataFileOptions& options,
+				OpenMode mode, bool create);
 
 		/* Read the available size of the dataset, in samples */
-		int datasetSize() const;
+		int64_t datasetSize() const;
 
 		/* Read or write underlying dataset or file HDF5 attributes */
 		void writeDataAttr(const std::string& name, const H5::DataType &type, void *buf);
@@ -368,15 +886,12 @@ class DataFile {
 		void readFileStringAttr(const std::string& name, std::string &dst);
 
 		/* Read the corresponding values from the file */
-		void readArray();
-		void readSampleRate();
-		void readGain();
-		void readOffset();
-		void readDate();
-		void readRoom();
-		void readNumSamples();
-		void readAnalogOutputSize();
-		void setNumSamples(int nsamples);
+		void readHeader();
+		void readLayout();
+		void setFilters();
+		void setNumSamples(int64_t nsamples);
+		void writeNumSamples();
+		void recoverNumSamples(bool stale);
 
 		H5::H5File m_file;				// The actual HDF5 file
 		H5::DataSpace m_dataspace;		// Data space for actual data
@@ -384,6 +899,23 @@ class DataFile {
 		H5::DSetCreatPropList m_props;	// Properties for the dataset (chunking, etc)
 		H5::DataSet m_dataset;			// The HDF5 dataset containing data
 		bool m_readOnly;				// Protection
+		bool m_updatable;				// Derived data may be stored
+		bool m_swmrWrite;				// Writing with SWMR access
+		bool m_swmrRead;				// Reading with SWMR access
+		DataFileOptions m_options;		// Chunk shape and cache settings
+		bool m_chunked;					// The dataset is stored in chunks
+		std::unique_ptr<SummaryPyramid> m_summary;	// Summary levels, if any
+		ChannelStats m_stats;			// Running statistics of each channel
+		uint64_t m_statsEnd;			// End of the samples in m_stats
+		bool m_statsDirty;				// m_stats differs from the file's copy
+		double m_lowRail;				// Smallest value of the file's data type
+		double m_highRail;				// Largest value of the file's data type
+		mutable IOCounters m_ioCounters;	// Statistics of the file's I/O
+
+		/* Create access property lists for the file and dataset from m_options */
+		H5::FileAccPropList fileAccessProperties() const;
+		H5::DSetAccPropList datasetAccessProperties() const;
+		void resolveCacheOptions();		// Compute any cache settings left as 0
 
 		std::string m_filename;		// Full path name of HDF5 file
 		std::string m_array;		// Array type
@@ -396,29 +928,129 @@ class DataFile {
 		uint64_t m_nchannels;		// Total number of channels in the file
 		uint64_t m_aoutSize;		// Size of any analog output used in the recording
 
+		/* Deferred writing of the number of samples */
+		bool m_deferNumSamples;		// Only write `nsamples` on flush or periodically
+		double m_numSamplesInterval;	// Seconds between periodic writes
+		bool m_numSamplesStale;		// File's `nsamples` differs from m_nsamples
+		std::chrono::steady_clock::time_point m_numSamplesWritten;
+
 		bool readOnly() const { return m_readOnly; }
 
+		/* Throw a std::logic_error unless derived data may be stored */
+		void verifyUpdatable(const std::string& operation) const;
+
+		/* Throw a std::logic_error if attributes cannot be created */
+		void verifyNewAttribute(const std::string& name) const;
+
 		/* Throw a std::logic_error if the requested write parameters are invalid.
 		 * This resizes the file's dataset if needed.
 		 */
-		void verifyWriteRequest(int startSample, int endSample);
+		void verifyWriteRequest(int64_t startSample, int64_t endSample);
 
 		/* Create a memory (source) dataspace and set up the file (dest)
 		 * dataspace for a write of data. This takes care of a lot of 
 		 * H5 library boilerplate that is shared across the different
 		 * setData() overloads.
 		 */
-		H5::DataSpace setupWrite(int startSample, int endSample);
+		H5::DataSpace setupWrite(int64_t startSample, int64_t endSample);
 
 		/* Throw a std::logic_error if the requested read parameters are invalid. */
 		void verifyReadRequest(int startChannel, int endChannel, 
-				int startSample, int endSample) const;
+				int64_t startSample, int64_t endSample) const;
 
-		/* Create a memory (destination) dataspace and setup the file (source)
-		 * dataspace for a read of data.
+		/* Throw a std::logic_error unless a block of the given size fits
+		 * in a matrix of the given size, starting at `row`.
+		 */
+		void verifyDestination(int nchannels, int64_t nsamples, arma::uword rows,
+				arma::uword cols, arma::uword row) const;
+
+		/* Create a memory (destination) dataspace and a file (source)
+		 * dataspace for a read of data. The file dataspace is a private
+		 * copy, so that concurrent reads do not share a selection. If
+		 * `bufSamples` is nonzero, the memory holds that many samples of
+		 * each channel, of which those starting at `bufOffset` are read.
 		 */
 		H5::DataSpace setupRead(int startChannel, int endChannel, 
-				int startSample, int endSample) const;
+				int64_t startSample, int64_t endSample, H5::DataSpace& fileSpace,
+				hsize_t bufOffset = 0, hsize_t bufSamples = 0) const;
+
+		/* Read an already-verified block of data into `buf`, converting it
+		 * to `memtype`. This is the single path through which all reads of
+		 * data reach HDF5, and is safe to call concurrently. The layout of
+		 * `buf` is as for setupRead().
+		 */
+		void readRaw(int startChannel, int endChannel, int64_t startSample, 
+				int64_t endSample, void* buf, const H5::DataType& memtype,
+				hsize_t bufOffset = 0, hsize_t bufSamples = 0) const;
+
+		/* Bring the summary up to date with a write of samples [startSample,
+		 * endSample), whose channels start `stride` values apart in memory.
+		 */
+		template<class T>
+		void updateSummary(int64_t startSample, int64_t endSample, const T* data, size_t stride)
+		{
+			prepareSummary(startSample);
+			m_summary->append(data, endSample - startSample, nchannels(), stride);
+			finishSummary(endSample);
+		}
+		void prepareSummary(int64_t startSample);	// Rewind or catch up to startSample
+		void finishSummary(int64_t endSample);		// Catch up to nsamples() and write
+		void appendSummary(uint64_t start, uint64_t end);	// Append data from the file
+
+		/* Bring the channel statistics up to date with a write of samples
+		 * [startSample, endSample). Only samples past the end of those
+		 * already counted are added.
+		 */
+		template<class T>
+		void updateStats(int64_t startSample, int64_t endSample, const T* data, size_t stride)
+		{
+			auto start = static_cast<uint64_t>(startSample);
+			auto end = static_cast<uint64_t>(endSample);
+			m_statsDirty = true;
+			if (start != m_statsEnd)
+				m_stats.complete = false;
+			if (end <= m_statsEnd)
+				return;
+			auto skip = (start < m_statsEnd) ? (m_statsEnd - start) : 0;
+			m_stats.accumulate(data + skip, end - start - skip, nchannels(), 
+					stride, m_lowRail, m_highRail);
+			m_statsEnd = end;
+		}
+		void resolveRails();			// Compute the rails of m_datatype
+		void readStats();				// Load statistics from the file, if any
+		void writeStats();				// Write statistics and means to the file
+		void writeMeans(const arma::vec& means);	// Write the `channel-means` attribute
+
+		/* Update everything derived from the data after a write of samples
+		 * [startSample, endSample), whose channels start `stride` values
+		 * apart in memory, and make the write visible to any SWMR readers.
+		 */
+		template<class T>
+		void recordWrite(int64_t startSample, int64_t endSample, const T* data, size_t stride)
+		{
+			updateStats(startSample, endSample, data, stride);
+			if (m_summary)
+				updateSummary(startSample, endSample, data, stride);
+			if (m_swmrWrite)
+				publishWrite();
+		}
+		void publishWrite();			// Flush the dataset for SWMR readers
+
+		/* Read raw samples into the memory of a floating-point matrix, and
+		 * widen them there to `gain * raw + offset`.
+		 */
+		template<class T>
+		void readScaled(int startChan, int endChan, int64_t startSample,
+				int64_t endSample, arma::Mat<T>& mat, T gain, T offset) const
+		{
+			static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value,
+					"Scaled data can only be read into float or double matrices");
+			verifyReadRequest(startChan, endChan, startSample, endSample);
+			mat.set_size(endSample - startSample, endChan - startChan);
+			readRaw(startChan, endChan, startSample, endSample,
+					mat.memptr(), H5::PredType::NATIVE_INT16);
+			scaleSamplesInPlace(mat.memptr(), mat.n_elem, gain, offset);
+		}
 
 
 
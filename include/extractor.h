@@ -0,0 +1,152 @@
+/*! \file extractor.h
+ *
+ * Extraction of candidate spike snippets from a recording into a
+ * snippet file.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef EXTRACT_EXTRACTOR_H_
+#define EXTRACT_EXTRACTOR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <armadillo>
+
+#include "datafile.h"
+#include "snipfile.h"
+#include "threadpool.h"
+
+namespace snipfile {
+
+/*! Default threshold for spike extraction, in standard deviations of each
+ * channel's data.
+ */
+const double DEFAULT_THRESHOLD = 4.5;
+
+/*! Options controlling an Extractor. */
+struct ExtractorOptions {
+	/*! Construct the default options, using the constants of the
+	 * snipfile namespace.
+	 */
+	ExtractorOptions();
+
+	double threshold;			// Threshold, in standard deviations
+	size_t nbefore;				// Samples before the peak of each snippet
+	size_t nafter;				// Samples after the peak of each snippet
+	size_t windowSize;			// Samples on either side of a peak it must exceed
+	int blockSize;				// Samples read from each channel at a time
+	int channelsPerGroup;		// Channels per task, 0 to choose from the file's chunks
+	size_t nthreads;			// Worker threads, 0 for one per hardware thread
+	arma::uvec channels;		// Channels to extract, empty for all
+};
+
+/*! The Extractor class finds candidate spikes in a recording, and writes
+ * a snippet of the raw data around each to a snippet file.
+ *
+ * Spikes are negative-going. A sample is a candidate spike if it lies more
+ * than the threshold below its channel's mean, and is the minimum of the
+ * samples up to `windowSize` before and after it. Of equal samples, only
+ * the first counts. Each snippet holds the raw data from `nbefore` samples
+ * before the peak to `nafter` samples after it, so spikes too close to
+ * either end of the recording for a whole snippet are skipped.
+ *
+ * The mean and standard deviation of each channel are taken from the
+ * recording's statistics (see DataFile::stats()) when they describe all of
+ * its data, and are otherwise computed with one extra pass over the data.
+ * Thresholds may also be given explicitly with setThresholds().
+ *
+ * The recording is read in blocks, each extended on either side by enough
+ * samples for the snippets and windows of spikes near its edges, so that
+ * spikes are found exactly as if the recording were read at once. The
+ * channels of each block are divided into groups, which are searched in
+ * parallel on a thread pool. Threshold crossings are found with SSE2 or
+ * AVX2 instructions when the library is compiled with support for them.
+ * The snippets of each block are appended to the snippet file while the
+ * next block is searched, so memory use is bounded by the block size.
+ *
+ * The recording must not be written during extraction.
+ */
+class Extractor {
+
+	public:
+
+		/*! Counts from a run of the extractor. */
+		struct Counters {
+			uint64_t samples;		// Samples searched, summed over channels
+			uint64_t spikes;		// Snippets written
+			double elapsedSeconds;	// Time taken by run()
+			double throughput;		// Samples searched per second
+		};
+
+		/*! Create an extractor for the given recording.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if any of the options are
+		 * invalid, or a channel to be extracted is not in the recording.
+		 */
+		Extractor(const datafile::DataFile& file,
+				const ExtractorOptions& options = ExtractorOptions());
+		Extractor(const Extractor& other) = delete;
+		Extractor& operator=(const Extractor& other) = delete;
+
+		/*! Return the options in effect */
+		const ExtractorOptions& options() const;
+
+		/*! Return the mean of each extracted channel, computing it if needed */
+		const arma::vec& means();
+
+		/*! Return the threshold of each extracted channel, in the raw units of
+		 * the recording, computing them if needed.
+		 */
+		const arma::vec& thresholds();
+
+		/*! Set the threshold of each extracted channel, in the raw units of
+		 * the recording, replacing those computed from the options.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if there is not one threshold
+		 * per extracted channel.
+		 */
+		void setThresholds(const arma::vec& thresholds);
+
+		/*! Extract all spikes from the recording into a snippet file.
+		 * \param snipFile A newly created snippet file, whose channels and
+		 * thresholds are set to those of the extractor.
+		 *
+		 * Snippets are appended to the file as they are found, unless it
+		 * uses the columnar layout, in which case they are all written once
+		 * extraction finishes.
+		 */
+		Counters run(SnipFile& snipFile);
+
+	private:
+
+		/* Candidate spikes found in one group of channels in one block */
+		struct GroupResult {
+			std::vector<std::vector<uint64_t> > idx;	// Per channel
+			std::vector<std::vector<short> > snips;		// Per channel, concatenated
+		};
+
+		/* Compute the means and standard deviations of the channels */
+		void computeStatistics();
+
+		/* Search one group of channels in the block of samples [start, end) */
+		GroupResult searchGroup(size_t group, int64_t start, int64_t end) const;
+
+		const datafile::DataFile& m_file;
+		ExtractorOptions m_options;
+		std::vector<size_t> m_groups;	// First channel position of each group, and the end
+		arma::vec m_means;
+		arma::vec m_thresholds;
+
+		/* Declared last, so its tasks finish before other members are destroyed */
+		datafile::ThreadPool m_pool;
+
+}; // end Extractor class
+
+}; // end snipfile namespace
+
+#endif
+
@@ -0,0 +1,167 @@
+/*! \file filter.h
+ *
+ * Streaming IIR and FIR filters applied to blocks of raw data.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include <armadillo>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace datafile {
+
+/*! Default order of the Butterworth filters designed by the Filter class */
+const int DefaultFilterOrder = 2;
+
+/*! Name of the dataset written by DataFile::writeFiltered() by default */
+const std::string FilteredDataset = "filtered";
+
+/*! A single second-order section of an IIR filter, with coefficients
+ * normalized so that a0 is 1. Its transfer function is
+ * (b0 + b1 z^-1 + b2 z^-2) / (1 + a1 z^-1 + a2 z^-2).
+ */
+struct Biquad {
+	double b0, b1, b2, a1, a2;
+};
+
+/*! The Filter class applies the same linear filter to every channel of
+ * blocks of data, as returned by DataFile::data().
+ *
+ * A filter is either a cascade of second-order IIR sections, such as the
+ * Butterworth filters from highpass(), lowpass() and bandpass(), or an FIR
+ * filter given by its taps, such as from firBandpass().
+ *
+ * process() filters successive blocks of a recording, carrying the state of
+ * each channel from one block to the next, so the result is the same
+ * however the recording is divided into blocks. The first block after
+ * construction or reset() starts from the steady state for its first
+ * sample, as if the signal had been constant before it, which avoids the
+ * large transient of starting from zero. filtfilt() instead filters a block
+ * forwards and then backwards, for a result with no phase distortion,
+ * which is suited to offline processing of whole spans of data.
+ *
+ * Channels are filtered several at a time, one per lane of SSE2 or AVX2
+ * registers when the library is compiled with support for them, with all
+ * arithmetic in single precision. Results are in the raw units of the
+ * input. The number of channels is fixed by the first block processed.
+ */
+class Filter {
+
+	public:
+
+		/*! Create an IIR filter from its second-order sections, applied
+		 * in order.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if there are no sections.
+		 */
+		explicit Filter(const std::vector<Biquad>& sections);
+
+		/*! Create an FIR filter from its taps.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if there are no taps.
+		 */
+		explicit Filter(const std::vector<double>& taps);
+
+		/*! Design a Butterworth high-pass filter.
+		 * \param cutoff The -3 dB frequency, in Hz.
+		 * \param sampleRate The sample rate of the data, in Hz.
+		 * \param order The order of the filter.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument unless the order is positive
+		 * and the cutoff lies between zero and the Nyquist frequency.
+		 */
+		static Filter highpass(double cutoff, double sampleRate,
+				int order = DefaultFilterOrder);
+
+		/*! Design a Butterworth low-pass filter, as for highpass() */
+		static Filter lowpass(double cutoff, double sampleRate,
+				int order = DefaultFilterOrder);
+
+		/*! Design a band-pass filter, as a Butterworth high-pass filter at
+		 * the low cutoff followed by a low-pass filter at the high cutoff,
+		 * each of the given order.
+		 */
+		static Filter bandpass(double low, double high, double sampleRate,
+				int order = DefaultFilterOrder);
+
+		/*! Design a linear-phase FIR band-pass filter, by the window method
+		 * with a Hamming window.
+		 * \param low The low cutoff, in Hz.
+		 * \param high The high cutoff, in Hz.
+		 * \param sampleRate The sample rate of the data, in Hz.
+		 * \param ntaps The number of taps, which must be odd.
+		 */
+		static Filter firBandpass(double low, double high, double sampleRate,
+				size_t ntaps);
+
+		/*! Return true if this is an FIR filter */
+		bool isFir() const;
+
+		/*! Return the sections of an IIR filter, or nothing for an FIR filter */
+		const std::vector<Biquad>& sections() const;
+
+		/*! Return the taps of an FIR filter, or nothing for an IIR filter */
+		const std::vector<double>& taps() const;
+
+		/*! Forget the state of every channel, so that the next block
+		 * processed is treated as the start of a signal.
+		 */
+		void reset();
+
+		/*! Filter the next block of data.
+		 * \param in The block, with shape (nsamples, nchannels).
+		 * \param out Filled with the filtered block, of the same shape.
+		 * `out` may be the same matrix as `in`.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the block has a different
+		 * number of channels than those before it.
+		 */
+		void process(const arma::Mat<int16_t>& in, arma::fmat& out);
+		void process(const arma::fmat& in, arma::fmat& out);
+
+		/*! Filter a block forwards and then backwards, so that the result
+		 * has no phase distortion, and the magnitude response is squared.
+		 * Each pass starts from the steady state for the first sample it
+		 * filters. This does not use or change the state of the filter.
+		 */
+		void filtfilt(const arma::Mat<int16_t>& in, arma::fmat& out) const;
+
+	private:
+
+		template<class T>
+		void run(const arma::Mat<T>& in, arma::fmat& out);
+
+		/* Set the state of each channel to the steady state for the
+		 * first sample of the block.
+		 */
+		template<class T>
+		void prime(const arma::Mat<T>& in);
+
+		std::vector<Biquad> m_sections;
+		std::vector<double> m_taps;
+		size_t m_nchannels;
+		bool m_primed;
+
+		/* State of each channel, grouped so that the channels of one
+		 * group of lanes are adjacent. For an IIR filter, this holds the
+		 * two delays of each section; for an FIR filter, the last
+		 * ntaps - 1 samples, oldest first.
+		 */
+		std::vector<float> m_state;
+
+}; // end Filter class
+
+}; // end datafile namespace
+
+#endif
+
@@ -32,7 +32,19 @@ class HidensFile : public datafile::DataFile {
 		/*! Construct a HiDens recording file. */
 		HidensFile(std::string filename, 
 				std::string array = DefaultArray,
-				int nchannels = NumChannels);
+				int nchannels = NumChannels,
+				const datafile::DataFileOptions& options = datafile::DataFileOptions());
+
+		/*! Open an existing HiDens recording, as by the DataFile constructor
+		 * taking an OpenMode, e.g., for update so that derived data may be
+		 * stored, or to follow an acquisition with SWMR access.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the file does not exist or
+		 * is not a valid recording.
+		 */
+		HidensFile(std::string filename, datafile::OpenMode mode,
+				const datafile::DataFileOptions& options = datafile::DataFileOptions());
 
 		/*! Return the configuration saved in this file */
 		Configuration configuration() const;
@@ -62,7 +74,8 @@ class HidensFile : public datafile::DataFile {
 		 * that setting analog output is not supported for this
 		 * class.
 		 */
-		virtual void setAnalogOutputSize(int sz) override;
+		virtual void setAnalogOutputSize(int64_t sz) override;
+		using DataFile::setAnalogOutputSize;
 
 	protected:
 		void readConfiguration();
@@ -36,10 +36,16 @@ class HidensSnipFile : public snipfile::SnipFile {
 		/*! Construct a new snippet file.
 		 * \param name The name of the newly constructed file
 		 * \param source The raw data file from which snippets will be extracted.
+		 * \param nbefore The number of samples before the peak of each snippet.
+		 * \param nafter The number of samples after the peak of each snippet.
+		 * \param deflate The deflate level applied to appended snippets.
+		 * \param layout The layout in which snippets are stored.
 		 */
 		HidensSnipFile(const std::string& name, const hidensfile::HidensFile& source,
 				const size_t nbefore = hidenssnipfile::NUM_SAMPLES_BEFORE,
-				const size_t nafter = hidenssnipfile::NUM_SAMPLES_AFTER);
+				const size_t nafter = hidenssnipfile::NUM_SAMPLES_AFTER,
+				const unsigned int deflate = 0,
+				const snipfile::SnipLayout layout = snipfile::SnipLayout::ChannelGroups);
 
 		/*! Open an existing snippet file */
 		HidensSnipFile(const std::string& name); // existing file
@@ -0,0 +1,185 @@
+/*! \file iostats.h
+ *
+ * Counters and timings of the I/O performed through recording and
+ * snippet files.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _IOSTATS_H_
+#define _IOSTATS_H_
+
+#include "H5Cpp.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace datafile {
+
+/*! Kinds of operation counted in IOStats */
+enum class IOOperation {
+	Read,		// Reads of data
+	Write,		// Writes of data
+	Extend,		// Extensions of a dataset
+	AttrRead,	// Reads of attributes
+	AttrWrite,	// Writes of attributes
+	Flush		// Flushes of the file
+};
+
+/*! Number of kinds of IOOperation */
+const size_t NumIOOperations = 6;
+
+/*! Number of buckets in each latency histogram. Bucket 0 counts operations
+ * taking less than 1 microsecond, bucket i > 0 those taking [2^(i - 1), 2^i)
+ * microseconds, and the last bucket also counts anything longer.
+ */
+const size_t IOLatencyBuckets = 32;
+
+/*! Statistics of one kind of operation */
+struct IOOperationStats {
+	uint64_t calls;			// Number of operations, including any which failed
+	uint64_t bytes;			// Bytes of data or attribute values transferred, where known
+	double seconds;			// Total time spent in the operations
+	double maxSeconds;		// Longest single operation
+	std::array<uint64_t, IOLatencyBuckets> latency;	// Histogram of durations
+
+	/*! Return the mean duration of an operation, or 0 if there were none */
+	double meanSeconds() const;
+
+	/*! Return an upper bound on the given quantile of the durations, e.g.,
+	 * 0.99, from the histogram, or 0 if there were no operations.
+	 */
+	double quantileSeconds(double quantile) const;
+
+	/*! Return the upper edge of a bucket of the histogram, in seconds */
+	static double bucketSeconds(size_t bucket);
+};
+
+/*! Snapshot of the I/O statistics of a file, since they were last reset.
+ *
+ * The HDF5 library keeps statistics of its metadata cache, but not of its
+ * raw data chunk cache, so only the size of the chunk cache is reported.
+ * Chunk cache misses show up as slow reads in the latency histograms.
+ */
+struct IOStats {
+	bool enabled;					// Statistics are being collected
+	double seconds;					// Time since the statistics were reset
+	std::array<IOOperationStats, NumIOOperations> operations;	// Indexed by IOOperation
+
+	double metadataCacheHitRate;	// Hit rate of the metadata cache, or NaN
+	size_t metadataCacheBytes;		// Current size of the metadata cache
+	size_t chunkCacheBytes;			// Size of the raw data chunk cache
+
+	/*! Return the statistics of one kind of operation */
+	const IOOperationStats& operator[](IOOperation operation) const;
+};
+
+/*! The IOCounters class accumulates the statistics of a file's I/O.
+ *
+ * Operations are recorded with relaxed atomic updates, so that a file may
+ * be read from many threads at once without taking a lock. Collection is
+ * off until enabled, and an IOTimer checks this before reading the clock,
+ * so that disabled counters cost a single load per operation.
+ */
+class IOCounters {
+
+	public:
+		/*! Construct disabled counters, with every count zero */
+		IOCounters();
+		IOCounters(const IOCounters& other) = delete;
+		IOCounters& operator=(const IOCounters& other) = delete;
+
+		/*! Start or stop collecting statistics. Counts are kept when
+		 * collection stops.
+		 */
+		void setEnabled(bool enabled);
+
+		/*! Return true if statistics are being collected */
+		bool enabled() const
+		{
+			return m_enabled.load(std::memory_order_relaxed);
+		}
+
+		/*! Record one operation transferring `bytes` bytes */
+		void record(IOOperation operation, uint64_t bytes,
+				std::chrono::steady_clock::duration elapsed);
+
+		/*! Set every count to zero */
+		void reset();
+
+		/*! Return the counts, without any cache statistics */
+		IOStats snapshot() const;
+
+		/*! Fill in the cache statistics of a snapshot from an HDF5 file,
+		 * whose chunk cache size is that given to its file access
+		 * properties.
+		 */
+		static void readCacheStats(hid_t file, IOStats& stats);
+
+		/*! Restart the hit rate statistics of an HDF5 file's metadata cache */
+		static void resetCacheStats(hid_t file);
+
+	private:
+
+		/* Running counts of one kind of operation */
+		struct Counts {
+			std::atomic<uint64_t> calls;
+			std::atomic<uint64_t> bytes;
+			std::atomic<uint64_t> nanoseconds;
+			std::atomic<uint64_t> maxNanoseconds;
+			std::array<std::atomic<uint64_t>, IOLatencyBuckets> latency;
+		};
+
+		std::atomic<bool> m_enabled;
+		std::array<Counts, NumIOOperations> m_counts;
+		std::atomic<int64_t> m_resetTime;	// Ticks of the steady clock at the last reset
+
+}; // end IOCounters class
+
+/*! The IOTimer class times one operation for as long as it is in scope,
+ * recording it when it is destroyed. Nothing is timed if the counters
+ * are disabled when the timer is created.
+ */
+class IOTimer {
+
+	public:
+		IOTimer(IOCounters& counters, IOOperation operation, uint64_t bytes = 0)
+			: m_counters(counters.enabled() ? &counters : nullptr),
+			  m_operation(operation),
+			  m_bytes(bytes)
+		{
+			if (m_counters) {
+				m_start = std::chrono::steady_clock::now();
+			}
+		}
+		IOTimer(const IOTimer& other) = delete;
+		IOTimer& operator=(const IOTimer& other) = delete;
+
+		/*! Set the number of bytes transferred, once it is known */
+		void setBytes(uint64_t bytes)
+		{
+			m_bytes = bytes;
+		}
+
+		~IOTimer()
+		{
+			if (m_counters) {
+				m_counters->record(m_operation, m_bytes,
+						std::chrono::steady_clock::now() - m_start);
+			}
+		}
+
+	private:
+		IOCounters* m_counters;
+		IOOperation m_operation;
+		uint64_t m_bytes;
+		std::chrono::steady_clock::time_point m_start;
+
+}; // end IOTimer class
+
+}; // end datafile namespace
+
+#endif
+
@@ -0,0 +1,122 @@
+/*! \file mappeddatafile.h
+ *
+ * Read-only, memory-mapped access to finalized recordings whose data
+ * is stored contiguously in the file.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _MAPPEDDATAFILE_H_
+#define _MAPPEDDATAFILE_H_
+
+#include "datafile.h"
+
+#include <string>
+
+namespace datafile {
+
+/*! Finalize a recording by copying it into a new file, with its data
+ * stored contiguously rather than in chunks.
+ * \param source The name of an existing recording.
+ * \param destination The name of the file to create.
+ *
+ * All attributes of the source dataset and all other objects in the source
+ * file (e.g., a HiDens configuration) are copied. The finalized file can
+ * still be read by DataFile, but can no longer be extended. It can also be
+ * memory-mapped with a MappedDataFile.
+ *
+ * Exceptions:
+ * This throws a std::invalid_argument if the destination already exists
+ * or the source cannot be opened. If the copy fails, the partial
+ * destination is removed.
+ */
+void finalize(const std::string& source, const std::string& destination);
+
+/*! The MappedDataFile class provides zero-copy, read-only access to the
+ * data of a finalized recording by mapping it into memory.
+ *
+ * Because the file stores data as (nchannels, nsamples) in row-major order,
+ * each channel is a contiguous run of samples. Matrices returned from data()
+ * are Armadillo aliases of the mapped file with shape (nsamples, nchannels),
+ * exactly as DataFile::data() would return them, but no data is read or
+ * copied until it is touched. Repeated sweeps over the file are served from
+ * the operating system's page cache, without going through HDF5.
+ *
+ * The matrices alias read-only memory. They must not be modified or resized,
+ * and must not outlive the MappedDataFile. Values are the raw values stored
+ * in the file; scale by gain() for voltages.
+ */
+class MappedDataFile {
+
+	public:
+
+		/*! Map an existing, finalized recording.
+		 * \param filename The name of the file to map.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the file cannot be opened,
+		 * if its data is not stored contiguously (see finalize()), or if
+		 * its data is not little-endian 16-bit integers. It throws a
+		 * std::runtime_error if mapping the file fails.
+		 */
+		MappedDataFile(const std::string& filename);
+		MappedDataFile(const MappedDataFile& other) = delete;
+		MappedDataFile& operator=(const MappedDataFile& other) = delete;
+
+		/*! Unmap the file */
+		~MappedDataFile();
+
+		/*! Return the full pathname of the file */
+		std::string filename() const;
+
+		/*! Return the total number of samples in the recording */
+		int64_t nsamples() const;
+
+		/*! Return the number of channels in the recording */
+		int nchannels() const;
+
+		/*! Return the sample rate of the data */
+		float sampleRate() const;
+
+		/*! Return the gain of the analog-digital conversion */
+		float gain() const;
+
+		/*! Return the offset of the analog-digital conversion */
+		float offset() const;
+
+		/*! Return an alias of all samples from all channels, with
+		 * shape (nsamples, nchannels).
+		 */
+		arma::Mat<int16_t> data() const;
+
+		/*! Return an alias of all samples from channels [startChan, endChan),
+		 * with shape (nsamples, endChan - startChan).
+		 *
+		 * Exceptions:
+		 * This throws a std::logic_error if the channels are out of range.
+		 */
+		arma::Mat<int16_t> data(int startChan, int endChan) const;
+
+		/*! Return a pointer to the first sample of the given channel.
+		 * The channel's nsamples() samples are contiguous.
+		 */
+		const int16_t* channel(int channel) const;
+
+	private:
+		std::string m_filename;
+		uint64_t m_nsamples;
+		uint64_t m_nchannels;
+		float m_sampleRate;
+		float m_gain;
+		float m_offset;
+
+		void* m_map;			// Start of the mapped region, page-aligned
+		size_t m_mapLength;		// Length of the mapped region
+		int16_t* m_data;		// First sample of the dataset within the map
+
+}; // end MappedDataFile class
+
+}; // end datafile namespace
+
+#endif
+
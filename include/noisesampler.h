@@ -0,0 +1,106 @@
+/*! \file noisesampler.h
+ *
+ * Reproducible sampling of random noise snippets from a recording.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef EXTRACT_NOISESAMPLER_H_
+#define EXTRACT_NOISESAMPLER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <armadillo>
+
+#include "datafile.h"
+#include "snipfile.h"
+#include "threadpool.h"
+
+namespace snipfile {
+
+/*! Seed used by a NoiseSampler when none is given */
+const uint64_t DEFAULT_NOISE_SEED = 0;
+
+/*! The NoiseSampler class cuts snippets of data around random samples of
+ * a recording, which serve as examples of the noise on each channel.
+ *
+ * All the random samples are drawn up front, and the snippets around them
+ * are read with a DataFile::ReadPlan. The plan groups the snippets by the
+ * chunks of the dataset they overlap, and reads each chunk once for all of
+ * them and all channels, rather than making one small read per snippet.
+ *
+ * The samples are drawn without replacement from every sample with a
+ * whole snippet around it, and returned in increasing order. They depend
+ * only on the seed, the number drawn and the size of the recording, and
+ * are drawn the same way on every platform, so a sampler with the same
+ * seed always picks the same samples. The same samples are used for
+ * every channel.
+ */
+class NoiseSampler {
+
+	public:
+
+		/*! Create a sampler drawing from the given recording.
+		 * \param file The recording, which must outlive the sampler.
+		 * \param seed Seed of the random samples.
+		 */
+		NoiseSampler(const datafile::DataFile& file,
+				uint64_t seed = DEFAULT_NOISE_SEED);
+
+		/*! Return the seed of the random samples */
+		uint64_t seed() const;
+
+		/*! Draw random samples, each with a whole snippet around it.
+		 * \param count The number of samples to draw.
+		 * \param nbefore Samples of each snippet before the drawn sample.
+		 * \param nafter Samples of each snippet after the drawn sample.
+		 * \return The drawn samples, in increasing order.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the recording has fewer
+		 * than `count` samples with a whole snippet around them.
+		 */
+		arma::uvec indices(size_t count, size_t nbefore, size_t nafter) const;
+
+		/*! Cut snippets around random samples from the given channels.
+		 * \param channels The channels from which to take snippets.
+		 * \param count The number of snippets from each channel.
+		 * \param nbefore Samples of each snippet before the drawn sample.
+		 * \param nafter Samples of each snippet after the drawn sample.
+		 * \param idx Filled with the drawn samples, once for each channel.
+		 * \param snips Filled with the snippets of each channel, one per
+		 * column, with shape (nbefore + nafter + 1, count).
+		 * \param pool If given, chunks are read on this pool.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if too many snippets are
+		 * requested, or a std::logic_error if a channel is not in the
+		 * recording.
+		 */
+		void sample(const arma::uvec& channels, size_t count,
+				size_t nbefore, size_t nafter, std::vector<arma::uvec>& idx,
+				std::vector<arma::Mat<short> >& snips,
+				datafile::ThreadPool* pool = nullptr) const;
+
+		/*! Cut snippets around random samples from each channel of a
+		 * snippet file, and write them as its noise snippets.
+		 * \param snipFile The snippet file, whose channels must be set, and
+		 * whose snippet size is used.
+		 * \param count The number of snippets from each channel.
+		 * \param pool If given, chunks are read on this pool.
+		 */
+		void sample(SnipFile& snipFile, size_t count = NUM_RANDOM_SNIPPETS,
+				datafile::ThreadPool* pool = nullptr) const;
+
+	private:
+
+		const datafile::DataFile& m_file;
+		uint64_t m_seed;
+
+}; // end NoiseSampler class
+
+}; // end snipfile namespace
+
+#endif
+
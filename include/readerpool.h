@@ -0,0 +1,126 @@
+/*! \file readerpool.h
+ *
+ * Pool of threads which read blocks of channels from a single DataFile
+ * concurrently.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _READERPOOL_H_
+#define _READERPOOL_H_
+
+#include "datafile.h"
+#include "threadpool.h"
+
+#include <functional>
+
+namespace datafile {
+
+/*! The ReaderPool class splits reads from a DataFile into blocks of
+ * channels, and reads the blocks on a pool of worker threads.
+ *
+ * All workers share the DataFile's file handle and chunk cache, and each
+ * writes directly into its own range of columns of the output matrix, so
+ * no data is copied after it is read. Blocks are aligned to the chunk
+ * shape of the dataset where possible, so that no two workers decompress
+ * the same chunk.
+ *
+ * How much HDF5 itself overlaps depends on the library: a thread-safe
+ * build still serializes its own API calls internally, and an unsafe one
+ * is serialized by an HDF5Gate. Work outside HDF5, such as converting
+ * samples to voltages in dataScaled(), always runs in parallel.
+ *
+ * The DataFile must outlive the pool, and must not be written while a
+ * read is in progress.
+ */
+class DataFile::ReaderPool {
+
+	public:
+
+		/*! Create a pool reading from the given file.
+		 * \param file The file to read.
+		 * \param nthreads The number of worker threads. If 0, one thread
+		 * is started for each hardware thread.
+		 */
+		ReaderPool(const DataFile& file, size_t nthreads = 0);
+		ReaderPool(const ReaderPool& other) = delete;
+		ReaderPool& operator=(const ReaderPool& other) = delete;
+
+		/*! Return the number of worker threads */
+		size_t size() const;
+
+		/*! Read data from a contiguous set of channels into the given matrix.
+		 * This is identical to DataFile::data(), with the channels
+		 * read in parallel.
+		 *
+		 * Exceptions:
+		 * This will throw a std::logic_error if either the requested channels
+		 * or samples are outside of the range for the file, and rethrows
+		 * any exception raised by a worker.
+		 */
+		template<class T>
+		void data(int startChan, int endChan, int64_t startSample, int64_t endSample,
+				arma::Mat<T>& mat)
+		{
+			m_file.verifyReadRequest(startChan, endChan, startSample, endSample);
+			mat.set_size(endSample - startSample, endChan - startChan);
+			auto& memtype = dtypeForMat(mat);
+			forEachBlock(startChan, endChan, [&](int first, int last) {
+					m_file.readRaw(first, last, startSample, endSample,
+							mat.colptr(first - startChan), memtype);
+				});
+		}
+
+		/*! Read data from all channels into the given matrix. */
+		template<class T>
+		void data(int64_t startSample, int64_t endSample, arma::Mat<T>& mat)
+		{
+			data(0, m_file.nchannels(), startSample, endSample, mat);
+		}
+
+		/*! Read data from a contiguous set of channels, converted to true
+		 * voltage units. This is identical to DataFile::dataScaled(), with
+		 * channels read and converted in parallel.
+		 */
+		template<class T>
+		void dataScaled(int startChan, int endChan, int64_t startSample, int64_t endSample,
+				arma::Mat<T>& mat)
+		{
+			static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value,
+					"Scaled data can only be read into float or double matrices");
+			m_file.verifyReadRequest(startChan, endChan, startSample, endSample);
+			mat.set_size(endSample - startSample, endChan - startChan);
+			auto gain = static_cast<T>(m_file.gain());
+			auto offset = static_cast<T>(m_file.offset());
+			forEachBlock(startChan, endChan, [&](int first, int last) {
+					auto buf = mat.colptr(first - startChan);
+					m_file.readRaw(first, last, startSample, endSample,
+							buf, H5::PredType::NATIVE_INT16);
+					scaleSamplesInPlace(buf, mat.n_rows * (last - first), gain, offset);
+				});
+		}
+
+		/*! Read data from all channels, converted to true voltage units. */
+		template<class T>
+		void dataScaled(int64_t startSample, int64_t endSample, arma::Mat<T>& mat)
+		{
+			dataScaled(0, m_file.nchannels(), startSample, endSample, mat);
+		}
+
+	private:
+
+		/* Split the channels into blocks, call `read` for each block of
+		 * channels [first, last) on the workers, and wait for all of them.
+		 */
+		void forEachBlock(int startChan, int endChan,
+				const std::function<void(int, int)>& read);
+
+		const DataFile& m_file;
+		ThreadPool m_pool;
+
+}; // end ReaderPool class
+
+}; // end datafile namespace
+
+#endif
+
@@ -0,0 +1,150 @@
+/*! \file readplan.h
+ *
+ * Batched reads of many blocks of data, coalesced so that each chunk of
+ * the dataset is read once.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _READPLAN_H_
+#define _READPLAN_H_
+
+#include "datafile.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace datafile {
+
+/*! The ReadPlan class reads a batch of (channel range, sample range)
+ * requests from a DataFile, touching each chunk of the dataset once.
+ *
+ * Requests are added with add(), and all of them are read by a call to
+ * execute(). The plan groups the requests by the chunks they overlap,
+ * reads the part of each chunk needed by any request with a single HDF5
+ * call, and scatters it into every destination matrix that needs it. Many
+ * overlapping windows, or per-channel reads of the same samples, therefore
+ * cost one read per chunk rather than one per request. A contiguous
+ * dataset has no chunks, so its requests are grouped by blocks of
+ * BlockSize samples instead.
+ *
+ * Chunks may optionally be read and scattered on a ThreadPool. Every
+ * sample of each destination comes from exactly one chunk, so workers
+ * never write the same memory.
+ *
+ * A plan may be executed any number of times, e.g., as the same windows
+ * are read from successive files. The DataFile must outlive the plan.
+ */
+class DataFile::ReadPlan {
+
+	public:
+
+		/*! Create an empty plan reading from the given file. */
+		ReadPlan(const DataFile& file);
+
+		/*! Add a request to the plan.
+		 * \param startChan The first channel to read.
+		 * \param endChan One past the last channel to read.
+		 * \param startSample The first sample to read.
+		 * \param endSample One past the last sample to read.
+		 * \return The index of the request, which is the index of its
+		 * data in the output of execute().
+		 *
+		 * Exceptions:
+		 * This will throw a std::logic_error if either the requested channels
+		 * or samples are outside of the range for the file.
+		 */
+		size_t add(int startChan, int endChan, int64_t startSample, int64_t endSample);
+
+		/*! Return the number of requests in the plan */
+		size_t size() const;
+
+		/*! Remove all requests from the plan */
+		void clear();
+
+		/*! Return the number of chunk reads needed to execute the plan */
+		size_t chunks() const;
+
+		/*! Read all requests.
+		 * \param out Filled with one matrix per request, in the order in
+		 * which they were added, each with size (nsamples, nchannels) as
+		 * returned from DataFile::data().
+		 * \param pool If given, chunks are read and scattered on this pool.
+		 */
+		template<class T>
+		void execute(std::vector<arma::Mat<T> >& out, ThreadPool* pool = nullptr) const
+		{
+			allocate(out);
+			run(pool, [&out](size_t request, int channel, int64_t sample, 
+						const int16_t* src, size_t n) {
+					std::copy(src, src + n, out[request].colptr(channel) + sample);
+				});
+		}
+
+		/*! Read all requests, converted to true voltage units as by
+		 * DataFile::dataScaled().
+		 * \param out Filled with one matrix per request.
+		 * \param pool If given, chunks are read and converted on this pool.
+		 */
+		template<class T>
+		void executeScaled(std::vector<arma::Mat<T> >& out, ThreadPool* pool = nullptr) const
+		{
+			static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value,
+					"Scaled data can only be read into float or double matrices");
+			auto gain = static_cast<T>(m_file.gain());
+			auto offset = static_cast<T>(m_file.offset());
+			allocate(out);
+			run(pool, [&out, gain, offset](size_t request, int channel, int64_t sample, 
+						const int16_t* src, size_t n) {
+					scaleSamples(src, out[request].colptr(channel) + sample, n, gain, offset);
+				});
+		}
+
+	private:
+
+		/* A single request added to the plan */
+		struct Request {
+			int startChan, endChan;
+			int64_t startSample, endSample;
+		};
+
+		/* The part of one chunk read for a set of requests */
+		struct ChunkRead {
+			int startChan, endChan;
+			int64_t startSample, endSample;
+			std::vector<size_t> requests;
+		};
+
+		/* Receives one channel's worth of a request from a chunk. The
+		 * channel and sample are relative to the start of the request.
+		 */
+		using Scatter = std::function<void(size_t request, int channel,
+				int64_t sample, const int16_t* src, size_t n)>;
+
+		/* Group requests by the chunks they overlap, in file order */
+		std::vector<ChunkRead> schedule() const;
+
+		/* Read each chunk and pass its pieces to `scatter` */
+		void run(ThreadPool* pool, const Scatter& scatter) const;
+
+		template<class T>
+		void allocate(std::vector<arma::Mat<T> >& out) const
+		{
+			out.resize(m_requests.size());
+			for (size_t i = 0; i < m_requests.size(); i++) {
+				auto& r = m_requests[i];
+				out[i].set_size(r.endSample - r.startSample, r.endChan - r.startChan);
+			}
+		}
+
+		const DataFile& m_file;
+		std::vector<Request> m_requests;
+
+}; // end ReadPlan class
+
+}; // end datafile namespace
+
+#endif
+
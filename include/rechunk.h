@@ -0,0 +1,70 @@
+/*! \file rechunk.h
+ *
+ * Rewriting existing recordings with a new chunk shape or compression.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _RECHUNK_H_
+#define _RECHUNK_H_
+
+#include "datafile.h"
+
+#include <cstdint>
+#include <string>
+
+namespace datafile {
+
+/*! Default bound on the memory used by rechunk() for blocks of data */
+const size_t DefaultRechunkBufferBytes = 256 * 1024 * 1024;
+
+/*! Copy a recording into a new file, changing the shape of its chunks,
+ * its compression, or both.
+ * \param source The name of an existing recording.
+ * \param destination The name of the file to create.
+ * \param options The chunk shape and filters of the new dataset, as for a
+ * new DataFile, e.g., from recommendOptions(). Cache sizes and summary
+ * factors are ignored.
+ * \param bufferBytes Bound on the memory used for blocks of data in
+ * flight, though at least one row of the new chunks is always used.
+ *
+ * The data is copied a block of chunks at a time. One thread reads blocks
+ * from the source, while the calling thread writes the previous block.
+ * When the new dataset uses only the shuffle and deflate filters, chunks
+ * are compressed on a pool of threads, outside of the HDF5 library, and
+ * written directly with H5Dwrite_chunk(), so that compression proceeds in
+ * parallel with reading and with itself. Other filters are applied by
+ * HDF5 as usual.
+ *
+ * Everything besides the data is copied as by finalize(): the attributes of
+ * the data and of the file, and all other objects in the file, such as a
+ * HiDens configuration or summary levels. The new file can be extended like
+ * any other recording.
+ *
+ * Exceptions:
+ * This throws a std::invalid_argument if the destination exists, the
+ * source cannot be opened, the chunk shape is invalid, or a filter is not
+ * available.
+ */
+void rechunk(const std::string& source, const std::string& destination,
+		const DataFileOptions& options,
+		size_t bufferBytes = DefaultRechunkBufferBytes);
+
+/*! Copy everything except the raw data from one recording file to another.
+ * \param source The source file.
+ * \param destination The destination file, which must already contain a
+ * dataset named "data", and no other objects.
+ * \param nsamples The number of samples to record for the destination.
+ *
+ * This copies every attribute of the source's data, except the number of
+ * samples, which is replaced by `nsamples`; every attribute of the root
+ * group; and every other object in the file. It is used by finalize() and
+ * rechunk().
+ */
+void copyRecordingMetadata(const H5::H5File& source, H5::H5File& destination,
+		uint64_t nsamples);
+
+}; // end datafile namespace
+
+#endif
+
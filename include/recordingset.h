@@ -0,0 +1,198 @@
+/*! \file recordingset.h
+ *
+ * A view of several consecutive recordings as a single recording.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _RECORDINGSET_H_
+#define _RECORDINGSET_H_
+
+#include "datafile.h"
+#include "threadpool.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace datafile {
+
+/*! The RecordingSet class presents the files of a segmented acquisition,
+ * recorded one after another, as one recording with a continuous sample
+ * axis.
+ *
+ * Reads are split at the boundaries between files, and each piece is read
+ * from its file directly into the rows of the destination matrix it
+ * covers, so no data is copied. When a read spans several files, the
+ * pieces may be read on a ThreadPool. As with a DataFile, the reading
+ * methods may be called from any number of threads at once.
+ *
+ * Every file must have the same number of channels, array, sample rate,
+ * gain and offset. The files are opened read-only.
+ *
+ * Code which reads from a DataFile, such as an Extractor, a NoiseSampler
+ * or a BlockIterator, can read the whole set through a virtual file,
+ * written by writeVirtual() and opened as any other recording.
+ */
+class RecordingSet {
+
+	public:
+
+		/*! Open a set of recordings.
+		 * \param filenames The names of the files, in the order in which
+		 * they were recorded.
+		 * \param options Cache settings used to open each file.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if there are no files, if any
+		 * cannot be opened, or if they do not match.
+		 */
+		explicit RecordingSet(const std::vector<std::string>& filenames,
+				const DataFileOptions& options = DataFileOptions());
+		RecordingSet(const RecordingSet& other) = delete;
+		RecordingSet& operator=(const RecordingSet& other) = delete;
+
+		/*! Return the number of files in the set */
+		size_t nfiles() const;
+
+		/*! Return one file of the set */
+		const DataFile& file(size_t index) const;
+
+		/*! Return the first sample of a file, in the samples of the set */
+		int64_t fileStart(size_t index) const;
+
+		/*! Return the index of the file holding a sample.
+		 *
+		 * Exceptions:
+		 * This throws a std::logic_error if the sample is out of range.
+		 */
+		size_t fileAt(int64_t sample) const;
+
+		/*! Return the total number of samples in all files */
+		int64_t nsamples() const;
+
+		/*! Return the number of channels of each file */
+		int nchannels() const;
+
+		/*! Return the total length of all files, in seconds */
+		double length() const;
+
+		/*! Return the array, sample rate, gain and offset shared by each file */
+		std::string array() const;
+		float sampleRate() const;
+		float gain() const;
+		float offset() const;
+
+		/*! Read data from a contiguous set of channels into the given matrix,
+		 * as by DataFile::data().
+		 * \param startChan The first channel to read.
+		 * \param endChan One past the last channel to read.
+		 * \param startSample The first sample to read, in the samples of the set.
+		 * \param endSample One past the last sample to read.
+		 * \param mat The matrix to fill, with size (nsamples, nchannels).
+		 * \param pool If given, the pieces of a read spanning several files
+		 * are read on this pool.
+		 *
+		 * Exceptions:
+		 * This will throw a std::logic_error if either the requested channels
+		 * or samples are outside of the range of the set, and rethrows any
+		 * exception raised by a worker.
+		 */
+		template<class T>
+		void data(int startChan, int endChan, int64_t startSample, int64_t endSample,
+				arma::Mat<T>& mat, ThreadPool* pool = nullptr) const
+		{
+			verifyReadRequest(startChan, endChan, startSample, endSample);
+			mat.set_size(endSample - startSample, endChan - startChan);
+			forEachPiece(startSample, endSample, pool,
+					[&](const DataFile& file, int64_t first, int64_t last, arma::uword row) {
+						file.dataInto(startChan, endChan, first, last, mat, row);
+					});
+		}
+
+		/*! Read data from all channels into the given matrix. */
+		template<class T>
+		void data(int64_t startSample, int64_t endSample, arma::Mat<T>& mat,
+				ThreadPool* pool = nullptr) const
+		{
+			data(0, nchannels(), startSample, endSample, mat, pool);
+		}
+
+		/*! Read data from a contiguous set of channels, converted to true
+		 * voltage units as by DataFile::dataScaled(). Each piece is
+		 * converted by the thread which read it.
+		 */
+		template<class T>
+		void dataScaled(int startChan, int endChan, int64_t startSample, int64_t endSample,
+				arma::Mat<T>& mat, ThreadPool* pool = nullptr) const
+		{
+			static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value,
+					"Scaled data can only be read into float or double matrices");
+			verifyReadRequest(startChan, endChan, startSample, endSample);
+			mat.set_size(endSample - startSample, endChan - startChan);
+			auto gain = static_cast<T>(this->gain());
+			auto offset = static_cast<T>(this->offset());
+			forEachPiece(startSample, endSample, pool,
+					[&](const DataFile& file, int64_t first, int64_t last, arma::uword row) {
+						file.dataInto(startChan, endChan, first, last, mat, row);
+						for (arma::uword c = 0; c < mat.n_cols; c++) {
+							auto values = mat.colptr(c) + row;
+							for (int64_t i = 0; i < last - first; i++) {
+								values[i] = gain * values[i] + offset;
+							}
+						}
+					});
+		}
+
+		/*! Read data from all channels, converted to true voltage units. */
+		template<class T>
+		void dataScaled(int64_t startSample, int64_t endSample, arma::Mat<T>& mat,
+				ThreadPool* pool = nullptr) const
+		{
+			dataScaled(0, nchannels(), startSample, endSample, mat, pool);
+		}
+
+		/*! Write a file whose data is an HDF5 virtual dataset mapping each
+		 * file of the set in turn, so that the set can be opened as a
+		 * single DataFile.
+		 * \param filename The name of the file to create.
+		 *
+		 * The virtual file holds the attributes of the first file, with the
+		 * total number of samples, and any HiDens configuration, but no
+		 * data of its own, nor any summary or statistics. It refers to the
+		 * files of the set by their absolute paths, so they must not be
+		 * moved while it is in use; samples of missing files read as zeros.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the file already exists,
+		 * and a std::runtime_error if it cannot be written.
+		 */
+		void writeVirtual(const std::string& filename) const;
+
+	private:
+
+		/* Reads [first, last) of one file into the destination from `row` */
+		using PieceReader = std::function<void(const DataFile& file,
+				int64_t first, int64_t last, arma::uword row)>;
+
+		/* Throw a std::logic_error if the requested read is out of range */
+		void verifyReadRequest(int startChan, int endChan,
+				int64_t startSample, int64_t endSample) const;
+
+		/* Split samples [startSample, endSample) at the boundaries of
+		 * files, and pass each piece to `read`, on `pool` if given and
+		 * there is more than one piece.
+		 */
+		void forEachPiece(int64_t startSample, int64_t endSample, ThreadPool* pool,
+				const PieceReader& read) const;
+
+		std::vector<std::unique_ptr<DataFile> > m_files;
+		std::vector<int64_t> m_starts;		// First sample of each file, then the total
+
+}; // end RecordingSet class
+
+}; // end datafile namespace
+
+#endif
+
@@ -9,13 +9,16 @@
 #ifndef EXTRACT_SNIPFILE_H_
 #define EXTRACT_SNIPFILE_H_
 
+#include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <armadillo>
 #include "H5Cpp.h"
 
 #include "datafile.h"
+#include "threadpool.h"
 
 /*! Namespace for files that are the output of extract. */
 namespace snipfile {
@@ -37,6 +40,23 @@ const size_t DEFAULT_NUM_SNIPPETS = 1000;
 const size_t SNIP_DATASET_RANK = 2;
 const size_t IDX_DATASET_RANK = 1;
 
+/*! The number of snippets in each chunk of datasets written by appending */
+const hsize_t SNIP_CHUNK_SIZE = 1024;
+
+/*! The number of spike indices between entries of the coarse index kept
+ * in memory for time-range queries. This matches the chunk size, so that
+ * each query reads at most one chunk of indices at either end of its range.
+ */
+const hsize_t SNIP_INDEX_STRIDE = SNIP_CHUNK_SIZE;
+
+/*! Layouts in which snippets may be stored. The value is stored in the 
+ * file's "layout-version" attribute. Files without it use ChannelGroups.
+ */
+enum class SnipLayout {
+	ChannelGroups = 1,	// One group of datasets per channel
+	Columnar = 2		// One table of snippets for all channels
+};
+
 /*! A class representing the output of extract.
  *
  * The SnipFile class represents the output of extract. It is an HDF5 file
@@ -47,6 +67,27 @@ const size_t IDX_DATASET_RANK = 1;
  * 	- 'noise-snippets' - The actual random snippets for this channel.
  * 	- 'spike-idx' - The indices of each extract spike snippet.
  * 	- 'spike-snippets' - The actual extracted candidate spikes.
+ *
+ * Snippets may be written all at once, with writeSpikeSnips() and 
+ * writeNoiseSnips(), or a block at a time as they are extracted, with
+ * appendSpikeSnips() and appendNoiseSnips(). Appended snippets are stored
+ * in chunked datasets which grow as needed, so that only the current block
+ * need be held in memory. Both are read in the same way.
+ *
+ * The columnar layout (SnipLayout::Columnar) instead stores each type of
+ * snippet in a single group, "spike" or "noise", containing one table for
+ * all channels, sorted by channel:
+ * 	- 'snippets' - All snippets, with shape (nsnippets, snippet_size).
+ * 	- 'idx' - The index of each snippet.
+ * 	- 'channel' - The channel of each snippet.
+ * 	- 'channel-offsets' - Channel i's snippets are rows 
+ * 	  [channel-offsets[i], channel-offsets[i + 1]) of the table, where
+ * 	  i is the position of the channel in the extracted channels.
+ *
+ * Reading all channels of a columnar file needs only a few dataset opens
+ * and large sequential reads, rather than several opens per channel, which
+ * is much faster for arrays with many channels. Snippets cannot be
+ * appended to a columnar file. Files of either layout are read the same way.
  */
 class SnipFile {
 
@@ -55,10 +96,17 @@ class SnipFile {
 		 * \param filename The name of the newly created file.
 		 * \param source The original DataFile object from which raw data
 		 * will be extracted. This is used to copy file metadata.
+		 * \param nbefore The number of samples before the peak of each snippet.
+		 * \param nafter The number of samples after the peak of each snippet.
+		 * \param deflate The deflate (gzip) level applied to appended snippets,
+		 * or 0 for none. The shuffle filter is applied first when this is set.
+		 * \param layout The layout in which snippets are stored.
 		 */
 		SnipFile(std::string filename, const datafile::DataFile& source,
 				const size_t nbefore = snipfile::NUM_SAMPLES_BEFORE, 
-				const size_t nafter = snipfile::NUM_SAMPLES_AFTER);
+				const size_t nafter = snipfile::NUM_SAMPLES_AFTER,
+				const unsigned int deflate = 0,
+				const SnipLayout layout = SnipLayout::ChannelGroups);
 
 		/*! Open an existing snippet file.
 		 * \param filename The name of the snippet file to load.
@@ -94,6 +142,30 @@ class SnipFile {
 		void writeNoiseSnips(const std::vector<arma::uvec>& idx,
 				const std::vector<arma::Mat<short> >& snips);
 
+		/*! Append extracted spike snippets from one channel to the file.
+		 * \param channel The channel from which the snippets were extracted,
+		 * which must be one of those passed to setChannels().
+		 * \param idx The index into the raw data of the peak of each snippet.
+		 * \param snips The snippets, with shape (snippet_size, nsnippets).
+		 *
+		 * Snippets are added after any already appended for the channel.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the channel was not extracted,
+		 * if there is not one index per snippet, or if the snippets differ in
+		 * size from those already appended. It throws a std::logic_error if
+		 * the channel's snippets were written with writeSpikeSnips(), or if
+		 * the file uses the columnar layout.
+		 */
+		void appendSpikeSnips(arma::uword channel, const arma::uvec& idx,
+				const arma::Mat<short>& snips);
+
+		/*! Append extracted noise snippets from one channel to the file.
+		 * See appendSpikeSnips() for details.
+		 */
+		void appendNoiseSnips(arma::uword channel, const arma::uvec& idx,
+				const arma::Mat<short>& snips);
+
 		/*! Return the extracted spike snippets in the file and their indices
 		 * \param idx Array of arrays, each of which is filled with the indices
 		 * into the raw data file of the peak of each extracted snippet.
@@ -106,6 +178,21 @@ class SnipFile {
 		void spikeSnips(std::vector<arma::uvec>& idx,
 				std::vector<arma::Mat<short> >& snips);
 
+		/*! Return the extracted spike snippets of all channels, loading
+		 * channels in parallel.
+		 * \param idx Filled with the indices of each channel's snippets.
+		 * \param snips Filled with each channel's snippets.
+		 * \param pool The threads on which channels are loaded.
+		 *
+		 * Reads from the file are serialized, but where possible each stored
+		 * chunk is fetched directly, still compressed, and decompressed on
+		 * the pool's threads outside of HDF5 (see DirectChunkReader). This
+		 * is much faster than spikeSnips(idx, snips) for compressed snippets.
+		 * Files with the columnar layout are read as usual.
+		 */
+		void spikeSnips(std::vector<arma::uvec>& idx,
+				std::vector<arma::Mat<short> >& snips, datafile::ThreadPool& pool);
+
 		/*! Return the extracted spike snippets in the file from the given channel.
 		 * \param channel The channel number to return snippets from.
 		 * \param idx Vector filled with indices of the snippets from the given channe.
@@ -116,6 +203,33 @@ class SnipFile {
 		void spikeSnips(arma::uword channel, arma::uvec& idx,
 				arma::mat& snips);
 
+		/*! Return the spike snippets from the given channel whose peaks are
+		 * in the samples [startSample, endSample).
+		 * \param channel The channel number to return snippets from.
+		 * \param startSample The first sample of the range.
+		 * \param endSample The sample after the last of the range.
+		 * \param idx Filled with the indices of the snippets in the range.
+		 * \param snips Filled with the snippets in the range.
+		 *
+		 * Spike indices must be sorted, as written by extract. They are
+		 * binary searched, using a coarse index of every SNIP_INDEX_STRIDE'th
+		 * spike which is read on the first query of each channel and kept
+		 * in memory, and only the snippets in the range are read. A query 
+		 * returning k snippets from n costs O(log n + k).
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the channel was not extracted.
+		 */
+		void spikeSnips(arma::uword channel, uint64_t startSample, uint64_t endSample,
+				arma::uvec& idx, arma::Mat<short>& snips);
+
+		/*! Return the spike snippets from every channel whose peaks are in
+		 * the samples [startSample, endSample). See the single-channel
+		 * version for details.
+		 */
+		void spikeSnips(uint64_t startSample, uint64_t endSample,
+				std::vector<arma::uvec>& idx, std::vector<arma::Mat<short> >& snips);
+
 		/*! Return the extracted noise snippets in the file and their indices
 		 * \param idx Array of arrays, each of which is filled with the indices
 		 * into the raw data file of the extracted noise snippets.
@@ -128,6 +242,12 @@ class SnipFile {
 		void noiseSnips(std::vector<arma::uvec>& idx,
 				std::vector<arma::Mat<short> >& snips);
 
+		/*! Return the extracted noise snippets of all channels, loading
+		 * channels in parallel. See the corresponding spikeSnips().
+		 */
+		void noiseSnips(std::vector<arma::uvec>& idx,
+				std::vector<arma::Mat<short> >& snips, datafile::ThreadPool& pool);
+
 		/*! Return the extracted noise snippets in the file from the given channel.
 		 * \param channel The channel number to return snippets from.
 		 * \param idx Vector filled with indices of the snippets from the given channe.
@@ -162,6 +282,9 @@ class SnipFile {
 		void noiseSnips(std::vector<arma::uvec>& idx,
 				std::vector<arma::mat>& snips);
 
+		/*! Return the layout in which snippets are stored */
+		SnipLayout layout();
+
 		/*! Return the type of the raw data stored in the array */
 		H5::DataType dtype();
 
@@ -208,6 +331,23 @@ class SnipFile {
 		/*! Return the thresholds used when extracting from each channel */
 		arma::vec thresholds();
 
+		/*! Start or stop collecting statistics of the file's I/O, as by
+		 * DataFile::setIOStatsEnabled(). Collection is off when a file is
+		 * created or opened, so the metadata read on opening is not counted.
+		 */
+		void setIOStatsEnabled(bool enable);
+
+		/*! Return true if I/O statistics are being collected */
+		bool ioStatsEnabled();
+
+		/*! Return a snapshot of the I/O statistics of the file. The chunk
+		 * cache size is that of the file's default access properties.
+		 */
+		datafile::IOStats ioStats();
+
+		/*! Set every I/O count to zero, and restart the cache statistics */
+		void resetIOStats();
+
 	protected:
 
 		std::string filename_;
@@ -223,6 +363,17 @@ class SnipFile {
 		size_t samplesAfter_;
 		arma::uvec channels_;
 		arma::vec thresholds_;
+		unsigned int deflate_;
+		SnipLayout layout_;
+
+		/* Coarse index of the spike indices of each type and channel, for
+		 * time-range queries. Entry k is the index of snippet 
+		 * k * SNIP_INDEX_STRIDE of the channel.
+		 */
+		std::map<std::pair<std::string, arma::uword>, std::vector<uint64_t> > coarseIndex_;
+
+		/* Statistics of the file's I/O, updated by reads on a ThreadPool */
+		datafile::IOCounters ioCounters_;
 
 		/* HDF components */
 		H5::H5File file;
@@ -237,6 +388,12 @@ class SnipFile {
 		void writeSnips(const std::string& type, 
 				const std::vector<arma::uvec>& idx,
 				const std::vector<arma::Mat<short> >& snips);
+		void writeColumnarSnips(const std::string& type,
+				const std::vector<arma::uvec>& idx,
+				const std::vector<arma::Mat<short> >& snips);
+		void appendSnips(const std::string& type, arma::uword channel,
+				const arma::uvec& idx, const arma::Mat<short>& snips);
+		size_t channelIndex(arma::uword channel);
 		void writeAttributes();
 		void readAttributes();
 		void writeFileStringAttr(const std::string& name, const std::string& value);
@@ -252,6 +409,29 @@ class SnipFile {
 				std::vector<arma::Mat<short> >& snips);
 		void snips(const std::string& type, arma::uword channel, arma::uvec& idx,
 				arma::Mat<short>& snips);
+		void snips(const std::string& type, std::vector<arma::uvec>& idx,
+				std::vector<arma::Mat<short> >& snips, datafile::ThreadPool& pool);
+
+		/* Open the index and snippet datasets holding a channel's snippets,
+		 * and find the rows [begin, end) of them which are the channel's.
+		 * Returns false if the channel has no snippets of the given type.
+		 */
+		bool openSnipRows(const std::string& type, arma::uword channel,
+				H5::DataSet& idxSet, H5::DataSet& snipSet, hsize_t& begin, hsize_t& end);
+
+		/* Return the first of rows [begin, end) of a channel's snippets
+		 * whose index is at least `sample`, or `end` if there is none.
+		 */
+		hsize_t lowerBound(const std::vector<uint64_t>& coarse, const H5::DataSet& idxSet,
+				hsize_t begin, hsize_t end, uint64_t sample);
+		void snips(const std::string& type, arma::uword channel, uint64_t startSample,
+				uint64_t endSample, arma::uvec& idx, arma::Mat<short>& snips);
+
+		/* Read snippets of the channels at positions [first, last) from the
+		 * columnar table of the given type.
+		 */
+		void columnarSnips(const std::string& type, size_t first, size_t last,
+				std::vector<arma::uvec>& idx, std::vector<arma::Mat<short> >& snips);
 };
 };
 
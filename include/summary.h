@@ -0,0 +1,179 @@
+/*! \file summary.h
+ *
+ * Multi-resolution summaries of raw data, stored alongside it, which
+ * allow zoomed-out views of a recording without reading every sample.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _SUMMARY_H_
+#define _SUMMARY_H_
+
+#include "H5Cpp.h"
+#include <armadillo>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace datafile {
+
+/*! Name of the group holding the summary levels of a recording */
+const std::string SummaryGroup = "summary";
+
+/*! Decimation factors of the summary levels built by DataFile::buildSummary() */
+const std::vector<int> DefaultSummaryFactors = { 10, 100, 1000, 10000 };
+
+/*! Number of statistics stored for each bin: min, max, mean, and RMS */
+const int SummaryStatistics = 4;
+
+/*! The Summary struct holds min/max/mean/RMS envelopes of a block of data,
+ * as returned by DataFile::summary().
+ *
+ * Each matrix has shape (npixels, nchannels), like the matrices returned by
+ * DataFile::data(), and values are in the raw units of the file. Scale them
+ * by DataFile::gain() for voltages.
+ */
+struct Summary {
+	int factor;			// Samples per bin of the level used, 1 for raw data
+	arma::fmat min;
+	arma::fmat max;
+	arma::fmat mean;
+	arma::fmat rms;
+};
+
+/*! The SummaryPyramid class maintains the summary levels of a recording.
+ *
+ * Each level divides the data into bins of a fixed number of samples, and
+ * stores the min, max, mean and RMS of every channel in each bin. Levels are
+ * stored in the file as datasets named by their factor, in the "summary"
+ * group, with shape (SummaryStatistics, nchannels, nbins).
+ *
+ * Samples are appended in order. The finest level is computed from the
+ * samples, and each coarser level from the bins of the level below it,
+ * so each factor must divide the next. Only completed bins are stored;
+ * samples of an incomplete bin are held in memory until it fills.
+ *
+ * This class is used by DataFile, which keeps its summary up to date as
+ * data is written. It is not normally needed directly.
+ */
+class SummaryPyramid {
+
+	public:
+
+		/*! Create empty summary levels in the given file, replacing any
+		 * that exist.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the factors are invalid.
+		 */
+		SummaryPyramid(H5::H5File& file, int nchannels, const std::vector<int>& factors);
+
+		/*! Open the existing summary levels of the given file.
+		 *
+		 * Exceptions:
+		 * This throws a std::invalid_argument if the file has no summary.
+		 */
+		SummaryPyramid(H5::H5File& file);
+
+		/*! Return true if the file contains summary levels */
+		static bool exists(H5::H5File& file);
+
+		/*! Throw a std::invalid_argument unless the factors are positive,
+		 * strictly increasing, and each divides the next.
+		 */
+		static void validate(const std::vector<int>& factors);
+
+		/*! Return the decimation factor of each level, finest first */
+		const std::vector<int>& factors() const;
+
+		/*! Return the number of samples appended so far */
+		uint64_t samples() const;
+
+		/*! Return the number of bins of the given level stored in the file */
+		uint64_t bins(size_t level) const;
+
+		/*! Discard everything from the start of the coarsest bin containing
+		 * the given sample onwards, and return the number of samples kept.
+		 * Samples from that point must be appended again.
+		 */
+		uint64_t rewind(uint64_t sample);
+
+		/*! Append samples from all channels.
+		 * \param data The first sample of the first channel.
+		 * \param nsamples The number of samples from each channel.
+		 * \param nchannels The number of channels.
+		 * \param stride The distance between the first samples of successive
+		 * channels, which is nsamples for a whole Armadillo matrix.
+		 *
+		 * Completed bins are held in memory until write() is called.
+		 */
+		template<class T>
+		void append(const T* data, size_t nsamples, size_t nchannels, size_t stride)
+		{
+			if (!m_aligned) {
+				rewind(m_samples);
+			}
+			for (size_t c = 0; c < nchannels; c++) {
+				auto column = data + c * stride;
+				auto& acc = m_accumulators[0][c];
+				for (size_t i = 0; i < nsamples; i++) {
+					acc.add(static_cast<double>(column[i]));
+					if (acc.count == static_cast<uint64_t>(m_factors[0])) {
+						completeBin(0, c);
+					}
+				}
+			}
+			m_samples += nsamples;
+		}
+
+		/*! Write all completed bins to the file */
+		void write();
+
+		/*! Read bins [startBin, endBin) of channels [startChan, endChan) of
+		 * one level into `bins`, in the file's order. Statistic s of channel c
+		 * in bin b is at index (s * nchannels + c) * nbins + b.
+		 */
+		void read(size_t level, int startChan, int endChan,
+				uint64_t startBin, uint64_t endBin, std::vector<float>& bins) const;
+
+		/*! Running statistics of a set of samples */
+		struct Accumulator {
+			Accumulator();
+			void reset();
+			void add(double value);
+			void add(const Accumulator& other);
+			void addBin(float min, float max, float mean, float rms, uint64_t count);
+			uint64_t count;
+			double min, max, sum, sumsq;
+		};
+
+	private:
+
+		/* Store the bin of channel c at the given level, and feed it to the
+		 * next level.
+		 */
+		void completeBin(size_t level, size_t channel);
+
+		H5::H5File& m_file;
+		H5::Group m_group;
+		std::vector<H5::DataSet> m_datasets;	// One per level
+		std::vector<int> m_factors;
+		uint64_t m_samples;						// Samples appended
+		bool m_aligned;							// All levels end at m_samples
+		std::vector<uint64_t> m_bins;			// Bins of each level in the file
+
+		/* Statistics of the incomplete bin of each level and channel */
+		std::vector<std::vector<Accumulator> > m_accumulators;
+
+		/* Completed bins not yet written, for each level and channel,
+		 * as successive (min, max, mean, rms) values.
+		 */
+		std::vector<std::vector<std::vector<float> > > m_completed;
+
+}; // end SummaryPyramid class
+
+}; // end datafile namespace
+
+#endif
+
@@ -0,0 +1,115 @@
+/*! \file threadpool.h
+ *
+ * A fixed-size pool of worker threads running queued tasks.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace datafile {
+
+/*! The ThreadPool class runs tasks on a fixed set of worker threads.
+ *
+ * Tasks are run in the order in which they are submitted. Each call to
+ * submit() returns a std::future, through which the caller can wait for
+ * the task's result or any exception it threw.
+ */
+class ThreadPool {
+
+	public:
+
+		/*! Start a pool of worker threads.
+		 * \param nthreads The number of threads. If 0, one thread is
+		 * started for each hardware thread.
+		 */
+		explicit ThreadPool(size_t nthreads = 0);
+		ThreadPool(const ThreadPool& other) = delete;
+		ThreadPool& operator=(const ThreadPool& other) = delete;
+
+		/*! Run all tasks already submitted, then stop the worker threads. */
+		~ThreadPool();
+
+		/*! Return the number of worker threads. */
+		size_t size() const;
+
+		/*! Queue a task to run on a worker thread.
+		 * \param task A callable taking no arguments.
+		 * \return A future holding the task's result.
+		 */
+		template<class Function>
+		std::future<typename std::result_of<Function()>::type> submit(Function task)
+		{
+			using Result = typename std::result_of<Function()>::type;
+			auto packaged = std::make_shared<std::packaged_task<Result()> >(task);
+			auto future = packaged->get_future();
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				m_tasks.push([packaged]() { (*packaged)(); });
+			}
+			m_ready.notify_one();
+			return future;
+		}
+
+	private:
+
+		/* Body of each worker thread */
+		void run();
+
+		std::vector<std::thread> m_threads;
+		std::queue<std::function<void()> > m_tasks;
+		std::mutex m_lock;
+		std::condition_variable m_ready;
+		bool m_stop;
+
+}; // end ThreadPool class
+
+/*! Wait for every task in a set of futures, then return their results.
+ *
+ * Tasks often refer to the caller's data, so all of them are finished
+ * before the first failure, if any, is rethrown.
+ * \param futures The futures returned by ThreadPool::submit().
+ * \return The results of the tasks, in order.
+ */
+template<class T>
+std::vector<T> waitAll(std::vector<std::future<T> >& futures)
+{
+	for (auto& future : futures) {
+		future.wait();
+	}
+	std::vector<T> results;
+	results.reserve(futures.size());
+	for (auto& future : futures) {
+		results.push_back(future.get());
+	}
+	return results;
+}
+
+/*! Wait for every task in a set of futures returning no value.
+ * \param futures The futures returned by ThreadPool::submit().
+ */
+inline void waitAll(std::vector<std::future<void> >& futures)
+{
+	for (auto& future : futures) {
+		future.wait();
+	}
+	for (auto& future : futures) {
+		future.get();
+	}
+}
+
+}; // end datafile namespace
+
+#endif
+
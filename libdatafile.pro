@@ -4,12 +4,12 @@
 
 TEMPLATE = lib
 TARGET = datafile
-VERSION = 0.6.1
+VERSION = 0.7.0
 
 DESTDIR = lib
 OBJECTS_DIR = build
 QT -= gui
-CONFIG += c++11 debug_and_release shared
+CONFIG += c++11 debug_and_release shared thread
 QMAKE_CXXFLAGS += -std=c++11
 
 INCLUDEPATH += . include \
@@ -28,14 +28,45 @@ linux {
 	INCLUDEPATH += /usr/include/hdf5/serial
 	LIBS += -L/usr/lib/x86_64-linux-gnu/hdf5/serial
 }
-LIBS += -lhdf5_cpp -lhdf5 -larmadillo
+LIBS += -lhdf5_cpp -lhdf5 -larmadillo -lz
 
 # Input
 HEADERS += include/datafile.h \
 			include/hidensfile.h \
 			include/snipfile.h \
-			include/hidenssnipfile.h
+			include/hidenssnipfile.h \
+			include/asyncwriter.h \
+			include/mappeddatafile.h \
+			include/conversion.h \
+			include/threadpool.h \
+			include/readerpool.h \
+			include/readplan.h \
+			include/blockiterator.h \
+			include/summary.h \
+			include/channelstats.h \
+			include/chunkreader.h \
+			include/extractor.h \
+			include/noisesampler.h \
+			include/filter.h \
+			include/rechunk.h \
+			include/recordingset.h \
+			include/iostats.h
 SOURCES += src/datafile.cc \
 			src/hidensfile.cc \
 			src/snipfile.cc \
-			src/hidenssnipfile.cc
+			src/hidenssnipfile.cc \
+			src/asyncwriter.cc \
+			src/mappeddatafile.cc \
+			src/conversion.cc \
+			src/threadpool.cc \
+			src/readerpool.cc \
+			src/readplan.cc \
+			src/summary.cc \
+			src/channelstats.cc \
+			src/chunkreader.cc \
+			src/extractor.cc \
+			src/noisesampler.cc \
+			src/filter.cc \
+			src/rechunk.cc \
+			src/recordingset.cc \
+			src/iostats.cc
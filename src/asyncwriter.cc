@@ -0,0 +1,317 @@
+/* asyncwriter.cc
+ *
+ * Implementation of the asynchronous, double-buffered DataFile writer.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "asyncwriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace datafile {
+
+/* Period at which waiting threads re-check the ring, in case a
+ * notification raced with the wait.
+ */
+static const std::chrono::milliseconds RingPollInterval(10);
+
+/* Return the number of samples in each buffer of the ring. This is one
+ * chunk of samples, or, if that would exceed AsyncWriterBufferBytes, the
+ * largest divisor of the chunk length which fits, so that writes never
+ * straddle a chunk boundary. If the only divisors that fit are much smaller
+ * than the limit, as for a prime chunk length, the limit is used instead,
+ * and writes may then straddle chunk boundaries.
+ */
+static size_t slotSamples(size_t chunkSamples, size_t nchannels)
+{
+	auto limit = std::max(AsyncWriterBufferBytes / (nchannels * sizeof(int16_t)),
+			static_cast<size_t>(1));
+	if (chunkSamples <= limit) {
+		return chunkSamples;
+	}
+	for (auto n = limit; n >= limit / 2 && n > 0; n--) {
+		if (chunkSamples % n == 0) {
+			return n;
+		}
+	}
+	return limit;
+}
+
+DataFile::AsyncWriter::AsyncWriter(DataFile& file, size_t nbuffers,
+		OverflowPolicy policy)
+	: m_file(file),
+	  m_policy(policy),
+	  m_head(0),
+	  m_tail(0),
+	  m_slotOpen(false),
+	  m_position(static_cast<uint64_t>(file.nsamples())),
+	  m_stop(false),
+	  m_failed(false),
+	  m_blocksAppended(0),
+	  m_samplesAppended(0),
+	  m_samplesWritten(0),
+	  m_samplesDropped(0),
+	  m_writes(0),
+	  m_stalls(0),
+	  m_highWater(0)
+{
+	if (m_file.readOnly()) {
+		throw std::logic_error("Cannot write to DataFile marked read-only.");
+	}
+	if (nbuffers < 2) {
+		throw std::logic_error("AsyncWriter requires at least 2 buffers, " +
+				std::to_string(nbuffers) + " requested");
+	}
+
+	m_slotSamples = slotSamples(static_cast<size_t>(m_file.options().chunkSamples),
+			static_cast<size_t>(m_file.nchannels()));
+
+	m_slots.resize(nbuffers);
+	for (auto& slot : m_slots) {
+		slot.buffer.set_size(m_slotSamples, m_file.nchannels());
+		slot.start = 0;
+		slot.begin = 0;
+		slot.end = 0;
+	}
+
+	m_thread = std::thread(&DataFile::AsyncWriter::run, this);
+}
+
+DataFile::AsyncWriter::~AsyncWriter()
+{
+	try {
+		if (!m_failed.load()) {
+			drain();
+		}
+	} catch (std::exception& e) {
+		std::cerr << "Error writing buffered data to " << m_file.filename()
+				<< ": " << e.what() << std::endl;
+	}
+	m_stop.store(true);
+	m_dataReady.notify_all();
+	m_thread.join();
+	try {
+		if (!m_failed.load()) {
+			m_file.flush();
+		}
+	} catch (std::exception& e) {
+		std::cerr << "Error flushing HDF5 file: " << m_file.filename()
+				<< ": " << e.what() << std::endl;
+	} catch (H5::Exception& e) {
+		std::cerr << "Error flushing HDF5 file: " << m_file.filename()
+				<< ": " << e.getDetailMsg() << std::endl;
+	}
+}
+
+bool DataFile::AsyncWriter::append(const arma::Mat<int16_t>& block)
+{
+	rethrow();
+	if (static_cast<int>(block.n_cols) != m_file.nchannels()) {
+		throw std::logic_error("Block has " + std::to_string(block.n_cols) +
+				" channels, file has " + std::to_string(m_file.nchannels()));
+	}
+	m_blocksAppended.fetch_add(1, std::memory_order_relaxed);
+	m_samplesAppended.fetch_add(block.n_rows, std::memory_order_relaxed);
+
+	size_t done = 0;
+	while (done < block.n_rows) {
+
+		/* Find room for the next sample, if there is any. */
+		if (!acquire()) {
+			m_stalls.fetch_add(1, std::memory_order_relaxed);
+			if (m_policy == OverflowPolicy::Drop) {
+				auto remaining = block.n_rows - done;
+				m_samplesDropped.fetch_add(remaining, std::memory_order_relaxed);
+				m_position += remaining;
+				return false;
+			}
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (!acquire()) {
+				m_spaceReady.wait_for(lock, RingPollInterval);
+				rethrow();
+			}
+		}
+
+		/* Copy as many samples as fit in the current chunk, one channel
+		 * (column) at a time.
+		 */
+		auto& slot = m_slots[m_head.load(std::memory_order_relaxed) % m_slots.size()];
+		auto offset = static_cast<size_t>(m_position - slot.start);
+		auto n = std::min(m_slotSamples - offset, static_cast<size_t>(block.n_rows - done));
+		for (arma::uword c = 0; c < block.n_cols; c++) {
+			std::memcpy(slot.buffer.colptr(c) + offset, block.colptr(c) + done,
+					n * sizeof(int16_t));
+		}
+		slot.end = offset + n;
+		m_position += n;
+		done += n;
+		if (slot.end == m_slotSamples) {
+			publish();
+		}
+	}
+	return true;
+}
+
+bool DataFile::AsyncWriter::acquire()
+{
+	if (m_slotOpen) {
+		return true;
+	}
+	auto head = m_head.load(std::memory_order_relaxed);
+	if (head - m_tail.load(std::memory_order_acquire) >= m_slots.size()) {
+		return false;
+	}
+
+	/* Start a new slot in the chunk containing the current position. */
+	auto& slot = m_slots[head % m_slots.size()];
+	slot.start = m_position - (m_position % m_slotSamples);
+	slot.begin = static_cast<size_t>(m_position - slot.start);
+	slot.end = slot.begin;
+	m_slotOpen = true;
+	return true;
+}
+
+void DataFile::AsyncWriter::publish()
+{
+	if (!m_slotOpen) {
+		return;
+	}
+	m_slotOpen = false;
+	auto head = m_head.load(std::memory_order_relaxed) + 1;
+	m_head.store(head, std::memory_order_release);
+
+	auto pending = static_cast<size_t>(head - m_tail.load(std::memory_order_acquire));
+	auto high = m_highWater.load(std::memory_order_relaxed);
+	if (pending > high) {
+		m_highWater.store(pending, std::memory_order_relaxed);
+	}
+	m_dataReady.notify_one();
+}
+
+void DataFile::AsyncWriter::drain()
+{
+	if (m_slotOpen) {
+		auto& slot = m_slots[m_head.load(std::memory_order_relaxed) % m_slots.size()];
+		if (slot.end > slot.begin) {
+			publish();
+		} else {
+			m_slotOpen = false;
+		}
+	}
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_tail.load(std::memory_order_acquire) !=
+			m_head.load(std::memory_order_relaxed)) {
+		if (m_failed.load()) {
+			break;
+		}
+		m_spaceReady.wait_for(lock, RingPollInterval);
+	}
+	lock.unlock();
+	rethrow();
+}
+
+void DataFile::AsyncWriter::flush()
+{
+	drain();
+	m_file.flush();
+}
+
+void DataFile::AsyncWriter::rethrow()
+{
+	if (m_failed.load()) {
+		std::rethrow_exception(m_error);
+	}
+}
+
+void DataFile::AsyncWriter::run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+	while (true) {
+		auto tail = m_tail.load(std::memory_order_relaxed);
+		if (tail == m_head.load(std::memory_order_acquire)) {
+			if (m_stop.load()) {
+				return;
+			}
+			lock.lock();
+			m_dataReady.wait_for(lock, RingPollInterval);
+			lock.unlock();
+			continue;
+		}
+
+		try {
+			writeSlot(m_slots[tail % m_slots.size()]);
+		} catch ( ... ) {
+			m_error = std::current_exception();
+			m_failed.store(true);
+			m_spaceReady.notify_all();
+			return;
+		}
+		m_tail.store(tail + 1, std::memory_order_release);
+		m_spaceReady.notify_one();
+	}
+}
+
+void DataFile::AsyncWriter::writeSlot(const Slot& slot)
+{
+	auto startSample = static_cast<int64_t>(slot.start + slot.begin);
+	auto endSample = static_cast<int64_t>(slot.start + slot.end);
+	HDF5Gate gate;
+	m_file.verifyWriteRequest(startSample, endSample);
+	m_file.setupWrite(startSample, endSample);
+
+	/* Select only the filled part of the buffer, so that no copy is needed. */
+	hsize_t dims[DatasetRank] = {
+			static_cast<hsize_t>(m_file.nchannels()),
+			static_cast<hsize_t>(m_slotSamples)
+		};
+	hsize_t offset[DatasetRank] = { 0, static_cast<hsize_t>(slot.begin) };
+	hsize_t count[DatasetRank] = {
+			static_cast<hsize_t>(m_file.nchannels()),
+			static_cast<hsize_t>(slot.end - slot.begin)
+		};
+	H5::DataSpace memspace(DatasetRank, dims);
+	memspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+	{
+		IOTimer timer(m_file.m_ioCounters, IOOperation::Write,
+				count[0] * count[1] * sizeof(int16_t));
+		m_file.m_dataset.write(slot.buffer.memptr(), dtypeForMat(slot.buffer),
+				memspace, m_file.m_dataspace);
+	}
+	m_file.recordWrite(startSample, endSample, 
+			slot.buffer.memptr() + slot.begin, m_slotSamples);
+
+	m_writes.fetch_add(1, std::memory_order_relaxed);
+	m_samplesWritten.fetch_add(slot.end - slot.begin, std::memory_order_relaxed);
+}
+
+uint64_t DataFile::AsyncWriter::position() const
+{
+	return m_position;
+}
+
+size_t DataFile::AsyncWriter::pending() const
+{
+	return static_cast<size_t>(m_head.load(std::memory_order_acquire) -
+			m_tail.load(std::memory_order_acquire));
+}
+
+DataFile::AsyncWriter::Counters DataFile::AsyncWriter::counters() const
+{
+	Counters c;
+	c.blocksAppended = m_blocksAppended.load();
+	c.samplesAppended = m_samplesAppended.load();
+	c.samplesWritten = m_samplesWritten.load();
+	c.samplesDropped = m_samplesDropped.load();
+	c.writes = m_writes.load();
+	c.stalls = m_stalls.load();
+	c.highWater = m_highWater.load();
+	c.capacity = m_slots.size();
+	return c;
+}
+
+} // end datafile namespace
+
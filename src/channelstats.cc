@@ -0,0 +1,61 @@
+/* channelstats.cc
+ *
+ * Implementation of streaming per-channel statistics.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "channelstats.h"
+
+#include <cmath>
+
+namespace datafile {
+
+ChannelStats::ChannelStats()
+	: count(0),
+	  complete(true)
+{
+}
+
+arma::vec ChannelStats::variance() const
+{
+	if (count < 2) {
+		return arma::vec(mean.n_elem, arma::fill::zeros);
+	}
+	return m2 / static_cast<double>(count - 1);
+}
+
+arma::vec ChannelStats::stddev() const
+{
+	return arma::sqrt(variance());
+}
+
+void ChannelStats::reset(size_t nchannels)
+{
+	count = 0;
+	complete = true;
+	mean.zeros(nchannels);
+	m2.zeros(nchannels);
+	min.set_size(nchannels);
+	min.fill(std::numeric_limits<double>::infinity());
+	max.set_size(nchannels);
+	max.fill(-std::numeric_limits<double>::infinity());
+	clipLow.zeros(nchannels);
+	clipHigh.zeros(nchannels);
+}
+
+void ChannelStats::merge(size_t channel, uint64_t n, double blockMean, double blockM2,
+		double blockMin, double blockMax, uint64_t low, uint64_t high)
+{
+	auto total = static_cast<double>(count + n);
+	auto delta = blockMean - mean(channel);
+	mean(channel) += delta * n / total;
+	m2(channel) += blockM2 + delta * delta * (static_cast<double>(count) * n / total);
+	min(channel) = std::min(min(channel), blockMin);
+	max(channel) = std::max(max(channel), blockMax);
+	clipLow(channel) += low;
+	clipHigh(channel) += high;
+}
+
+} // end datafile namespace
+
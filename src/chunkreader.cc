@@ -0,0 +1,152 @@
+/* chunkreader.cc
+ *
+ * Implementation of direct reads of stored chunks, decoded outside of HDF5.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "chunkreader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <zlib.h>
+
+namespace datafile {
+
+DirectChunkReader::DirectChunkReader(const H5::DataSet& dataset, 
+		const H5::DataType& memtype)
+	: m_dataset(dataset.getId()),
+	  m_supported(false),
+	  m_elementSize(memtype.getSize()),
+	  m_dims{ 0, 1 },
+	  m_chunkDims{ 1, 1 }
+{
+	auto space = dataset.getSpace();
+	auto rank = space.getSimpleExtentNdims();
+	if ( (rank < 1) || (rank > 2) ) {
+		return;
+	}
+	space.getSimpleExtentDims(m_dims);
+
+	auto props = dataset.getCreatePlist();
+	if (props.getLayout() != H5D_CHUNKED) {
+		return;
+	}
+	props.getChunk(rank, m_chunkDims);
+	if (!(dataset.getDataType() == memtype)) {
+		return;
+	}
+	for (int i = 0; i < props.getNfilters(); i++) {
+		unsigned int flags = 0, config = 0;
+		size_t nvalues = 0;
+		char name[1] = { 0 };
+		auto filter = props.getFilter(i, flags, nvalues, nullptr, sizeof(name), name, config);
+		if ( (filter != H5Z_FILTER_SHUFFLE) && (filter != H5Z_FILTER_DEFLATE) ) {
+			return;
+		}
+		m_filters.push_back(filter);
+	}
+	m_supported = true;
+}
+
+bool DirectChunkReader::supported() const
+{
+	return m_supported;
+}
+
+size_t DirectChunkReader::size() const
+{
+	return m_dims[0] * m_dims[1];
+}
+
+void DirectChunkReader::fetch()
+{
+	m_chunks.clear();
+	for (hsize_t row = 0; row < m_dims[0]; row += m_chunkDims[0]) {
+		for (hsize_t col = 0; col < m_dims[1]; col += m_chunkDims[1]) {
+			Chunk chunk = { { row, col }, 0, {} };
+			hsize_t nbytes = 0;
+			if (H5Dget_chunk_storage_size(m_dataset, chunk.offset, &nbytes) < 0) {
+				throw std::runtime_error("Could not find the size of a stored chunk");
+			}
+			if (nbytes == 0) {
+				continue;		// Never written, so decoded as zeros
+			}
+			chunk.bytes.resize(nbytes);
+			if (H5Dread_chunk(m_dataset, H5P_DEFAULT, chunk.offset, 
+					&chunk.filterMask, chunk.bytes.data()) < 0) {
+				throw std::runtime_error("Could not read a stored chunk");
+			}
+			m_chunks.push_back(std::move(chunk));
+		}
+	}
+}
+
+const std::vector<unsigned char>& DirectChunkReader::decodeChunk(Chunk& chunk,
+		std::vector<unsigned char>& scratch) const
+{
+	auto chunkBytes = m_chunkDims[0] * m_chunkDims[1] * m_elementSize;
+	auto* current = &chunk.bytes;
+	auto* other = &scratch;
+
+	/* Filters are undone in the reverse of the order they were applied */
+	for (auto i = m_filters.size(); i-- > 0; ) {
+		if (chunk.filterMask & (1u << i)) {
+			continue;
+		}
+		other->resize(chunkBytes);
+		if (m_filters[i] == H5Z_FILTER_DEFLATE) {
+			uLongf length = chunkBytes;
+			if ( (uncompress(other->data(), &length, current->data(), current->size()) != Z_OK) ||
+					(length != chunkBytes) ) {
+				throw std::runtime_error("Could not inflate a stored chunk");
+			}
+		} else {
+			/* The shuffle filter stores byte b of every element together.
+			 * Any trailing bytes which do not form a whole element are
+			 * stored unchanged.
+			 */
+			if (current->size() != chunkBytes) {
+				throw std::runtime_error("Shuffled chunk has the wrong size");
+			}
+			auto n = chunkBytes / m_elementSize;
+			for (size_t b = 0; b < m_elementSize; b++) {
+				auto src = current->data() + b * n;
+				for (size_t e = 0; e < n; e++) {
+					(*other)[e * m_elementSize + b] = src[e];
+				}
+			}
+			std::copy(current->begin() + n * m_elementSize, current->end(),
+					other->begin() + n * m_elementSize);
+		}
+		std::swap(current, other);
+	}
+	if (current->size() != chunkBytes) {
+		throw std::runtime_error("Decoded chunk has the wrong size");
+	}
+	return *current;
+}
+
+void DirectChunkReader::decode(void* buf)
+{
+	auto out = static_cast<unsigned char*>(buf);
+	std::memset(out, 0, size() * m_elementSize);
+	std::vector<unsigned char> scratch;
+	for (auto& chunk : m_chunks) {
+		auto& bytes = decodeChunk(chunk, scratch);
+
+		/* Copy the part of each row of the chunk inside the dataset */
+		auto rows = std::min(m_chunkDims[0], m_dims[0] - chunk.offset[0]);
+		auto rowBytes = std::min(m_chunkDims[1], m_dims[1] - chunk.offset[1]) * m_elementSize;
+		for (hsize_t r = 0; r < rows; r++) {
+			std::memcpy(out + ((chunk.offset[0] + r) * m_dims[1] + chunk.offset[1]) * m_elementSize,
+					bytes.data() + r * m_chunkDims[1] * m_elementSize, rowBytes);
+		}
+	}
+	m_chunks.clear();
+}
+
+} // end datafile namespace
+
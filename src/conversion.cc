@@ -0,0 +1,151 @@
+/* conversion.cc
+ *
+ * Implementation of the kernels converting raw samples to voltages.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "conversion.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace datafile {
+
+/* Number of samples converted by each call to scaleBlock() */
+static const size_t BlockLanes = 8;
+
+/* Convert BlockLanes samples. All samples are loaded before any are
+ * stored, so the destination may overlap the source as long as it
+ * starts at or after it, as happens when widening in place.
+ */
+static inline void scaleBlock(const int16_t* src, float* dst, float gain, float offset)
+{
+#if defined(__AVX2__)
+	auto raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+	auto values = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(raw));
+	values = _mm256_add_ps(_mm256_mul_ps(values, _mm256_set1_ps(gain)),
+			_mm256_set1_ps(offset));
+	_mm256_storeu_ps(dst, values);
+#elif defined(__SSE2__)
+	auto raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+	auto g = _mm_set1_ps(gain);
+	auto o = _mm_set1_ps(offset);
+	/* Sign-extend each half to 32 bits by unpacking and shifting back */
+	auto lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16));
+	auto hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(raw, raw), 16));
+	_mm_storeu_ps(dst, _mm_add_ps(_mm_mul_ps(lo, g), o));
+	_mm_storeu_ps(dst + 4, _mm_add_ps(_mm_mul_ps(hi, g), o));
+#else
+	int16_t raw[BlockLanes];
+	std::memcpy(raw, src, sizeof(raw));
+	float values[BlockLanes];
+	for (size_t i = 0; i < BlockLanes; i++)
+		values[i] = gain * raw[i] + offset;
+	std::memcpy(dst, values, sizeof(values));
+#endif
+}
+
+static inline void scaleBlock(const int16_t* src, double* dst, double gain, double offset)
+{
+#if defined(__AVX2__)
+	auto raw = _mm256_cvtepi16_epi32(
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+	auto g = _mm256_set1_pd(gain);
+	auto o = _mm256_set1_pd(offset);
+	auto lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(raw));
+	auto hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(raw, 1));
+	_mm256_storeu_pd(dst, _mm256_add_pd(_mm256_mul_pd(lo, g), o));
+	_mm256_storeu_pd(dst + 4, _mm256_add_pd(_mm256_mul_pd(hi, g), o));
+#elif defined(__SSE2__)
+	auto raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+	auto g = _mm_set1_pd(gain);
+	auto o = _mm_set1_pd(offset);
+	auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16);
+	auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(raw, raw), 16);
+	/* Each conversion to double consumes the low two 32-bit lanes */
+	__m128d values[4] = {
+		_mm_cvtepi32_pd(lo),
+		_mm_cvtepi32_pd(_mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2))),
+		_mm_cvtepi32_pd(hi),
+		_mm_cvtepi32_pd(_mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)))
+	};
+	for (int i = 0; i < 4; i++)
+		_mm_storeu_pd(dst + 2 * i, _mm_add_pd(_mm_mul_pd(values[i], g), o));
+#else
+	int16_t raw[BlockLanes];
+	std::memcpy(raw, src, sizeof(raw));
+	double values[BlockLanes];
+	for (size_t i = 0; i < BlockLanes; i++)
+		values[i] = gain * raw[i] + offset;
+	std::memcpy(dst, values, sizeof(values));
+#endif
+}
+
+/* Convert a single sample. This goes through memcpy so that the
+ * compiler cannot reorder it with respect to overlapping neighbours.
+ */
+template<class T>
+static inline void scaleOne(const int16_t* src, T* dst, T gain, T offset)
+{
+	int16_t raw;
+	std::memcpy(&raw, src, sizeof(raw));
+	T value = gain * raw + offset;
+	std::memcpy(dst, &value, sizeof(value));
+}
+
+template<class T>
+static void scaleForward(const int16_t* src, T* dst, size_t n, T gain, T offset)
+{
+	size_t i = 0;
+	for (; i + BlockLanes <= n; i += BlockLanes)
+		scaleBlock(src + i, dst + i, gain, offset);
+	for (; i < n; i++)
+		scaleOne(src + i, dst + i, gain, offset);
+}
+
+/* The i-th output occupies the bytes of raw samples at and after i,
+ * so working from the end backwards never overwrites an unread sample.
+ */
+template<class T>
+static void scaleBackward(T* buf, size_t n, T gain, T offset)
+{
+	auto src = reinterpret_cast<const int16_t*>(buf);
+	size_t i = n;
+	for (; i >= BlockLanes; i -= BlockLanes)
+		scaleBlock(src + i - BlockLanes, buf + i - BlockLanes, gain, offset);
+	while (i > 0) {
+		i--;
+		scaleOne(src + i, buf + i, gain, offset);
+	}
+}
+
+void scaleSamples(const int16_t* src, float* dst, size_t n,
+		float gain, float offset)
+{
+	scaleForward(src, dst, n, gain, offset);
+}
+
+void scaleSamples(const int16_t* src, double* dst, size_t n,
+		double gain, double offset)
+{
+	scaleForward(src, dst, n, gain, offset);
+}
+
+void scaleSamplesInPlace(float* buf, size_t n, float gain, float offset)
+{
+	scaleBackward(buf, n, gain, offset);
+}
+
+void scaleSamplesInPlace(double* buf, size_t n, double gain, double offset)
+{
+	scaleBackward(buf, n, gain, offset);
+}
+
+} // end datafile namespace
+
@@ -5,24 +5,203 @@
 
 #include <sys/stat.h>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 #include <ctime>
+#include <limits>
+#include <mutex>
+#include <thread>
 
 #include "datafile.h"
 
 namespace datafile {
 
+/* Bytes of data in each chunk of a recommended chunk shape */
+static const size_t RecommendedChunkBytes = 1 << 19;
+
+/* Minimum number of slots in the chunk cache's hash table. This is the
+ * HDF5 library's default.
+ */
+static const size_t MinChunkCacheSlots = 521;
+
+/* Rows of the "channel-stats" attribute: mean, M2, min and max */
+static const hsize_t ChannelStatsRows = 4;
+
+/* Rows of the "channel-clip-counts" attribute: low and high */
+static const hsize_t ChannelClipRows = 2;
+
+/* The gate serializing HDF5 calls. It is created on first use, so that it
+ * exists before any static object using the library.
+ */
+static std::recursive_mutex& hdf5Mutex()
+{
+	static std::recursive_mutex mutex;
+	return mutex;
+}
+
+bool HDF5Gate::libraryThreadSafe()
+{
+	static const bool threadSafe = []() {
+		hbool_t safe = false;
+		H5is_library_threadsafe(&safe);
+		return safe > 0;
+	}();
+	return threadSafe;
+}
+
+HDF5Gate::HDF5Gate()
+	: m_locked(!libraryThreadSafe())
+{
+	if (m_locked) {
+		hdf5Mutex().lock();
+	}
+}
+
+HDF5Gate::~HDF5Gate()
+{
+	if (m_locked) {
+		hdf5Mutex().unlock();
+	}
+}
+
+DataFileOptions::DataFileOptions()
+	: chunkChannels(DatasetChunkDims[0]),
+	  chunkSamples(DatasetChunkDims[1]),
+	  chunkCacheBytes(0),
+	  chunkCacheSlots(0),
+	  chunkCacheW0(ChunkCacheW0),
+	  metadataCacheBytes(0),
+	  shuffle(false),
+	  deflate(0),
+	  filter(0),
+	  swmr(false),
+	  ioStats(false)
+{
+}
+
+DataFileOptions recommendOptions(AccessPattern pattern, hsize_t nchannels)
+{
+	DataFileOptions options;
+	auto samplesPerChunk = [](hsize_t channels) -> hsize_t {
+		return RecommendedChunkBytes / (channels * sizeof(int16_t));
+	};
+	switch (pattern) {
+		case AccessPattern::ChannelScan:
+			options.chunkChannels = 1;
+			break;
+		case AccessPattern::TimeWindow:
+			options.chunkChannels = std::min(nchannels, 
+					static_cast<hsize_t>(MaxNumChannels));
+			break;
+		case AccessPattern::Mixed:
+			options.chunkChannels = std::min(nchannels, static_cast<hsize_t>(16));
+			break;
+	}
+	options.chunkChannels = std::max(options.chunkChannels, static_cast<hsize_t>(1));
+	options.chunkSamples = samplesPerChunk(options.chunkChannels);
+	return options;
+}
+
+static bool isPrime(size_t n)
+{
+	if (n < 2) {
+		return false;
+	}
+	for (size_t i = 2; i * i <= n; i++) {
+		if (n % i == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void DataFile::resolveCacheOptions()
+{
+	size_t chunkBytes = std::max(static_cast<size_t>(m_options.chunkChannels * 
+			m_options.chunkSamples * m_datatype.getSize()), static_cast<size_t>(1));
+	if (m_options.chunkCacheBytes == 0) {
+		m_options.chunkCacheBytes = ChunkCacheSize * chunkBytes;
+	}
+
+	/* The HDF5 documentation recommends a prime number of slots, 
+	 * about 100 times the number of chunks that fit in the cache.
+	 */
+	if (m_options.chunkCacheSlots == 0) {
+		auto nchunks = std::max(m_options.chunkCacheBytes / chunkBytes,
+				static_cast<size_t>(1));
+		auto slots = std::max(100 * nchunks, MinChunkCacheSlots);
+		while (!isPrime(slots)) {
+			slots++;
+		}
+		m_options.chunkCacheSlots = slots;
+	}
+}
+
+H5::FileAccPropList DataFile::fileAccessProperties() const
+{
+	H5::FileAccPropList props;
+	if (m_options.metadataCacheBytes > 0) {
+		H5AC_cache_config_t config;
+		config.version = H5AC__CURR_CACHE_CONFIG_VERSION;
+		H5Pget_mdc_config(props.getId(), &config);
+		config.set_initial_size = true;
+		config.initial_size = m_options.metadataCacheBytes;
+		config.min_size = std::min(config.min_size, config.initial_size);
+		config.max_size = std::max(config.max_size, config.initial_size);
+		H5Pset_mdc_config(props.getId(), &config);
+	}
+	if (m_options.swmr) {
+		props.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+	}
+	return props;
+}
+
+H5::DSetAccPropList DataFile::datasetAccessProperties() const
+{
+	H5::DSetAccPropList props;
+	props.setChunkCache(m_options.chunkCacheSlots, 
+			m_options.chunkCacheBytes, m_options.chunkCacheW0);
+	return props;
+}
+
+DataFile::DataFile(const std::string& filename, 
+		const std::string& array,
+		const hsize_t nchannels,
+		const DataFileOptions& options)
+		: DataFile(filename, array, nchannels, options, OpenMode::ReadOnly, true)
+{
+}
+
+DataFile::DataFile(const std::string& filename, OpenMode mode,
+		const DataFileOptions& options)
+		: DataFile(filename, DefaultArray, NumChannels, options, mode, false)
+{
+}
+
 DataFile::DataFile(const std::string& filename, 
 		const std::string& array,
-		const hsize_t nchannels)
-		: m_filename(filename),
+		const hsize_t nchannels,
+		const DataFileOptions& options,
+		OpenMode mode,
+		bool create)
+		: m_options(options),
+		  m_chunked(true),
+		  m_statsEnd(0),
+		  m_statsDirty(false),
+		  m_filename(filename),
 		  m_array(array),
 		  m_date("unknown"),
 		  m_room("unknown"),
 		  m_nsamples(0),
-		  m_aoutSize(0)
+		  m_aoutSize(0),
+		  m_deferNumSamples(false),
+		  m_numSamplesInterval(MetadataFlushInterval),
+		  m_numSamplesStale(false),
+		  m_numSamplesWritten(std::chrono::steady_clock::now())
 {
 	/* Turn off automatic printing of errors */
 	H5::Exception::dontPrint();
+	m_ioCounters.setEnabled(m_options.ioStats);
 
 	/* If file exists, verify it is valid HDF5 and load data from it.
 	 * Else, construct a new file.
@@ -34,80 +213,131 @@ DataFile::DataFile(const std::string& filename,
 				throw std::invalid_argument("Invalid HDF5 file");
 			}
 			m_readOnly = true;
-			m_file = H5::H5File(m_filename, H5F_ACC_RDWR); // must be read-write so we can call setMeans()
+			m_updatable = (mode == OpenMode::Update);
+			m_swmrWrite = false;
+			m_swmrRead = (mode == OpenMode::SwmrRead);
+			unsigned int flags = H5F_ACC_RDONLY;
+			if (m_updatable) {
+				flags = H5F_ACC_RDWR;
+			} else if (m_swmrRead) {
+				flags |= H5F_ACC_SWMR_READ;
+			}
+			m_file = H5::H5File(m_filename, flags,
+					H5::FileCreatPropList::DEFAULT, fileAccessProperties());
 		} catch (H5::FileIException &e) {
 			throw std::invalid_argument("Could not open HDF5 file");
 		}
 
-		/* Open the dataset */
+		/* Open the dataset, then re-open it with a chunk cache sized
+		 * for its actual chunk shape.
+		 */
 		try {
 			m_dataset = m_file.openDataSet("data");
 		} catch (H5::FileIException &e) {
 			throw std::invalid_argument("File must contain a 'data' dataset");
 		}
-		m_dataspace = m_dataset.getSpace();
 		m_datatype = m_dataset.getDataType();
+		readLayout();
+		resolveCacheOptions();
+		m_dataset = m_file.openDataSet("data", datasetAccessProperties());
+		m_dataspace = m_dataset.getSpace();
 
 		hsize_t dims[DatasetRank] = {0, 0};
 		m_dataspace.getSimpleExtentDims(dims);
 		m_nchannels = dims[0];
 
-		/* Read attributes into data members. These will throw a
-		 * std::invalid_argument if the attribute could not accessed
-		 * for some reason.
+		/* Read attributes into data members. This will throw a
+		 * std::invalid_argument if any required attribute could not 
+		 * be accessed for some reason.
 		 */
-		readArray();
-		readSampleRate();
-		readGain();
-		readOffset();
-		readDate();
-		readRoom();
-		readNumSamples();
-		readAnalogOutputSize();
+		readHeader();
+		if (SummaryPyramid::exists(m_file)) {
+			m_summary.reset(new SummaryPyramid(m_file));
+			m_options.summaryFactors = m_summary->factors();
+		}
+		resolveRails();
+		readStats();
+
+	} else if (!create) {
+		throw std::invalid_argument("Recording does not exist: " + m_filename);
 
 	} else {
 		/* Construct the file. Define to have a chunk cache large enough to hold
 		 * a few chunks at a time.
 		 */
 		m_readOnly = false;
-		H5::FileAccPropList m_fileProps(H5::FileAccPropList::DEFAULT);
-		int mdc_nelmts = 0;
-		size_t rdcc_nelmts, rdcc_nbytes = 0;
-		size_t chunkCacheSizeElems = (
-				datafile::ChunkCacheSize * datafile::BlockSize * 
-				datafile::NumChannels
-			);
-		double rdcc_w0 = 0.0;
-		m_fileProps.getCache(mdc_nelmts, rdcc_nelmts, rdcc_nbytes, rdcc_w0);
-		m_fileProps.setCache(mdc_nelmts, chunkCacheSizeElems, 
-				chunkCacheSizeElems * sizeof(int16_t), rdcc_w0);
+		m_updatable = true;
+		m_swmrWrite = false;
+		m_swmrRead = false;
+		if ( (m_options.chunkChannels == 0) || 
+				(m_options.chunkChannels > static_cast<hsize_t>(MaxNumChannels)) ||
+				(m_options.chunkSamples == 0) ) {
+			throw std::invalid_argument("Invalid chunk shape: (" +
+					std::to_string(m_options.chunkChannels) + ", " +
+					std::to_string(m_options.chunkSamples) + ")");
+		}
+		m_datatype = H5::DataType(H5::PredType::STD_I16LE);
+		m_props = H5::DSetCreatPropList();
+		hsize_t chunkDims[DatasetRank] = { 
+				m_options.chunkChannels, m_options.chunkSamples };
+		m_props.setChunk(DatasetRank, chunkDims);
+		setFilters();
+		if (!m_options.summaryFactors.empty()) {
+			SummaryPyramid::validate(m_options.summaryFactors);
+		}
+		resolveCacheOptions();
 		m_file = H5::H5File(m_filename, H5F_ACC_TRUNC, 
-				H5::FileCreatPropList::DEFAULT, m_fileProps);
+				H5::FileCreatPropList::DEFAULT, fileAccessProperties());
 
 		/* Create the dataset */
 		m_nchannels = nchannels;
 		hsize_t dims[DatasetRank] = {nchannels, DatasetDefaultDims[1]};
 		m_dataspace = H5::DataSpace(DatasetRank, dims, DatasetMaxDims);
-		m_props = H5::DSetCreatPropList();
-		m_props.setChunk(DatasetRank, DatasetChunkDims);
-		m_datatype = H5::DataType(H5::PredType::STD_I16LE);
-		m_dataset = m_file.createDataSet("data", m_datatype, m_dataspace, m_props);
+		m_dataset = m_file.createDataSet("data", m_datatype, m_dataspace, m_props,
+				datasetAccessProperties());
+		if (!m_options.summaryFactors.empty()) {
+			m_summary.reset(new SummaryPyramid(m_file, nchannels, 
+						m_options.summaryFactors));
+		}
+		resolveRails();
+		m_stats.reset(nchannels);
 
-		/* Set default parameters */
+		/* Set default parameters. The number of channels is stored so that
+		 * peek() need not open the dataset for its size, and the number of
+		 * samples so that a file closed before any data is written is not
+		 * taken for one of the older files without it.
+		 */
 		setSampleRate(SampleRate);
 		setRoom(DefaultRoomString);
 		setArray(m_array);
+		writeDataAttr("nchannels", H5::PredType::STD_U64LE, &m_nchannels);
+		writeNumSamples();
 	}
 }
 
 DataFile::~DataFile() 
 {
+	/* Close the file even if the final flush fails. SWMR writing ends
+	 * here, so the means are written with the final statistics.
+	 */
 	try {
+		if (m_swmrWrite) {
+			m_swmrWrite = false;
+			m_statsDirty = true;
+		}
 		if (!readOnly()) {
 			flush();
 		}
+	} catch (std::exception& e) {
+		std::cerr << "Error flushing HDF5 file: " << m_filename
+				<< ": " << e.what() << std::endl;
+	} catch (H5::Exception& e) {
+		std::cerr << "Error flushing HDF5 file: " << m_filename
+				<< ": " << e.getDetailMsg() << std::endl;
+	}
+	try {
 		m_file.close();
-	} catch (H5::FileIException &e) {
+	} catch (H5::Exception& e) {
 		std::cerr << "Error closing HDF5 file: " << m_filename << std::endl;
 	}
 }
@@ -121,9 +351,9 @@ double DataFile::length() const
 	return ((double) nsamples() / sampleRate());
 }
 
-int DataFile::nsamples() const
+int64_t DataFile::nsamples() const
 {
-	return static_cast<int>(m_nsamples);
+	return static_cast<int64_t>(m_nsamples);
 }
 
 int DataFile::nchannels() const
@@ -141,22 +371,24 @@ std::string DataFile::date(void) const { return m_date; }
 
 std::string DataFile::room(void) const { return m_room; }
 
-samples DataFile::data(int startSample, int endSample) const
+samples DataFile::data(int64_t startSample, int64_t endSample) const
 {
 	samples s;
-	data(0, nchannels(), startSample, endSample, s);
-	return s * gain();
+	readScaled(0, nchannels(), startSample, endSample, s,
+			static_cast<double>(gain()), 0.0);
+	return s;
 }
 
-arma::vec DataFile::data(int channel, int startSample, int endSample) const
+arma::vec DataFile::data(int channel, int64_t startSample, int64_t endSample) const
 {
 	arma::vec s;
-	data(channel, channel + 1, startSample, endSample, s);
-	return s * gain();
+	readScaled(channel, channel + 1, startSample, endSample, s,
+			static_cast<double>(gain()), 0.0);
+	return s;
 }
 
 void DataFile::verifyReadRequest(int startChannel, int endChannel, 
-		int startSample, int endSample) const
+		int64_t startSample, int64_t endSample) const
 {
 	if ( (startSample < 0) || (startSample > nsamples()) ) {
 		throw std::logic_error("Requested start sample out of range: " + 
@@ -168,7 +400,7 @@ void DataFile::verifyReadRequest(int startChannel, int endChannel,
 				std::to_string(endSample) + " is not in range [0, " +
 				std::to_string(nsamples()) + "]");
 	}
-	int requestedSamples = endSample - startSample;
+	auto requestedSamples = endSample - startSample;
 	if (requestedSamples <= 0) {
 		throw std::logic_error("Requested sample range invalid: (" + 
 				std::to_string(startSample) + " - " + 
@@ -193,10 +425,26 @@ void DataFile::verifyReadRequest(int startChannel, int endChannel,
 	}
 }
 
+void DataFile::verifyDestination(int nchannels, int64_t nsamples, 
+		arma::uword rows, arma::uword cols, arma::uword row) const
+{
+	if (cols != static_cast<arma::uword>(nchannels)) {
+		throw std::logic_error("Destination has " + std::to_string(cols) +
+				" columns, but " + std::to_string(nchannels) + 
+				" channels were requested");
+	}
+	if ( (row > rows) || (rows - row < static_cast<arma::uword>(nsamples)) ) {
+		throw std::logic_error("Destination rows out of range: [" +
+				std::to_string(row) + ", " + std::to_string(row + nsamples) +
+				") is not in range [0, " + std::to_string(rows) + "]");
+	}
+}
+
 H5::DataSpace DataFile::setupRead(int startChannel, int endChannel, 
-		int startSample, int endSample) const
+		int64_t startSample, int64_t endSample, H5::DataSpace& fileSpace,
+		hsize_t bufOffset, hsize_t bufSamples) const
 {
-	int requestedSamples = endSample - startSample;
+	auto requestedSamples = endSample - startSample;
 	int requestedChannels = endChannel - startChannel;
 
 	/* Compute the source file data space */
@@ -208,8 +456,9 @@ H5::DataSpace DataFile::setupRead(int startChannel, int endChannel,
 			static_cast<hsize_t>(requestedChannels),
 			static_cast<hsize_t>(requestedSamples)
 		};
-	m_dataspace.selectHyperslab(H5S_SELECT_SET, fileCount, fileOffset);
-	if (!m_dataspace.selectValid()) {
+	fileSpace.copy(m_dataspace);
+	fileSpace.selectHyperslab(H5S_SELECT_SET, fileCount, fileOffset);
+	if (!fileSpace.selectValid()) {
 		std::stringstream what;
 		what << "Dataset selection invalid:" << std::endl
 				<< "Offset: (" << startSample << ", 0)" << std::endl
@@ -221,9 +470,9 @@ H5::DataSpace DataFile::setupRead(int startChannel, int endChannel,
 	/* Define the destination data space in memory */
 	hsize_t dims[DatasetRank] = {
 			static_cast<hsize_t>(requestedChannels),
-			static_cast<hsize_t>(requestedSamples)
+			(bufSamples > 0) ? bufSamples : static_cast<hsize_t>(requestedSamples)
 		};
-	hsize_t memOffset[DatasetRank] = {0, 0};
+	hsize_t memOffset[DatasetRank] = {0, bufOffset};
 	hsize_t memCount[DatasetRank] = {
 			static_cast<hsize_t>(requestedChannels),
 			static_cast<hsize_t>(requestedSamples)
@@ -240,13 +489,431 @@ H5::DataSpace DataFile::setupRead(int startChannel, int endChannel,
 	return memspace;
 }
 
+void DataFile::readRaw(int startChannel, int endChannel, int64_t startSample, 
+		int64_t endSample, void* buf, const H5::DataType& memtype,
+		hsize_t bufOffset, hsize_t bufSamples) const
+{
+	/* The gate must outlive the dataspaces, whose destructors call HDF5. */
+	HDF5Gate gate;
+	H5::DataSpace fileSpace;
+	auto memspace = setupRead(startChannel, endChannel, startSample, 
+			endSample, fileSpace, bufOffset, bufSamples);
+	IOTimer timer(m_ioCounters, IOOperation::Read, 
+			static_cast<uint64_t>(endChannel - startChannel) * 
+			static_cast<uint64_t>(endSample - startSample) * memtype.getSize());
+	m_dataset.read(buf, memtype, memspace, fileSpace);
+}
+
+Summary DataFile::summary(int startChan, int endChan, int64_t startSample,
+		int64_t endSample, int pixels) const
+{
+	verifyReadRequest(startChan, endChan, startSample, endSample);
+	if (pixels <= 0) {
+		throw std::invalid_argument("Number of pixels must be positive");
+	}
+	auto nsamples = endSample - startSample;
+	auto nchannels = endChan - startChan;
+	pixels = static_cast<int>(std::min<int64_t>(pixels, nsamples));
+
+	/* Find the coarsest level with at least one bin per pixel */
+	int level = -1, factor = 1;
+	if (m_summary) {
+		auto& factors = m_summary->factors();
+		for (size_t i = 0; i < factors.size(); i++) {
+			if (factors[i] <= nsamples / pixels) {
+				level = static_cast<int>(i);
+				factor = factors[i];
+			}
+		}
+	}
+
+	/* Read the stored bins lying wholly within the samples. The partial
+	 * bins at either end, and any past the end of the level, are read from
+	 * the raw data, so that no sample outside the range is summarized.
+	 */
+	uint64_t firstBin = startSample / factor;
+	uint64_t endBin = (endSample + factor - 1) / factor;
+	uint64_t storedBegin = (startSample + factor - 1) / factor;
+	uint64_t storedEnd = storedBegin;
+	std::vector<float> stored;
+	if (level >= 0) {
+		storedEnd = std::max(storedBegin, std::min<uint64_t>(endSample / factor,
+				m_summary->bins(level)));
+		if (storedEnd > storedBegin) {
+			HDF5Gate gate;
+			m_summary->read(level, startChan, endChan, storedBegin, storedEnd, stored);
+		}
+	}
+	auto nstored = storedEnd - storedBegin;
+	auto headEnd = (nstored > 0) ? storedBegin * factor : static_cast<uint64_t>(endSample);
+	auto tailStart = (nstored > 0) ? storedEnd * factor : static_cast<uint64_t>(endSample);
+	auto readSamples = [&](uint64_t first, uint64_t last, arma::Mat<int16_t>& raw) {
+		if (first < last) {
+			raw.set_size(last - first, nchannels);
+			readRaw(startChan, endChan, static_cast<int64_t>(first),
+					static_cast<int64_t>(last), raw.memptr(), H5::PredType::NATIVE_INT16);
+		}
+	};
+	arma::Mat<int16_t> head, tail;
+	readSamples(startSample, headEnd, head);
+	readSamples(tailStart, endSample, tail);
+
+	/* Combine the bins falling in each pixel */
+	Summary result;
+	result.factor = factor;
+	result.min.set_size(pixels, nchannels);
+	result.max.set_size(pixels, nchannels);
+	result.mean.set_size(pixels, nchannels);
+	result.rms.set_size(pixels, nchannels);
+	auto nbins = endBin - firstBin;
+	for (int c = 0; c < nchannels; c++) {
+		for (int p = 0; p < pixels; p++) {
+			SummaryPyramid::Accumulator acc;
+			auto begin = firstBin + p * nbins / pixels;
+			auto end = firstBin + (p + 1) * nbins / pixels;
+			for (auto b = begin; b < end; b++) {
+				if ( (b >= storedBegin) && (b < storedEnd) ) {
+					auto bin = stored.data() + c * nstored + (b - storedBegin);
+					auto step = nchannels * nstored;
+					acc.addBin(bin[0], bin[step], bin[2 * step], bin[3 * step], factor);
+				} else {
+					auto first = std::max(b * factor, static_cast<uint64_t>(startSample));
+					auto last = std::min((b + 1) * factor, static_cast<uint64_t>(endSample));
+					for (auto i = first; i < last; i++) {
+						acc.add( (i < headEnd) ? head(i - startSample, c) :
+								tail(i - tailStart, c));
+					}
+				}
+			}
+			result.min(p, c) = static_cast<float>(acc.min);
+			result.max(p, c) = static_cast<float>(acc.max);
+			result.mean(p, c) = static_cast<float>(acc.sum / acc.count);
+			result.rms(p, c) = static_cast<float>(std::sqrt(acc.sumsq / acc.count));
+		}
+	}
+	return result;
+}
+
+void DataFile::buildSummary(const std::vector<int>& factors)
+{
+	verifyUpdatable("build summary levels");
+	m_summary.reset(new SummaryPyramid(m_file, nchannels(), factors));
+	appendSummary(0, nsamples());
+	m_summary->write();
+	m_options.summaryFactors = factors;
+}
+
+void DataFile::prepareSummary(int64_t startSample)
+{
+	auto start = static_cast<uint64_t>(startSample);
+	if (start < m_summary->samples()) {
+		m_summary->rewind(start);
+	}
+	appendSummary(m_summary->samples(), start);
+}
+
+void DataFile::finishSummary(int64_t endSample)
+{
+	appendSummary(static_cast<uint64_t>(endSample), m_nsamples);
+	m_summary->write();
+}
+
+void DataFile::appendSummary(uint64_t start, uint64_t end)
+{
+	arma::Mat<int16_t> block;
+	for (auto first = start; first < end; first += BlockSize) {
+		auto last = std::min(first + BlockSize, end);
+		block.set_size(last - first, nchannels());
+		readRaw(0, nchannels(), static_cast<int64_t>(first), static_cast<int64_t>(last),
+				block.memptr(), H5::PredType::NATIVE_INT16);
+		m_summary->append(block.memptr(), block.n_rows, block.n_cols, block.n_rows);
+	}
+}
+
+void DataFile::resolveRails()
+{
+	m_lowRail = -std::numeric_limits<double>::infinity();
+	m_highRail = std::numeric_limits<double>::infinity();
+	if (m_datatype.getClass() != H5T_INTEGER) {
+		return;
+	}
+	auto bits = 8 * m_datatype.getSize();
+	if (H5Tget_sign(m_datatype.getId()) == H5T_SGN_NONE) {
+		m_lowRail = 0;
+		m_highRail = std::ldexp(1.0, bits) - 1;
+	} else {
+		m_lowRail = -std::ldexp(1.0, bits - 1);
+		m_highRail = std::ldexp(1.0, bits - 1) - 1;
+	}
+}
+
+const ChannelStats& DataFile::stats() const
+{
+	return m_stats;
+}
+
+void DataFile::computeStats()
+{
+	verifyUpdatable("store channel statistics");
+	m_stats.reset(nchannels());
+	arma::Mat<int16_t> block;
+	for (uint64_t first = 0; first < m_nsamples; first += BlockSize) {
+		auto last = std::min(first + BlockSize, m_nsamples);
+		block.set_size(last - first, nchannels());
+		readRaw(0, nchannels(), static_cast<int64_t>(first), static_cast<int64_t>(last),
+				block.memptr(), H5::PredType::NATIVE_INT16);
+		m_stats.accumulate(block.memptr(), block.n_rows, block.n_cols, 
+				block.n_rows, m_lowRail, m_highRail);
+	}
+	m_statsEnd = m_nsamples;
+	writeStats();
+}
+
+/* Write an array attribute of the dataset, replacing any that exists */
+static void writeArrayAttr(IOCounters& counters, H5::DataSet& dataset, 
+		const std::string& name, const H5::PredType& type, int rank, 
+		const hsize_t* dims, const void* buf)
+{
+	uint64_t bytes = type.getSize();
+	for (int i = 0; i < rank; i++) {
+		bytes *= dims[i];
+	}
+	IOTimer timer(counters, IOOperation::AttrWrite, bytes);
+	if (dataset.attrExists(name)) {
+		auto attr = dataset.openAttribute(name);
+		auto space = attr.getSpace();
+		std::vector<hsize_t> existing(rank);
+		if ( (space.getSimpleExtentNdims() == rank) &&
+				(space.getSimpleExtentDims(existing.data()), 
+				 std::equal(existing.begin(), existing.end(), dims)) ) {
+			attr.write(type, buf);
+			return;
+		}
+		attr.close();
+		dataset.removeAttr(name);
+	}
+	auto attr = dataset.createAttribute(name, type, H5::DataSpace(rank, dims));
+	attr.write(type, buf);
+	attr.close();
+}
+
+/* Read an array attribute of the dataset with `n` values */
+static void readArrayAttr(IOCounters& counters, const H5::DataSet& dataset, 
+		const std::string& name, const H5::PredType& type, size_t n, void* buf)
+{
+	IOTimer timer(counters, IOOperation::AttrRead, n * type.getSize());
+	auto attr = dataset.openAttribute(name);
+	if (static_cast<size_t>(attr.getSpace().getSimpleExtentNpoints()) != n) {
+		throw std::invalid_argument("The data attribute '" + name + 
+				"' has the wrong size");
+	}
+	attr.read(type, buf);
+	attr.close();
+}
+
+/* Select samples [first, last) of all channels of a dataset */
+static H5::DataSpace selectSamples(const H5::DataSet& dataset, int nchannels,
+		uint64_t first, uint64_t last)
+{
+	hsize_t offset[DatasetRank] = { 0, first };
+	hsize_t count[DatasetRank] = { static_cast<hsize_t>(nchannels), last - first };
+	auto space = dataset.getSpace();
+	space.selectHyperslab(H5S_SELECT_SET, count, offset);
+	return space;
+}
+
+void DataFile::writeFiltered(Filter& filter, bool zeroPhase, const std::string& name)
+{
+	verifyUpdatable("write filtered data");
+	if (name == "data") {
+		throw std::invalid_argument("The raw data cannot be replaced by filtered data");
+	}
+	if (H5Lexists(m_file.getId(), name.c_str(), H5P_DEFAULT) > 0) {
+		m_file.unlink(name);
+	}
+	auto opts = options();
+	hsize_t dims[DatasetRank] = { static_cast<hsize_t>(nchannels()), m_nsamples };
+	hsize_t maxDims[DatasetRank] = { dims[0], H5S_UNLIMITED };
+
+	/* Follow the raw data's chunks, but bound them, since a contiguous
+	 * dataset reports its whole extent as its chunk.
+	 */
+	hsize_t chunkDims[DatasetRank] = { 
+			std::max<hsize_t>(1, std::min<hsize_t>({ opts.chunkChannels, dims[0],
+					static_cast<hsize_t>(MaxNumChannels) })),
+			std::max<hsize_t>(1, std::min<hsize_t>(opts.chunkSamples, BlockSize)) };
+	H5::DSetCreatPropList props;
+	props.setChunk(DatasetRank, chunkDims);
+	auto dataset = m_file.createDataSet(name, H5::PredType::IEEE_F32LE,
+			H5::DataSpace(DatasetRank, dims, maxDims), props);
+
+	auto write = [&](uint64_t first, const arma::fmat& block) {
+		hsize_t count[DatasetRank] = { block.n_cols, block.n_rows };
+		H5::DataSpace memspace(DatasetRank, count);
+		IOTimer timer(m_ioCounters, IOOperation::Write, block.n_elem * sizeof(float));
+		dataset.write(block.memptr(), H5::PredType::NATIVE_FLOAT, memspace,
+				selectSamples(dataset, nchannels(), first, first + block.n_rows));
+	};
+
+	filter.reset();
+	arma::Mat<int16_t> block;
+	arma::fmat filtered;
+	for (uint64_t first = 0; first < m_nsamples; first += BlockSize) {
+		auto last = std::min(first + BlockSize, m_nsamples);
+		block.set_size(last - first, nchannels());
+		readRaw(0, nchannels(), static_cast<int64_t>(first), static_cast<int64_t>(last),
+				block.memptr(), H5::PredType::NATIVE_INT16);
+		filter.process(block, filtered);
+		write(first, filtered);
+	}
+
+	/* The backward pass runs over the blocks in reverse, each reversed */
+	if (zeroPhase) {
+		filter.reset();
+		auto reverse = [&filtered]() {
+			for (arma::uword c = 0; c < filtered.n_cols; c++) {
+				std::reverse(filtered.colptr(c), filtered.colptr(c) + filtered.n_rows);
+			}
+		};
+		for (auto nblocks = (m_nsamples + BlockSize - 1) / BlockSize; nblocks-- > 0; ) {
+			auto first = nblocks * BlockSize;
+			auto last = std::min(first + BlockSize, m_nsamples);
+			filtered.set_size(last - first, nchannels());
+			hsize_t count[DatasetRank] = { filtered.n_cols, filtered.n_rows };
+			H5::DataSpace memspace(DatasetRank, count);
+			{
+				IOTimer timer(m_ioCounters, IOOperation::Read, filtered.n_elem * sizeof(float));
+				dataset.read(filtered.memptr(), H5::PredType::NATIVE_FLOAT, memspace,
+						selectSamples(dataset, nchannels(), first, last));
+			}
+			reverse();
+			filter.process(filtered, filtered);
+			reverse();
+			write(first, filtered);
+		}
+	}
+
+	if (filter.isFir()) {
+		hsize_t ntaps = filter.taps().size();
+		writeArrayAttr(m_ioCounters, dataset, "filter-taps", H5::PredType::IEEE_F64LE,
+				1, &ntaps, filter.taps().data());
+	} else {
+		std::vector<double> sections;
+		for (auto& section : filter.sections()) {
+			sections.insert(sections.end(), 
+					{ section.b0, section.b1, section.b2, section.a1, section.a2 });
+		}
+		hsize_t sectionDims[DatasetRank] = { filter.sections().size(), 5 };
+		writeArrayAttr(m_ioCounters, dataset, "filter-sections", H5::PredType::IEEE_F64LE,
+				DatasetRank, sectionDims, sections.data());
+	}
+	int32_t zero = zeroPhase;
+	hsize_t one = 1;
+	writeArrayAttr(m_ioCounters, dataset, "zero-phase", H5::PredType::STD_I32LE,
+			1, &one, &zero);
+}
+
+void DataFile::filtered(int startChan, int endChan, int64_t startSample, int64_t endSample,
+		arma::fmat& out, const std::string& name) const
+{
+	verifyReadRequest(startChan, endChan, startSample, endSample);
+	HDF5Gate gate;
+	if (H5Lexists(m_file.getId(), name.c_str(), H5P_DEFAULT) <= 0) {
+		throw std::invalid_argument("File has no filtered dataset '" + name + "'");
+	}
+	auto dataset = m_file.openDataSet(name);
+	out.set_size(endSample - startSample, endChan - startChan);
+	hsize_t offset[DatasetRank] = { static_cast<hsize_t>(startChan),
+			static_cast<hsize_t>(startSample) };
+	hsize_t count[DatasetRank] = { out.n_cols, out.n_rows };
+	auto fileSpace = dataset.getSpace();
+	fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+	H5::DataSpace memspace(DatasetRank, count);
+	IOTimer timer(m_ioCounters, IOOperation::Read, out.n_elem * sizeof(float));
+	dataset.read(out.memptr(), H5::PredType::NATIVE_FLOAT, memspace, fileSpace);
+}
+
+void DataFile::writeStats()
+{
+	try {
+		auto nchannels = static_cast<hsize_t>(m_stats.mean.n_elem);
+		hsize_t dims[DatasetRank] = { ChannelStatsRows, nchannels };
+		arma::mat values(nchannels, ChannelStatsRows);
+		for (hsize_t c = 0; c < nchannels; c++) {
+			values(c, 0) = m_stats.mean(c);
+			values(c, 1) = m_stats.m2(c);
+			values(c, 2) = m_stats.min(c);
+			values(c, 3) = m_stats.max(c);
+		}
+		writeArrayAttr(m_ioCounters, m_dataset, "channel-stats", 
+				H5::PredType::IEEE_F64LE, DatasetRank, dims, values.memptr());
+
+		dims[0] = ChannelClipRows;
+		std::vector<uint64_t> clips(ChannelClipRows * nchannels);
+		for (hsize_t c = 0; c < nchannels; c++) {
+			clips[c] = m_stats.clipLow(c);
+			clips[nchannels + c] = m_stats.clipHigh(c);
+		}
+		writeArrayAttr(m_ioCounters, m_dataset, "channel-clip-counts", 
+				H5::PredType::STD_U64LE, DatasetRank, dims, clips.data());
+
+		uint64_t info[2] = { m_stats.count, m_stats.complete };
+		dims[0] = 2;
+		writeArrayAttr(m_ioCounters, m_dataset, "channel-stats-samples", 
+				H5::PredType::STD_U64LE, 1, dims, info);
+
+		/* Under SWMR, the means stay NaN until writing ends */
+		if (m_stats.complete && (m_stats.count > 0) && !m_swmrWrite) {
+			writeMeans(m_stats.mean);
+		}
+	} catch (H5::Exception& e) {
+		throw std::invalid_argument("Could not write channel statistics");
+	}
+	m_statsDirty = false;
+}
+
+void DataFile::readStats()
+{
+	m_stats.reset(nchannels());
+	m_stats.complete = (m_nsamples == 0);
+	if (m_dataset.attrExists("channel-stats-samples")) {
+		try {
+			uint64_t info[2] = { 0, 0 };
+			readArrayAttr(m_ioCounters, m_dataset, "channel-stats-samples", 
+					H5::PredType::NATIVE_UINT64, 2, info);
+			arma::mat values(nchannels(), ChannelStatsRows);
+			readArrayAttr(m_ioCounters, m_dataset, "channel-stats", 
+					H5::PredType::NATIVE_DOUBLE, values.n_elem, values.memptr());
+			std::vector<uint64_t> clips(ChannelClipRows * nchannels());
+			readArrayAttr(m_ioCounters, m_dataset, "channel-clip-counts", 
+					H5::PredType::NATIVE_UINT64, clips.size(), clips.data());
+
+			m_stats.count = info[0];
+			m_stats.complete = (info[1] != 0);
+			for (int c = 0; c < nchannels(); c++) {
+				m_stats.mean(c) = values(c, 0);
+				m_stats.m2(c) = values(c, 1);
+				m_stats.min(c) = values(c, 2);
+				m_stats.max(c) = values(c, 3);
+				m_stats.clipLow(c) = clips[c];
+				m_stats.clipHigh(c) = clips[nchannels() + c];
+			}
+		} catch (H5::Exception& e) {
+			throw std::invalid_argument("Could not read channel statistics");
+		}
+	}
+	m_statsEnd = m_stats.count;
+}
+
 void DataFile::writeDataAttr(const std::string& name, const H5::DataType &type, void *buf) 
 {
 	if (readOnly())
 		return;
 	try {
 		H5::DataType writeType(type);
+		IOTimer timer(m_ioCounters, IOOperation::AttrWrite, writeType.getSize());
 		if (!(m_dataset.attrExists(name))) {
+			verifyNewAttribute(name);
 			H5::DataSpace space(H5S_SCALAR);
 			m_dataset.createAttribute(name, writeType, space);
 		}
@@ -264,7 +931,9 @@ void DataFile::writeDataStringAttr(const std::string& name, const std::string& v
 		return;
 	try {
 		H5::StrType stringType(0, value.length());
+		IOTimer timer(m_ioCounters, IOOperation::AttrWrite, value.length());
 		if (!(m_dataset.attrExists(name))) {
+			verifyNewAttribute(name);
 			H5::DataSpace space(H5S_SCALAR);
 			m_dataset.createAttribute(name, stringType, space);
 		}
@@ -323,21 +992,71 @@ void DataFile::setArray(std::string array)
 	m_array = array;
 }
 
-void DataFile::setAnalogOutputSize(int size)
+void DataFile::setAnalogOutputSize(int64_t size)
 {
-	writeDataAttr("analog-output-size", H5::PredType::STD_U64LE, &m_aoutSize);
 	m_aoutSize = static_cast<decltype(m_aoutSize)>(size);
+	writeDataAttr("analog-output-size", H5::PredType::STD_U64LE, &m_aoutSize);
+}
+
+void DataFile::setAnalogOutputSize(int size)
+{
+	setAnalogOutputSize(static_cast<int64_t>(size));
 }
 
-void DataFile::setNumSamples(int nsamples)
+void DataFile::setNumSamples(int64_t nsamples)
 {
 	m_nsamples = static_cast<decltype(m_nsamples)>(nsamples);
+	if (!m_deferNumSamples) {
+		writeDataAttr("nsamples", H5::PredType::STD_U64LE, &m_nsamples);
+		return;
+	}
+
+	/* Mark the file's count as stale the first time it falls behind,
+	 * so that it can be recovered if we never get to write it.
+	 */
+	if (!m_numSamplesStale) {
+		uint8_t stale = 1;
+		writeDataAttr("nsamples-stale", H5::PredType::STD_U8LE, &stale);
+		m_numSamplesStale = true;
+	}
+	if (m_numSamplesInterval > 0) {
+		std::chrono::duration<double> elapsed = 
+			std::chrono::steady_clock::now() - m_numSamplesWritten;
+		if (elapsed.count() >= m_numSamplesInterval) {
+			writeNumSamples();
+		}
+	}
+}
+
+void DataFile::writeNumSamples()
+{
 	writeDataAttr("nsamples", H5::PredType::STD_U64LE, &m_nsamples);
+	if (m_numSamplesStale) {
+		uint8_t stale = 0;
+		writeDataAttr("nsamples-stale", H5::PredType::STD_U8LE, &stale);
+		m_numSamplesStale = false;
+	}
+	m_numSamplesWritten = std::chrono::steady_clock::now();
+}
+
+void DataFile::setDeferNumSamples(bool defer, double interval)
+{
+	if (!defer && m_deferNumSamples) {
+		writeNumSamples();
+	}
+	m_deferNumSamples = defer;
+	m_numSamplesInterval = interval;
+	m_numSamplesWritten = std::chrono::steady_clock::now();
+}
+
+bool DataFile::deferNumSamples() const
+{
+	return m_deferNumSamples;
 }
 
-int DataFile::analogOutputSize() const
+int64_t DataFile::analogOutputSize() const
 {
-	return static_cast<int>(m_aoutSize);
+	return static_cast<int64_t>(m_aoutSize);
 }
 
 arma::vec DataFile::analogOutput() const
@@ -352,7 +1071,9 @@ arma::vec DataFile::analogOutput() const
 void DataFile::readFileAttr(const std::string& name, void *buf) 
 {
 	try {
+		IOTimer timer(m_ioCounters, IOOperation::AttrRead);
 		H5::Attribute attr = m_file.openAttribute(name);
+		timer.setBytes(attr.getStorageSize());
 		attr.read(attr.getDataType(), buf);
 	} catch (H5::Exception &e) {
 		throw std::invalid_argument("The file attribute '" + name +
@@ -363,7 +1084,9 @@ void DataFile::readFileAttr(const std::string& name, void *buf)
 void DataFile::readDataAttr(const std::string& name, void *buf) 
 {
 	try {
+		IOTimer timer(m_ioCounters, IOOperation::AttrRead);
 		H5::Attribute attr = m_dataset.openAttribute(name);
+		timer.setBytes(attr.getStorageSize());
 		attr.read(attr.getDataType(), buf);
 	} catch (H5::Exception &e) {
 		throw std::invalid_argument("The dataset attribute '" + name +
@@ -409,95 +1132,489 @@ void DataFile::readFileStringAttr(const std::string& name, std::string &loc)
 	}
 }
 
-void DataFile::readSampleRate(void) 
+/* Attributes of the data which every recording has */
+static const char* RequiredHeaderAttributes[] = {
+	"sample-rate", "gain", "offset", "array", "date", "room"
+};
+
+/* Read a fixed-length string attribute, up to its first null character */
+static herr_t readStringAttribute(hid_t attr, std::string& value)
 {
-	readDataAttr("sample-rate", &m_sampleRate);
+	auto type = H5Aget_type(attr);
+	if (type < 0) {
+		return -1;
+	}
+	herr_t status = -1;
+	if (H5Tis_variable_str(type) == 0) {
+		std::vector<char> buf(H5Tget_size(type) + 1, '\0');
+		status = H5Aread(attr, type, buf.data());
+		value = buf.data();
+	}
+	H5Tclose(type);
+	return status;
 }
 
-void DataFile::readGain(void) 
+/* Read one attribute into the header, if it is part of the header, and
+ * record its name in `found`.
+ */
+static herr_t readHeaderAttribute(hid_t attr, DataFileInfo& info, 
+		std::vector<std::string>& found)
 {
-	readDataAttr("gain", &m_gain);
+	auto length = H5Aget_name(attr, 0, nullptr);
+	if (length < 0) {
+		return -1;
+	}
+	std::vector<char> buf(length + 1, '\0');
+	H5Aget_name(attr, buf.size(), buf.data());
+	std::string name(buf.data());
+
+	herr_t status = 0;
+	uint8_t stale = 0;
+	if (name == "sample-rate") {
+		status = H5Aread(attr, H5T_NATIVE_FLOAT, &info.sampleRate);
+	} else if (name == "gain") {
+		status = H5Aread(attr, H5T_NATIVE_FLOAT, &info.gain);
+	} else if (name == "offset") {
+		status = H5Aread(attr, H5T_NATIVE_FLOAT, &info.offset);
+	} else if (name == "nsamples") {
+		status = H5Aread(attr, H5T_NATIVE_UINT64, &info.nsamples);
+	} else if (name == "nchannels") {
+		status = H5Aread(attr, H5T_NATIVE_UINT64, &info.nchannels);
+	} else if (name == "analog-output-size") {
+		status = H5Aread(attr, H5T_NATIVE_UINT64, &info.analogOutputSize);
+	} else if (name == "nsamples-stale") {
+		status = H5Aread(attr, H5T_NATIVE_UINT8, &stale);
+		info.nsamplesStale = (stale != 0);
+	} else if (name == "array") {
+		status = readStringAttribute(attr, info.array);
+	} else if (name == "date") {
+		status = readStringAttribute(attr, info.date);
+	} else if (name == "room") {
+		status = readStringAttribute(attr, info.room);
+	} else {
+		return 0;
+	}
+	if (status >= 0) {
+		found.push_back(name);
+	}
+	return status;
 }
 
-void DataFile::readOffset(void) 
+/* Read the header of a recording from the attributes of the object `name`
+ * at `location`, in one pass over them. This only opens the object's
+ * header, not the object itself, so the dataset's layout and chunk cache
+ * are never set up. Returns the names of the attributes found.
+ */
+static std::vector<std::string> readHeaderAttributes(hid_t location, 
+		const char* name, DataFileInfo& info)
 {
-	readDataAttr("offset", &m_offset);
+	H5O_info_t objectInfo;
+	if (H5Oget_info_by_name2(location, name, &objectInfo, H5O_INFO_NUM_ATTRS,
+				H5P_DEFAULT) < 0) {
+		throw std::invalid_argument("File must contain a 'data' dataset");
+	}
+	std::vector<std::string> found;
+	for (hsize_t i = 0; i < objectInfo.num_attrs; i++) {
+		auto attr = H5Aopen_by_idx(location, name, H5_INDEX_NAME, 
+				H5_ITER_NATIVE, i, H5P_DEFAULT, H5P_DEFAULT);
+		auto status = (attr < 0) ? -1 : readHeaderAttribute(attr, info, found);
+		if (attr >= 0) {
+			H5Aclose(attr);
+		}
+		if (status < 0) {
+			throw std::invalid_argument("Could not read the attributes of the data");
+		}
+	}
+	for (auto required : RequiredHeaderAttributes) {
+		if (std::find(found.begin(), found.end(), required) == found.end()) {
+			throw std::invalid_argument("The dataset attribute '" + 
+					std::string(required) + "' does not exist.");
+		}
+	}
+	return found;
 }
 
-void DataFile::readNumSamples(void)
+void DataFile::readHeader()
 {
-	if (m_dataset.attrExists("nsamples")) {
-		readDataAttr("nsamples", &m_nsamples);
+	DataFileInfo info { m_filename, m_array, m_date, m_room, m_nchannels, 
+		0, m_aoutSize, 0, 0, 0, false };
+	std::vector<std::string> found;
+	{
+		IOTimer timer(m_ioCounters, IOOperation::AttrRead);
+		found = readHeaderAttributes(m_dataset.getId(), ".", info);
+	}
+	m_array = info.array;
+	m_date = info.date;
+	m_room = info.room;
+	m_sampleRate = info.sampleRate;
+	m_gain = info.gain;
+	m_offset = info.offset;
+	m_aoutSize = info.analogOutputSize;
+
+	/* Older versions of the library did not explicitly encode the
+	 * number of samples, or whether analog output was performed. Fall 
+	 * back to the size of the dataset and no analog output.
+	 */
+	if (std::find(found.begin(), found.end(), "nsamples") != found.end()) {
+		m_nsamples = info.nsamples;
 	} else {
-		/* 
-		 * Older versions of the library did not explicitly encode the
-		 * number of samples. Fall back to the size of the dataset if
-		 * needed.
-		 */
 		m_nsamples = datasetSize();
 	}
+
+	/* A SWMR writer keeps the extent of the dataset at the number of samples,
+	 * and only writes the attribute when it closes the file.
+	 */
+	if (m_swmrRead) {
+		m_nsamples = datasetSize();
+	} else {
+		recoverNumSamples(info.nsamplesStale);
+	}
 }
 
-void DataFile::readAnalogOutputSize(void)
+DataFileInfo peek(const std::string& filename)
 {
-	if (m_dataset.attrExists("analog-output-size")) {
-		readDataAttr("analog-output-size", &m_aoutSize);
-		/* 
-		 * Older versions of the library did not explicitly encode
-		 * whether analog output was performed in this recording.
-		 * For simplicity, we just assume none was done in this
-		 * case. The constructor sets this value to 0.
-		 */
+	H5::Exception::dontPrint();
+	H5::H5File file;
+	try {
+		file = H5::H5File(filename, H5F_ACC_RDONLY);
+	} catch (H5::Exception& e) {
+		throw std::invalid_argument("Could not open HDF5 file: " + filename);
+	}
+
+	DataFileInfo info { filename, "", "", "", 0, 0, 0, 0, 0, 0, false };
+	auto found = readHeaderAttributes(file.getId(), "data", info);
+	auto has = [&found](const char* name) {
+		return std::find(found.begin(), found.end(), name) != found.end();
+	};
+	if (!has("nchannels") || !has("nsamples")) {
+		hsize_t dims[DatasetRank] = { 0, 0 };
+		try {
+			file.openDataSet("data").getSpace().getSimpleExtentDims(dims);
+		} catch (H5::Exception& e) {
+			throw std::invalid_argument("File has no 'data' dataset: " + filename);
+		}
+		if (!has("nchannels")) {
+			info.nchannels = dims[0];
+		}
+		if (!has("nsamples")) {
+			info.nsamples = dims[1];
+		}
 	}
+	return info;
 }
 
-void DataFile::readDate(void) 
+/* Return the creation properties of the first source of a virtual dataset,
+ * or the given properties if it has none or it cannot be opened.
+ */
+static H5::DSetCreatPropList virtualSourceProperties(const H5::DSetCreatPropList& props)
 {
-	readDataStringAttr("date", m_date);
+	size_t count = 0;
+	if ( (H5Pget_virtual_count(props.getId(), &count) < 0) || (count == 0) ) {
+		return props;
+	}
+	auto fileLength = H5Pget_virtual_filename(props.getId(), 0, nullptr, 0);
+	auto nameLength = H5Pget_virtual_dsetname(props.getId(), 0, nullptr, 0);
+	if ( (fileLength <= 0) || (nameLength <= 0) ) {
+		return props;
+	}
+	std::vector<char> filename(fileLength + 1), name(nameLength + 1);
+	H5Pget_virtual_filename(props.getId(), 0, filename.data(), filename.size());
+	H5Pget_virtual_dsetname(props.getId(), 0, name.data(), name.size());
+	try {
+		H5::H5File source(filename.data(), H5F_ACC_RDONLY);
+		return source.openDataSet(name.data()).getCreatePlist();
+	} catch (H5::Exception&) {
+		return props;
+	}
+}
+
+void DataFile::readLayout(void)
+{
+	/* A virtual dataset, such as one written by RecordingSet::writeVirtual(),
+	 * has no chunks of its own. Its data is read from the chunks of its
+	 * sources, so report those of the first.
+	 */
+	auto props = m_dataset.getCreatePlist();
+	if (props.getLayout() == H5D_VIRTUAL) {
+		props = virtualSourceProperties(props);
+	}
+	hsize_t dims[DatasetRank] = { 0, 0 };
+	m_chunked = (props.getLayout() == H5D_CHUNKED);
+	if (m_chunked) {
+		props.getChunk(DatasetRank, dims);
+	} else {
+		m_dataset.getSpace().getSimpleExtentDims(dims);
+	}
+	m_options.chunkChannels = dims[0];
+	m_options.chunkSamples = dims[1];
+
+	/* Record the filters actually applied to the dataset */
+	m_options.shuffle = false;
+	m_options.deflate = 0;
+	m_options.filter = 0;
+	m_options.filterValues.clear();
+	for (int i = 0; i < props.getNfilters(); i++) {
+		unsigned int flags = 0, config = 0;
+		size_t nvalues = 8;
+		std::vector<unsigned int> values(nvalues);
+		char name[64];
+		auto filter = props.getFilter(i, flags, nvalues, values.data(), 
+				sizeof(name), name, config);
+		values.resize(std::min(nvalues, values.size()));
+		if (filter == H5Z_FILTER_SHUFFLE) {
+			m_options.shuffle = true;
+		} else if (filter == H5Z_FILTER_DEFLATE) {
+			m_options.deflate = values.empty() ? 0 : values[0];
+		} else {
+			m_options.filter = filter;
+			m_options.filterValues = values;
+		}
+	}
 }
 
-void DataFile::readRoom(void) 
+bool filterAvailable(H5Z_filter_t filter)
 {
-	readDataStringAttr("room", m_room);
+	return H5Zfilter_avail(filter) > 0;
 }
 
-void DataFile::readArray()
+void DataFile::setFilters(void)
 {
-	readDataStringAttr("array", m_array);
+	if (m_options.shuffle) {
+		m_props.setShuffle();
+	}
+	if (m_options.deflate > 0) {
+		if (!filterAvailable(H5Z_FILTER_DEFLATE)) {
+			throw std::invalid_argument("The deflate filter is not available");
+		}
+		m_props.setDeflate(m_options.deflate);
+	}
+	if (m_options.filter != 0) {
+		if (!filterAvailable(m_options.filter)) {
+			throw std::invalid_argument("HDF5 filter " + 
+					std::to_string(m_options.filter) + " is not available");
+		}
+		m_props.setFilter(m_options.filter, H5Z_FLAG_OPTIONAL, 
+				m_options.filterValues.size(), m_options.filterValues.data());
+	}
+}
+
+const DataFileOptions& DataFile::options() const
+{
+	return m_options;
+}
+
+bool DataFile::chunked() const
+{
+	return m_chunked;
+}
+
+void DataFile::recoverNumSamples(bool stale)
+{
+	if (!stale) {
+		return;
+	}
+
+	/* 
+	 * The writer died while the number of samples was deferred, so the
+	 * stored count may be behind. Samples beyond the last complete write
+	 * of the count were either written or are still the dataset's zero
+	 * fill value, so scan backwards from the end of the dataset for the
+	 * last sample that is not zero on every channel.
+	 */
+	auto size = static_cast<uint64_t>(datasetSize());
+	arma::Mat<int16_t> block;
+	auto end = size;
+	while (end > m_nsamples) {
+		auto start = std::max(m_nsamples,
+				end > static_cast<uint64_t>(BlockSize) ? end - BlockSize : 0);
+		block.set_size(end - start, nchannels());
+		readRaw(0, nchannels(), static_cast<int64_t>(start), static_cast<int64_t>(end),
+				block.memptr(), dtypeForMat(block));
+		arma::uword last = 0;
+		for (arma::uword c = 0; c < block.n_cols; c++) {
+			auto column = block.colptr(c);
+			for (auto i = block.n_rows; i > last; i--) {
+				if (column[i - 1] != 0) {
+					last = i;
+					break;
+				}
+			}
+		}
+		if (last > 0) {
+			m_nsamples = start + last;
+			return;
+		}
+		end = start;
+	}
 }
 
 void DataFile::flush(void) 
 {
-	m_file.flush(H5F_SCOPE_GLOBAL);
+	if (!readOnly() && m_numSamplesStale) {
+		writeNumSamples();
+	}
+	if (!readOnly() && m_statsDirty) {
+		writeStats();
+	}
+	if (m_updatable) {
+		IOTimer timer(m_ioCounters, IOOperation::Flush);
+		m_file.flush(H5F_SCOPE_GLOBAL);
+	}
+}
+
+bool DataFile::updatable() const
+{
+	return m_updatable;
+}
+
+void DataFile::verifyUpdatable(const std::string& operation) const
+{
+	if (!m_updatable) {
+		throw std::logic_error("Cannot " + operation + 
+				" in a DataFile not opened for update.");
+	}
+	if (m_swmrWrite) {
+		throw std::logic_error("Cannot " + operation + 
+				" while writing with SWMR access.");
+	}
+}
+
+void DataFile::startSwmrWrite()
+{
+	if (readOnly() || !m_options.swmr) {
+		throw std::logic_error("SWMR writing requires a new file created "
+				"with DataFileOptions::swmr set.");
+	}
+	if (m_swmrWrite) {
+		return;
+	}
+
+	/* Write all metadata, so that every attribute written while SWMR
+	 * writing already exists, and can be written in place. The means are
+	 * unknown until the file is closed. The number of samples is marked
+	 * as stale until then, in case the writer dies.
+	 */
+	flush();
+	writeStats();
+	arma::vec unknown(nchannels());
+	unknown.fill(std::numeric_limits<double>::quiet_NaN());
+	writeMeans(unknown);
+	uint8_t stale = 1;
+	writeDataAttr("nsamples-stale", H5::PredType::STD_U8LE, &stale);
+	m_numSamplesStale = true;
+
+	/* Trim the extent of the dataset, which readers take as the number
+	 * of samples.
+	 */
+	hsize_t dims[DatasetRank] = { m_nchannels, m_nsamples };
+	if (H5Dset_extent(m_dataset.getId(), dims) < 0) {
+		throw std::runtime_error("Could not resize the data of " + m_filename);
+	}
+	m_dataspace = m_dataset.getSpace();
+	if (H5Fstart_swmr_write(m_file.getId()) < 0) {
+		throw std::runtime_error("Could not start SWMR writing of " + m_filename);
+	}
+	m_swmrWrite = true;
+}
+
+bool DataFile::swmr() const
+{
+	return m_swmrWrite || m_swmrRead;
+}
+
+void DataFile::publishWrite()
+{
+	if (H5Dflush(m_dataset.getId()) < 0) {
+		throw std::runtime_error("Could not flush data to " + m_filename);
+	}
+}
+
+void DataFile::verifyNewAttribute(const std::string& name) const
+{
+	if (m_swmrWrite) {
+		throw std::logic_error("Cannot create the attribute '" + name + 
+				"' while writing with SWMR access.");
+	}
+}
+
+int64_t DataFile::refresh()
+{
+	if (m_swmrRead) {
+		HDF5Gate gate;
+		if (H5Drefresh(m_dataset.getId()) < 0) {
+			throw std::runtime_error("Could not refresh the data of " + m_filename);
+		}
+		m_dataspace = m_dataset.getSpace();
+		m_nsamples = static_cast<uint64_t>(datasetSize());
+	}
+	return nsamples();
+}
+
+bool DataFile::waitForSamples(int64_t nsamples, double timeout)
+{
+	auto deadline = std::chrono::steady_clock::now() + 
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double>(timeout));
+	auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(SwmrPollInterval));
+	while (refresh() < nsamples) {
+		auto now = std::chrono::steady_clock::now();
+		if (now >= deadline) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::min(interval, deadline - now));
+	}
+	return true;
+}
+
+void DataFile::setIOStatsEnabled(bool enable)
+{
+	m_ioCounters.setEnabled(enable);
+}
+
+bool DataFile::ioStatsEnabled() const
+{
+	return m_ioCounters.enabled();
+}
+
+IOStats DataFile::ioStats() const
+{
+	auto stats = m_ioCounters.snapshot();
+	{
+		HDF5Gate gate;
+		IOCounters::readCacheStats(m_file.getId(), stats);
+	}
+
+	/* The dataset has its own chunk cache, sized for its chunks */
+	stats.chunkCacheBytes = m_options.chunkCacheBytes;
+	return stats;
+}
+
+void DataFile::resetIOStats()
+{
+	m_ioCounters.reset();
+	HDF5Gate gate;
+	IOCounters::resetCacheStats(m_file.getId());
 }
 
 std::string array(const std::string& fname)
 {
-	std::string a;
 	try {
-		H5::H5File f(fname, H5F_ACC_RDONLY);
-		H5::DataSet dset = f.openDataSet("data");
-		H5::Attribute attr = dset.openAttribute("array");
-		hsize_t sz = attr.getStorageSize();
-		a.resize(sz);
-		attr.read(attr.getStrType(), a);
-		attr.close();
-		dset.close();
-		f.close();
+		return peek(fname).array;
 	} catch ( ... ) {
+		return std::string();
 	}
-	return a;
 }
 
-void DataFile::verifyWriteRequest(int startSample, int endSample)
+void DataFile::verifyWriteRequest(int64_t startSample, int64_t endSample)
 {
 	if (readOnly()) {
 		throw std::logic_error("Cannot write to DataFile marked read-only.");
 	}
 
 	/* Validate requested samples */
-	int requestedSamples = endSample - startSample;
-	if (requestedSamples <= 0) {
+	auto requestedSamples = endSample - startSample;
+	if ( (startSample < 0) || (requestedSamples <= 0) ) {
 		throw std::logic_error("Requested sample range invalid: (" + 
 				std::to_string(startSample) + "-" + 
 				std::to_string(endSample) + ")");
@@ -508,10 +1625,14 @@ void DataFile::verifyWriteRequest(int startSample, int endSample)
 		hsize_t dims[DatasetRank] = {0, 0};
 		m_dataspace = m_dataset.getSpace();
 		m_dataspace.getSimpleExtentDims(dims);
-		auto nblocks = static_cast<int>(std::ceil(
-				static_cast<float>(endSample - datasetSize()) /
-				static_cast<float>(BlockSize)));
-		dims[1] += nblocks * BlockSize;
+		auto nblocks = static_cast<hsize_t>(
+				(endSample - datasetSize() + BlockSize - 1) / BlockSize);
+		if (m_swmrWrite) {
+			dims[1] = static_cast<hsize_t>(endSample);
+		} else {
+			dims[1] += nblocks * BlockSize;
+		}
+		IOTimer timer(m_ioCounters, IOOperation::Extend);
 		m_dataset.extend(dims);
 		m_dataspace = m_dataset.getSpace();
 	}
@@ -519,10 +1640,10 @@ void DataFile::verifyWriteRequest(int startSample, int endSample)
 	setNumSamples(m_nsamples);
 }
 
-H5::DataSpace DataFile::setupWrite(int startSample, int endSample)
+H5::DataSpace DataFile::setupWrite(int64_t startSample, int64_t endSample)
 {
 	/* Compute the destination file data space */
-	int requestedSamples = endSample - startSample;
+	auto requestedSamples = endSample - startSample;
 		hsize_t memoffset[DatasetRank] = {0,
 			static_cast<hsize_t>(startSample)};
 	hsize_t memcount[DatasetRank] = {
@@ -558,23 +1679,28 @@ H5::DataSpace DataFile::setupWrite(int startSample, int endSample)
 	return memspace;
 }
 
-int DataFile::datasetSize() const {
+int64_t DataFile::datasetSize() const {
 	hsize_t dims[DatasetRank] = { 0, 0 };
 	m_dataspace.getSimpleExtentDims(dims);
-	return static_cast<int>(dims[1]);
+	return static_cast<int64_t>(dims[1]);
 }
 
 void DataFile::setMeans(const arma::vec& means)
 {
-	const char name[] = "channel-means";
-	if (m_dataset.attrExists(name)) {
-		m_dataset.removeAttr(name);
+	verifyUpdatable("set channel means");
+
+	/* Write pending statistics first, so their means do not replace these */
+	if (!readOnly() && m_statsDirty) {
+		writeStats();
 	}
+	writeMeans(means);
+}
+
+void DataFile::writeMeans(const arma::vec& means)
+{
 	hsize_t dims[1] = { static_cast<hsize_t>(means.n_elem) };
-	auto space = H5::DataSpace(1, dims);
-	auto attr = m_dataset.createAttribute(name, H5::PredType::IEEE_F64LE, space);
-	attr.write(H5::PredType::IEEE_F64LE, means.memptr());
-	attr.close();
+	writeArrayAttr(m_ioCounters, m_dataset, "channel-means", H5::PredType::IEEE_F64LE,
+			1, dims, means.memptr());
 }
 
 arma::vec DataFile::means() const
@@ -591,8 +1717,16 @@ arma::vec DataFile::means() const
 	hsize_t dims[1] = { 0 };
 	space.getSimpleExtentDims(dims);
 	ret.set_size(dims[0]);
-	attr.read(H5::PredType::IEEE_F64LE, ret.memptr());
+	{
+		IOTimer timer(m_ioCounters, IOOperation::AttrRead, ret.n_elem * sizeof(double));
+		attr.read(H5::PredType::IEEE_F64LE, ret.memptr());
+	}
 	attr.close();
+
+	/* Files written with SWMR access hold NaN until the means are known */
+	if (std::any_of(ret.begin(), ret.end(), [](double v) { return std::isnan(v); })) {
+		ret.reset();
+	}
 	return ret;
 }
 
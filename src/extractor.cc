@@ -0,0 +1,364 @@
+/* extractor.cc
+ *
+ * Implementation of the extraction of candidate spike snippets.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "extractor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace snipfile {
+
+/* Find the position of each sample of `data` below `level`. The comparison
+ * is vectorized, and since candidates are rare, only the lanes which pass
+ * are visited.
+ */
+static void findBelow(const int16_t* data, size_t n, int16_t level,
+		std::vector<uint32_t>& positions)
+{
+	positions.clear();
+	size_t i = 0;
+#if defined(__AVX2__)
+	auto levels = _mm256_set1_epi16(level);
+	for (; i + 16 <= n; i += 16) {
+		auto values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+					_mm256_cmpgt_epi16(levels, values)));
+		while (mask) {
+			auto bit = __builtin_ctz(mask);
+			positions.push_back(static_cast<uint32_t>(i + bit / 2));
+			mask &= ~(3u << bit);	// Each lane sets two bits
+		}
+	}
+#elif defined(__SSE2__)
+	auto levels = _mm_set1_epi16(level);
+	for (; i + 8 <= n; i += 8) {
+		auto values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		auto mask = static_cast<uint32_t>(_mm_movemask_epi8(
+					_mm_cmplt_epi16(values, levels)));
+		while (mask) {
+			auto bit = __builtin_ctz(mask);
+			positions.push_back(static_cast<uint32_t>(i + bit / 2));
+			mask &= ~(3u << bit);	// Each lane sets two bits
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		if (data[i] < level) {
+			positions.push_back(static_cast<uint32_t>(i));
+		}
+	}
+}
+
+ExtractorOptions::ExtractorOptions()
+	: threshold(DEFAULT_THRESHOLD),
+	  nbefore(NUM_SAMPLES_BEFORE),
+	  nafter(NUM_SAMPLES_AFTER),
+	  windowSize(WINDOW_SIZE),
+	  blockSize(datafile::BlockSize),
+	  channelsPerGroup(0),
+	  nthreads(0)
+{
+}
+
+Extractor::Extractor(const datafile::DataFile& file, const ExtractorOptions& options)
+	: m_file(file),
+	  m_options(options),
+	  m_pool(options.nthreads)
+{
+	if ( (m_options.threshold <= 0) || (m_options.blockSize <= 0) ||
+			(m_options.channelsPerGroup < 0) ) {
+		throw std::invalid_argument("Extractor threshold, block size and "
+				"channels per group must be positive");
+	}
+	if (m_options.channels.is_empty()) {
+		m_options.channels.set_size(m_file.nchannels());
+		for (int c = 0; c < m_file.nchannels(); c++) {
+			m_options.channels(c) = c;
+		}
+	}
+	auto& channels = m_options.channels;
+	for (arma::uword i = 0; i < channels.n_elem; i++) {
+		if ( (channels(i) >= static_cast<arma::uword>(m_file.nchannels())) ||
+				((i > 0) && (channels(i) <= channels(i - 1))) ) {
+			throw std::invalid_argument("Extracted channels must be increasing, "
+					"and in the recording");
+		}
+	}
+
+	/* Group channels by rows of chunks, so that each group's reads touch
+	 * as few chunks as possible. A contiguous file has one "row" of every
+	 * channel, so split its channels evenly among the threads instead.
+	 */
+	if (m_options.channelsPerGroup == 0) {
+		if (m_file.chunked()) {
+			m_options.channelsPerGroup = static_cast<int>(m_file.options().chunkChannels);
+		} else {
+			auto nthreads = static_cast<int>(m_pool.size());
+			m_options.channelsPerGroup = std::max(1,
+					(m_file.nchannels() + nthreads - 1) / nthreads);
+		}
+	}
+	auto perGroup = static_cast<arma::uword>(m_options.channelsPerGroup);
+	for (arma::uword i = 0; i < channels.n_elem; i++) {
+		if ( (i == 0) || (channels(i) / perGroup != channels(i - 1) / perGroup) ) {
+			m_groups.push_back(i);
+		}
+	}
+	m_groups.push_back(channels.n_elem);
+}
+
+const ExtractorOptions& Extractor::options() const
+{
+	return m_options;
+}
+
+const arma::vec& Extractor::means()
+{
+	if (m_means.is_empty()) {
+		computeStatistics();
+	}
+	return m_means;
+}
+
+const arma::vec& Extractor::thresholds()
+{
+	if (m_thresholds.is_empty()) {
+		computeStatistics();
+	}
+	return m_thresholds;
+}
+
+void Extractor::setThresholds(const arma::vec& thresholds)
+{
+	if (thresholds.n_elem != m_options.channels.n_elem) {
+		throw std::invalid_argument("There must be one threshold for each "
+				"extracted channel");
+	}
+	m_thresholds = thresholds;
+}
+
+void Extractor::computeStatistics()
+{
+	auto& channels = m_options.channels;
+	arma::vec means(channels.n_elem), stddevs(channels.n_elem);
+	auto& stats = m_file.stats();
+	if (stats.complete && (stats.count == static_cast<uint64_t>(m_file.nsamples())) &&
+			(stats.mean.n_elem == static_cast<arma::uword>(m_file.nchannels()))) {
+		auto all = stats.stddev();
+		for (arma::uword i = 0; i < channels.n_elem; i++) {
+			means(i) = stats.mean(channels(i));
+			stddevs(i) = all(channels(i));
+		}
+	} else {
+
+		/* Make one pass over the data, with a task for each group */
+		std::vector<std::future<datafile::ChannelStats> > results;
+		for (size_t g = 0; g + 1 < m_groups.size(); g++) {
+			int startChan = channels(m_groups[g]);
+			int endChan = channels(m_groups[g + 1] - 1) + 1;
+			results.push_back(m_pool.submit([this, startChan, endChan]() {
+				datafile::ChannelStats groupStats;
+				arma::Mat<int16_t> block;
+				for (int64_t start = 0; start < m_file.nsamples(); start += m_options.blockSize) {
+					auto end = std::min(start + m_options.blockSize, m_file.nsamples());
+					m_file.data(startChan, endChan, start, end, block);
+					groupStats.accumulate(block.memptr(), block.n_rows, block.n_cols,
+							block.n_rows, -std::numeric_limits<double>::infinity(),
+							std::numeric_limits<double>::infinity());
+				}
+				return groupStats;
+			}));
+		}
+		auto allStats = datafile::waitAll(results);
+		for (size_t g = 0; g + 1 < m_groups.size(); g++) {
+			auto& groupStats = allStats[g];
+			auto groupStddevs = groupStats.stddev();
+			auto startChan = channels(m_groups[g]);
+			for (auto i = m_groups[g]; i < m_groups[g + 1]; i++) {
+				means(i) = groupStats.mean(channels(i) - startChan);
+				stddevs(i) = groupStddevs(channels(i) - startChan);
+			}
+		}
+	}
+	m_means = means;
+	if (m_thresholds.is_empty()) {
+		m_thresholds = stddevs * m_options.threshold;
+	}
+}
+
+Extractor::GroupResult Extractor::searchGroup(size_t group, int64_t start, int64_t end) const
+{
+	auto& channels = m_options.channels;
+	auto first = m_groups[group], last = m_groups[group + 1];
+	int startChan = static_cast<int>(channels(first));
+	int endChan = static_cast<int>(channels(last - 1)) + 1;
+
+	/* Read the block with enough samples on either side for the window and
+	 * snippet of any spike in it.
+	 */
+	auto halo = static_cast<int64_t>(std::max(m_options.nbefore, m_options.nafter) +
+			m_options.windowSize);
+	auto readStart = std::max<int64_t>(0, start - halo);
+	auto readEnd = std::min(m_file.nsamples(), end + halo);
+	arma::Mat<int16_t> block;
+	m_file.data(startChan, endChan, readStart, readEnd, block);
+	size_t length = block.n_rows;
+	size_t ownStart = start - readStart, ownEnd = end - readStart;
+	auto window = m_options.windowSize;
+	auto nbefore = m_options.nbefore, nafter = m_options.nafter;
+
+	GroupResult result;
+	result.idx.resize(last - first);
+	result.snips.resize(last - first);
+	std::vector<uint32_t> candidates;
+	for (auto p = first; p < last; p++) {
+		auto level = std::ceil(m_means(p) - m_thresholds(p));
+		if (level <= std::numeric_limits<int16_t>::min()) {
+			continue;
+		}
+		level = std::min(level, static_cast<double>(std::numeric_limits<int16_t>::max()));
+		auto column = block.colptr(channels(p) - startChan);
+		findBelow(column + ownStart, ownEnd - ownStart, static_cast<int16_t>(level),
+				candidates);
+
+		auto& idx = result.idx[p - first];
+		auto& snips = result.snips[p - first];
+		for (auto candidate : candidates) {
+			size_t i = ownStart + candidate;
+			if ( (i < nbefore) || (i + nafter >= length) ) {
+				continue;
+			}
+
+			/* The peak must be below every sample before it in the window,
+			 * and no higher than any after it.
+			 */
+			auto value = column[i];
+			bool peak = true;
+			for (size_t j = (i > window) ? i - window : 0; peak && (j < i); j++) {
+				peak = (column[j] > value);
+			}
+			for (size_t j = i + 1; peak && (j <= std::min(i + window, length - 1)); j++) {
+				peak = (column[j] >= value);
+			}
+			if (peak) {
+				idx.push_back(static_cast<uint64_t>(readStart + i));
+				snips.insert(snips.end(), column + i - nbefore, column + i + nafter + 1);
+			}
+		}
+	}
+	return result;
+}
+
+Extractor::Counters Extractor::run(SnipFile& snipFile)
+{
+	auto started = std::chrono::steady_clock::now();
+	if ( (static_cast<size_t>(snipFile.nsamplesAfter()) != m_options.nafter) ||
+			(static_cast<size_t>(-snipFile.nsamplesBefore()) != m_options.nbefore) ) {
+		throw std::invalid_argument("The snippet file and extractor must use "
+				"the same snippet size");
+	}
+	means();
+	auto& channels = m_options.channels;
+	snipFile.setChannels(channels);
+	snipFile.setThresholds(m_thresholds);
+
+	Counters counters = { 0, 0, 0, 0 };
+	auto snipSize = m_options.nbefore + m_options.nafter + 1;
+	bool columnar = (snipFile.layout() == SnipLayout::Columnar);
+	std::vector<std::vector<arma::uvec> > blockIdx(channels.n_elem);
+	std::vector<std::vector<arma::Mat<short> > > blockSnips(channels.n_elem);
+
+	typedef std::vector<std::future<GroupResult> > Block;
+	auto search = [this](int64_t start) -> Block {
+		Block block;
+		auto end = std::min(start + m_options.blockSize, m_file.nsamples());
+		for (size_t g = 0; g + 1 < m_groups.size(); g++) {
+			block.push_back(m_pool.submit([this, g, start, end]() {
+				return searchGroup(g, start, end);
+			}));
+		}
+		return block;
+	};
+	auto write = [&](Block& block) {
+		auto results = datafile::waitAll(block);
+		for (size_t g = 0; g < results.size(); g++) {
+			auto& result = results[g];
+			for (auto p = m_groups[g]; p < m_groups[g + 1]; p++) {
+				auto& idx = result.idx[p - m_groups[g]];
+				auto& snips = result.snips[p - m_groups[g]];
+				if (idx.empty()) {
+					continue;
+				}
+				arma::uvec newIdx(idx.size());
+				std::copy(idx.begin(), idx.end(), newIdx.begin());
+				arma::Mat<short> newSnips(snips.data(), snipSize, idx.size());
+				if (columnar) {
+					blockIdx[p].push_back(std::move(newIdx));
+					blockSnips[p].push_back(std::move(newSnips));
+				} else {
+					snipFile.appendSpikeSnips(channels(p), newIdx, newSnips);
+				}
+				counters.spikes += idx.size();
+			}
+		}
+	};
+
+	/* Search each block while the snippets of the last are written */
+	Block pending;
+	for (int64_t start = 0; start < m_file.nsamples(); start += m_options.blockSize) {
+		auto next = search(start);
+		write(pending);
+		pending = std::move(next);
+	}
+	write(pending);
+
+	/* Join each channel's blocks once, rather than as they arrive */
+	if (columnar) {
+		std::vector<arma::uvec> allIdx(channels.n_elem);
+		std::vector<arma::Mat<short> > allSnips(channels.n_elem);
+		for (arma::uword p = 0; p < channels.n_elem; p++) {
+			arma::uword total = 0;
+			for (auto& idx : blockIdx[p]) {
+				total += idx.n_elem;
+			}
+			allIdx[p].set_size(total);
+			allSnips[p].set_size(snipSize, total);
+			arma::uword next = 0;
+			for (size_t b = 0; b < blockIdx[p].size(); b++) {
+				auto n = blockIdx[p][b].n_elem;
+				std::copy(blockIdx[p][b].begin(), blockIdx[p][b].end(),
+						allIdx[p].begin() + next);
+				std::copy(blockSnips[p][b].begin(), blockSnips[p][b].end(),
+						allSnips[p].colptr(next));
+				next += n;
+			}
+			blockIdx[p].clear();
+			blockSnips[p].clear();
+		}
+		snipFile.writeSpikeSnips(allIdx, allSnips);
+	}
+
+	counters.samples = static_cast<uint64_t>(m_file.nsamples()) * channels.n_elem;
+	counters.elapsedSeconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - started).count();
+	counters.throughput = (counters.elapsedSeconds > 0) ?
+		counters.samples / counters.elapsedSeconds : 0;
+	return counters;
+}
+
+} // end snipfile namespace
+
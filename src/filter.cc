@@ -0,0 +1,371 @@
+/* filter.cc
+ *
+ * Implementation of the streaming IIR and FIR filters.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace datafile {
+
+/* Channels are interleaved into groups of lanes, which are filtered
+ * together, one channel per lane of a vector register.
+ */
+#if defined(__AVX2__)
+typedef __m256 Lanes;
+static const size_t NumLanes = 8;
+static inline Lanes splat(float v) { return _mm256_set1_ps(v); }
+static inline Lanes load(const float* src) { return _mm256_loadu_ps(src); }
+static inline void store(float* dst, Lanes v) { _mm256_storeu_ps(dst, v); }
+static inline Lanes add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+static inline Lanes sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+static inline Lanes mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+#elif defined(__SSE2__)
+typedef __m128 Lanes;
+static const size_t NumLanes = 4;
+static inline Lanes splat(float v) { return _mm_set1_ps(v); }
+static inline Lanes load(const float* src) { return _mm_loadu_ps(src); }
+static inline void store(float* dst, Lanes v) { _mm_storeu_ps(dst, v); }
+static inline Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+#else
+static const size_t NumLanes = 4;
+struct Lanes {
+	float v[NumLanes];
+};
+static inline Lanes splat(float v)
+{
+	Lanes r;
+	std::fill(r.v, r.v + NumLanes, v);
+	return r;
+}
+static inline Lanes load(const float* src)
+{
+	Lanes r;
+	std::copy(src, src + NumLanes, r.v);
+	return r;
+}
+static inline void store(float* dst, Lanes v) { std::copy(v.v, v.v + NumLanes, dst); }
+#define LANEWISE(name, op) \
+	static inline Lanes name(Lanes a, Lanes b) \
+	{ \
+		for (size_t i = 0; i < NumLanes; i++) \
+			a.v[i] = a.v[i] op b.v[i]; \
+		return a; \
+	}
+LANEWISE(add, +)
+LANEWISE(sub, -)
+LANEWISE(mul, *)
+#undef LANEWISE
+#endif
+
+/* Samples of each channel interleaved and filtered at a time */
+static const size_t SubBlockSize = 256;
+
+/* Filter `n` interleaved samples in place through each section in turn,
+ * with the transposed direct form II.
+ */
+static void iirLanes(float* buf, size_t n, const std::vector<Biquad>& sections,
+		float* state)
+{
+	for (size_t s = 0; s < sections.size(); s++) {
+		auto& section = sections[s];
+		auto b0 = splat(static_cast<float>(section.b0));
+		auto b1 = splat(static_cast<float>(section.b1));
+		auto b2 = splat(static_cast<float>(section.b2));
+		auto a1 = splat(static_cast<float>(section.a1));
+		auto a2 = splat(static_cast<float>(section.a2));
+		auto z1 = load(state + 2 * s * NumLanes);
+		auto z2 = load(state + (2 * s + 1) * NumLanes);
+		for (size_t i = 0; i < n; i++) {
+			auto x = load(buf + i * NumLanes);
+			auto y = add(mul(b0, x), z1);
+			z1 = add(sub(mul(b1, x), mul(a1, y)), z2);
+			z2 = sub(mul(b2, x), mul(a2, y));
+			store(buf + i * NumLanes, y);
+		}
+		store(state + 2 * s * NumLanes, z1);
+		store(state + (2 * s + 1) * NumLanes, z2);
+	}
+}
+
+/* Filter `n` interleaved samples in place, where the `taps.size() - 1`
+ * samples before them hold the history. Outputs are computed from the
+ * last backwards, so that each overwrites only a sample which no earlier
+ * output needs.
+ */
+static void firLanes(float* buf, size_t n, const std::vector<float>& taps)
+{
+	auto history = taps.size() - 1;
+	for (size_t i = n; i-- > 0; ) {
+		auto newest = buf + (i + history) * NumLanes;
+		auto y = mul(splat(taps[0]), load(newest));
+		for (size_t k = 1; k < taps.size(); k++) {
+			y = add(y, mul(splat(taps[k]), load(newest - k * NumLanes)));
+		}
+		store(newest, y);
+	}
+}
+
+/* Design a Butterworth low- or high-pass filter by the bilinear transform,
+ * with each pair of poles of the analog prototype in its own section.
+ */
+static std::vector<Biquad> butterworth(double cutoff, double sampleRate,
+		int order, bool highpass)
+{
+	if ( (order <= 0) || (sampleRate <= 0) || (cutoff <= 0) ||
+			(cutoff >= sampleRate / 2) ) {
+		throw std::invalid_argument("Filter order must be positive, and its "
+				"cutoff between zero and the Nyquist frequency");
+	}
+	auto w0 = 2 * M_PI * cutoff / sampleRate;
+	std::vector<Biquad> sections;
+	if (order % 2) {
+		auto k = std::tan(w0 / 2);
+		auto a1 = (k - 1) / (k + 1);
+		if (highpass) {
+			sections.push_back({ 1 / (1 + k), -1 / (1 + k), 0, a1, 0 });
+		} else {
+			sections.push_back({ k / (1 + k), k / (1 + k), 0, a1, 0 });
+		}
+	}
+	auto cosw = std::cos(w0);
+	for (int p = 1; p <= order / 2; p++) {
+		auto theta = (order % 2) ? (p * M_PI / order) : ((2 * p - 1) * M_PI / (2 * order));
+		auto q = 1 / (2 * std::cos(theta));
+		auto alpha = std::sin(w0) / (2 * q);
+		auto a0 = 1 + alpha;
+		auto b0 = (highpass ? (1 + cosw) : (1 - cosw)) / (2 * a0);
+		sections.push_back({ b0, highpass ? -2 * b0 : 2 * b0, b0,
+				-2 * cosw / a0, (1 - alpha) / a0 });
+	}
+	return sections;
+}
+
+Filter::Filter(const std::vector<Biquad>& sections)
+	: m_sections(sections),
+	  m_nchannels(0),
+	  m_primed(false)
+{
+	if (m_sections.empty()) {
+		throw std::invalid_argument("An IIR filter must have at least one section");
+	}
+}
+
+Filter::Filter(const std::vector<double>& taps)
+	: m_taps(taps),
+	  m_nchannels(0),
+	  m_primed(false)
+{
+	if (m_taps.empty()) {
+		throw std::invalid_argument("An FIR filter must have at least one tap");
+	}
+}
+
+Filter Filter::highpass(double cutoff, double sampleRate, int order)
+{
+	return Filter(butterworth(cutoff, sampleRate, order, true));
+}
+
+Filter Filter::lowpass(double cutoff, double sampleRate, int order)
+{
+	return Filter(butterworth(cutoff, sampleRate, order, false));
+}
+
+Filter Filter::bandpass(double low, double high, double sampleRate, int order)
+{
+	if (low >= high) {
+		throw std::invalid_argument("The low cutoff of a band-pass filter "
+				"must be below the high cutoff");
+	}
+	auto sections = butterworth(low, sampleRate, order, true);
+	auto lowpass = butterworth(high, sampleRate, order, false);
+	sections.insert(sections.end(), lowpass.begin(), lowpass.end());
+	return Filter(sections);
+}
+
+Filter Filter::firBandpass(double low, double high, double sampleRate, size_t ntaps)
+{
+	if ( (ntaps % 2 == 0) || (sampleRate <= 0) || (low <= 0) ||
+			(low >= high) || (high >= sampleRate / 2) ) {
+		throw std::invalid_argument("FIR filters must have an odd number of "
+				"taps, and cutoffs increasing between zero and the Nyquist frequency");
+	}
+
+	/* Windowed difference of ideal low-pass filters, scaled to unit gain
+	 * at the centre of the pass band.
+	 */
+	auto fl = low / sampleRate, fh = high / sampleRate;
+	auto middle = static_cast<double>(ntaps - 1) / 2;
+	auto sinc = [](double x) {
+		return (x == 0) ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+	};
+	std::vector<double> taps(ntaps);
+	std::complex<double> response = 0;
+	auto centre = M_PI * (fl + fh);
+	for (size_t n = 0; n < ntaps; n++) {
+		auto t = n - middle;
+		auto window = (ntaps == 1) ? 1.0 : 0.54 - 0.46 * std::cos(2 * M_PI * n / (ntaps - 1));
+		taps[n] = (2 * fh * sinc(2 * fh * t) - 2 * fl * sinc(2 * fl * t)) * window;
+		response += taps[n] * std::polar(1.0, -centre * n);
+	}
+	for (auto& tap : taps) {
+		tap /= std::abs(response);
+	}
+	return Filter(taps);
+}
+
+bool Filter::isFir() const
+{
+	return !m_taps.empty();
+}
+
+const std::vector<Biquad>& Filter::sections() const
+{
+	return m_sections;
+}
+
+const std::vector<double>& Filter::taps() const
+{
+	return m_taps;
+}
+
+void Filter::reset()
+{
+	m_nchannels = 0;
+	m_primed = false;
+	m_state.clear();
+}
+
+void Filter::process(const arma::Mat<int16_t>& in, arma::fmat& out)
+{
+	run(in, out);
+}
+
+void Filter::process(const arma::fmat& in, arma::fmat& out)
+{
+	run(in, out);
+}
+
+void Filter::filtfilt(const arma::Mat<int16_t>& in, arma::fmat& out) const
+{
+	Filter filter(*this);
+	filter.reset();
+	filter.process(in, out);
+	auto reverse = [&out]() {
+		for (arma::uword c = 0; c < out.n_cols; c++) {
+			std::reverse(out.colptr(c), out.colptr(c) + out.n_rows);
+		}
+	};
+	reverse();
+	filter.reset();
+	filter.process(out, out);
+	reverse();
+}
+
+template<class T>
+void Filter::prime(const arma::Mat<T>& in)
+{
+	auto stateSize = isFir() ? m_taps.size() - 1 : 2 * m_sections.size();
+	for (arma::uword c = 0; c < in.n_cols; c++) {
+		auto state = m_state.data() + (c / NumLanes) * stateSize * NumLanes + c % NumLanes;
+		double u = in(0, c);
+		if (isFir()) {
+			for (size_t k = 0; k < stateSize; k++) {
+				state[k * NumLanes] = static_cast<float>(u);
+			}
+			continue;
+		}
+		for (size_t s = 0; s < m_sections.size(); s++) {
+			auto& section = m_sections[s];
+			auto denominator = 1 + section.a1 + section.a2;
+			auto y = (denominator == 0) ? 0.0 :
+				(section.b0 + section.b1 + section.b2) * u / denominator;
+			state[2 * s * NumLanes] = static_cast<float>(y - section.b0 * u);
+			state[(2 * s + 1) * NumLanes] = static_cast<float>(section.b2 * u - section.a2 * y);
+			u = y;
+		}
+	}
+	m_primed = true;
+}
+
+template<class T>
+void Filter::run(const arma::Mat<T>& in, arma::fmat& out)
+{
+	size_t nsamples = in.n_rows, nchannels = in.n_cols;
+	auto stateSize = isFir() ? m_taps.size() - 1 : 2 * m_sections.size();
+	auto ngroups = (nchannels + NumLanes - 1) / NumLanes;
+	if (m_nchannels == 0) {
+		m_nchannels = nchannels;
+		m_state.assign(ngroups * stateSize * NumLanes, 0.0f);
+	} else if (nchannels != m_nchannels) {
+		throw std::invalid_argument("Blocks passed to a filter must all have "
+				"the same number of channels");
+	}
+	out.set_size(nsamples, nchannels);
+	if (nsamples == 0) {
+		return;
+	}
+	if (!m_primed) {
+		prime(in);
+	}
+
+	std::vector<float> taps(m_taps.begin(), m_taps.end());
+	auto history = isFir() ? stateSize : 0;
+	std::vector<float> buffer((history + SubBlockSize) * NumLanes);
+	auto samples = buffer.data() + history * NumLanes;
+	for (size_t group = 0; group < ngroups; group++) {
+		auto first = group * NumLanes;
+		auto lanes = std::min(NumLanes, nchannels - first);
+		auto state = m_state.data() + group * stateSize * NumLanes;
+		for (size_t start = 0; start < nsamples; start += SubBlockSize) {
+			auto n = std::min(SubBlockSize, nsamples - start);
+
+			/* Interleave the channels of the group, zeroing unused lanes */
+			for (size_t lane = 0; lane < NumLanes; lane++) {
+				if (lane < lanes) {
+					auto column = in.colptr(first + lane) + start;
+					for (size_t i = 0; i < n; i++) {
+						samples[i * NumLanes + lane] = static_cast<float>(column[i]);
+					}
+				} else {
+					for (size_t i = 0; i < n; i++) {
+						samples[i * NumLanes + lane] = 0.0f;
+					}
+				}
+			}
+
+			if (isFir()) {
+				std::copy(state, state + history * NumLanes, buffer.begin());
+				std::copy(buffer.begin() + n * NumLanes,
+						buffer.begin() + (n + history) * NumLanes, state);
+				firLanes(buffer.data(), n, taps);
+			} else {
+				iirLanes(samples, n, m_sections, state);
+			}
+
+			for (size_t lane = 0; lane < lanes; lane++) {
+				auto column = out.colptr(first + lane) + start;
+				for (size_t i = 0; i < n; i++) {
+					column[i] = samples[i * NumLanes + lane];
+				}
+			}
+		}
+	}
+}
+
+} // end datafile namespace
+
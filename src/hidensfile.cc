@@ -12,8 +12,9 @@
 namespace hidensfile {
 
 HidensFile::HidensFile(std::string filename,
-		std::string array, int nchannels)
-		: DataFile(filename, array, nchannels)
+		std::string array, int nchannels,
+		const datafile::DataFileOptions& options)
+		: DataFile(filename, array, nchannels, options)
 {
 	if (readOnly())
 		readConfiguration();
@@ -22,6 +23,13 @@ HidensFile::HidensFile(std::string filename,
 	}
 }
 
+HidensFile::HidensFile(std::string filename, datafile::OpenMode mode,
+		const datafile::DataFileOptions& options)
+	: DataFile(filename, mode, options)
+{
+	readConfiguration();
+}
+
 arma::Col<uint32_t> HidensFile::xpos() const { return m_xpos; }
 arma::Col<uint32_t> HidensFile::ypos() const { return m_ypos; }
 arma::Col<uint16_t> HidensFile::x() const { return m_x; }
@@ -142,7 +150,7 @@ void HidensFile::writeConfiguration()
 	}
 }
 
-void HidensFile::setAnalogOutputSize(int /* size */)
+void HidensFile::setAnalogOutputSize(int64_t /* size */)
 {
 }
 
@@ -16,8 +16,9 @@ hidenssnipfile::HidensSnipFile::HidensSnipFile(const std::string& name)
 
 hidenssnipfile::HidensSnipFile::HidensSnipFile(const std::string& name,
 		const hidensfile::HidensFile& source,
-		const size_t nbefore, const size_t nafter)
-	: snipfile::SnipFile(name, source, nbefore, nafter)
+		const size_t nbefore, const size_t nafter, const unsigned int deflate,
+		const snipfile::SnipLayout layout)
+	: snipfile::SnipFile(name, source, nbefore, nafter, deflate, layout)
 {
 	copyConfiguration(source);
 }
@@ -0,0 +1,155 @@
+/* iostats.cc
+ *
+ * Implementation of the I/O statistics of recording and snippet files.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "iostats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace datafile {
+
+double IOOperationStats::meanSeconds() const
+{
+	return (calls == 0) ? 0.0 : seconds / calls;
+}
+
+double IOOperationStats::quantileSeconds(double quantile) const
+{
+	if (calls == 0) {
+		return 0.0;
+	}
+	auto target = static_cast<uint64_t>(std::ceil(quantile * calls));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < latency.size(); i++) {
+		seen += latency[i];
+		if ( (seen >= target) && (seen > 0) ) {
+			return std::min(bucketSeconds(i), maxSeconds);
+		}
+	}
+	return maxSeconds;
+}
+
+double IOOperationStats::bucketSeconds(size_t bucket)
+{
+	return std::ldexp(1e-6, static_cast<int>(bucket));
+}
+
+const IOOperationStats& IOStats::operator[](IOOperation operation) const
+{
+	return operations[static_cast<size_t>(operation)];
+}
+
+static int64_t ticks(std::chrono::steady_clock::time_point time)
+{
+	return static_cast<int64_t>(time.time_since_epoch().count());
+}
+
+IOCounters::IOCounters()
+	: m_enabled(false)
+{
+	reset();
+}
+
+void IOCounters::setEnabled(bool enabled)
+{
+	m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void IOCounters::record(IOOperation operation, uint64_t bytes,
+		std::chrono::steady_clock::duration elapsed)
+{
+	auto& counts = m_counts[static_cast<size_t>(operation)];
+	auto ns = static_cast<uint64_t>(std::max<int64_t>(0,
+			std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+	counts.calls.fetch_add(1, std::memory_order_relaxed);
+	counts.bytes.fetch_add(bytes, std::memory_order_relaxed);
+	counts.nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+	auto longest = counts.maxNanoseconds.load(std::memory_order_relaxed);
+	while ( (ns > longest) && !counts.maxNanoseconds.compare_exchange_weak(
+			longest, ns, std::memory_order_relaxed) ) {
+	}
+
+	/* The bucket is one more than the index of the highest bit set in the
+	 * number of whole microseconds.
+	 */
+	size_t bucket = 0;
+	for (auto us = ns / 1000; (us > 0) && (bucket + 1 < IOLatencyBuckets); us >>= 1) {
+		bucket++;
+	}
+	counts.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void IOCounters::reset()
+{
+	for (auto& counts : m_counts) {
+		counts.calls.store(0, std::memory_order_relaxed);
+		counts.bytes.store(0, std::memory_order_relaxed);
+		counts.nanoseconds.store(0, std::memory_order_relaxed);
+		counts.maxNanoseconds.store(0, std::memory_order_relaxed);
+		for (auto& bucket : counts.latency) {
+			bucket.store(0, std::memory_order_relaxed);
+		}
+	}
+	m_resetTime.store(ticks(std::chrono::steady_clock::now()), std::memory_order_relaxed);
+}
+
+IOStats IOCounters::snapshot() const
+{
+	IOStats stats;
+	stats.enabled = enabled();
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::duration since(ticks(now) -
+			m_resetTime.load(std::memory_order_relaxed));
+	stats.seconds = std::chrono::duration<double>(since).count();
+	for (size_t i = 0; i < NumIOOperations; i++) {
+		auto& counts = m_counts[i];
+		auto& op = stats.operations[i];
+		op.calls = counts.calls.load(std::memory_order_relaxed);
+		op.bytes = counts.bytes.load(std::memory_order_relaxed);
+		op.seconds = counts.nanoseconds.load(std::memory_order_relaxed) * 1e-9;
+		op.maxSeconds = counts.maxNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+		for (size_t b = 0; b < IOLatencyBuckets; b++) {
+			op.latency[b] = counts.latency[b].load(std::memory_order_relaxed);
+		}
+	}
+	stats.metadataCacheHitRate = std::numeric_limits<double>::quiet_NaN();
+	stats.metadataCacheBytes = 0;
+	stats.chunkCacheBytes = 0;
+	return stats;
+}
+
+void IOCounters::readCacheStats(hid_t file, IOStats& stats)
+{
+	double rate = 0;
+	if (H5Fget_mdc_hit_rate(file, &rate) >= 0) {
+		stats.metadataCacheHitRate = rate;
+	}
+	size_t maxSize = 0, minCleanSize = 0, currentSize = 0;
+	int nentries = 0;
+	if (H5Fget_mdc_size(file, &maxSize, &minCleanSize, &currentSize, &nentries) >= 0) {
+		stats.metadataCacheBytes = currentSize;
+	}
+	auto access = H5Fget_access_plist(file);
+	if (access >= 0) {
+		int elements = 0;
+		size_t slots = 0, bytes = 0;
+		double w0 = 0;
+		if (H5Pget_cache(access, &elements, &slots, &bytes, &w0) >= 0) {
+			stats.chunkCacheBytes = bytes;
+		}
+		H5Pclose(access);
+	}
+}
+
+void IOCounters::resetCacheStats(hid_t file)
+{
+	H5Freset_mdc_hit_rate_stats(file);
+}
+
+} // end datafile namespace
+
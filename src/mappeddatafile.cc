@@ -0,0 +1,187 @@
+/* mappeddatafile.cc
+ *
+ * Implementation of finalized, memory-mapped recording files.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "mappeddatafile.h"
+#include "rechunk.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace datafile {
+
+void finalize(const std::string& source, const std::string& destination)
+{
+	struct stat buf;
+	if (stat(destination.c_str(), &buf) == 0) {
+		throw std::invalid_argument("Finalized file already exists: " + destination);
+	}
+
+	DataFile src(source, OpenMode::ReadOnly);
+	H5::H5File srcFile(source, H5F_ACC_RDONLY);
+	auto srcData = srcFile.openDataSet("data");
+	H5::H5File dstFile(destination, H5F_ACC_EXCL);
+
+	/* Remove the partial copy if anything fails */
+	try {
+		/* Create a contiguous dataset, exactly as large as the data, and
+		 * allocate its storage immediately so that it has an address in the file.
+		 */
+		hsize_t dims[DatasetRank] = {
+				static_cast<hsize_t>(src.nchannels()),
+				static_cast<hsize_t>(src.nsamples())
+			};
+		H5::DataSpace space(DatasetRank, dims);
+		H5::DSetCreatPropList props;
+		props.setLayout(H5D_CONTIGUOUS);
+		props.setAllocTime(H5D_ALLOC_TIME_EARLY);
+		auto dstData = dstFile.createDataSet("data", src.dtype(), space, props);
+
+		/* Copy data a block at a time */
+		arma::Mat<int16_t> block;
+		for (int64_t start = 0; start < src.nsamples(); start += BlockSize) {
+			auto end = std::min(start + BlockSize, src.nsamples());
+			src.data(start, end, block);
+			hsize_t count[DatasetRank] = { dims[0], static_cast<hsize_t>(end - start) };
+			hsize_t offset[DatasetRank] = { 0, static_cast<hsize_t>(start) };
+			auto fileSpace = dstData.getSpace();
+			fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+			H5::DataSpace memspace(DatasetRank, count);
+			dstData.write(block.memptr(), dtypeForMat(block), memspace, fileSpace);
+		}
+
+		/* Copy metadata, writing the number of samples as DataFile found it. */
+		copyRecordingMetadata(srcFile, dstFile, dims[1]);
+	} catch (...) {
+		dstFile.close();
+		std::remove(destination.c_str());
+		throw;
+	}
+}
+
+MappedDataFile::MappedDataFile(const std::string& filename)
+	: m_filename(filename),
+	  m_map(nullptr),
+	  m_mapLength(0),
+	  m_data(nullptr)
+{
+	/* Find the data and metadata through HDF5 */
+	haddr_t address = HADDR_UNDEF;
+	try {
+		H5::Exception::dontPrint();
+		H5::H5File file(m_filename, H5F_ACC_RDONLY);
+		auto dset = file.openDataSet("data");
+		if (dset.getCreatePlist().getLayout() != H5D_CONTIGUOUS) {
+			throw std::invalid_argument("Data in " + m_filename +
+					" is not contiguous, it must be finalized before mapping");
+		}
+		if ( !(dset.getDataType() == H5::PredType::STD_I16LE) ||
+				!(H5::PredType::NATIVE_INT16 == H5::PredType::STD_I16LE) ) {
+			throw std::invalid_argument("Data in " + m_filename +
+					" cannot be mapped as native 16-bit integers");
+		}
+		hsize_t dims[DatasetRank] = { 0, 0 };
+		dset.getSpace().getSimpleExtentDims(dims);
+		m_nchannels = dims[0];
+		m_nsamples = dims[1];
+		dset.openAttribute("sample-rate").read(H5::PredType::NATIVE_FLOAT, &m_sampleRate);
+		dset.openAttribute("gain").read(H5::PredType::NATIVE_FLOAT, &m_gain);
+		dset.openAttribute("offset").read(H5::PredType::NATIVE_FLOAT, &m_offset);
+		address = dset.getOffset();
+	} catch (H5::Exception& e) {
+		throw std::invalid_argument("Could not read recording from " + m_filename);
+	}
+	if (m_nsamples * m_nchannels == 0) {
+		return;
+	}
+	if (address == HADDR_UNDEF) {
+		throw std::invalid_argument("Data in " + m_filename + " is not allocated");
+	}
+
+#ifdef _WIN32
+	throw std::runtime_error("Memory-mapped recordings are not supported on Windows");
+#else
+	/* Map the dataset's bytes, starting from the enclosing page */
+	auto fd = open(m_filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Could not open " + m_filename +
+				": " + std::strerror(errno));
+	}
+	auto pageSize = static_cast<haddr_t>(sysconf(_SC_PAGESIZE));
+	auto start = address - (address % pageSize);
+	m_mapLength = static_cast<size_t>(address - start +
+			m_nsamples * m_nchannels * sizeof(int16_t));
+	m_map = mmap(nullptr, m_mapLength, PROT_READ, MAP_SHARED, fd,
+			static_cast<off_t>(start));
+	auto error = errno;
+	close(fd);
+	if (m_map == MAP_FAILED) {
+		m_map = nullptr;
+		throw std::runtime_error("Could not map " + m_filename +
+				": " + std::strerror(error));
+	}
+	m_data = reinterpret_cast<int16_t*>(static_cast<char*>(m_map) + (address - start));
+#endif
+}
+
+MappedDataFile::~MappedDataFile()
+{
+#ifndef _WIN32
+	if (m_map) {
+		munmap(m_map, m_mapLength);
+	}
+#endif
+}
+
+std::string MappedDataFile::filename() const { return m_filename; }
+
+int64_t MappedDataFile::nsamples() const { return static_cast<int64_t>(m_nsamples); }
+
+int MappedDataFile::nchannels() const { return static_cast<int>(m_nchannels); }
+
+float MappedDataFile::sampleRate() const { return m_sampleRate; }
+
+float MappedDataFile::gain() const { return m_gain; }
+
+float MappedDataFile::offset() const { return m_offset; }
+
+arma::Mat<int16_t> MappedDataFile::data() const
+{
+	return data(0, nchannels());
+}
+
+arma::Mat<int16_t> MappedDataFile::data(int startChan, int endChan) const
+{
+	if ( (startChan < 0) || (endChan > nchannels()) || (endChan <= startChan) ) {
+		throw std::logic_error("Requested channel range invalid: (" +
+				std::to_string(startChan) + " - " + std::to_string(endChan) + ")");
+	}
+	if (m_data == nullptr) {
+		return arma::Mat<int16_t>(m_nsamples, endChan - startChan);
+	}
+
+	/* Alias the mapped memory, without copying, and forbid resizing. */
+	return arma::Mat<int16_t>(const_cast<int16_t*>(channel(startChan)),
+			m_nsamples, endChan - startChan, false, true);
+}
+
+const int16_t* MappedDataFile::channel(int channel) const
+{
+	return m_data + static_cast<uint64_t>(channel) * m_nsamples;
+}
+
+} // end datafile namespace
+
@@ -0,0 +1,101 @@
+/* noisesampler.cc
+ *
+ * Implementation of the sampling of random noise snippets.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "noisesampler.h"
+#include "readplan.h"
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+namespace snipfile {
+
+NoiseSampler::NoiseSampler(const datafile::DataFile& file, uint64_t seed)
+	: m_file(file),
+	  m_seed(seed)
+{
+}
+
+uint64_t NoiseSampler::seed() const
+{
+	return m_seed;
+}
+
+arma::uvec NoiseSampler::indices(size_t count, size_t nbefore, size_t nafter) const
+{
+	auto nsamples = static_cast<uint64_t>(m_file.nsamples());
+	uint64_t available = (nsamples > nbefore + nafter) ?
+		nsamples - nbefore - nafter : 0;
+	if (count > available) {
+		throw std::invalid_argument("The recording is too short for the "
+				"requested number of noise snippets");
+	}
+
+	/* The output of the Mersenne twister is fixed by the standard, but
+	 * the distributions are not, so samples are mapped into range directly.
+	 * Duplicates are replaced until enough distinct samples are drawn.
+	 */
+	std::mt19937_64 rng(m_seed);
+	std::vector<uint64_t> drawn;
+	drawn.reserve(count);
+	while (drawn.size() < count) {
+		for (auto remaining = count - drawn.size(); remaining > 0; remaining--) {
+			drawn.push_back(nbefore + rng() % available);
+		}
+		std::sort(drawn.begin(), drawn.end());
+		drawn.erase(std::unique(drawn.begin(), drawn.end()), drawn.end());
+	}
+
+	arma::uvec idx(count);
+	std::copy(drawn.begin(), drawn.end(), idx.begin());
+	return idx;
+}
+
+void NoiseSampler::sample(const arma::uvec& channels, size_t count,
+		size_t nbefore, size_t nafter, std::vector<arma::uvec>& idx,
+		std::vector<arma::Mat<short> >& snips, datafile::ThreadPool* pool) const
+{
+	auto drawn = indices(count, nbefore, nafter);
+	auto snipSize = nbefore + nafter + 1;
+	idx.assign(channels.n_elem, drawn);
+	snips.assign(channels.n_elem, arma::Mat<short>(snipSize, count));
+	if (channels.is_empty() || (count == 0)) {
+		return;
+	}
+
+	/* Read the snippets of all channels together, so that each chunk is
+	 * read once, and then cut out those of each channel.
+	 */
+	int startChan = static_cast<int>(channels.min());
+	int endChan = static_cast<int>(channels.max()) + 1;
+	datafile::DataFile::ReadPlan plan(m_file);
+	for (auto sample : drawn) {
+		plan.add(startChan, endChan, static_cast<int64_t>(sample - nbefore),
+				static_cast<int64_t>(sample + nafter + 1));
+	}
+	std::vector<arma::Mat<int16_t> > windows;
+	plan.execute(windows, pool);
+	for (size_t i = 0; i < count; i++) {
+		for (arma::uword c = 0; c < channels.n_elem; c++) {
+			auto window = windows[i].colptr(channels(c) - startChan);
+			std::copy(window, window + snipSize, snips[c].colptr(i));
+		}
+	}
+}
+
+void NoiseSampler::sample(SnipFile& snipFile, size_t count,
+		datafile::ThreadPool* pool) const
+{
+	std::vector<arma::uvec> idx;
+	std::vector<arma::Mat<short> > snips;
+	sample(snipFile.channels(), count, static_cast<size_t>(-snipFile.nsamplesBefore()),
+			static_cast<size_t>(snipFile.nsamplesAfter()), idx, snips, pool);
+	snipFile.writeNoiseSnips(idx, snips);
+}
+
+} // end snipfile namespace
+
@@ -0,0 +1,67 @@
+/* readerpool.cc
+ *
+ * Implementation of the pool of threads reading from a DataFile.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "readerpool.h"
+
+#include <algorithm>
+#include <future>
+#include <vector>
+
+namespace datafile {
+
+DataFile::ReaderPool::ReaderPool(const DataFile& file, size_t nthreads)
+	: m_file(file),
+	  m_pool(nthreads)
+{
+}
+
+size_t DataFile::ReaderPool::size() const
+{
+	return m_pool.size();
+}
+
+void DataFile::ReaderPool::forEachBlock(int startChan, int endChan,
+		const std::function<void(int, int)>& read)
+{
+	/* Find the boundaries of the rows of chunks spanned by the request */
+	auto chunkChannels = std::max(1, static_cast<int>(m_file.options().chunkChannels));
+	std::vector<int> bounds { startChan };
+	for (auto c = (startChan / chunkChannels + 1) * chunkChannels; 
+			c < endChan; c += chunkChannels) {
+		bounds.push_back(c);
+	}
+	bounds.push_back(endChan);
+
+	/* Deal the rows of chunks out as evenly as possible. If there are
+	 * fewer rows than workers, split them channel by channel instead.
+	 */
+	auto nrows = bounds.size() - 1;
+	if (nrows < m_pool.size()) {
+		bounds.clear();
+		auto nblocks = std::min(m_pool.size(), static_cast<size_t>(endChan - startChan));
+		for (size_t i = 0; i <= nblocks; i++) {
+			bounds.push_back(startChan + static_cast<int>(
+					i * static_cast<size_t>(endChan - startChan) / nblocks));
+		}
+	} else {
+		std::vector<int> rows;
+		rows.swap(bounds);
+		for (size_t i = 0; i <= m_pool.size(); i++) {
+			bounds.push_back(rows[i * nrows / m_pool.size()]);
+		}
+	}
+
+	std::vector<std::future<void> > blocks;
+	for (size_t i = 0; i + 1 < bounds.size(); i++) {
+		auto first = bounds[i], last = bounds[i + 1];
+		blocks.push_back(m_pool.submit([&read, first, last]() { read(first, last); }));
+	}
+	waitAll(blocks);
+}
+
+} // end datafile namespace
+
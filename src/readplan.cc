@@ -0,0 +1,142 @@
+/* readplan.cc
+ *
+ * Implementation of batched, chunk-coalesced reads.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "readplan.h"
+
+#include <future>
+#include <map>
+#include <utility>
+
+namespace datafile {
+
+DataFile::ReadPlan::ReadPlan(const DataFile& file)
+	: m_file(file)
+{
+}
+
+size_t DataFile::ReadPlan::add(int startChan, int endChan, 
+		int64_t startSample, int64_t endSample)
+{
+	m_file.verifyReadRequest(startChan, endChan, startSample, endSample);
+	m_requests.push_back({ startChan, endChan, startSample, endSample });
+	return m_requests.size() - 1;
+}
+
+size_t DataFile::ReadPlan::size() const
+{
+	return m_requests.size();
+}
+
+void DataFile::ReadPlan::clear()
+{
+	m_requests.clear();
+}
+
+size_t DataFile::ReadPlan::chunks() const
+{
+	return schedule().size();
+}
+
+std::vector<DataFile::ReadPlan::ChunkRead> DataFile::ReadPlan::schedule() const
+{
+	auto chunkChannels = std::max(1, static_cast<int>(m_file.options().chunkChannels));
+	auto chunkSamples = std::max<int64_t>(1, m_file.options().chunkSamples);
+
+	/* A contiguous dataset is one "chunk" spanning the whole file, so
+	 * group requests into blocks of samples instead, which bounds the
+	 * size of each read.
+	 */
+	if (!m_file.chunked()) {
+		chunkChannels = m_file.nchannels();
+		chunkSamples = BlockSize;
+	}
+
+	/* Chunks are keyed by their (row, column) in the grid of chunks, so 
+	 * that they are read in the order in which they are stored.
+	 */
+	std::map<std::pair<int, int64_t>, ChunkRead> chunks;
+	for (size_t i = 0; i < m_requests.size(); i++) {
+		auto& r = m_requests[i];
+		for (auto row = r.startChan / chunkChannels; 
+				row * chunkChannels < r.endChan; row++) {
+			for (auto col = r.startSample / chunkSamples; 
+					col * chunkSamples < r.endSample; col++) {
+
+				/* Part of this chunk needed by the request */
+				auto startChan = std::max(r.startChan, row * chunkChannels);
+				auto endChan = std::min(r.endChan, (row + 1) * chunkChannels);
+				auto startSample = std::max(r.startSample, col * chunkSamples);
+				auto endSample = std::min(r.endSample, (col + 1) * chunkSamples);
+
+				auto it = chunks.find({ row, col });
+				if (it == chunks.end()) {
+					chunks[{ row, col }] = { startChan, endChan, startSample, endSample, { i } };
+				} else {
+					auto& chunk = it->second;
+					chunk.startChan = std::min(chunk.startChan, startChan);
+					chunk.endChan = std::max(chunk.endChan, endChan);
+					chunk.startSample = std::min(chunk.startSample, startSample);
+					chunk.endSample = std::max(chunk.endSample, endSample);
+					chunk.requests.push_back(i);
+				}
+			}
+		}
+	}
+
+	std::vector<ChunkRead> reads;
+	reads.reserve(chunks.size());
+	for (auto& chunk : chunks) {
+		reads.push_back(std::move(chunk.second));
+	}
+	return reads;
+}
+
+void DataFile::ReadPlan::run(ThreadPool* pool, const Scatter& scatter) const
+{
+	for (auto& r : m_requests) {
+		m_file.verifyReadRequest(r.startChan, r.endChan, r.startSample, r.endSample);
+	}
+	auto chunks = schedule();
+
+	auto read = [this, &scatter](const ChunkRead& chunk) {
+		arma::Mat<int16_t> buffer(chunk.endSample - chunk.startSample,
+				chunk.endChan - chunk.startChan);
+		m_file.readRaw(chunk.startChan, chunk.endChan, chunk.startSample,
+				chunk.endSample, buffer.memptr(), H5::PredType::NATIVE_INT16);
+
+		/* Hand each request the part of the buffer it overlaps */
+		for (auto i : chunk.requests) {
+			auto& r = m_requests[i];
+			auto startChan = std::max(r.startChan, chunk.startChan);
+			auto endChan = std::min(r.endChan, chunk.endChan);
+			auto startSample = std::max(r.startSample, chunk.startSample);
+			auto endSample = std::min(r.endSample, chunk.endSample);
+			for (auto c = startChan; c < endChan; c++) {
+				scatter(i, c - r.startChan, startSample - r.startSample,
+						buffer.colptr(c - chunk.startChan) + (startSample - chunk.startSample),
+						static_cast<size_t>(endSample - startSample));
+			}
+		}
+	};
+
+	if (pool == nullptr) {
+		for (auto& chunk : chunks) {
+			read(chunk);
+		}
+		return;
+	}
+
+	std::vector<std::future<void> > reads;
+	reads.reserve(chunks.size());
+	for (auto& chunk : chunks) {
+		reads.push_back(pool->submit([&read, &chunk]() { read(chunk); }));
+	}
+	waitAll(reads);
+}
+
+} // end datafile namespace
+
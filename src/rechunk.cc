@@ -0,0 +1,260 @@
+/* rechunk.cc
+ *
+ * Implementation of rewriting recordings with a new chunk shape.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "rechunk.h"
+#include "threadpool.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <vector>
+
+#include <zlib.h>
+
+namespace datafile {
+
+/* Copy every attribute of one HDF5 object to another, except
+ * those named in `skip`.
+ */
+static void copyAttributes(const H5::H5Object& source, H5::H5Object& dest,
+		const std::vector<std::string>& skip)
+{
+	for (int i = 0; i < source.getNumAttrs(); i++) {
+		auto attr = source.openAttribute(static_cast<unsigned int>(i));
+		auto name = attr.getName();
+		if (std::find(skip.begin(), skip.end(), name) != skip.end()) {
+			continue;
+		}
+		auto type = attr.getDataType();
+		auto space = attr.getSpace();
+		std::vector<char> buf(attr.getInMemDataSize());
+		attr.read(type, buf.data());
+		dest.createAttribute(name, type, space).write(type, buf.data());
+	}
+}
+
+void copyRecordingMetadata(const H5::H5File& source, H5::H5File& destination,
+		uint64_t nsamples)
+{
+	/* Copy metadata, writing the number of samples as given */
+	auto srcData = source.openDataSet("data");
+	auto dstData = destination.openDataSet("data");
+	copyAttributes(srcData, dstData, { "nsamples", "nsamples-stale" });
+	dstData.createAttribute("nsamples", H5::PredType::STD_U64LE,
+			H5::DataSpace(H5S_SCALAR)).write(H5::PredType::STD_U64LE, &nsamples);
+	auto srcRoot = source.openGroup("/");
+	auto dstRoot = destination.openGroup("/");
+	copyAttributes(srcRoot, dstRoot, {});
+	for (hsize_t i = 0; i < source.getNumObjs(); i++) {
+		auto name = source.getObjnameByIdx(i);
+		if (name != "data") {
+			H5Ocopy(source.getId(), name.c_str(), destination.getId(), name.c_str(),
+					H5P_DEFAULT, H5P_DEFAULT);
+		}
+	}
+}
+
+/* A block of the source, spanning one row of chunks of the destination,
+ * stored as (nchannels, nsamples) in row-major order.
+ */
+struct RechunkBlock {
+	hsize_t startChan, nchannels, startSample, nsamples;
+	std::vector<unsigned char> bytes;
+};
+
+/* Lay out one chunk of the destination from a block, padding it with zeros
+ * where it extends past the data, and apply the shuffle and deflate filters
+ * in the order HDF5 would.
+ */
+static std::vector<unsigned char> encodeChunk(const RechunkBlock& block,
+		hsize_t firstSample, const DataFileOptions& options, size_t elementSize)
+{
+	auto rowBytes = options.chunkSamples * elementSize;
+	auto chunkBytes = options.chunkChannels * rowBytes;
+	std::vector<unsigned char> chunk(chunkBytes, 0);
+	auto copied = std::min(options.chunkSamples, block.nsamples - firstSample) * elementSize;
+	for (hsize_t row = 0; row < block.nchannels; row++) {
+		std::memcpy(chunk.data() + row * rowBytes,
+				block.bytes.data() + (row * block.nsamples + firstSample) * elementSize,
+				copied);
+	}
+
+	if (options.shuffle && (elementSize > 1)) {
+		std::vector<unsigned char> shuffled(chunkBytes);
+		auto n = chunkBytes / elementSize;
+		for (size_t e = 0; e < n; e++) {
+			for (size_t b = 0; b < elementSize; b++) {
+				shuffled[b * n + e] = chunk[e * elementSize + b];
+			}
+		}
+		chunk.swap(shuffled);
+	}
+	if (options.deflate > 0) {
+		uLongf length = compressBound(chunkBytes);
+		std::vector<unsigned char> compressed(length);
+		if (compress2(compressed.data(), &length, chunk.data(), chunkBytes,
+				static_cast<int>(options.deflate)) != Z_OK) {
+			throw std::runtime_error("Could not deflate a chunk");
+		}
+		compressed.resize(length);
+		chunk.swap(compressed);
+	}
+	return chunk;
+}
+
+void rechunk(const std::string& source, const std::string& destination,
+		const DataFileOptions& options, size_t bufferBytes)
+{
+	struct stat buf;
+	if (stat(destination.c_str(), &buf) == 0) {
+		throw std::invalid_argument("Rechunked file already exists: " + destination);
+	}
+	if ( (options.chunkChannels == 0) ||
+			(options.chunkChannels > static_cast<hsize_t>(MaxNumChannels)) ||
+			(options.chunkSamples == 0) ) {
+		throw std::invalid_argument("Invalid chunk shape: (" +
+				std::to_string(options.chunkChannels) + ", " +
+				std::to_string(options.chunkSamples) + ")");
+	}
+	H5::DSetCreatPropList props;
+	hsize_t chunkDims[DatasetRank] = { options.chunkChannels, options.chunkSamples };
+	props.setChunk(DatasetRank, chunkDims);
+	if (options.shuffle) {
+		props.setShuffle();
+	}
+	if (options.deflate > 0) {
+		if (!filterAvailable(H5Z_FILTER_DEFLATE)) {
+			throw std::invalid_argument("The deflate filter is not available");
+		}
+		props.setDeflate(options.deflate);
+	}
+	if (options.filter != 0) {
+		if (!filterAvailable(options.filter)) {
+			throw std::invalid_argument("HDF5 filter " +
+					std::to_string(options.filter) + " is not available");
+		}
+		props.setFilter(options.filter, H5Z_FLAG_OPTIONAL,
+				options.filterValues.size(), options.filterValues.data());
+	}
+
+	DataFile src(source, OpenMode::ReadOnly);
+	hsize_t nchannels = src.nchannels();
+	hsize_t nsamples = src.nsamples();
+	auto type = src.dtype();
+	auto elementSize = type.getSize();
+
+	/* Each block spans one row of destination chunks, and as many chunks
+	 * along it as fit in a third of the buffer, since one block is read
+	 * while another is encoded and written.
+	 */
+	auto chunkBytes = options.chunkChannels * options.chunkSamples * elementSize;
+	auto chunksPerBlock = std::max<size_t>(1, bufferBytes / (3 * chunkBytes));
+	auto blockSamples = chunksPerBlock * options.chunkSamples;
+	std::vector<RechunkBlock> blocks;
+	for (hsize_t start = 0; start < nsamples; start += blockSamples) {
+		for (hsize_t chan = 0; chan < nchannels; chan += options.chunkChannels) {
+			blocks.push_back({ chan, std::min(options.chunkChannels, nchannels - chan),
+					start, std::min<hsize_t>(blockSamples, nsamples - start), {} });
+		}
+	}
+
+	/* Let the source cache hold every chunk it has under a span of samples,
+	 * so that each is decompressed once for all rows of the destination.
+	 */
+	H5::H5File srcFile(source, H5F_ACC_RDONLY);
+	auto srcOptions = src.options();
+	auto srcChunkBytes = srcOptions.chunkChannels * srcOptions.chunkSamples * elementSize;
+	auto srcChunks = ((nchannels + srcOptions.chunkChannels - 1) / srcOptions.chunkChannels) *
+			(blockSamples / srcOptions.chunkSamples + 2);
+	H5::DSetAccPropList srcAccess;
+	srcAccess.setChunkCache(100 * srcChunks + 1,
+			std::min<size_t>(bufferBytes, srcChunks * srcChunkBytes), 1.0);
+	auto srcData = srcFile.openDataSet("data", srcAccess);
+
+	H5::H5File dstFile(destination, H5F_ACC_EXCL);
+
+	/* Remove the partial copy if anything fails. The pools are destroyed,
+	 * finishing any read in flight, before the file is closed.
+	 */
+	try {
+		hsize_t dims[DatasetRank] = { nchannels, nsamples };
+		H5::DSetAccPropList dstAccess;
+		dstAccess.setChunkCache(100 * chunksPerBlock + 1,
+				(chunksPerBlock + 1) * chunkBytes, 1.0);
+		auto dstData = dstFile.createDataSet("data", type,
+				H5::DataSpace(DatasetRank, dims, DatasetMaxDims), props, dstAccess);
+		bool direct = (options.filter == 0);
+
+		auto read = [&srcData, &type, elementSize](RechunkBlock block) {
+			block.bytes.resize(block.nchannels * block.nsamples * elementSize);
+			hsize_t count[DatasetRank] = { block.nchannels, block.nsamples };
+			hsize_t offset[DatasetRank] = { block.startChan, block.startSample };
+			HDF5Gate gate;
+			auto fileSpace = srcData.getSpace();
+			fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+			H5::DataSpace memspace(DatasetRank, count);
+			srcData.read(block.bytes.data(), type, memspace, fileSpace);
+			return block;
+		};
+
+		/* Read the next block on one thread while the last is written, with
+		 * its chunks encoded on others.
+		 */
+		ThreadPool reader(1), encoders;
+		std::future<RechunkBlock> next;
+		if (!blocks.empty()) {
+			next = reader.submit([&read, &blocks]() { return read(blocks[0]); });
+		}
+		for (size_t i = 0; i < blocks.size(); i++) {
+			auto block = next.get();
+			if (i + 1 < blocks.size()) {
+				next = reader.submit([&read, &blocks, i]() { return read(blocks[i + 1]); });
+			}
+
+			if (direct) {
+				std::vector<std::future<std::vector<unsigned char> > > chunks;
+				for (hsize_t first = 0; first < block.nsamples; first += options.chunkSamples) {
+					chunks.push_back(encoders.submit([&block, first, &options, elementSize]() {
+						return encodeChunk(block, first, options, elementSize);
+					}));
+				}
+				auto encoded = waitAll(chunks);
+				for (size_t c = 0; c < encoded.size(); c++) {
+					auto& bytes = encoded[c];
+					hsize_t offset[DatasetRank] = { block.startChan,
+							block.startSample + c * options.chunkSamples };
+					HDF5Gate gate;
+					if (H5Dwrite_chunk(dstData.getId(), H5P_DEFAULT, 0, offset,
+							bytes.size(), bytes.data()) < 0) {
+						throw std::runtime_error("Could not write a chunk of " + destination);
+					}
+				}
+			} else {
+				hsize_t count[DatasetRank] = { block.nchannels, block.nsamples };
+				hsize_t offset[DatasetRank] = { block.startChan, block.startSample };
+				HDF5Gate gate;
+				auto fileSpace = dstData.getSpace();
+				fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+				H5::DataSpace memspace(DatasetRank, count);
+				dstData.write(block.bytes.data(), type, memspace, fileSpace);
+			}
+		}
+
+		copyRecordingMetadata(srcFile, dstFile, nsamples);
+	} catch (...) {
+		dstFile.close();
+		std::remove(destination.c_str());
+		throw;
+	}
+}
+
+} // end datafile namespace
+
@@ -0,0 +1,247 @@
+/* recordingset.cc
+ *
+ * Implementation of the view of several recordings as one.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "recordingset.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <future>
+#include <stdexcept>
+
+namespace datafile {
+
+RecordingSet::RecordingSet(const std::vector<std::string>& filenames,
+		const DataFileOptions& options)
+{
+	if (filenames.empty()) {
+		throw std::invalid_argument("A RecordingSet needs at least one file");
+	}
+	int64_t total = 0;
+	for (auto& name : filenames) {
+		m_files.emplace_back(new DataFile(name, OpenMode::ReadOnly, options));
+		auto& file = *m_files.back();
+		auto& first = *m_files.front();
+		if ( (file.nchannels() != first.nchannels()) ||
+				(file.array() != first.array()) ||
+				(file.sampleRate() != first.sampleRate()) ||
+				(file.gain() != first.gain()) ||
+				(file.offset() != first.offset()) ) {
+			throw std::invalid_argument("The recording " + name +
+					" does not match " + first.filename() + " in its channels, "
+					"array, sample rate, gain or offset");
+		}
+		m_starts.push_back(total);
+		total += file.nsamples();
+	}
+	m_starts.push_back(total);
+}
+
+size_t RecordingSet::nfiles() const
+{
+	return m_files.size();
+}
+
+const DataFile& RecordingSet::file(size_t index) const
+{
+	return *m_files.at(index);
+}
+
+int64_t RecordingSet::fileStart(size_t index) const
+{
+	if (index >= m_files.size()) {
+		throw std::out_of_range("File index out of range: " + std::to_string(index));
+	}
+	return m_starts[index];
+}
+
+size_t RecordingSet::fileAt(int64_t sample) const
+{
+	if ( (sample < 0) || (sample >= nsamples()) ) {
+		throw std::logic_error("Requested sample out of range: " +
+				std::to_string(sample) + " is not in range [0, " +
+				std::to_string(nsamples()) + ")");
+	}
+
+	/* Empty files share their start with the next, so take the last */
+	auto after = std::upper_bound(m_starts.begin(), m_starts.end(), sample);
+	return static_cast<size_t>(after - m_starts.begin()) - 1;
+}
+
+int64_t RecordingSet::nsamples() const
+{
+	return m_starts.back();
+}
+
+int RecordingSet::nchannels() const
+{
+	return m_files.front()->nchannels();
+}
+
+double RecordingSet::length() const
+{
+	return nsamples() / static_cast<double>(sampleRate());
+}
+
+std::string RecordingSet::array() const
+{
+	return m_files.front()->array();
+}
+
+float RecordingSet::sampleRate() const
+{
+	return m_files.front()->sampleRate();
+}
+
+float RecordingSet::gain() const
+{
+	return m_files.front()->gain();
+}
+
+float RecordingSet::offset() const
+{
+	return m_files.front()->offset();
+}
+
+void RecordingSet::verifyReadRequest(int startChan, int endChan,
+		int64_t startSample, int64_t endSample) const
+{
+	if ( (startSample < 0) || (endSample > nsamples()) || (endSample <= startSample) ) {
+		throw std::logic_error("Requested sample range invalid: (" +
+				std::to_string(startSample) + " - " +
+				std::to_string(endSample) + "), the set has " +
+				std::to_string(nsamples()) + " samples");
+	}
+	if ( (startChan < 0) || (endChan > nchannels()) || (endChan <= startChan) ) {
+		throw std::logic_error("Requested channel range invalid: (" +
+				std::to_string(startChan) + " - " +
+				std::to_string(endChan) + "), the set has " +
+				std::to_string(nchannels()) + " channels");
+	}
+}
+
+void RecordingSet::forEachPiece(int64_t startSample, int64_t endSample, ThreadPool* pool,
+		const PieceReader& read) const
+{
+	struct Piece {
+		size_t file;
+		int64_t first, last;
+		arma::uword row;
+	};
+	std::vector<Piece> pieces;
+	for (auto i = fileAt(startSample); (i < m_files.size()) &&
+			(m_starts[i] < endSample); i++) {
+		auto first = std::max(startSample, m_starts[i]);
+		auto last = std::min(endSample, m_starts[i + 1]);
+		if (last > first) {
+			pieces.push_back({ i, first - m_starts[i], last - m_starts[i],
+					static_cast<arma::uword>(first - startSample) });
+		}
+	}
+
+	if ( (pool == nullptr) || (pieces.size() == 1) ) {
+		for (auto& piece : pieces) {
+			read(*m_files[piece.file], piece.first, piece.last, piece.row);
+		}
+		return;
+	}
+
+	std::vector<std::future<void> > reads;
+	reads.reserve(pieces.size());
+	for (auto& piece : pieces) {
+		reads.push_back(pool->submit([this, &read, &piece]() {
+				read(*m_files[piece.file], piece.first, piece.last, piece.row);
+			}));
+	}
+	waitAll(reads);
+}
+
+/* Write a scalar attribute of the virtual dataset */
+static void writeScalarAttr(H5::DataSet& dataset, const std::string& name,
+		const H5::PredType& type, const void* buf)
+{
+	dataset.createAttribute(name, type, H5::DataSpace(H5S_SCALAR)).write(type, buf);
+}
+
+/* Write a string attribute of the virtual dataset, as DataFile does */
+static void writeStringAttr(H5::DataSet& dataset, const std::string& name,
+		const std::string& value)
+{
+	H5::StrType type(0, std::max<size_t>(1, value.length()));
+	dataset.createAttribute(name, type, H5::DataSpace(H5S_SCALAR)).write(type, value);
+}
+
+void RecordingSet::writeVirtual(const std::string& filename) const
+{
+	struct stat buf;
+	if (stat(filename.c_str(), &buf) == 0) {
+		throw std::invalid_argument("Virtual file already exists: " + filename);
+	}
+
+	auto& first = *m_files.front();
+	hsize_t nchannels = first.nchannels();
+	hsize_t dims[DatasetRank] = { nchannels, static_cast<hsize_t>(nsamples()) };
+	try {
+		/* Map each file's samples onto its span of the virtual dataset */
+		H5::DataSpace space(DatasetRank, dims);
+		H5::DSetCreatPropList props;
+		uint64_t aoutSize = 0;
+		for (size_t i = 0; i < m_files.size(); i++) {
+			auto& file = *m_files[i];
+			aoutSize += file.analogOutputSize();
+			if (file.nsamples() == 0) {
+				continue;
+			}
+			hsize_t count[DatasetRank] = { nchannels, static_cast<hsize_t>(file.nsamples()) };
+			hsize_t offset[DatasetRank] = { 0, static_cast<hsize_t>(m_starts[i]) };
+			H5::DataSpace target(space);
+			target.selectHyperslab(H5S_SELECT_SET, count, offset);
+
+			/* The dataset may extend past the samples written */
+			hsize_t start[DatasetRank] = { 0, 0 };
+			auto source = H5::H5File(file.filename(), H5F_ACC_RDONLY)
+					.openDataSet("data").getSpace();
+			source.selectHyperslab(H5S_SELECT_SET, count, start);
+			auto path = realpath(file.filename().c_str(), nullptr);
+			std::string absolute(path ? path : file.filename().c_str());
+			free(path);
+			if (H5Pset_virtual(props.getId(), target.getId(), absolute.c_str(),
+					"data", source.getId()) < 0) {
+				throw std::runtime_error("Could not map " + absolute +
+						" into the virtual file");
+			}
+		}
+
+		H5::H5File out(filename, H5F_ACC_EXCL);
+		auto dataset = out.createDataSet("data", first.dtype(), space, props);
+		auto sampleRate = first.sampleRate(), gain = first.gain(), offset = first.offset();
+		uint64_t total = static_cast<uint64_t>(nsamples());
+		writeScalarAttr(dataset, "sample-rate", H5::PredType::IEEE_F32LE, &sampleRate);
+		writeScalarAttr(dataset, "gain", H5::PredType::IEEE_F32LE, &gain);
+		writeScalarAttr(dataset, "offset", H5::PredType::IEEE_F32LE, &offset);
+		writeScalarAttr(dataset, "nsamples", H5::PredType::STD_U64LE, &total);
+		writeScalarAttr(dataset, "nchannels", H5::PredType::STD_U64LE, &dims[0]);
+		writeScalarAttr(dataset, "analog-output-size", H5::PredType::STD_U64LE, &aoutSize);
+		writeStringAttr(dataset, "array", first.array());
+		writeStringAttr(dataset, "date", first.date());
+		writeStringAttr(dataset, "room", first.room());
+
+		/* A HiDens configuration describes every file of the set */
+		H5::H5File source(first.filename(), H5F_ACC_RDONLY);
+		if (H5Lexists(source.getId(), "configuration", H5P_DEFAULT) > 0) {
+			H5Ocopy(source.getId(), "configuration", out.getId(), "configuration",
+					H5P_DEFAULT, H5P_DEFAULT);
+		}
+	} catch (H5::Exception& e) {
+		throw std::runtime_error("Could not write the virtual file " +
+				filename + ": " + e.getDetailMsg());
+	}
+}
+
+} // end datafile namespace
+
@@ -7,15 +7,20 @@
  */
 
 #include <sys/stat.h>
+#include <algorithm>
 #include <iostream>
 #include <typeinfo>
 
 #include "snipfile.h"
+#include "chunkreader.h"
 
 snipfile::SnipFile::SnipFile(std::string fname, const datafile::DataFile& source, 
-		const size_t nbefore, const size_t nafter)
+		const size_t nbefore, const size_t nafter, const unsigned int deflate,
+		const SnipLayout layout)
 	: samplesBefore_(-nbefore),
-	samplesAfter_(nafter)
+	samplesAfter_(nafter),
+	deflate_(deflate),
+	layout_(layout)
 {
 	filename_ = fname;
 	struct stat buf;
@@ -31,6 +36,8 @@ snipfile::SnipFile::SnipFile(std::string fname, const datafile::DataFile& source
 }
 
 snipfile::SnipFile::SnipFile(std::string fname) 
+	: deflate_(0),
+	layout_(SnipLayout::ChannelGroups)
 {
 	/* open existing snippet file */
 	filename_ = fname;
@@ -62,6 +69,8 @@ void snipfile::SnipFile::writeAttributes()
 	writeFileAttr("nsamples-before", H5::PredType::STD_I32LE, &samplesBefore_);
 	writeFileAttr("nsamples-after", H5::PredType::STD_I32LE, &samplesAfter_);
 	writeFileAttr("sample-rate", H5::PredType::IEEE_F32LE, &sampleRate_);
+	int version = static_cast<int>(layout_);
+	writeFileAttr("layout-version", H5::PredType::STD_I32LE, &version);
 }
 
 void snipfile::SnipFile::readAttributes()
@@ -75,6 +84,17 @@ void snipfile::SnipFile::readAttributes()
 	readFileAttr("nsamples-before", &samplesBefore_);
 	readFileAttr("nsamples-after", &samplesAfter_);
 	readFileAttr("sample-rate", &sampleRate_);
+	if (file.attrExists("layout-version")) {
+		int version = 0;
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::AttrRead, sizeof(version));
+		file.openAttribute("layout-version").read(H5::PredType::NATIVE_INT, &version);
+		if ( (version != static_cast<int>(SnipLayout::ChannelGroups)) &&
+				(version != static_cast<int>(SnipLayout::Columnar)) ) {
+			throw std::invalid_argument("Unknown snippet file layout version " +
+					std::to_string(version));
+		}
+		layout_ = static_cast<SnipLayout>(version);
+	}
 }
 
 void snipfile::SnipFile::getSourceInfo(const datafile::DataFile& source)
@@ -99,18 +119,43 @@ float snipfile::SnipFile::gain() { return gain_; }
 float snipfile::SnipFile::offset() { return offset_; }
 arma::uvec snipfile::SnipFile::channels() { return channels_; }
 arma::vec snipfile::SnipFile::thresholds() { return thresholds_; }
+snipfile::SnipLayout snipfile::SnipFile::layout() { return layout_; }
+
+void snipfile::SnipFile::setIOStatsEnabled(bool enable)
+{
+	ioCounters_.setEnabled(enable);
+}
+
+bool snipfile::SnipFile::ioStatsEnabled() { return ioCounters_.enabled(); }
+
+datafile::IOStats snipfile::SnipFile::ioStats()
+{
+	auto stats = ioCounters_.snapshot();
+	datafile::IOCounters::readCacheStats(file.getId(), stats);
+	return stats;
+}
+
+void snipfile::SnipFile::resetIOStats()
+{
+	ioCounters_.reset();
+	datafile::IOCounters::resetCacheStats(file.getId());
+}
 
 void snipfile::SnipFile::setChannels(const arma::uvec& channels)
 {
 	channels_ = channels;
 	nchannels_ = channels.n_elem;
-	if (channelGroups.size() == 0) {
+	if ( (layout_ == SnipLayout::ChannelGroups) && (channelGroups.size() == 0) ) {
 		std::string buf(32, '\0');
 		for (auto& c : channels) {
 			buf.clear();
 			std::snprintf(&buf[0], buf.capacity(), "channel-%03llu", c);
 			channelGroups.push_back(file.createGroup(buf.c_str()));
 		}
+		spikeDatasets.resize(nchannels_);
+		spikeIdxDatasets.resize(nchannels_);
+		noiseDatasets.resize(nchannels_);
+		noiseIdxDatasets.resize(nchannels_);
 	}
 	writeChannels(channels_);
 }
@@ -136,6 +181,11 @@ void snipfile::SnipFile::writeNoiseSnips(const std::vector<arma::uvec> &idx,
 void snipfile::SnipFile::writeSnips(const std::string& type, 
 		const std::vector<arma::uvec>& idx, const std::vector<arma::Mat<short> >& snips)
 {
+	coarseIndex_.clear();
+	if (layout_ == SnipLayout::Columnar) {
+		writeColumnarSnips(type, idx, snips);
+		return;
+	}
 	for (decltype(nchannels_) i = 0; i < nchannels_; i++) {
 		/* Create data{space,set} for each channel's spike snippets and indices */
 		auto& grp = channelGroups[i];
@@ -148,21 +198,221 @@ void snipfile::SnipFile::writeSnips(const std::string& type,
 				snipSpace);
 		H5::DataSet idxSet = grp.createDataSet(type + "-idx", H5::PredType::STD_U64LE,
 				idxSpace);
-		spikeDatasets.push_back(snipSet);
-		spikeIdxDatasets.push_back(idxSet);
+		if (type == "spike") {
+			spikeDatasets.at(i) = snipSet;
+			spikeIdxDatasets.at(i) = idxSet;
+		} else {
+			noiseDatasets.at(i) = snipSet;
+			noiseIdxDatasets.at(i) = idxSet;
+		}
 
 		/* Write the datasets */
 		//snipSet.write(snips.at(i).memptr(), dstType);
-		snipSet.write(snips.at(i).memptr(), H5::PredType::STD_I16LE);
+		{
+			datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Write, snips.at(i).n_elem * sizeof(short));
+			snipSet.write(snips.at(i).memptr(), H5::PredType::STD_I16LE);
+		}
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Write, idx.at(i).n_elem * sizeof(uint64_t));
 		idxSet.write(idx.at(i).memptr(), H5::PredType::STD_U64LE);
 	}
 }
 
+void snipfile::SnipFile::writeColumnarSnips(const std::string& type,
+		const std::vector<arma::uvec>& idx, const std::vector<arma::Mat<short> >& snips)
+{
+	/* Find where each channel's snippets start in the table */
+	std::vector<uint64_t> offsets(nchannels_ + 1, 0);
+	hsize_t snipsize = 0;
+	for (decltype(nchannels_) i = 0; i < nchannels_; i++) {
+		if (idx.at(i).n_elem != snips.at(i).n_cols) {
+			throw std::invalid_argument("There must be one index for each snippet");
+		}
+		if (snips[i].n_cols > 0) {
+			if ( (snipsize != 0) && (snipsize != snips[i].n_rows) ) {
+				throw std::invalid_argument("All snippets must be the same size");
+			}
+			snipsize = snips[i].n_rows;
+		}
+		offsets[i + 1] = offsets[i] + snips[i].n_cols;
+	}
+	hsize_t total = offsets.back();
+
+	/* Create the table and columns */
+	auto grp = file.createGroup(type);
+	H5::DSetCreatPropList snipProps, columnProps;
+	if ( (deflate_ > 0) && (total > 0) ) {
+		hsize_t snipChunk[snipfile::SNIP_DATASET_RANK] = {
+				std::min(snipfile::SNIP_CHUNK_SIZE, total), std::max<hsize_t>(snipsize, 1) };
+		hsize_t columnChunk[snipfile::IDX_DATASET_RANK] = { snipChunk[0] };
+		snipProps.setChunk(snipfile::SNIP_DATASET_RANK, snipChunk);
+		columnProps.setChunk(snipfile::IDX_DATASET_RANK, columnChunk);
+		for (auto props : { &snipProps, &columnProps }) {
+			props->setShuffle();
+			props->setDeflate(deflate_);
+		}
+	}
+	hsize_t dims[snipfile::SNIP_DATASET_RANK] = { total, snipsize };
+	auto snipSet = grp.createDataSet("snippets", dstType, 
+			H5::DataSpace(snipfile::SNIP_DATASET_RANK, dims), snipProps);
+	auto idxSet = grp.createDataSet("idx", H5::PredType::STD_U64LE, 
+			H5::DataSpace(snipfile::IDX_DATASET_RANK, dims), columnProps);
+	auto chanSet = grp.createDataSet("channel", H5::PredType::STD_U64LE, 
+			H5::DataSpace(snipfile::IDX_DATASET_RANK, dims), columnProps);
+	hsize_t offsetDims[snipfile::IDX_DATASET_RANK] = { offsets.size() };
+	auto offsetSet = grp.createDataSet("channel-offsets", H5::PredType::STD_U64LE,
+			H5::DataSpace(snipfile::IDX_DATASET_RANK, offsetDims));
+	{
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Write, offsets.size() * sizeof(uint64_t));
+		offsetSet.write(offsets.data(), H5::PredType::NATIVE_UINT64);
+	}
+	if (total == 0) {
+		return;
+	}
+
+	std::vector<uint64_t> channel(total);
+	for (decltype(nchannels_) i = 0; i < nchannels_; i++) {
+		std::fill(channel.begin() + offsets[i], channel.begin() + offsets[i + 1], 
+				channels_(i));
+	}
+	{
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Write, channel.size() * sizeof(uint64_t));
+		chanSet.write(channel.data(), H5::PredType::NATIVE_UINT64);
+	}
+
+	/* Write each channel's snippets and indices to its rows */
+	auto snipSpace = snipSet.getSpace();
+	auto idxSpace = idxSet.getSpace();
+	for (decltype(nchannels_) i = 0; i < nchannels_; i++) {
+		hsize_t offset[snipfile::SNIP_DATASET_RANK] = { offsets[i], 0 };
+		hsize_t count[snipfile::SNIP_DATASET_RANK] = { snips[i].n_cols, snipsize };
+		if (count[0] == 0) {
+			continue;
+		}
+		snipSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+		H5::DataSpace snipMemSpace(snipfile::SNIP_DATASET_RANK, count);
+		{
+			datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Write, snips[i].n_elem * sizeof(short));
+			snipSet.write(snips[i].memptr(), H5::PredType::NATIVE_SHORT, 
+					snipMemSpace, snipSpace);
+		}
+		idxSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+		H5::DataSpace idxMemSpace(snipfile::IDX_DATASET_RANK, count);
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Write, idx[i].n_elem * sizeof(uint64_t));
+		idxSet.write(idx[i].memptr(), H5::PredType::STD_U64LE, idxMemSpace, idxSpace);
+	}
+}
+
+void snipfile::SnipFile::appendSpikeSnips(arma::uword channel,
+		const arma::uvec& idx, const arma::Mat<short>& snips)
+{
+	appendSnips("spike", channel, idx, snips);
+}
+
+void snipfile::SnipFile::appendNoiseSnips(arma::uword channel,
+		const arma::uvec& idx, const arma::Mat<short>& snips)
+{
+	appendSnips("noise", channel, idx, snips);
+}
+
+size_t snipfile::SnipFile::channelIndex(arma::uword channel)
+{
+	for (decltype(nchannels_) i = 0; i < nchannels_; i++) {
+		if (channels_(i) == channel) {
+			return i;
+		}
+	}
+	throw std::invalid_argument("Channel " + std::to_string(channel) + 
+			" was not extracted");
+}
+
+void snipfile::SnipFile::appendSnips(const std::string& type, arma::uword channel,
+		const arma::uvec& idx, const arma::Mat<short>& snips)
+{
+	if (layout_ == SnipLayout::Columnar) {
+		throw std::logic_error("Snippets cannot be appended to a columnar snippet file");
+	}
+	if (idx.n_elem != snips.n_cols) {
+		throw std::invalid_argument("There must be one index for each snippet");
+	}
+	auto i = channelIndex(channel);
+	coarseIndex_.erase(std::make_pair(type, channel));
+	auto& snipSet = (type == "spike") ? spikeDatasets.at(i) : noiseDatasets.at(i);
+	auto& idxSet = (type == "spike") ? spikeIdxDatasets.at(i) : noiseIdxDatasets.at(i);
+
+	/* Create extendible datasets on the first append */
+	if (H5Iis_valid(snipSet.getId()) <= 0) {
+		hsize_t snipDims[snipfile::SNIP_DATASET_RANK] = { 0, snips.n_rows };
+		hsize_t snipMaxDims[snipfile::SNIP_DATASET_RANK] = { H5S_UNLIMITED, snips.n_rows };
+		hsize_t snipChunk[snipfile::SNIP_DATASET_RANK] = { 
+				snipfile::SNIP_CHUNK_SIZE, std::max<hsize_t>(snips.n_rows, 1) };
+		hsize_t idxDims[snipfile::IDX_DATASET_RANK] = { 0 };
+		hsize_t idxMaxDims[snipfile::IDX_DATASET_RANK] = { H5S_UNLIMITED };
+		hsize_t idxChunk[snipfile::IDX_DATASET_RANK] = { snipfile::SNIP_CHUNK_SIZE };
+		H5::DSetCreatPropList snipProps, idxProps;
+		snipProps.setChunk(snipfile::SNIP_DATASET_RANK, snipChunk);
+		idxProps.setChunk(snipfile::IDX_DATASET_RANK, idxChunk);
+		if (deflate_ > 0) {
+			snipProps.setShuffle();
+			snipProps.setDeflate(deflate_);
+			idxProps.setShuffle();
+			idxProps.setDeflate(deflate_);
+		}
+		auto& grp = channelGroups.at(i);
+		snipSet = grp.createDataSet(type + "-snippets", dstType,
+				H5::DataSpace(snipfile::SNIP_DATASET_RANK, snipDims, snipMaxDims),
+				snipProps);
+		idxSet = grp.createDataSet(type + "-idx", H5::PredType::STD_U64LE,
+				H5::DataSpace(snipfile::IDX_DATASET_RANK, idxDims, idxMaxDims),
+				idxProps);
+	}
+
+	hsize_t dims[snipfile::SNIP_DATASET_RANK] = { 0, 0 };
+	hsize_t maxDims[snipfile::SNIP_DATASET_RANK] = { 0, 0 };
+	snipSet.getSpace().getSimpleExtentDims(dims, maxDims);
+	if (maxDims[0] != H5S_UNLIMITED) {
+		throw std::logic_error("Snippets written all at once cannot be appended to");
+	}
+	if (dims[1] != snips.n_rows) {
+		throw std::invalid_argument("Snippets must be the same size as those "
+				"already in the file");
+	}
+	if (snips.n_cols == 0) {
+		return;
+	}
+
+	/* Extend both datasets, and write to the new region */
+	hsize_t offset[snipfile::SNIP_DATASET_RANK] = { dims[0], 0 };
+	hsize_t count[snipfile::SNIP_DATASET_RANK] = { snips.n_cols, snips.n_rows };
+	hsize_t newDims[snipfile::SNIP_DATASET_RANK] = { dims[0] + snips.n_cols, dims[1] };
+	{
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Extend);
+		snipSet.extend(newDims);
+	}
+	auto snipSpace = snipSet.getSpace();
+	snipSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+	H5::DataSpace snipMemSpace(snipfile::SNIP_DATASET_RANK, count);
+	{
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Write, snips.n_elem * sizeof(short));
+		snipSet.write(snips.memptr(), H5::PredType::NATIVE_SHORT, snipMemSpace, snipSpace);
+	}
+
+	{
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Extend);
+		idxSet.extend(newDims);
+	}
+	auto idxSpace = idxSet.getSpace();
+	idxSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+	H5::DataSpace idxMemSpace(snipfile::IDX_DATASET_RANK, count);
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Write, idx.n_elem * sizeof(uint64_t));
+	idxSet.write(idx.memptr(), H5::PredType::STD_U64LE, idxMemSpace, idxSpace);
+}
+
 void snipfile::SnipFile::writeFileStringAttr(const std::string& name,
 		const std::string& value)
 {
 	H5::StrType type(0, value.length());
 	H5::DataSpace space(H5S_SCALAR);
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::AttrWrite, value.length());
 	file.createAttribute(name, type, space);
 	H5::Attribute attr = file.openAttribute(name);
 	attr.write(type, value.c_str());
@@ -173,6 +423,7 @@ void snipfile::SnipFile::writeFileAttr(const std::string& name,
 {
 	H5::DataType type(dtype);
 	H5::DataSpace space(H5S_SCALAR);
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::AttrWrite, type.getSize());
 	file.createAttribute(name, type, space);
 	H5::Attribute attr = file.openAttribute(name);
 	attr.write(type, buf);
@@ -192,7 +443,9 @@ void snipfile::SnipFile::readFileStringAttr(const std::string& name,
 void snipfile::SnipFile::readFileAttr(const std::string& name,
 		void *buf)
 {
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::AttrRead);
 	auto attr = file.openAttribute(name);
+	timer.setBytes(attr.getStorageSize());
 	attr.read(attr.getDataType(), buf);
 }
 
@@ -207,6 +460,7 @@ void snipfile::SnipFile::writeChannels(const arma::uvec& channels)
 	hsize_t dims[1] = {channels.n_elem};
 	H5::DataSpace space(1, dims);
 	H5::DataSet set = file.createDataSet("extracted-channels", type, space);
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Write, channels.n_elem * sizeof(arma::uword));
 	set.write(channels.memptr(), type);
 }
 
@@ -225,6 +479,7 @@ void snipfile::SnipFile::readChannels()
 	auto memspace = H5::DataSpace(1, dims);
 	memspace.selectHyperslab(H5S_SELECT_SET, spaceCount, spaceOffset);
 	channels_.set_size(dims[0]);
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Read, dims[0] * sizeof(arma::uword));
 	chanSet.read(channels_.memptr(), H5::PredType::STD_U64LE, memspace, chanSpace);
 }
 
@@ -234,6 +489,7 @@ void snipfile::SnipFile::writeThresholds(const arma::vec& thresholds)
 	hsize_t dims[1] = {thresholds.n_elem};
 	H5::DataSpace space(1, dims);
 	H5::DataSet set = file.createDataSet("thresholds", type, space);
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Write, thresholds.n_elem * sizeof(double));
 	set.write(thresholds.memptr(), type);
 }
 
@@ -250,6 +506,7 @@ void snipfile::SnipFile::readThresholds()
 	auto memspace = H5::DataSpace(1, dims);
 	memspace.selectHyperslab(H5S_SELECT_SET, spaceCount, spaceOffset);
 	thresholds_.set_size(dims[0]);
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Read, dims[0] * sizeof(double));
 	threshSet.read(thresholds_.memptr(), H5::PredType::IEEE_F64LE, memspace, threshSpace);
 }
 
@@ -265,6 +522,34 @@ void snipfile::SnipFile::noiseSnips(std::vector<arma::uvec>& idx,
 	snips("noise", idx, snippets);
 }
 
+void snipfile::SnipFile::spikeSnips(std::vector<arma::uvec>& idx, 
+		std::vector<arma::Mat<short> >& snippets, datafile::ThreadPool& pool)
+{
+	snips("spike", idx, snippets, pool);
+}
+
+void snipfile::SnipFile::noiseSnips(std::vector<arma::uvec>& idx, 
+		std::vector<arma::Mat<short> >& snippets, datafile::ThreadPool& pool)
+{
+	snips("noise", idx, snippets, pool);
+}
+
+void snipfile::SnipFile::spikeSnips(arma::uword channel, uint64_t startSample,
+		uint64_t endSample, arma::uvec& idx, arma::Mat<short>& snippets)
+{
+	snips("spike", channel, startSample, endSample, idx, snippets);
+}
+
+void snipfile::SnipFile::spikeSnips(uint64_t startSample, uint64_t endSample,
+		std::vector<arma::uvec>& idx, std::vector<arma::Mat<short> >& snippets)
+{
+	idx.resize(nchannels());
+	snippets.resize(nchannels());
+	for (decltype(nchannels()) c = 0; c < nchannels(); c++) {
+		snips("spike", channels_(c), startSample, endSample, idx[c], snippets[c]);
+	}
+}
+
 void snipfile::SnipFile::spikeSnips(arma::uword channel, arma::uvec& idx, 
 		arma::Mat<short>& snippets)
 {
@@ -282,7 +567,8 @@ void snipfile::SnipFile::spikeSnips(arma::uword channel, arma::uvec& idx,
 {
 	arma::Mat<short> tmp;
 	snips("spike", channel, idx, tmp);
-	snippets = arma::conv_to<arma::mat>::from(tmp) * gain();
+	snippets.set_size(tmp.n_rows, tmp.n_cols);
+	datafile::scaleSamples(tmp.memptr(), snippets.memptr(), tmp.n_elem, gain());
 }
 
 void snipfile::SnipFile::noiseSnips(arma::uword channel, arma::uvec& idx, 
@@ -290,7 +576,8 @@ void snipfile::SnipFile::noiseSnips(arma::uword channel, arma::uvec& idx,
 {
 	arma::Mat<short> tmp;
 	snips("noise", channel, idx, tmp);
-	snippets = arma::conv_to<arma::mat>::from(tmp) * gain();
+	snippets.set_size(tmp.n_rows, tmp.n_cols);
+	datafile::scaleSamples(tmp.memptr(), snippets.memptr(), tmp.n_elem, gain());
 }
 
 void snipfile::SnipFile::spikeSnips(std::vector<arma::uvec>& idx,
@@ -299,8 +586,11 @@ void snipfile::SnipFile::spikeSnips(std::vector<arma::uvec>& idx,
 	std::vector<arma::Mat<short> > tmp;
 	spikeSnips(idx, tmp);
 	snippets.resize(tmp.size());
-	for (decltype(tmp.size()) i = 0; i < tmp.size(); i++)
-		snippets[i] = gain() * arma::conv_to<arma::mat>::from(tmp[i]) + offset();
+	for (decltype(tmp.size()) i = 0; i < tmp.size(); i++) {
+		snippets[i].set_size(tmp[i].n_rows, tmp[i].n_cols);
+		datafile::scaleSamples(tmp[i].memptr(), snippets[i].memptr(),
+				tmp[i].n_elem, gain(), offset());
+	}
 }
 
 void snipfile::SnipFile::noiseSnips(std::vector<arma::uvec>& idx,
@@ -309,13 +599,20 @@ void snipfile::SnipFile::noiseSnips(std::vector<arma::uvec>& idx,
 	std::vector<arma::Mat<short> > tmp;
 	noiseSnips(idx, tmp);
 	snippets.resize(tmp.size());
-	for (decltype(tmp.size()) i = 0; i < tmp.size(); i++)
-		snippets[i] = gain() * arma::conv_to<arma::mat>::from(tmp[i]) + offset();
+	for (decltype(tmp.size()) i = 0; i < tmp.size(); i++) {
+		snippets[i].set_size(tmp[i].n_rows, tmp[i].n_cols);
+		datafile::scaleSamples(tmp[i].memptr(), snippets[i].memptr(),
+				tmp[i].n_elem, gain(), offset());
+	}
 }
 
 void snipfile::SnipFile::snips(const std::string& type, 
 		std::vector<arma::uvec>& idx, std::vector<arma::Mat<short> >& snippets)
 {
+	if (layout_ == SnipLayout::Columnar) {
+		columnarSnips(type, 0, nchannels(), idx, snippets);
+		return;
+	}
 	snippets.resize(nchannels());
 	idx.resize(nchannels());
 	for (decltype(nchannels()) c = 0; c < nchannels(); c++) {
@@ -326,6 +623,16 @@ void snipfile::SnipFile::snips(const std::string& type,
 void snipfile::SnipFile::snips(const std::string& type, arma::uword channel,
 		arma::uvec& idx, arma::Mat<short>& snippets) {
 
+	if (layout_ == SnipLayout::Columnar) {
+		auto i = channelIndex(channel);
+		std::vector<arma::uvec> idxs;
+		std::vector<arma::Mat<short> > snips;
+		columnarSnips(type, i, i + 1, idxs, snips);
+		idx = idxs.front();
+		snippets = snips.front();
+		return;
+	}
+
 	std::string grpName(64, '\0');
 	std::snprintf(&grpName[0], grpName.capacity(), "channel-%03llu", channel);
 	H5::Group grp;
@@ -335,6 +642,13 @@ void snipfile::SnipFile::snips(const std::string& type, arma::uword channel,
 		std::cerr << "Channel group does not exist: " << grpName << std::endl;
 		return;
 	}
+
+	/* Channels to which nothing was appended have no snippets */
+	if (H5Lexists(grp.getId(), (type + "-idx").c_str(), H5P_DEFAULT) <= 0) {
+		idx.reset();
+		snippets.reset();
+		return;
+	}
 	
 	/* Read indices */
 	auto tmpIdxSet = grp.openDataSet(type + "-idx");
@@ -349,7 +663,10 @@ void snipfile::SnipFile::snips(const std::string& type, arma::uword channel,
 	auto idxMemSpace = H5::DataSpace(1, idxDims);
 	idxMemSpace.selectHyperslab(H5S_SELECT_SET, spaceCount, spaceOffset);
 	idx.set_size(nsnips);
-	tmpIdxSet.read(idx.memptr(), H5::PredType::STD_U64LE, idxSpace, idxMemSpace);
+	{
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Read, nsnips * sizeof(uint64_t));
+		tmpIdxSet.read(idx.memptr(), H5::PredType::STD_U64LE, idxSpace, idxMemSpace);
+	}
 	
 	/* Read snippets */
 	auto tmpSnipSet = grp.openDataSet(type + "-snippets");
@@ -363,10 +680,268 @@ void snipfile::SnipFile::snips(const std::string& type, arma::uword channel,
 	auto snipMemSpace = H5::DataSpace(2, snipDims);
 	snipMemSpace.selectHyperslab(H5S_SELECT_SET, snipCount, snipOffset);
 	snippets.set_size(snipDims[1], nsnips);
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Read, snippets.n_elem * sizeof(short));
 	tmpSnipSet.read(snippets.memptr(), H5::PredType::STD_I16LE, snipSpace, snipMemSpace);
 }
 
+void snipfile::SnipFile::columnarSnips(const std::string& type, size_t first, 
+		size_t last, std::vector<arma::uvec>& idx, std::vector<arma::Mat<short> >& snippets)
+{
+	idx.assign(last - first, arma::uvec());
+	snippets.assign(last - first, arma::Mat<short>());
+	if (H5Lexists(file.getId(), type.c_str(), H5P_DEFAULT) <= 0) {
+		return;
+	}
+	auto grp = file.openGroup(type);
+
+	/* Read the offsets, and from them the rows holding the channels */
+	auto offsetSet = grp.openDataSet("channel-offsets");
+	if (offsetSet.getSpace().getSimpleExtentNpoints() !=
+			static_cast<hssize_t>(nchannels_ + 1)) {
+		throw std::invalid_argument("Snippet channel offsets do not match "
+				"the extracted channels");
+	}
+	std::vector<uint64_t> offsets(nchannels_ + 1);
+	{
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Read, offsets.size() * sizeof(uint64_t));
+		offsetSet.read(offsets.data(), H5::PredType::NATIVE_UINT64);
+	}
+	hsize_t offset[snipfile::SNIP_DATASET_RANK] = { offsets.at(first), 0 };
+	hsize_t count[snipfile::SNIP_DATASET_RANK] = { offsets.at(last) - offsets[first], 0 };
+	if (count[0] == 0) {
+		return;
+	}
+
+	/* Read all the indices at once */
+	auto idxSet = grp.openDataSet("idx");
+	auto idxSpace = idxSet.getSpace();
+	idxSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+	H5::DataSpace idxMemSpace(snipfile::IDX_DATASET_RANK, count);
+	arma::uvec allIdx(count[0]);
+	{
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Read, count[0] * sizeof(uint64_t));
+		idxSet.read(allIdx.memptr(), H5::PredType::STD_U64LE, idxMemSpace, idxSpace);
+	}
+
+	/* Read each channel's rows of snippets directly into its matrix */
+	auto snipSet = grp.openDataSet("snippets");
+	auto snipSpace = snipSet.getSpace();
+	hsize_t dims[snipfile::SNIP_DATASET_RANK] = { 0, 0 };
+	snipSpace.getSimpleExtentDims(dims);
+	for (auto c = first; c < last; c++) {
+		hsize_t n = offsets[c + 1] - offsets[c];
+		idx[c - first] = arma::uvec(allIdx.memptr() + (offsets[c] - offsets[first]), n);
+		snippets[c - first].set_size(dims[1], n);
+		if (n == 0) {
+			continue;
+		}
+		hsize_t snipOffset[snipfile::SNIP_DATASET_RANK] = { offsets[c], 0 };
+		hsize_t snipCount[snipfile::SNIP_DATASET_RANK] = { n, dims[1] };
+		snipSpace.selectHyperslab(H5S_SELECT_SET, snipCount, snipOffset);
+		H5::DataSpace snipMemSpace(snipfile::SNIP_DATASET_RANK, snipCount);
+		datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Read, snippets[c - first].n_elem * sizeof(short));
+		snipSet.read(snippets[c - first].memptr(), H5::PredType::NATIVE_SHORT,
+				snipMemSpace, snipSpace);
+	}
+}
+
+/* Read a whole dataset into `buf`, decoding its chunks outside of HDF5 
+ * if possible. Only the calls into HDF5 are serialized.
+ */
+static void loadDataset(datafile::IOCounters& counters, const H5::DataSet& dataset,
+		datafile::DirectChunkReader& reader, void* buf, const H5::PredType& memtype)
+{
+	if (reader.size() == 0) {
+		return;
+	}
+	datafile::IOTimer timer(counters, datafile::IOOperation::Read,
+			reader.size() * memtype.getSize());
+	if (reader.supported()) {
+		{
+			datafile::HDF5Gate gate;
+			reader.fetch();
+		}
+		reader.decode(buf);
+	} else {
+		datafile::HDF5Gate gate;
+		dataset.read(buf, memtype);
+	}
+}
+
+void snipfile::SnipFile::snips(const std::string& type, std::vector<arma::uvec>& idx,
+		std::vector<arma::Mat<short> >& snippets, datafile::ThreadPool& pool)
+{
+	if (layout_ == SnipLayout::Columnar) {
+		snips(type, idx, snippets);
+		return;
+	}
+	idx.resize(nchannels());
+	snippets.resize(nchannels());
+
+	/* Open each channel's datasets and size its results here, so that the
+	 * workers only read.
+	 */
+	struct ChannelLoad {
+		H5::DataSet idxSet, snipSet;
+		std::unique_ptr<datafile::DirectChunkReader> idxReader, snipReader;
+	};
+	std::vector<ChannelLoad> loads(nchannels());
+	char buf[64];
+	for (decltype(nchannels()) c = 0; c < nchannels(); c++) {
+		std::snprintf(buf, sizeof(buf), "channel-%03llu", channels_(c));
+		std::string grpName(buf);
+		idx[c].reset();
+		snippets[c].reset();
+		if ( (H5Lexists(file.getId(), grpName.c_str(), H5P_DEFAULT) <= 0) ||
+				(H5Lexists(file.getId(), (grpName + "/" + type + "-idx").c_str(),
+						   H5P_DEFAULT) <= 0) ) {
+			continue;
+		}
+		auto grp = file.openGroup(grpName);
+		auto& load = loads[c];
+		load.idxSet = grp.openDataSet(type + "-idx");
+		load.snipSet = grp.openDataSet(type + "-snippets");
+		load.idxReader.reset(new datafile::DirectChunkReader(load.idxSet, 
+					H5::PredType::NATIVE_UINT64));
+		load.snipReader.reset(new datafile::DirectChunkReader(load.snipSet,
+					H5::PredType::NATIVE_SHORT));
+
+		hsize_t dims[snipfile::SNIP_DATASET_RANK] = { 0, 0 };
+		load.snipSet.getSpace().getSimpleExtentDims(dims);
+		idx[c].set_size(load.idxReader->size());
+		snippets[c].set_size(dims[1], dims[0]);
+	}
+
+	std::vector<std::future<void> > results;
+	for (decltype(nchannels()) c = 0; c < nchannels(); c++) {
+		if (!loads[c].idxReader) {
+			continue;
+		}
+		results.push_back(pool.submit([&, c]() {
+			loadDataset(ioCounters_, loads[c].idxSet, *loads[c].idxReader,
+					idx[c].memptr(), H5::PredType::NATIVE_UINT64);
+			loadDataset(ioCounters_, loads[c].snipSet, *loads[c].snipReader,
+					snippets[c].memptr(), H5::PredType::NATIVE_SHORT);
+		}));
+	}
+	datafile::waitAll(results);
+}
+
+/* Read rows [first, first + count) of a dataset of indices, or every 
+ * stride'th row of them.
+ */
+static void readIdxRows(datafile::IOCounters& counters, const H5::DataSet& idxSet,
+		hsize_t first, hsize_t count, void* buf, hsize_t stride = 1)
+{
+	if (count == 0) {
+		return;
+	}
+	datafile::IOTimer timer(counters, datafile::IOOperation::Read, count * sizeof(uint64_t));
+	hsize_t offset[snipfile::IDX_DATASET_RANK] = { first };
+	hsize_t counts[snipfile::IDX_DATASET_RANK] = { count };
+	hsize_t strides[snipfile::IDX_DATASET_RANK] = { stride };
+	auto space = idxSet.getSpace();
+	space.selectHyperslab(H5S_SELECT_SET, counts, offset, strides);
+	H5::DataSpace memspace(snipfile::IDX_DATASET_RANK, counts);
+	idxSet.read(buf, H5::PredType::NATIVE_UINT64, memspace, space);
+}
+
+bool snipfile::SnipFile::openSnipRows(const std::string& type, arma::uword channel,
+		H5::DataSet& idxSet, H5::DataSet& snipSet, hsize_t& begin, hsize_t& end)
+{
+	auto position = channelIndex(channel);
+	if (layout_ == SnipLayout::Columnar) {
+		if (H5Lexists(file.getId(), type.c_str(), H5P_DEFAULT) <= 0) {
+			return false;
+		}
+		auto grp = file.openGroup(type);
+		idxSet = grp.openDataSet("idx");
+		snipSet = grp.openDataSet("snippets");
+		uint64_t offsets[2] = { 0, 0 };
+		readIdxRows(ioCounters_, grp.openDataSet("channel-offsets"), position, 2, offsets);
+		begin = offsets[0];
+		end = offsets[1];
+		return true;
+	}
+
+	char buf[64];
+	std::snprintf(buf, sizeof(buf), "channel-%03llu", channel);
+	std::string grpName(buf);
+	if ( (H5Lexists(file.getId(), grpName.c_str(), H5P_DEFAULT) <= 0) ||
+			(H5Lexists(file.getId(), (grpName + "/" + type + "-idx").c_str(), 
+					   H5P_DEFAULT) <= 0) ) {
+		return false;
+	}
+	auto grp = file.openGroup(grpName);
+	idxSet = grp.openDataSet(type + "-idx");
+	snipSet = grp.openDataSet(type + "-snippets");
+	begin = 0;
+	end = idxSet.getSpace().getSimpleExtentNpoints();
+	return true;
+}
+
+hsize_t snipfile::SnipFile::lowerBound(const std::vector<uint64_t>& coarse,
+		const H5::DataSet& idxSet, hsize_t begin, hsize_t end, uint64_t sample)
+{
+	/* Find the block of SNIP_INDEX_STRIDE rows in which the bound lies,
+	 * then search the indices of only that block.
+	 */
+	auto k = std::lower_bound(coarse.begin(), coarse.end(), sample) - coarse.begin();
+	if (k == 0) {
+		return begin;
+	}
+	auto first = begin + (k - 1) * snipfile::SNIP_INDEX_STRIDE;
+	auto count = std::min(snipfile::SNIP_INDEX_STRIDE, end - first);
+	std::vector<uint64_t> block(count);
+	readIdxRows(ioCounters_, idxSet, first, count, block.data());
+	return first + (std::lower_bound(block.begin(), block.end(), sample) - block.begin());
+}
+
+void snipfile::SnipFile::snips(const std::string& type, arma::uword channel,
+		uint64_t startSample, uint64_t endSample, arma::uvec& idx, 
+		arma::Mat<short>& snippets)
+{
+	H5::DataSet idxSet, snipSet;
+	hsize_t begin = 0, end = 0;
+	idx.reset();
+	snippets.reset();
+	if (!openSnipRows(type, channel, idxSet, snipSet, begin, end) || 
+			(endSample <= startSample)) {
+		return;
+	}
+
+	auto key = std::make_pair(type, channel);
+	auto coarse = coarseIndex_.find(key);
+	if (coarse == coarseIndex_.end()) {
+		std::vector<uint64_t> entries((end - begin + snipfile::SNIP_INDEX_STRIDE - 1) /
+				snipfile::SNIP_INDEX_STRIDE);
+		readIdxRows(ioCounters_, idxSet, begin, entries.size(), entries.data(),
+				snipfile::SNIP_INDEX_STRIDE);
+		coarse = coarseIndex_.emplace(key, std::move(entries)).first;
+	}
+	auto first = lowerBound(coarse->second, idxSet, begin, end, startSample);
+	auto last = lowerBound(coarse->second, idxSet, begin, end, endSample);
+
+	/* Read the indices and snippets of only the rows in the range */
+	hsize_t dims[snipfile::SNIP_DATASET_RANK] = { 0, 0 };
+	snipSet.getSpace().getSimpleExtentDims(dims);
+	idx.set_size(last - first);
+	snippets.set_size(dims[1], last - first);
+	if (last == first) {
+		return;
+	}
+	readIdxRows(ioCounters_, idxSet, first, last - first, idx.memptr());
+	hsize_t offset[snipfile::SNIP_DATASET_RANK] = { first, 0 };
+	hsize_t count[snipfile::SNIP_DATASET_RANK] = { last - first, dims[1] };
+	auto space = snipSet.getSpace();
+	space.selectHyperslab(H5S_SELECT_SET, count, offset);
+	H5::DataSpace memspace(snipfile::SNIP_DATASET_RANK, count);
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::Read, snippets.n_elem * sizeof(short));
+	snipSet.read(snippets.memptr(), H5::PredType::NATIVE_SHORT, memspace, space);
+}
+
 int snipfile::SnipFile::nsamplesBefore() {
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::AttrRead, sizeof(int));
 	auto attr = file.openAttribute("nsamples-before");
 	int n = 0;
 	attr.read(H5::PredType::NATIVE_INT, &n);
@@ -374,6 +949,7 @@ int snipfile::SnipFile::nsamplesBefore() {
 }
 
 int snipfile::SnipFile::nsamplesAfter() {
+	datafile::IOTimer timer(ioCounters_, datafile::IOOperation::AttrRead, sizeof(int));
 	auto attr = file.openAttribute("nsamples-after");
 	int n = 0;
 	attr.read(H5::PredType::NATIVE_INT, &n);
@@ -0,0 +1,262 @@
+/* summary.cc
+ *
+ * Implementation of the multi-resolution summaries of raw data.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "summary.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace datafile {
+
+/* Rank of each summary level's dataset */
+static const int SummaryRank = 3;
+
+/* Number of bins in each chunk of a summary level */
+static const hsize_t SummaryChunkBins = 1024;
+
+SummaryPyramid::Accumulator::Accumulator()
+{
+	reset();
+}
+
+void SummaryPyramid::Accumulator::reset()
+{
+	count = 0;
+	min = std::numeric_limits<double>::infinity();
+	max = -std::numeric_limits<double>::infinity();
+	sum = 0;
+	sumsq = 0;
+}
+
+void SummaryPyramid::Accumulator::add(double value)
+{
+	count++;
+	min = std::min(min, value);
+	max = std::max(max, value);
+	sum += value;
+	sumsq += value * value;
+}
+
+void SummaryPyramid::Accumulator::add(const Accumulator& other)
+{
+	count += other.count;
+	min = std::min(min, other.min);
+	max = std::max(max, other.max);
+	sum += other.sum;
+	sumsq += other.sumsq;
+}
+
+void SummaryPyramid::Accumulator::addBin(float binMin, float binMax,
+		float mean, float rms, uint64_t binCount)
+{
+	count += binCount;
+	min = std::min(min, static_cast<double>(binMin));
+	max = std::max(max, static_cast<double>(binMax));
+	sum += static_cast<double>(mean) * binCount;
+	sumsq += static_cast<double>(rms) * rms * binCount;
+}
+
+void SummaryPyramid::validate(const std::vector<int>& factors)
+{
+	if (factors.empty()) {
+		throw std::invalid_argument("At least one summary factor is required");
+	}
+	for (size_t i = 0; i < factors.size(); i++) {
+		if ( (factors[i] <= 1) ||
+				((i > 0) && ((factors[i] <= factors[i - 1]) ||
+				(factors[i] % factors[i - 1] != 0))) ) {
+			throw std::invalid_argument("Summary factors must be greater than 1, "
+					"increasing, and each must divide the next");
+		}
+	}
+}
+
+bool SummaryPyramid::exists(H5::H5File& file)
+{
+	return H5Lexists(file.getId(), SummaryGroup.c_str(), H5P_DEFAULT) > 0;
+}
+
+SummaryPyramid::SummaryPyramid(H5::H5File& file, int nchannels,
+		const std::vector<int>& factors)
+	: m_file(file),
+	  m_factors(factors),
+	  m_samples(0),
+	  m_aligned(true),
+	  m_bins(factors.size(), 0),
+	  m_accumulators(factors.size(), std::vector<Accumulator>(nchannels)),
+	  m_completed(factors.size(), std::vector<std::vector<float> >(nchannels))
+{
+	validate(m_factors);
+	if (exists(m_file)) {
+		m_file.unlink(SummaryGroup);
+	}
+	m_group = m_file.createGroup(SummaryGroup);
+
+	hsize_t dims[SummaryRank] = { SummaryStatistics,
+			static_cast<hsize_t>(nchannels), 0 };
+	hsize_t maxDims[SummaryRank] = { SummaryStatistics,
+			static_cast<hsize_t>(nchannels), H5S_UNLIMITED };
+	hsize_t chunkDims[SummaryRank] = { SummaryStatistics,
+			static_cast<hsize_t>(nchannels), SummaryChunkBins };
+	H5::DSetCreatPropList props;
+	props.setChunk(SummaryRank, chunkDims);
+	for (auto factor : m_factors) {
+		m_datasets.push_back(m_group.createDataSet(std::to_string(factor),
+				H5::PredType::IEEE_F32LE, H5::DataSpace(SummaryRank, dims, maxDims), props));
+	}
+}
+
+SummaryPyramid::SummaryPyramid(H5::H5File& file)
+	: m_file(file),
+	  m_samples(0),
+	  m_aligned(true)
+{
+	if (!exists(m_file)) {
+		throw std::invalid_argument("File does not contain a summary");
+	}
+	m_group = m_file.openGroup(SummaryGroup);
+	for (hsize_t i = 0; i < m_group.getNumObjs(); i++) {
+		m_factors.push_back(std::stoi(m_group.getObjnameByIdx(i)));
+	}
+	std::sort(m_factors.begin(), m_factors.end());
+	validate(m_factors);
+
+	hsize_t nchannels = 0;
+	for (auto factor : m_factors) {
+		m_datasets.push_back(m_group.openDataSet(std::to_string(factor)));
+		hsize_t dims[SummaryRank] = { 0, 0, 0 };
+		m_datasets.back().getSpace().getSimpleExtentDims(dims);
+		nchannels = dims[1];
+		m_bins.push_back(dims[2]);
+	}
+
+	/* Appending would resume after the last bin of the coarsest level,
+	 * once finer levels are truncated to match it.
+	 */
+	m_accumulators.assign(m_factors.size(), std::vector<Accumulator>(nchannels));
+	m_completed.assign(m_factors.size(), std::vector<std::vector<float> >(nchannels));
+	m_samples = m_bins.back() * m_factors.back();
+	m_aligned = false;
+}
+
+const std::vector<int>& SummaryPyramid::factors() const
+{
+	return m_factors;
+}
+
+uint64_t SummaryPyramid::samples() const
+{
+	return m_samples;
+}
+
+uint64_t SummaryPyramid::bins(size_t level) const
+{
+	return m_bins.at(level);
+}
+
+uint64_t SummaryPyramid::rewind(uint64_t sample)
+{
+	auto coarsest = static_cast<uint64_t>(m_factors.back());
+	auto kept = std::min({ sample, m_samples, m_bins.back() * coarsest });
+	kept -= kept % coarsest;
+
+	for (size_t level = 0; level < m_factors.size(); level++) {
+		m_bins[level] = std::min(m_bins[level], kept / m_factors[level]);
+		hsize_t dims[SummaryRank] = { 0, 0, 0 };
+		m_datasets[level].getSpace().getSimpleExtentDims(dims);
+		if (dims[2] != m_bins[level]) {
+			dims[2] = m_bins[level];
+			m_datasets[level].extend(dims);
+		}
+		for (auto& acc : m_accumulators[level]) {
+			acc.reset();
+		}
+		for (auto& completed : m_completed[level]) {
+			completed.clear();
+		}
+	}
+	m_samples = kept;
+	m_aligned = true;
+	return kept;
+}
+
+void SummaryPyramid::completeBin(size_t level, size_t channel)
+{
+	auto& acc = m_accumulators[level][channel];
+	auto& completed = m_completed[level][channel];
+	completed.push_back(static_cast<float>(acc.min));
+	completed.push_back(static_cast<float>(acc.max));
+	completed.push_back(static_cast<float>(acc.sum / acc.count));
+	completed.push_back(static_cast<float>(std::sqrt(acc.sumsq / acc.count)));
+
+	if (level + 1 < m_factors.size()) {
+		auto& next = m_accumulators[level + 1][channel];
+		next.add(acc);
+		if (next.count == static_cast<uint64_t>(m_factors[level + 1])) {
+			completeBin(level + 1, channel);
+		}
+	}
+	acc.reset();
+}
+
+void SummaryPyramid::write()
+{
+	for (size_t level = 0; level < m_factors.size(); level++) {
+		auto& completed = m_completed[level];
+		auto nchannels = completed.size();
+		auto nbins = completed.front().size() / SummaryStatistics;
+		if (nbins == 0) {
+			continue;
+		}
+
+		/* Gather into the file's (statistic, channel, bin) order */
+		std::vector<float> buffer(SummaryStatistics * nchannels * nbins);
+		for (size_t c = 0; c < nchannels; c++) {
+			for (size_t b = 0; b < nbins; b++) {
+				for (int s = 0; s < SummaryStatistics; s++) {
+					buffer[(s * nchannels + c) * nbins + b] =
+						completed[c][b * SummaryStatistics + s];
+				}
+			}
+			completed[c].clear();
+		}
+
+		hsize_t dims[SummaryRank] = { SummaryStatistics, nchannels, m_bins[level] + nbins };
+		m_datasets[level].extend(dims);
+		hsize_t offset[SummaryRank] = { 0, 0, m_bins[level] };
+		hsize_t count[SummaryRank] = { SummaryStatistics, nchannels, nbins };
+		auto fileSpace = m_datasets[level].getSpace();
+		fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+		H5::DataSpace memspace(SummaryRank, count);
+		m_datasets[level].write(buffer.data(), H5::PredType::NATIVE_FLOAT,
+				memspace, fileSpace);
+		m_bins[level] += nbins;
+	}
+}
+
+void SummaryPyramid::read(size_t level, int startChan, int endChan,
+		uint64_t startBin, uint64_t endBin, std::vector<float>& bins) const
+{
+	auto nbins = endBin - startBin;
+	bins.resize(SummaryStatistics * (endChan - startChan) * nbins);
+	if (nbins == 0) {
+		return;
+	}
+	hsize_t offset[SummaryRank] = { 0, static_cast<hsize_t>(startChan), startBin };
+	hsize_t count[SummaryRank] = { SummaryStatistics,
+			static_cast<hsize_t>(endChan - startChan), nbins };
+	auto fileSpace = m_datasets.at(level).getSpace();
+	fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+	H5::DataSpace memspace(SummaryRank, count);
+	m_datasets[level].read(bins.data(), H5::PredType::NATIVE_FLOAT,
+			memspace, fileSpace);
+}
+
+} // end datafile namespace
+
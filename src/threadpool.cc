@@ -0,0 +1,61 @@
+/* threadpool.cc
+ *
+ * Implementation of the pool of worker threads.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "threadpool.h"
+
+#include <algorithm>
+
+namespace datafile {
+
+ThreadPool::ThreadPool(size_t nthreads)
+	: m_stop(false)
+{
+	if (nthreads == 0) {
+		nthreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	m_threads.reserve(nthreads);
+	for (size_t i = 0; i < nthreads; i++) {
+		m_threads.emplace_back(&ThreadPool::run, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stop = true;
+	}
+	m_ready.notify_all();
+	for (auto& thread : m_threads) {
+		thread.join();
+	}
+}
+
+size_t ThreadPool::size() const
+{
+	return m_threads.size();
+}
+
+void ThreadPool::run()
+{
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_ready.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+			if (m_tasks.empty()) {
+				return;
+			}
+			task = std::move(m_tasks.front());
+			m_tasks.pop();
+		}
+		task();
+	}
+}
+
+} // end datafile namespace
+
@@ -7,8 +7,17 @@
 
 #include "test_libdatafile.h"
 
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <thread>
 #include <vector>
 
+#include <sys/wait.h>
+#include <unistd.h>
+
 void DatafileTest::initTestCase()
 {
 	/* Create data */
@@ -361,13 +370,2089 @@ void DatafileTest::testReadWriteSnippets()
 			"Reading/writing noise snippets failed.");
 }
 
+void DatafileTest::testAppendSnippets()
+{
+	QString filename = "test-append.snip";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	const arma::uword nchannels = 4, snipsize = 33, nblocks = 5;
+	std::vector<arma::uvec> spikeIdx(nchannels), noiseIdx(nchannels);
+	std::vector<arma::Mat<qint16>> spikeSnips(nchannels), noiseSnips(nchannels);
+	{
+		SnipFile snipFile(filename.toStdString(), *m_dataFile, 
+				snipfile::NUM_SAMPLES_BEFORE, snipfile::NUM_SAMPLES_AFTER, 4);
+		arma::uvec channels(nchannels);
+		for (arma::uword c = 0; c < nchannels; c++) {
+			channels(c) = 10 + c;
+		}
+		snipFile.setChannels(channels);
+		snipFile.setThresholds(arma::vec(nchannels, arma::fill::ones));
+
+		/* Channel 10 gets no spikes, and the others differing numbers per block */
+		for (arma::uword block = 0; block < nblocks; block++) {
+			for (arma::uword c = 1; c < nchannels; c++) {
+				arma::uword nsnips = 300 * c + 7 * block;
+				arma::Mat<qint16> snips(snipsize, nsnips);
+				arma::uvec idx(nsnips);
+				for (arma::uword i = 0; i < snips.n_elem; i++) {
+					snips(i) = static_cast<qint16>((i * 2654435761u + block + c) >> 16);
+				}
+				for (arma::uword i = 0; i < nsnips; i++) {
+					idx(i) = block * 100000 + 10 * i;
+				}
+				snipFile.appendSpikeSnips(10 + c, idx, snips);
+				spikeIdx[c] = arma::join_cols(spikeIdx[c], idx);
+				spikeSnips[c] = arma::join_rows(spikeSnips[c], snips);
+			}
+		}
+		for (arma::uword c = 0; c < nchannels; c++) {
+			arma::Mat<qint16> snips(snipsize, 50, arma::fill::randu);
+			arma::uvec idx(50, arma::fill::randu);
+			snipFile.appendNoiseSnips(10 + c, idx, snips);
+			noiseIdx[c] = idx;
+			noiseSnips[c] = snips;
+		}
+
+		QVERIFY_EXCEPTION_THROWN(snipFile.appendSpikeSnips(99, spikeIdx[1], spikeSnips[1]),
+				std::invalid_argument);
+		QVERIFY_EXCEPTION_THROWN(snipFile.appendSpikeSnips(11, 
+					spikeIdx[1], spikeSnips[1].rows(0, snipsize - 2).eval()),
+				std::invalid_argument);
+	}
+	spikeSnips[0].set_size(0, 0);
+
+	SnipFile snipFile(filename.toStdString());
+	std::vector<arma::uvec> readIdx;
+	std::vector<arma::Mat<qint16>> readSnips;
+	snipFile.spikeSnips(readIdx, readSnips);
+	QVERIFY2(snippetsEqual(spikeIdx, spikeSnips, readIdx, readSnips),
+			"Appended spike snippets were not read back correctly.");
+	snipFile.noiseSnips(readIdx, readSnips);
+	QVERIFY2(snippetsEqual(noiseIdx, noiseSnips, readIdx, readSnips),
+			"Appended noise snippets were not read back correctly.");
+	QFile::remove(filename);
+}
+
+void DatafileTest::testColumnarSnippets()
+{
+	QString filename = "test-columnar.snip";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	const arma::uword nchannels = 5, snipsize = 27;
+	arma::uvec channels(nchannels);
+	std::vector<arma::uvec> spikeIdx(nchannels), noiseIdx(nchannels);
+	std::vector<arma::Mat<qint16>> spikeSnips(nchannels), noiseSnips(nchannels);
+	for (arma::uword c = 0; c < nchannels; c++) {
+		channels(c) = 3 * c + 1;
+		arma::uword nsnips = (c == 2) ? 0 : 40 * (c + 1);
+		spikeIdx[c].set_size(nsnips);
+		spikeSnips[c].set_size(snipsize, nsnips);
+		for (arma::uword i = 0; i < nsnips; i++) {
+			spikeIdx[c](i) = 1000 * c + 7 * i;
+		}
+		for (arma::uword i = 0; i < spikeSnips[c].n_elem; i++) {
+			spikeSnips[c](i) = static_cast<qint16>((i * 2654435761u + c) >> 16);
+		}
+		noiseIdx[c] = arma::uvec(10, arma::fill::randu);
+		noiseSnips[c] = arma::Mat<qint16>(snipsize, 10, arma::fill::randu);
+	}
+
+	{
+		SnipFile snipFile(filename.toStdString(), *m_dataFile, 
+				snipfile::NUM_SAMPLES_BEFORE, snipfile::NUM_SAMPLES_AFTER, 0,
+				snipfile::SnipLayout::Columnar);
+		snipFile.setChannels(channels);
+		snipFile.setThresholds(arma::vec(nchannels, arma::fill::ones));
+		snipFile.writeSpikeSnips(spikeIdx, spikeSnips);
+		snipFile.writeNoiseSnips(noiseIdx, noiseSnips);
+		QVERIFY_EXCEPTION_THROWN(snipFile.appendSpikeSnips(1, spikeIdx[0], spikeSnips[0]),
+				std::logic_error);
+	}
+	spikeSnips[2].set_size(0, 0);
+
+	SnipFile snipFile(filename.toStdString());
+	QVERIFY(snipFile.layout() == snipfile::SnipLayout::Columnar);
+	std::vector<arma::uvec> readIdx;
+	std::vector<arma::Mat<qint16>> readSnips;
+	snipFile.spikeSnips(readIdx, readSnips);
+	QVERIFY2(snippetsEqual(spikeIdx, spikeSnips, readIdx, readSnips),
+			"Columnar spike snippets were not read back correctly.");
+	snipFile.noiseSnips(readIdx, readSnips);
+	QVERIFY2(snippetsEqual(noiseIdx, noiseSnips, readIdx, readSnips),
+			"Columnar noise snippets were not read back correctly.");
+
+	arma::uvec idx;
+	arma::Mat<qint16> snips;
+	snipFile.spikeSnips(channels(3), idx, snips);
+	QVERIFY2(arma::all(idx == spikeIdx[3]) && 
+			arma::all(arma::vectorise(snips == spikeSnips[3])),
+			"Columnar snippets of a single channel were not read back correctly.");
+	QFile::remove(filename);
+}
+
+void DatafileTest::testParallelSnippetLoad()
+{
+	QString filename = "test-parallel.snip";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	/* Spike snippets are appended, so chunked and compressed, and span
+	 * several chunks with a partial one at the end. Noise snippets are
+	 * written at once, so contiguous.
+	 */
+	const arma::uword nchannels = 6, snipsize = 31;
+	arma::uvec channels(nchannels);
+	std::vector<arma::uvec> noiseIdx(nchannels);
+	std::vector<arma::Mat<qint16>> noiseSnips(nchannels);
+	{
+		SnipFile snipFile(filename.toStdString(), *m_dataFile, 
+				snipfile::NUM_SAMPLES_BEFORE, snipfile::NUM_SAMPLES_AFTER, 6);
+		for (arma::uword c = 0; c < nchannels; c++) {
+			channels(c) = c;
+		}
+		snipFile.setChannels(channels);
+		snipFile.setThresholds(arma::vec(nchannels, arma::fill::ones));
+		for (arma::uword c = 1; c < nchannels; c++) {
+			arma::uword nsnips = 700 * c + 13;
+			arma::Mat<qint16> snips(snipsize, nsnips);
+			arma::uvec idx(nsnips);
+			for (arma::uword i = 0; i < snips.n_elem; i++) {
+				snips(i) = static_cast<qint16>(((i % 97) * c) - 3000);
+			}
+			for (arma::uword i = 0; i < nsnips; i++) {
+				idx(i) = 40 * i + c;
+			}
+			snipFile.appendSpikeSnips(c, idx, snips);
+			noiseIdx[c] = idx.subvec(0, 9);
+			noiseSnips[c] = snips.cols(0, 9).eval();
+		}
+		noiseIdx[0] = arma::uvec(10, arma::fill::randu);
+		noiseSnips[0] = arma::Mat<qint16>(snipsize, 10, arma::fill::randu);
+		snipFile.writeNoiseSnips(noiseIdx, noiseSnips);
+	}
+
+	SnipFile snipFile(filename.toStdString());
+	std::vector<arma::uvec> serialIdx, parallelIdx;
+	std::vector<arma::Mat<qint16>> serialSnips, parallelSnips;
+	snipFile.spikeSnips(serialIdx, serialSnips);
+	serialSnips[0].set_size(0, 0);
+	ThreadPool pool(3);
+	snipFile.spikeSnips(parallelIdx, parallelSnips, pool);
+	QVERIFY2(snippetsEqual(serialIdx, serialSnips, parallelIdx, parallelSnips),
+			"Compressed snippets loaded in parallel differ from those loaded serially.");
+
+	snipFile.noiseSnips(parallelIdx, parallelSnips, pool);
+	QVERIFY2(snippetsEqual(noiseIdx, noiseSnips, parallelIdx, parallelSnips),
+			"Contiguous snippets loaded in parallel are incorrect.");
+	QFile::remove(filename);
+}
+
+/* Return true if `idx` and `snips` are exactly the snippets of `allIdx`
+ * and `allSnips` with indices in [start, end).
+ */
+static bool snippetsInRange(const arma::uvec& allIdx, const arma::Mat<qint16>& allSnips,
+		arma::uword start, arma::uword end, const arma::uvec& idx, const arma::Mat<qint16>& snips)
+{
+	arma::uword n = 0;
+	for (arma::uword i = 0; i < allIdx.n_elem; i++) {
+		if ( (allIdx(i) < start) || (allIdx(i) >= end) ) {
+			continue;
+		}
+		if ( (n >= idx.n_elem) || (idx(n) != allIdx(i)) || (snips.n_rows != allSnips.n_rows) ||
+				std::memcmp(snips.colptr(n), allSnips.colptr(i), 
+					snips.n_rows * sizeof(qint16)) ) {
+			return false;
+		}
+		n++;
+	}
+	return (n == idx.n_elem) && (n == snips.n_cols);
+}
+
+void DatafileTest::testSnippetTimeRange()
+{
+	QString filename = "test-timerange.snip";
+	const arma::uword nchannels = 3, snipsize = 17;
+	for (auto layout : { SnipLayout::ChannelGroups, SnipLayout::Columnar }) {
+		if (QFile::exists(filename)) {
+			QFile::remove(filename);
+		}
+
+		/* Spikes span several blocks of the coarse index, with some at
+		 * the same sample, and channel 0 has none.
+		 */
+		arma::uvec channels(nchannels);
+		std::vector<arma::uvec> allIdx(nchannels);
+		std::vector<arma::Mat<qint16>> allSnips(nchannels);
+		for (arma::uword c = 0; c < nchannels; c++) {
+			channels(c) = 2 * c;
+			arma::uword nsnips = (c == 0) ? 0 : 1500 * c + 321;
+			allIdx[c].set_size(nsnips);
+			allSnips[c].set_size(snipsize, nsnips);
+			for (arma::uword i = 0; i < nsnips; i++) {
+				allIdx[c](i) = 10 * (i - i % 3) + c;
+			}
+			for (arma::uword i = 0; i < allSnips[c].n_elem; i++) {
+				allSnips[c](i) = static_cast<qint16>((i * 2654435761u) >> 16);
+			}
+		}
+		{
+			SnipFile snipFile(filename.toStdString(), *m_dataFile, 
+					snipfile::NUM_SAMPLES_BEFORE, snipfile::NUM_SAMPLES_AFTER, 0, layout);
+			snipFile.setChannels(channels);
+			snipFile.setThresholds(arma::vec(nchannels, arma::fill::ones));
+			if (layout == SnipLayout::Columnar) {
+				snipFile.writeSpikeSnips(allIdx, allSnips);
+			} else {
+				for (arma::uword c = 1; c < nchannels; c++) {
+					snipFile.appendSpikeSnips(channels(c), allIdx[c], allSnips[c]);
+				}
+			}
+		}
+
+		SnipFile snipFile(filename.toStdString());
+		arma::uvec idx;
+		arma::Mat<qint16> snips;
+		std::vector<std::pair<arma::uword, arma::uword>> ranges = {
+			{ 0, 1 }, { 0, 50000 }, { 10232, 10262 }, { 10230, 20480 },
+			{ 12345, 12345 }, { 29000, 100000 }, { 200000, 300000 }
+		};
+		bool correct = true;
+		for (auto& range : ranges) {
+			for (arma::uword c = 0; c < nchannels; c++) {
+				snipFile.spikeSnips(channels(c), range.first, range.second, idx, snips);
+				correct = correct && snippetsInRange(allIdx[c], allSnips[c], 
+						range.first, range.second, idx, snips);
+			}
+		}
+		QVERIFY2(correct, "Snippets of a single channel in a range are incorrect.");
+
+		std::vector<arma::uvec> idxs;
+		std::vector<arma::Mat<qint16>> snipss;
+		snipFile.spikeSnips(5000, 15000, idxs, snipss);
+		QVERIFY(idxs.size() == nchannels);
+		for (arma::uword c = 0; c < nchannels; c++) {
+			correct = correct && snippetsInRange(allIdx[c], allSnips[c], 
+					5000, 15000, idxs[c], snipss[c]);
+		}
+		QVERIFY2(correct, "Snippets of all channels in a range are incorrect.");
+		QVERIFY_EXCEPTION_THROWN(snipFile.spikeSnips(1, 0, 100, idx, snips), 
+				std::invalid_argument);
+	}
+	QFile::remove(filename);
+}
+
 void DatafileTest::testReadWriteMeans()
 {
+	/* Means are only stored in existing files opened for update */
 	arma::vec means(m_dataFile->nchannels(), arma::fill::randn);
+	QVERIFY_EXCEPTION_THROWN(m_dataFile->setMeans(means), std::logic_error);
+	m_dataFile.reset();
+	m_dataFile.reset(new DataFile(m_datafileName.toStdString(), OpenMode::Update));
 	m_dataFile->setMeans(means);
 
 	QVERIFY2(arma::all(m_dataFile->means() == means),
 			"Channel mean values not correctly read or written.");
 }
 
+void DatafileTest::testAsyncWriter()
+{
+	QString filename = "test-asyncwriter.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	{
+		DataFile df(filename.toStdString());
+		DataFile::AsyncWriter writer(df, 2);
+
+		/* Append in blocks which do not line up with chunk boundaries,
+		 * flushing part of the way through.
+		 */
+		arma::uword blockSize = 7001, pos = 0;
+		while (pos < m_data.n_rows) {
+			auto n = std::min(blockSize, m_data.n_rows - pos);
+			QVERIFY(writer.append(m_data.rows(pos, pos + n - 1).eval()));
+			pos += n;
+			if (pos == 2 * blockSize) {
+				writer.flush();
+				QVERIFY2(df.nsamples() == static_cast<int>(pos),
+						"Flushing the asynchronous writer did not write all data.");
+			}
+		}
+		writer.flush();
+
+		auto counters = writer.counters();
+		QVERIFY2(counters.samplesWritten == m_data.n_rows,
+				"Asynchronous writer did not write every appended sample.");
+		QVERIFY2(counters.samplesDropped == 0,
+				"Asynchronous writer dropped samples with the blocking policy.");
+
+		decltype(m_data) read;
+		df.data(0, df.nsamples(), read);
+		QVERIFY2((read.size() == m_data.size()) && arma::all(arma::vectorise(read == m_data)),
+				"Data appended through the asynchronous writer not written correctly.");
+	}
+	QFile::remove(filename);
+
+	/* With the dropping policy, appending whole blocks faster than the I/O
+	 * thread can write them fills the ring, and the rest of a block is dropped.
+	 */
+	{
+		DataFile df(filename.toStdString());
+		DataFile::AsyncWriter writer(df, 2, DataFile::AsyncWriter::OverflowPolicy::Drop);
+		bool dropped = false;
+		uint64_t nappended = 0;
+		for (int i = 0; (i < 32) && !dropped; i++) {
+			dropped = !writer.append(m_data);
+			nappended += m_data.n_rows;
+		}
+		QVERIFY2(dropped, "Asynchronous writer never dropped samples when its ring was full.");
+		writer.flush();
+
+		auto counters = writer.counters();
+		QVERIFY2(counters.stalls > 0,
+				"Asynchronous writer did not count finding its ring full.");
+		QVERIFY2(counters.samplesDropped > 0,
+				"Asynchronous writer did not count the samples it dropped.");
+		QVERIFY2(counters.samplesWritten + counters.samplesDropped == nappended,
+				"Asynchronous writer lost track of appended samples.");
+		QVERIFY2(writer.position() == nappended,
+				"Dropped samples did not advance the asynchronous writer's position.");
+	}
+	QFile::remove(filename);
+}
+
+void DatafileTest::testDeferNumSamples()
+{
+	QString filename = "test-defer-nsamples.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+	int nsamples = datafile::BlockSize + 100;
+	arma::Mat<qint16> data(nsamples, datafile::NumChannels);
+	for (arma::uword i = 0; i < data.n_elem; i++) {
+		data(i) = static_cast<qint16>(i % 1000) + 1;
+	}
+
+	{
+		DataFile df(filename.toStdString());
+		df.setGain(1.0);
+		df.setOffset(0.0);
+		df.setDate("unknown");
+		df.setDeferNumSamples(true, 0);
+		QVERIFY(df.deferNumSamples());
+		df.setData(0, nsamples / 2, data.rows(0, nsamples / 2 - 1).eval());
+		df.setData(nsamples / 2, nsamples, data.rows(nsamples / 2, nsamples - 1).eval());
+		QVERIFY2(df.nsamples() == nsamples,
+				"Number of samples not updated in memory when writes are deferred.");
+	}
+
+	{
+		DataFile df(filename.toStdString());
+		QVERIFY2(df.nsamples() == nsamples,
+				"Deferred number of samples not written when the file was closed.");
+	}
+
+	/* Make the stored count stale, as if the writer had died. */
+	{
+		H5::H5File file(filename.toStdString(), H5F_ACC_RDWR);
+		auto dset = file.openDataSet("data");
+		uint64_t zero = 0;
+		dset.openAttribute("nsamples").write(H5::PredType::STD_U64LE, &zero);
+		uint8_t stale = 1;
+		dset.openAttribute("nsamples-stale").write(H5::PredType::STD_U8LE, &stale);
+	}
+
+	{
+		DataFile df(filename.toStdString());
+		QVERIFY2(df.nsamples() == nsamples,
+				"Stale number of samples not recovered from the dataset.");
+		decltype(m_data) read;
+		df.data(0, nsamples, read);
+		QVERIFY2(arma::all(arma::vectorise(read == data)),
+				"Data not read correctly after recovering the number of samples.");
+	}
+	QFile::remove(filename);
+}
+
+void DatafileTest::testChunkOptions()
+{
+	QString filename = "test-chunk-options.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	auto scan = recommendOptions(AccessPattern::ChannelScan, hidensfile::NumChannels);
+	QVERIFY2(scan.chunkChannels == 1,
+			"Chunks recommended for channel scans should hold a single channel.");
+	auto window = recommendOptions(AccessPattern::TimeWindow, hidensfile::NumChannels);
+	QVERIFY2(window.chunkChannels == static_cast<hsize_t>(hidensfile::NumChannels),
+			"Chunks recommended for time windows should hold every channel.");
+	QVERIFY2(window.chunkSamples < scan.chunkSamples,
+			"Chunks recommended for time windows should be shorter than for channel scans.");
+
+	auto options = recommendOptions(AccessPattern::Mixed);
+	options.chunkCacheBytes = 4 * options.chunkChannels * options.chunkSamples * 
+			sizeof(qint16);
+	{
+		DataFile df(filename.toStdString(), datafile::DefaultArray,
+				datafile::NumChannels, options);
+		df.setGain(1.0);
+		df.setOffset(0.0);
+		df.setDate("unknown");
+		df.setData(0, m_data.n_rows, m_data);
+	}
+
+	/* Re-open, with a different cache, and verify the shape comes from the file. */
+	DataFileOptions reopen;
+	reopen.chunkCacheBytes = 1 << 20;
+	DataFile df(filename.toStdString(), datafile::DefaultArray,
+			datafile::NumChannels, reopen);
+	QVERIFY2( (df.options().chunkChannels == options.chunkChannels) &&
+			(df.options().chunkSamples == options.chunkSamples),
+			"Chunk shape of an existing file not read correctly.");
+	QVERIFY2(df.options().chunkCacheBytes == reopen.chunkCacheBytes,
+			"Chunk cache size not applied when opening an existing file.");
+	QVERIFY2(df.options().chunkCacheSlots > 0,
+			"Number of chunk cache slots not computed when opening an existing file.");
+
+	auto channel = df.data(3, 0, df.nsamples());
+	QVERIFY2(arma::all(arma::conv_to<arma::Col<qint16>>::from(channel) == m_data.col(3)),
+			"Data not read correctly from a file with a non-default chunk shape.");
+	QFile::remove(filename);
+}
+
+void DatafileTest::testCompression()
+{
+	QString filename = "test-compression.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	DataFileOptions options;
+	options.filter = 65000; // Not a registered filter
+	QVERIFY_EXCEPTION_THROWN(DataFile(filename.toStdString(), datafile::DefaultArray,
+				datafile::NumChannels, options), std::invalid_argument);
+	QVERIFY2(!QFile::exists(filename),
+			"File created even though the requested filter is unavailable.");
+
+	options.filter = 0;
+	options.shuffle = true;
+	options.deflate = 4;
+	{
+		DataFile df(filename.toStdString(), datafile::DefaultArray,
+				datafile::NumChannels, options);
+		df.setGain(1.0);
+		df.setOffset(0.0);
+		df.setDate("unknown");
+		df.setData(0, m_data.n_rows, m_data);
+	}
+
+	DataFile df(filename.toStdString());
+	QVERIFY2(df.options().shuffle && (df.options().deflate == options.deflate),
+			"Filters of an existing compressed file not read correctly.");
+	decltype(m_data) read;
+	df.data(0, df.nsamples(), read);
+	QVERIFY2((read.size() == m_data.size()) && arma::all(arma::vectorise(read == m_data)),
+			"Data not read correctly from a compressed file.");
+	QFile::remove(filename);
+}
+
+void DatafileTest::testMappedDataFile()
+{
+	QString filename = "test-mapped-source.h5";
+	QString finalName = "test-mapped-final.h5";
+	for (auto& name : { filename, finalName }) {
+		if (QFile::exists(name)) {
+			QFile::remove(name);
+		}
+	}
+
+	{
+		DataFile df(filename.toStdString());
+		df.setGain(0.5);
+		df.setOffset(0.0);
+		df.setDate("unknown");
+		df.setData(0, m_data.n_rows, m_data);
+	}
+
+	/* Only finalized files can be mapped. */
+	QVERIFY_EXCEPTION_THROWN(MappedDataFile(filename.toStdString()), std::invalid_argument);
+	finalize(filename.toStdString(), finalName.toStdString());
+	QVERIFY_EXCEPTION_THROWN(finalize(filename.toStdString(), finalName.toStdString()),
+			std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(finalize("test-missing.h5", "test-missing-final.h5"),
+			std::invalid_argument);
+	QVERIFY2(!QFile::exists("test-missing.h5") && !QFile::exists("test-missing-final.h5"),
+			"Finalizing a missing recording created a file.");
+
+	{
+		MappedDataFile mapped(finalName.toStdString());
+		QVERIFY2( (mapped.nsamples() == static_cast<int>(m_data.n_rows)) &&
+				(mapped.nchannels() == static_cast<int>(m_data.n_cols)) &&
+				(mapped.gain() == 0.5),
+				"Metadata of a mapped file not read correctly.");
+		auto all = mapped.data();
+		QVERIFY2((all.size() == m_data.size()) && arma::all(arma::vectorise(all == m_data)),
+				"Data from a mapped file not read correctly.");
+		auto some = mapped.data(3, 5);
+		QVERIFY2(some.memptr() == mapped.channel(3),
+				"Data from a mapped file was copied rather than aliased.");
+	}
+
+	/* The finalized file is still a valid recording. */
+	{
+		DataFile df(finalName.toStdString());
+		decltype(m_data) read;
+		df.data(0, df.nsamples(), read);
+		QVERIFY2((read.size() == m_data.size()) && arma::all(arma::vectorise(read == m_data)),
+				"Data from a finalized file not read correctly.");
+	}
+	QFile::remove(filename);
+	QFile::remove(finalName);
+}
+
+void DatafileTest::testDataScaled()
+{
+	QString filename = "test-datascaled.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	/* Use a length which is not a multiple of any vector width */
+	const int nsamples = 1003;
+	arma::Mat<int16_t> raw(nsamples, datafile::NumChannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>(static_cast<int>(i % 65536) - 32768);
+	}
+	const float gain = 0.125, offset = -3.5;
+	DataFile df(filename.toStdString());
+	df.setGain(gain);
+	df.setOffset(offset);
+	df.setDate("unknown");
+	df.setData(0, nsamples, raw);
+
+	arma::mat expected = gain * arma::conv_to<arma::mat>::from(raw) + offset;
+	arma::mat doubles;
+	df.dataScaled(0, nsamples, doubles);
+	QVERIFY2(arma::approx_equal(doubles, expected, "absdiff", 1e-9),
+			"Data read as scaled doubles is not correct.");
+
+	arma::fmat floats;
+	df.dataScaled(3, 8, 17, nsamples, floats);
+	arma::mat expectedSubset = expected.submat(17, 3, nsamples - 1, 7);
+	arma::fmat expectedFloats = arma::conv_to<arma::fmat>::from(expectedSubset);
+	QVERIFY2((floats.n_rows == nsamples - 17) && (floats.n_cols == 5) &&
+			arma::approx_equal(floats, expectedFloats, "reldiff", 1e-6),
+			"Data read as scaled floats is not correct.");
+
+	/* The voltage overloads of data() still apply only the gain. */
+	arma::mat gainOnly = df.data(0, nsamples);
+	arma::mat expectedGainOnly = gain * arma::conv_to<arma::mat>::from(raw);
+	QVERIFY2(arma::approx_equal(gainOnly, expectedGainOnly, "absdiff", 1e-9),
+			"Data read as voltages is not correct.");
+	arma::vec channel = df.data(5, 1, 100);
+	arma::vec expectedChannel = expectedGainOnly.submat(1, 5, 99, 5);
+	QVERIFY2(arma::approx_equal(channel, expectedChannel, "absdiff", 1e-9),
+			"Channel data read as voltages is not correct.");
+	QFile::remove(filename);
+}
+
+void DatafileTest::testConcurrentReads()
+{
+	QString filename = "test-concurrent.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	const int nsamples = 3 * datafile::BlockSize;
+	arma::Mat<int16_t> raw(nsamples, datafile::NumChannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>((i * 2654435761u) >> 16);
+	}
+	const float gain = 0.5;
+	arma::fmat voltages = arma::conv_to<arma::fmat>::from(raw);
+	voltages *= gain;
+
+	/* Use small chunks, so reads span many of them. */
+	DataFileOptions options;
+	options.chunkChannels = 8;
+	options.chunkSamples = 1000;
+	{
+		DataFile df(filename.toStdString(), datafile::DefaultArray, 
+				datafile::NumChannels, options);
+		df.setGain(gain);
+		df.setOffset(0.0);
+		df.setDate("unknown");
+		df.setData(0, nsamples, raw);
+	}
+
+	DataFile df(filename.toStdString());
+	std::atomic<int> mismatches(0), failures(0);
+	auto reader = [&](unsigned int seed) {
+		std::mt19937 rng(seed);
+		for (int i = 0; i < 100; i++) {
+			int startChan = rng() % (datafile::NumChannels - 1);
+			int endChan = startChan + 1 + rng() % (datafile::NumChannels - startChan);
+			int startSample = rng() % (nsamples - 1);
+			int endSample = startSample + 1 + rng() % std::min(nsamples - startSample, 5000);
+			try {
+				if (i % 2) {
+					arma::Mat<int16_t> read;
+					df.data(startChan, endChan, startSample, endSample, read);
+					arma::Mat<int16_t> expected = raw.submat(startSample, startChan,
+							endSample - 1, endChan - 1);
+					if (!arma::all(arma::vectorise(read == expected)))
+						mismatches++;
+				} else {
+					arma::fmat read;
+					df.dataScaled(startChan, endChan, startSample, endSample, read);
+					arma::fmat expected = voltages.submat(startSample, startChan,
+							endSample - 1, endChan - 1);
+					if (!arma::all(arma::vectorise(read == expected)))
+						mismatches++;
+				}
+			} catch (...) {
+				failures++;
+			}
+		}
+	};
+	auto pooled = [&]() {
+		DataFile::ReaderPool pool(df, 4);
+		for (int i = 0; i < 10; i++) {
+			try {
+				arma::Mat<int16_t> read;
+				pool.data(0, nsamples, read);
+				if (!arma::all(arma::vectorise(read == raw)))
+					mismatches++;
+				arma::fmat scaled;
+				pool.dataScaled(3, 61, 17, nsamples, scaled);
+				arma::fmat expected = voltages.submat(17, 3, nsamples - 1, 60);
+				if (!arma::all(arma::vectorise(scaled == expected)))
+					mismatches++;
+			} catch (...) {
+				failures++;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < 8; i++) {
+		threads.emplace_back(reader, i);
+	}
+	threads.emplace_back(pooled);
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	QVERIFY2(failures == 0, "Concurrent reads raised exceptions.");
+	QVERIFY2(mismatches == 0, "Concurrent reads returned incorrect data.");
+
+	DataFile::ReaderPool pool(df, 2);
+	arma::Mat<int16_t> read;
+	QVERIFY_EXCEPTION_THROWN(pool.data(0, nsamples + 1, read), std::logic_error);
+	QFile::remove(filename);
+}
+
+void DatafileTest::testReadPlan()
+{
+	QString filename = "test-readplan.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	const int nsamples = 10000;
+	arma::Mat<int16_t> raw(nsamples, datafile::NumChannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>((i * 2654435761u) >> 16);
+	}
+	DataFileOptions options;
+	options.chunkChannels = 16;
+	options.chunkSamples = 1000;
+	{
+		DataFile df(filename.toStdString(), datafile::DefaultArray, 
+				datafile::NumChannels, options);
+		df.setGain(0.5);
+		df.setOffset(1.0);
+		df.setDate("unknown");
+		df.setData(0, nsamples, raw);
+	}
+
+	/* Every channel over the same window, plus overlapping windows
+	 * sliding across the first rows of chunks.
+	 */
+	DataFile df(filename.toStdString());
+	DataFile::ReadPlan plan(df);
+	for (int c = 0; c < datafile::NumChannels; c++) {
+		plan.add(c, c + 1, 2500, 4500);
+	}
+	for (int i = 0; i < 20; i++) {
+		plan.add(4, 20, 100 + 250 * i, 1100 + 250 * i);
+	}
+	QVERIFY_EXCEPTION_THROWN(plan.add(0, 1, 0, nsamples + 1), std::logic_error);
+
+	/* Samples [2500, 4500) span 3 columns of chunks in each of 4 rows.
+	 * The windows span samples [100, 5850) of the first 2 rows, adding
+	 * 3 columns in each that the first requests did not touch.
+	 */
+	QVERIFY2(plan.size() == static_cast<size_t>(datafile::NumChannels + 20),
+			"ReadPlan did not keep all requests.");
+	QVERIFY2(plan.chunks() == 4 * 3 + 2 * 3, 
+			"ReadPlan does not read each chunk exactly once.");
+
+	ThreadPool pool(4);
+	std::vector<arma::Mat<int16_t> > serial, parallel;
+	std::vector<arma::mat> scaled;
+	plan.execute(serial);
+	plan.execute(parallel, &pool);
+	plan.executeScaled(scaled, &pool);
+	bool correct = (serial.size() == plan.size()) && (parallel.size() == plan.size());
+	for (size_t i = 0; correct && (i < plan.size()); i++) {
+		auto& r = serial[i];
+		arma::Mat<int16_t> expected;
+		arma::mat expectedScaled;
+		if (i < static_cast<size_t>(datafile::NumChannels)) {
+			df.data(i, i + 1, 2500, 4500, expected);
+			df.dataScaled(i, i + 1, 2500, 4500, expectedScaled);
+		} else {
+			auto j = i - datafile::NumChannels;
+			df.data(4, 20, 100 + 250 * j, 1100 + 250 * j, expected);
+			df.dataScaled(4, 20, 100 + 250 * j, 1100 + 250 * j, expectedScaled);
+		}
+		correct = (r.size() == expected.size()) && 
+			arma::all(arma::vectorise(r == expected)) &&
+			arma::all(arma::vectorise(parallel[i] == expected)) &&
+			arma::approx_equal(scaled[i], expectedScaled, "absdiff", 1e-12);
+	}
+	QVERIFY2(correct, "ReadPlan returned incorrect data.");
+	QVERIFY(df.chunked());
+
+	/* A contiguous dataset is one "chunk", so requests are grouped by
+	 * blocks of samples rather than into one read of the whole file.
+	 */
+	QString longName = "test-readplan-long.h5";
+	QString finalName = "test-readplan-final.h5";
+	for (auto& name : { longName, finalName }) {
+		if (QFile::exists(name)) {
+			QFile::remove(name);
+		}
+	}
+	const int64_t nlong = 2 * datafile::BlockSize + 500;
+	arma::Mat<int16_t> longRaw(nlong, 4);
+	for (arma::uword i = 0; i < longRaw.n_elem; i++) {
+		longRaw(i) = static_cast<int16_t>(static_cast<uint32_t>(i * 2654435761u) >> 16);
+	}
+	{
+		DataFile source(longName.toStdString(), datafile::DefaultArray, 4);
+		source.setGain(0.5);
+		source.setOffset(1.0);
+		source.setDate("unknown");
+		source.setData(0, nlong, longRaw);
+	}
+	finalize(longName.toStdString(), finalName.toStdString());
+	DataFile contiguous(finalName.toStdString(), OpenMode::ReadOnly);
+	QVERIFY(!contiguous.chunked());
+	DataFile::ReadPlan blocks(contiguous);
+	blocks.add(0, 2, 100, 200);
+	blocks.add(1, 4, datafile::BlockSize - 50, datafile::BlockSize + 50);
+	blocks.add(3, 4, 2 * datafile::BlockSize + 100, 2 * datafile::BlockSize + 200);
+	QVERIFY2(blocks.chunks() == 3,
+			"ReadPlan does not group reads of a contiguous dataset by blocks.");
+	std::vector<arma::Mat<int16_t> > windows;
+	blocks.execute(windows, &pool);
+	QVERIFY2( arma::all(arma::vectorise(windows[0] == longRaw.submat(100, 0, 199, 1))) &&
+			arma::all(arma::vectorise(windows[1] == longRaw.submat(
+					datafile::BlockSize - 50, 1, datafile::BlockSize + 49, 3))) &&
+			arma::all(arma::vectorise(windows[2] == longRaw.submat(
+					2 * datafile::BlockSize + 100, 3, 2 * datafile::BlockSize + 199, 3))),
+			"ReadPlan read a contiguous dataset incorrectly.");
+	QFile::remove(filename);
+	QFile::remove(longName);
+	QFile::remove(finalName);
+}
+
+void DatafileTest::testBlockIterator()
+{
+	QString filename = "test-blockiterator.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	const int nsamples = 10123, blockSize = 1000, overlap = 100;
+	arma::Mat<int16_t> raw(nsamples, datafile::NumChannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>((i * 2654435761u) >> 16);
+	}
+	{
+		DataFile df(filename.toStdString());
+		df.setGain(1.0);
+		df.setOffset(0.0);
+		df.setDate("unknown");
+		df.setData(0, nsamples, raw);
+	}
+
+	DataFile df(filename.toStdString());
+	QVERIFY_EXCEPTION_THROWN(DataFile::BlockIterator<int16_t>(df, blockSize, blockSize),
+			std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(DataFile::BlockIterator<int16_t>(df, blockSize, 0, 2, 0,
+			nsamples + 1), std::logic_error);
+
+	DataFile::BlockIterator<int16_t> blocks(df, blockSize, overlap, 3);
+	int count = 0, expectedStart = 0, lastEnd = 0;
+	bool correct = true;
+	for (auto& block : blocks) {
+		arma::Mat<int16_t> expected = raw.rows(block.start, block.end - 1);
+		correct = correct && (block.start == expectedStart) &&
+			(block.data.n_rows == static_cast<arma::uword>(block.end - block.start)) &&
+			arma::all(arma::vectorise(block.data == expected));
+		expectedStart += blockSize - overlap;
+		lastEnd = block.end;
+		count++;
+	}
+	QVERIFY2(correct, "BlockIterator returned incorrect blocks.");
+	QVERIFY2((count == blocks.nblocks()) && (count == 12) && (lastEnd == nsamples),
+			"BlockIterator did not cover the recording.");
+	auto counters = blocks.counters();
+	QVERIFY2((counters.blocks == static_cast<uint64_t>(count)) &&
+			(counters.samples >= static_cast<uint64_t>(nsamples)),
+			"BlockIterator counters are incorrect.");
+
+	/* The range is single-pass, and an empty range yields nothing. */
+	QVERIFY(blocks.begin() == blocks.end());
+	DataFile::BlockIterator<double> empty(df, blockSize, 0, 1, 10, 10);
+	QVERIFY(empty.begin() == empty.end());
+	QFile::remove(filename);
+}
+
+/* Return true if a summary matches envelopes of `raw` computed over
+ * consecutive runs of `width` samples, starting at sample 0.
+ */
+static bool summaryMatches(const Summary& summary, const arma::Mat<int16_t>& raw, int width)
+{
+	for (arma::uword c = 0; c < raw.n_cols; c++) {
+		for (arma::uword p = 0; p < summary.min.n_rows; p++) {
+			double min = raw(p * width, c), max = min, sum = 0, sumsq = 0;
+			for (arma::uword i = p * width; i < (p + 1) * width; i++) {
+				double value = raw(i, c);
+				min = std::min(min, value);
+				max = std::max(max, value);
+				sum += value;
+				sumsq += value * value;
+			}
+			double mean = sum / width, rms = std::sqrt(sumsq / width);
+			if ( (summary.min(p, c) != min) || (summary.max(p, c) != max) ||
+					(std::abs(summary.mean(p, c) - mean) > 1e-3 * (1 + std::abs(mean))) ||
+					(std::abs(summary.rms(p, c) - rms) > 1e-3 * (1 + rms)) ) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void DatafileTest::testSummary()
+{
+	QString filename = "test-summary.h5";
+	QString plainName = "test-summary-plain.h5";
+	for (auto& name : { filename, plainName }) {
+		if (QFile::exists(name)) {
+			QFile::remove(name);
+		}
+	}
+
+	const int nsamples = 25500, nchannels = 8, blockSize = 777;
+	arma::Mat<int16_t> raw(nsamples, nchannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>((i * 2654435761u) >> 16);
+	}
+
+	DataFileOptions options;
+	options.summaryFactors = { 1, 10 };
+	QVERIFY_EXCEPTION_THROWN(DataFile(filename.toStdString(), datafile::DefaultArray,
+				nchannels, options), std::invalid_argument);
+	QVERIFY(!QFile::exists(filename));
+
+	options.summaryFactors = { 10, 100, 1000 };
+	{
+		DataFile df(filename.toStdString(), datafile::DefaultArray, nchannels, options);
+		df.setGain(1.0);
+		df.setOffset(0.0);
+		df.setDate("unknown");
+
+		/* Write blocks out of order, which leaves a gap, then fill it */
+		for (int start = 0; start < nsamples; start += blockSize) {
+			if ( (start < 7 * blockSize) || (start >= 9 * blockSize) ) {
+				auto end = std::min(start + blockSize, nsamples);
+				df.setData(start, end, raw.rows(start, end - 1).eval());
+			}
+		}
+		df.setData(7 * blockSize, 9 * blockSize, raw.rows(7 * blockSize, 9 * blockSize - 1).eval());
+
+		/* Coarse requests use the stored levels, fine ones the raw data */
+		auto coarse = df.summary(0, nchannels, 0, 25000, 25);
+		QVERIFY2((coarse.factor == 1000) && summaryMatches(coarse, raw, 1000),
+				"Summary from the coarsest level is incorrect.");
+		auto middle = df.summary(0, nchannels, 0, 25000, 250);
+		QVERIFY2((middle.factor == 100) && summaryMatches(middle, raw, 100),
+				"Summary from an intermediate level is incorrect.");
+		auto fine = df.summary(0, nchannels, 0, 500, 100);
+		QVERIFY2((fine.factor == 1) && summaryMatches(fine, raw, 5),
+				"Summary from raw data is incorrect.");
+		QVERIFY_EXCEPTION_THROWN(df.summary(0, nchannels, 0, nsamples, 0),
+				std::invalid_argument);
+	}
+
+	/* The stored levels are read back, and the last 500 samples, which
+	 * do not fill a bin of the coarsest level, come from the raw data.
+	 */
+	{
+		DataFile df(filename.toStdString());
+		QVERIFY(df.options().summaryFactors == options.summaryFactors);
+		auto all = df.summary(0, nchannels, 0, nsamples, 20);
+		bool correct = (all.factor == 1000);
+		for (int c = 0; c < nchannels; c++) {
+			correct = correct && (all.min.col(c).min() == raw.col(c).min()) &&
+				(all.max.col(c).max() == raw.col(c).max());
+		}
+		QVERIFY2(correct, "Summary of a reopened file is incorrect.");
+		auto coarse = df.summary(0, nchannels, 0, 25000, 25);
+		QVERIFY2(summaryMatches(coarse, raw, 1000),
+				"Summary of a reopened file is incorrect.");
+
+		/* Only the requested samples of the partial bins at either end count */
+		auto partial = df.summary(0, nchannels, 1500, 23700, 22);
+		correct = (partial.factor == 1000);
+		for (int c = 0; c < nchannels; c++) {
+			correct = correct &&
+				(partial.min(0, c) == raw.col(c).rows(1500, 1999).min()) &&
+				(partial.max(0, c) == raw.col(c).rows(1500, 1999).max()) &&
+				(partial.min.col(c).min() == raw.col(c).rows(1500, 23699).min()) &&
+				(partial.max.col(c).max() == raw.col(c).rows(1500, 23699).max());
+		}
+		QVERIFY2(correct, "Summary includes samples outside the requested range.");
+	}
+
+	/* Summaries can be built for existing files */
+	{
+		DataFile df(plainName.toStdString(), datafile::DefaultArray, nchannels);
+		df.setGain(1.0);
+		df.setOffset(0.0);
+		df.setDate("unknown");
+		df.setData(0, nsamples, raw);
+	}
+	{
+		DataFile df(plainName.toStdString(), OpenMode::Update);
+		auto unsummarized = df.summary(0, nchannels, 0, 25000, 25);
+		QVERIFY2((unsummarized.factor == 1) && summaryMatches(unsummarized, raw, 1000),
+				"Summary of a file without summary levels is incorrect.");
+		df.buildSummary();
+		auto coarse = df.summary(0, nchannels, 0, 20000, 2);
+		QVERIFY2((coarse.factor == 10000) && summaryMatches(coarse, raw, 10000),
+				"Summary built for an existing file is incorrect.");
+	}
+	QFile::remove(filename);
+	QFile::remove(plainName);
+}
+
+/* Return true if the statistics match those of each column of `raw` */
+static bool statsMatch(const ChannelStats& stats, const arma::Mat<int16_t>& raw)
+{
+	if ( (stats.count != raw.n_rows) || (stats.mean.n_elem != raw.n_cols) ) {
+		return false;
+	}
+	auto variance = stats.variance();
+	for (arma::uword c = 0; c < raw.n_cols; c++) {
+		double sum = 0, sumsq = 0, lo = raw(0, c), hi = raw(0, c);
+		arma::uword low = 0, high = 0;
+		for (arma::uword i = 0; i < raw.n_rows; i++) {
+			double value = raw(i, c);
+			sum += value;
+			lo = std::min(lo, value);
+			hi = std::max(hi, value);
+			low += (raw(i, c) == std::numeric_limits<int16_t>::min());
+			high += (raw(i, c) == std::numeric_limits<int16_t>::max());
+		}
+		double mean = sum / raw.n_rows;
+		for (arma::uword i = 0; i < raw.n_rows; i++) {
+			sumsq += (raw(i, c) - mean) * (raw(i, c) - mean);
+		}
+		if ( (std::abs(stats.mean(c) - mean) > 1e-9 * std::abs(mean) + 1e-9) ||
+				(std::abs(variance(c) - sumsq / (raw.n_rows - 1)) > 1e-9 * variance(c)) ||
+				(stats.min(c) != lo) || (stats.max(c) != hi) ||
+				(stats.clipLow(c) != low) || (stats.clipHigh(c) != high) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void DatafileTest::testChannelStats()
+{
+	QString filename = "test-channelstats.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	const int nsamples = 30000, nchannels = 6, blockSize = 4096;
+	arma::Mat<int16_t> raw(nsamples, nchannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>(((i * 2654435761u) >> 20) + 1000 * (i / nsamples));
+	}
+	for (int i = 0; i < nsamples; i += 997) {
+		raw(i, i % nchannels) = std::numeric_limits<int16_t>::max();
+		raw(i + 1, (i + 1) % nchannels) = std::numeric_limits<int16_t>::min();
+	}
+
+	{
+		DataFile df(filename.toStdString(), datafile::DefaultArray, nchannels);
+		df.setGain(1.0);
+		df.setOffset(0.0);
+		df.setDate("unknown");
+		QVERIFY(df.stats().complete && (df.stats().count == 0));
+		for (int start = 0; start < nsamples; start += blockSize) {
+			auto end = std::min(start + blockSize, nsamples);
+			df.setData(start, end, raw.rows(start, end - 1).eval());
+		}
+		QVERIFY2(df.stats().complete && statsMatch(df.stats(), raw),
+				"Statistics accumulated during writes are incorrect.");
+	}
+
+	/* Statistics and means are stored in the file */
+	{
+		DataFile df(filename.toStdString());
+		QVERIFY2(df.stats().complete && statsMatch(df.stats(), raw),
+				"Statistics read from the file are incorrect.");
+		QVERIFY2(arma::all(df.means() == df.stats().mean),
+				"Channel means were not written along with the statistics.");
+	}
+	QFile::remove(filename);
+
+	/* Overwriting data invalidates the statistics, until recomputed */
+	{
+		DataFile df(filename.toStdString(), datafile::DefaultArray, nchannels);
+		df.setGain(1.0);
+		df.setOffset(0.0);
+		df.setDate("unknown");
+		df.setData(0, nsamples, raw);
+		for (int c = 0; c < nchannels; c++) {
+			raw(10, c) = 0;
+		}
+		df.setData(10, 11, raw.rows(10, 10).eval());
+		QVERIFY(!df.stats().complete);
+	}
+	{
+		DataFile df(filename.toStdString(), OpenMode::Update);
+		QVERIFY(!df.stats().complete);
+		df.computeStats();
+		QVERIFY2(df.stats().complete && statsMatch(df.stats(), raw),
+				"Statistics computed for an existing file are incorrect.");
+	}
+	{
+		DataFile df(filename.toStdString());
+		QVERIFY(df.stats().complete && statsMatch(df.stats(), raw));
+	}
+	QFile::remove(filename);
+}
+
+/* Find the spikes of one channel of raw data as the Extractor should,
+ * by searching every sample directly.
+ */
+static void findSpikes(const arma::Mat<int16_t>& raw, arma::uword channel,
+		double mean, double threshold, arma::uvec& idx, arma::Mat<qint16>& snips)
+{
+	const int nbefore = snipfile::NUM_SAMPLES_BEFORE;
+	const int nafter = snipfile::NUM_SAMPLES_AFTER;
+	const int window = snipfile::WINDOW_SIZE;
+	const int nsamples = raw.n_rows;
+	std::vector<arma::uword> found;
+	for (int i = nbefore; i + nafter < nsamples; i++) {
+		auto value = raw(i, channel);
+		if (value >= mean - threshold) {
+			continue;
+		}
+		bool peak = true;
+		for (int j = std::max(0, i - window); j < i; j++) {
+			peak = peak && (raw(j, channel) > value);
+		}
+		for (int j = i + 1; j <= std::min(nsamples - 1, i + window); j++) {
+			peak = peak && (raw(j, channel) >= value);
+		}
+		if (peak) {
+			found.push_back(i);
+		}
+	}
+	idx.set_size(found.size());
+	snips.set_size(nbefore + nafter + 1, found.size());
+	for (size_t s = 0; s < found.size(); s++) {
+		idx(s) = found[s];
+		for (int j = 0; j < nbefore + nafter + 1; j++) {
+			snips(j, s) = raw(found[s] - nbefore + j, channel);
+		}
+	}
+}
+
+void DatafileTest::testExtractor()
+{
+	QString filename = "test-extractor.h5", snipname = "test-extractor.snip";
+	for (auto& name : { filename, snipname }) {
+		if (QFile::exists(name)) {
+			QFile::remove(name);
+		}
+	}
+
+	/* Small noise, with spikes planted at the ends of the recording and
+	 * on either side of block boundaries.
+	 */
+	const int nsamples = 10000, nchannels = 8, blockSize = 1000;
+	arma::Mat<int16_t> raw(nsamples, nchannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>((static_cast<uint32_t>(i * 2654435761u) >> 28) +
+				100 * (i / nsamples));
+	}
+	std::vector<int> peaks = { 2, 30, 997, 1000, 1003, 2999, 5012, 5015, 7000, 9985, 9998 };
+	for (int c = 0; c < nchannels; c += 2) {
+		for (auto peak : peaks) {
+			for (int j = -2; j <= 2; j++) {
+				raw(peak + c + j, c) -= static_cast<int16_t>(500 - 150 * std::abs(j));
+			}
+		}
+	}
+	DataFile df(filename.toStdString(), datafile::DefaultArray, nchannels);
+	df.setGain(1.0);
+	df.setOffset(0.0);
+	df.setDate("unknown");
+	df.setData(0, nsamples, raw);
+
+	snipfile::ExtractorOptions options;
+	options.blockSize = blockSize;
+	options.channelsPerGroup = 3;
+	options.nthreads = 3;
+	options.channels = arma::uvec({ 0, 1, 2, 4, 5, 7 });
+	for (auto layout : { SnipLayout::ChannelGroups, SnipLayout::Columnar }) {
+		snipfile::Extractor extractor(df, options);
+		std::unique_ptr<SnipFile> snipFile(new SnipFile(snipname.toStdString(), df,
+				snipfile::NUM_SAMPLES_BEFORE, snipfile::NUM_SAMPLES_AFTER, 0, layout));
+		auto counters = extractor.run(*snipFile);
+		snipFile.reset(new SnipFile(snipname.toStdString()));
+		QVERIFY(arma::all(snipFile->channels() == options.channels));
+		QVERIFY(arma::all(snipFile->thresholds() == extractor.thresholds()));
+
+		std::vector<arma::uvec> idx;
+		std::vector<arma::Mat<qint16>> snips;
+		snipFile->spikeSnips(idx, snips);
+		QVERIFY(idx.size() == options.channels.n_elem);
+		bool correct = true;
+		arma::uword total = 0;
+		for (arma::uword i = 0; i < options.channels.n_elem; i++) {
+			auto c = options.channels(i);
+			correct = correct && (extractor.means()(i) == df.stats().mean(c)) &&
+				(std::abs(extractor.thresholds()(i) -
+						snipfile::DEFAULT_THRESHOLD * df.stats().stddev()(c)) < 1e-9);
+			arma::uvec expectedIdx;
+			arma::Mat<qint16> expectedSnips;
+			findSpikes(raw, c, extractor.means()(i), extractor.thresholds()(i),
+					expectedIdx, expectedSnips);
+			correct = correct && snippetsEqual({ expectedIdx }, { expectedSnips },
+					{ idx[i] }, { snips[i] });
+			total += expectedIdx.n_elem;
+		}
+		QVERIFY2(correct, "Extracted spikes differ from a direct search of the data.");
+		QVERIFY(total > 0);
+		QVERIFY((counters.spikes == total) &&
+				(counters.samples == static_cast<uint64_t>(nsamples) * options.channels.n_elem));
+		snipFile.reset();
+		QFile::remove(snipname);
+	}
+
+	/* Explicit thresholds, and statistics computed by the extractor once
+	 * those of the file are out of date.
+	 */
+	df.setData(10, 11, raw.rows(10, 10).eval());
+	QVERIFY(!df.stats().complete);
+	options.channels.reset();
+	snipfile::Extractor extractor(df, options);
+	arma::vec thresholds(nchannels);
+	thresholds.fill(200);
+	extractor.setThresholds(thresholds);
+	{
+		SnipFile snipFile(snipname.toStdString(), df);
+		extractor.run(snipFile);
+	}
+	SnipFile snipFile(snipname.toStdString());
+	std::vector<arma::uvec> idx;
+	std::vector<arma::Mat<qint16>> snips;
+	snipFile.spikeSnips(idx, snips);
+	bool correct = (idx.size() == static_cast<size_t>(nchannels));
+	for (int c = 0; correct && (c < nchannels); c++) {
+		double mean = 0;
+		for (int i = 0; i < nsamples; i++) {
+			mean += raw(i, c);
+		}
+		correct = (std::abs(extractor.means()(c) - mean / nsamples) < 1e-9);
+		arma::uvec expectedIdx;
+		arma::Mat<qint16> expectedSnips;
+		findSpikes(raw, c, extractor.means()(c), 200, expectedIdx, expectedSnips);
+		correct = correct && snippetsEqual({ expectedIdx }, { expectedSnips },
+				{ idx[c] }, { snips[c] });
+	}
+	QVERIFY2(correct, "Spikes extracted with explicit thresholds are incorrect.");
+	QVERIFY_EXCEPTION_THROWN(extractor.setThresholds(arma::vec(2)), std::invalid_argument);
+	options.channels = arma::uvec({ 3, 2 });
+	QVERIFY_EXCEPTION_THROWN(snipfile::Extractor(df, options), std::invalid_argument);
+
+	/* The channels of a contiguous file are shared among the threads */
+	QString finalName = "test-extractor-final.h5";
+	if (QFile::exists(finalName)) {
+		QFile::remove(finalName);
+	}
+	df.flush();
+	finalize(filename.toStdString(), finalName.toStdString());
+	{
+		DataFile contiguous(finalName.toStdString(), OpenMode::ReadOnly);
+		options.channels.reset();
+		options.channelsPerGroup = 0;
+		options.nthreads = 3;
+		QVERIFY2(snipfile::Extractor(contiguous, options).options().channelsPerGroup == 3,
+				"Channels of a contiguous file not divided among threads.");
+		options.channelsPerGroup = 0;
+		QVERIFY(snipfile::Extractor(df, options).options().channelsPerGroup ==
+				static_cast<int>(df.options().chunkChannels));
+	}
+	QFile::remove(snipname);
+	QFile::remove(filename);
+	QFile::remove(finalName);
+}
+
+void DatafileTest::testNoiseSampler()
+{
+	QString filename = "test-noise.h5", snipname = "test-noise.snip";
+	for (auto& name : { filename, snipname }) {
+		if (QFile::exists(name)) {
+			QFile::remove(name);
+		}
+	}
+
+	const int nsamples = 20000, nchannels = 6;
+	const size_t count = 500;
+	const size_t nbefore = snipfile::NUM_SAMPLES_BEFORE, nafter = snipfile::NUM_SAMPLES_AFTER;
+	arma::Mat<int16_t> raw(nsamples, nchannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>(static_cast<uint32_t>(i * 2654435761u) >> 16);
+	}
+	DataFile df(filename.toStdString(), datafile::DefaultArray, nchannels);
+	df.setGain(1.0);
+	df.setOffset(0.0);
+	df.setDate("unknown");
+	df.setData(0, nsamples, raw);
+
+	/* Samples are distinct, sorted, and depend only on the seed */
+	snipfile::NoiseSampler sampler(df, 17);
+	auto idx = sampler.indices(count, nbefore, nafter);
+	QVERIFY(idx.n_elem == count);
+	bool valid = true;
+	for (arma::uword i = 0; i < idx.n_elem; i++) {
+		valid = valid && (idx(i) >= nbefore) && (idx(i) + nafter < nsamples) &&
+			((i == 0) || (idx(i) > idx(i - 1)));
+	}
+	QVERIFY2(valid, "Noise samples are out of range, unsorted or repeated.");
+	QVERIFY(arma::all(snipfile::NoiseSampler(df, 17).indices(count, nbefore, nafter) == idx));
+	QVERIFY(arma::any(snipfile::NoiseSampler(df, 18).indices(count, nbefore, nafter) != idx));
+	QVERIFY(sampler.indices(nsamples - nbefore - nafter, nbefore, nafter).n_elem ==
+			nsamples - nbefore - nafter);
+	QVERIFY_EXCEPTION_THROWN(sampler.indices(nsamples, nbefore, nafter),
+			std::invalid_argument);
+
+	/* Snippets match the data, whether or not chunks are read on a pool */
+	arma::uvec channels = arma::uvec({ 1, 2, 4 });
+	std::vector<arma::uvec> sampledIdx, pooledIdx;
+	std::vector<arma::Mat<qint16>> sampledSnips, pooledSnips;
+	sampler.sample(channels, count, nbefore, nafter, sampledIdx, sampledSnips);
+	ThreadPool pool(3);
+	sampler.sample(channels, count, nbefore, nafter, pooledIdx, pooledSnips, &pool);
+	QVERIFY(snippetsEqual(sampledIdx, sampledSnips, pooledIdx, pooledSnips));
+	bool correct = (sampledIdx.size() == channels.n_elem);
+	for (arma::uword c = 0; correct && (c < channels.n_elem); c++) {
+		correct = arma::all(sampledIdx[c] == idx) && 
+			(sampledSnips[c].n_rows == nbefore + nafter + 1) &&
+			(sampledSnips[c].n_cols == count);
+		for (size_t i = 0; correct && (i < count); i++) {
+			for (size_t j = 0; j < sampledSnips[c].n_rows; j++) {
+				correct = correct && 
+					(sampledSnips[c](j, i) == raw(idx(i) - nbefore + j, channels(c)));
+			}
+		}
+	}
+	QVERIFY2(correct, "Noise snippets do not match the data.");
+
+	/* Snippets written to a snippet file */
+	{
+		SnipFile snipFile(snipname.toStdString(), df);
+		snipFile.setChannels(channels);
+		snipFile.setThresholds(arma::vec(channels.n_elem, arma::fill::ones));
+		sampler.sample(snipFile, count);
+	}
+	SnipFile snipFile(snipname.toStdString());
+	std::vector<arma::uvec> readIdx;
+	std::vector<arma::Mat<qint16>> readSnips;
+	snipFile.noiseSnips(readIdx, readSnips);
+	QVERIFY2(snippetsEqual(sampledIdx, sampledSnips, readIdx, readSnips),
+			"Noise snippets were written to the snippet file incorrectly.");
+	QFile::remove(snipname);
+	QFile::remove(filename);
+}
+
+/* Filter one channel in double precision, directly from the definition
+ * of each section or the taps, starting from the steady state for its
+ * first sample.
+ */
+static arma::vec referenceFilter(const Filter& filter, const arma::vec& x)
+{
+	arma::vec y = x;
+	if (filter.isFir()) {
+		auto& taps = filter.taps();
+		for (arma::uword i = 0; i < x.n_elem; i++) {
+			y(i) = 0;
+			for (size_t k = 0; k < taps.size(); k++) {
+				y(i) += taps[k] * ((i >= k) ? x(i - k) : x(0));
+			}
+		}
+		return y;
+	}
+	for (auto& s : filter.sections()) {
+		arma::vec in = y;
+		double gain = (s.b0 + s.b1 + s.b2) / (1 + s.a1 + s.a2);
+		double x1 = in(0), x2 = in(0), y1 = gain * in(0), y2 = gain * in(0);
+		for (arma::uword i = 0; i < in.n_elem; i++) {
+			y(i) = s.b0 * in(i) + s.b1 * x1 + s.b2 * x2 - s.a1 * y1 - s.a2 * y2;
+			x2 = x1;
+			x1 = in(i);
+			y2 = y1;
+			y1 = y(i);
+		}
+	}
+	return y;
+}
+
+void DatafileTest::testFilter()
+{
+	QString filename = "test-filter.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	/* An offset, a slow drift and a tone in the pass band on each channel,
+	 * with a little noise. The channels do not fill the last SIMD lanes.
+	 */
+	const int nsamples = 30000, nchannels = 11;
+	const double sampleRate = hidensfile::SampleRate, tone = 1000, amplitude = 100;
+	arma::Mat<int16_t> raw(nsamples, nchannels);
+	arma::mat clean(nsamples, nchannels);
+	for (int c = 0; c < nchannels; c++) {
+		for (int i = 0; i < nsamples; i++) {
+			auto t = i / sampleRate;
+			clean(i, c) = amplitude * std::sin(2 * M_PI * tone * t + c);
+			raw(i, c) = static_cast<int16_t>(std::round(200 * c + clean(i, c) +
+					50 * std::sin(2 * M_PI * 5 * t) +
+					(static_cast<uint32_t>((i + c * nsamples) * 2654435761u) >> 30)));
+		}
+	}
+
+	/* Blocks of any size give the same result as the whole, which matches
+	 * the direct computation.
+	 */
+	for (auto filter : { Filter::bandpass(300, 5000, sampleRate, 3),
+			Filter::firBandpass(300, 5000, sampleRate, 63) }) {
+		arma::fmat whole, part;
+		filter.process(raw, whole);
+		filter.reset();
+		bool same = true;
+		int start = 0;
+		for (auto size : { 777, 1, 5000, 256, nsamples }) {
+			auto end = std::min(start + size, nsamples);
+			filter.process(raw.rows(start, end - 1).eval(), part);
+			for (arma::uword i = 0; i < part.n_elem; i++) {
+				same = same && (part(i % part.n_rows, i / part.n_rows) == 
+						whole(start + i % part.n_rows, i / part.n_rows));
+			}
+			start = end;
+		}
+		QVERIFY2(same, "Filtering in blocks differs from filtering all data at once.");
+
+		double error = 0;
+		for (int c = 0; c < nchannels; c++) {
+			auto expected = referenceFilter(filter, arma::conv_to<arma::vec>::from(raw.col(c)));
+			for (int i = 0; i < nsamples; i++) {
+				error = std::max(error, std::abs(expected(i) - whole(i, c)));
+			}
+		}
+		QVERIFY2(error < 0.05, "Filtered data differs from the direct computation.");
+		QVERIFY_EXCEPTION_THROWN(filter.process(raw.cols(0, 2).eval(), part), 
+				std::invalid_argument);
+	}
+
+	/* Zero-phase filtering keeps the tone in place and removes the rest */
+	auto filter = Filter::bandpass(300, 5000, sampleRate);
+	arma::fmat zeroPhase;
+	filter.filtfilt(raw, zeroPhase);
+	double error = 0;
+	for (int c = 0; c < nchannels; c++) {
+		for (int i = 2000; i < nsamples - 2000; i++) {
+			error = std::max(error, std::abs(zeroPhase(i, c) - clean(i, c)));
+		}
+	}
+	QVERIFY2(error < 0.1 * amplitude, "Zero-phase filtered data is incorrect.");
+	QVERIFY_EXCEPTION_THROWN(Filter::highpass(0, sampleRate), std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(Filter::bandpass(5000, 300, sampleRate), std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(Filter::firBandpass(300, 5000, sampleRate, 64),
+			std::invalid_argument);
+
+	/* Filtered datasets written to the file */
+	DataFile df(filename.toStdString(), datafile::DefaultArray, nchannels);
+	df.setGain(1.0);
+	df.setOffset(0.0);
+	df.setDate("unknown");
+	df.setData(0, nsamples, raw);
+	arma::fmat filtered, expected;
+	QVERIFY_EXCEPTION_THROWN(df.filtered(0, nchannels, 0, nsamples, filtered),
+			std::invalid_argument);
+	df.writeFiltered(filter);
+	filter.reset();
+	filter.process(raw, expected);
+	df.filtered(0, nchannels, 0, nsamples, filtered);
+	QVERIFY2(arma::all(arma::vectorise(filtered == expected)),
+			"Filtered data written to the file is incorrect.");
+	df.writeFiltered(filter, true, "zero-phase");
+	df.filtered(2, 5, 100, 20100, filtered, "zero-phase");
+	QVERIFY2(arma::all(arma::vectorise(filtered == zeroPhase.submat(100, 2, 20099, 4))),
+			"Zero-phase filtered data written to the file is incorrect.");
+
+	/* A contiguous recording's filtered data is still stored in bounded chunks */
+	QString finalName = "test-filter-final.h5";
+	if (QFile::exists(finalName)) {
+		QFile::remove(finalName);
+	}
+	df.flush();
+	finalize(filename.toStdString(), finalName.toStdString());
+	{
+		DataFile contiguous(finalName.toStdString(), OpenMode::Update);
+		QVERIFY(!contiguous.chunked());
+		filter.reset();
+		contiguous.writeFiltered(filter);
+		contiguous.filtered(0, nchannels, 0, nsamples, filtered);
+		QVERIFY2(arma::all(arma::vectorise(filtered == expected)),
+				"Filtered data of a contiguous recording is incorrect.");
+	}
+	H5::H5File file(finalName.toStdString(), H5F_ACC_RDONLY);
+	hsize_t chunk[DatasetRank] = { 0, 0 };
+	file.openDataSet(datafile::FilteredDataset).getCreatePlist().getChunk(DatasetRank, chunk);
+	QVERIFY2( (chunk[0] == static_cast<hsize_t>(nchannels)) &&
+			(chunk[1] == static_cast<hsize_t>(datafile::BlockSize)),
+			"Chunks of filtered data not bounded.");
+	QFile::remove(filename);
+	QFile::remove(finalName);
+}
+
 QTEST_APPLESS_MAIN(DatafileTest)
+
+void DatafileTest::testRechunk()
+{
+	QString filename = "test-rechunk-source.h5";
+	QString rechunkedName = "test-rechunk.h5";
+	for (auto& name : { filename, rechunkedName }) {
+		if (QFile::exists(name)) {
+			QFile::remove(name);
+		}
+	}
+
+	/* A HiDens recording, whose length is not a multiple of any chunk */
+	const int nsamples = 25003;
+	const int nchannels = static_cast<int>(m_config.size());
+	arma::Mat<uint8_t> raw(nsamples, nchannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<uint8_t>(static_cast<uint32_t>(i * 2654435761u) >> 24);
+	}
+	{
+		HidensFile hf(filename.toStdString(), hidensfile::DefaultArray, nchannels);
+		hf.setGain(0.5);
+		hf.setOffset(-1.0);
+		hf.setDate("unknown");
+		hf.setConfiguration(m_config);
+		hf.setData(0, nsamples, raw);
+	}
+	std::string date, array;
+	{
+		DataFile df(filename.toStdString());
+		date = df.date();
+		array = df.array();
+	}
+
+	/* Blocks much smaller than the file, spanning partial chunks on both
+	 * the channel and sample axes, with and without filters applied by
+	 * the library.
+	 */
+	auto options = recommendOptions(AccessPattern::ChannelScan, nchannels);
+	options.chunkChannels = 5;
+	options.chunkSamples = 4096;
+	for (auto deflate : { 4u, 0u }) {
+		options.shuffle = (deflate > 0);
+		options.deflate = deflate;
+		rechunk(filename.toStdString(), rechunkedName.toStdString(), options,
+				3 * 5 * 4096 * 2);
+		QVERIFY_EXCEPTION_THROWN(rechunk(filename.toStdString(),
+				rechunkedName.toStdString(), options), std::invalid_argument);
+
+		HidensFile hf(rechunkedName.toStdString());
+		QVERIFY2( (hf.nsamples() == nsamples) && (hf.nchannels() == nchannels) &&
+				(hf.gain() == 0.5) && (hf.offset() == -1.0) &&
+				(hf.date() == date) && (hf.array() == array),
+				"Metadata of a rechunked file not copied correctly.");
+		QVERIFY2( (hf.options().chunkChannels == options.chunkChannels) &&
+				(hf.options().chunkSamples == options.chunkSamples) &&
+				(hf.options().shuffle == options.shuffle) &&
+				(hf.options().deflate == options.deflate),
+				"Rechunked file does not have the requested layout.");
+		QVERIFY2(configsEqual(hf.configuration(), m_config),
+				"Configuration of a rechunked file not copied correctly.");
+		arma::Mat<uint8_t> read;
+		hf.data(0, nsamples, read);
+		QVERIFY2((read.size() == raw.size()) && arma::all(arma::vectorise(read == raw)),
+				"Data of a rechunked file not copied correctly.");
+		QFile::remove(rechunkedName);
+	}
+
+	/* Invalid chunks are rejected before anything is written. */
+	options.chunkChannels = 0;
+	QVERIFY_EXCEPTION_THROWN(rechunk(filename.toStdString(),
+			rechunkedName.toStdString(), options), std::invalid_argument);
+	QVERIFY(!QFile::exists(rechunkedName));
+	options.chunkChannels = 16;
+	QVERIFY_EXCEPTION_THROWN(rechunk("test-missing.h5", rechunkedName.toStdString(),
+			options), std::invalid_argument);
+	QVERIFY2(!QFile::exists("test-missing.h5") && !QFile::exists(rechunkedName),
+			"Rechunking a missing recording created a file.");
+	QFile::remove(filename);
+}
+
+void DatafileTest::testOpenModes()
+{
+	QString filename = "test-open-modes.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+	QVERIFY_EXCEPTION_THROWN(DataFile(filename.toStdString(), OpenMode::ReadOnly),
+			std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(peek(filename.toStdString()), std::invalid_argument);
+	QVERIFY(datafile::array(filename.toStdString()).empty());
+	QVERIFY(!QFile::exists(filename));
+
+	const int nsamples = 12345, nchannels = 7;
+	arma::Mat<int16_t> raw(nsamples, nchannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>(static_cast<uint32_t>(i * 2654435761u) >> 20);
+	}
+	{
+		DataFile df(filename.toStdString(), "hexagonal", nchannels);
+		QVERIFY(df.updatable());
+		df.setGain(0.25);
+		df.setOffset(-2.0);
+		df.setDate("2016-01-01T00:00:00");
+		df.setData(0, nsamples, raw);
+	}
+
+	/* The header matches the file opened as a DataFile */
+	auto info = peek(filename.toStdString());
+	{
+		DataFile df(filename.toStdString());
+		QVERIFY2( (info.filename == filename.toStdString()) &&
+				(info.array == "hexagonal") && (df.array() == info.array) &&
+				(info.date == "2016-01-01T00:00:00") && (df.date() == info.date) &&
+				(info.room == df.room()) && (info.room == DefaultRoomString) &&
+				(info.nchannels == static_cast<uint64_t>(nchannels)) &&
+				(info.nsamples == static_cast<uint64_t>(nsamples)) &&
+				(info.analogOutputSize == 0) && !info.nsamplesStale &&
+				(info.sampleRate == df.sampleRate()) && (info.gain == 0.25f) &&
+				(info.offset == -2.0f),
+				"Header of a recording not read correctly.");
+		QVERIFY(datafile::array(filename.toStdString()) == "hexagonal");
+
+		/* Files opened read-only can be read, but not changed in any way */
+		QVERIFY(!df.updatable());
+		arma::Mat<int16_t> read;
+		df.data(0, nsamples, read);
+		QVERIFY(arma::all(arma::vectorise(read == raw)));
+		QVERIFY_EXCEPTION_THROWN(df.setData(0, nsamples, raw), std::logic_error);
+		QVERIFY_EXCEPTION_THROWN(df.setMeans(arma::vec(nchannels, arma::fill::zeros)),
+				std::logic_error);
+		QVERIFY_EXCEPTION_THROWN(df.buildSummary(), std::logic_error);
+		QVERIFY_EXCEPTION_THROWN(df.computeStats(), std::logic_error);
+		auto filter = Filter::highpass(100, datafile::SampleRate);
+		QVERIFY_EXCEPTION_THROWN(df.writeFiltered(filter), std::logic_error);
+
+		/* Any number of readers may share the file */
+		DataFile other(filename.toStdString(), OpenMode::ReadOnly);
+		QVERIFY(other.nsamples() == nsamples);
+	}
+
+	/* Files opened for update store derived data, but not raw data */
+	{
+		DataFile df(filename.toStdString(), OpenMode::Update);
+		QVERIFY(df.updatable());
+		arma::vec means(nchannels, arma::fill::ones);
+		df.setMeans(means);
+		QVERIFY(arma::all(df.means() == means));
+		QVERIFY_EXCEPTION_THROWN(df.setData(0, nsamples, raw), std::logic_error);
+	}
+
+	/* HiDens recordings may be opened for update too, keeping their configuration */
+	QString hidensName = "test-open-modes-hidens.h5";
+	if (QFile::exists(hidensName)) {
+		QFile::remove(hidensName);
+	}
+	{
+		HidensFile hf(hidensName.toStdString(), hidensfile::DefaultArray,
+				static_cast<int>(m_config.size()));
+		hf.setGain(0.5);
+		hf.setOffset(-1.0);
+		hf.setDate("unknown");
+		hf.setConfiguration(m_config);
+		hf.setData(0, 1000, arma::Mat<uint8_t>(1000, m_config.size(), arma::fill::ones));
+	}
+	{
+		HidensFile hf(hidensName.toStdString(), OpenMode::Update);
+		QVERIFY(hf.updatable());
+		QVERIFY2(configsEqual(hf.configuration(), m_config),
+				"Configuration of a HiDens file opened for update not read.");
+		hf.computeStats();
+		QVERIFY(hf.stats().complete && (hf.stats().count == 1000));
+	}
+	QVERIFY_EXCEPTION_THROWN(HidensFile("test-missing.h5", OpenMode::ReadOnly),
+			std::invalid_argument);
+	QFile::remove(hidensName);
+
+	/* Files written before the number of channels was stored */
+	{
+		H5::H5File file(filename.toStdString(), H5F_ACC_RDWR);
+		file.openDataSet("data").removeAttr("nchannels");
+	}
+	info = peek(filename.toStdString());
+	QVERIFY2( (info.nchannels == static_cast<uint64_t>(nchannels)) &&
+			(info.nsamples == static_cast<uint64_t>(nsamples)),
+			"Size of a recording without the number of channels not read correctly.");
+
+	/* Files which are not recordings */
+	{
+		H5::H5File file(filename.toStdString(), H5F_ACC_TRUNC);
+	}
+	QVERIFY_EXCEPTION_THROWN(peek(filename.toStdString()), std::invalid_argument);
+	{
+		H5::H5File file(filename.toStdString(), H5F_ACC_TRUNC);
+		file.createGroup("data");
+	}
+	QVERIFY_EXCEPTION_THROWN(peek(filename.toStdString()), std::invalid_argument);
+	QVERIFY(datafile::array(filename.toStdString()).empty());
+	QFile::remove(filename);
+}
+
+void DatafileTest::testSwmr()
+{
+	QString filename = "test-swmr.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+	const int nchannels = 5, blockSize = 1000, nblocks = 8;
+	auto block = [](int i) {
+		arma::Mat<int16_t> data(blockSize, nchannels);
+		data.fill(static_cast<int16_t>(i + 1));
+		return data;
+	};
+
+	/* SWMR writing requires a file created for it */
+	{
+		DataFile df(filename.toStdString(), datafile::DefaultArray, nchannels);
+		QVERIFY_EXCEPTION_THROWN(df.startSwmrWrite(), std::logic_error);
+		QVERIFY(!df.swmr());
+	}
+	QFile::remove(filename);
+
+	/* A reader in another process, started once SWMR writing starts,
+	 * waits for all blocks and checks them.
+	 */
+	int ready[2];
+	QVERIFY(pipe(ready) == 0);
+	auto pid = fork();
+	QVERIFY(pid >= 0);
+	if (pid == 0) {
+		char c;
+		close(ready[1]);
+		bool ok = (read(ready[0], &c, 1) == 1);
+		try {
+			DataFile df(filename.toStdString(), OpenMode::SwmrRead);
+			ok = ok && df.swmr() && (df.nsamples() >= blockSize) &&
+				df.waitForSamples(nblocks * blockSize, 30.0);
+			arma::Mat<int16_t> data;
+			for (int i = 0; ok && (i < nblocks); i++) {
+				df.data(i * blockSize, (i + 1) * blockSize, data);
+				ok = arma::all(arma::vectorise(data == block(i)));
+			}
+			ok = ok && !df.waitForSamples(nblocks * blockSize + 1, 0.05);
+		} catch ( ... ) {
+			ok = false;
+		}
+		_exit(ok ? 0 : 1);
+	}
+	close(ready[0]);
+
+	DataFileOptions options;
+	options.swmr = true;
+	{
+		DataFile df(filename.toStdString(), datafile::DefaultArray, nchannels, options);
+		df.setGain(0.5);
+		df.setOffset(0.0);
+		df.setDate("unknown");
+		df.setData(0, blockSize, block(0));
+		df.startSwmrWrite();
+		QVERIFY(df.swmr());
+		QVERIFY(write(ready[1], "x", 1) == 1);
+		close(ready[1]);
+		for (int i = 1; i < nblocks; i++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			df.setData(i * blockSize, (i + 1) * blockSize, block(i), true);
+		}
+		QVERIFY2(df.means().is_empty(), "Means written during SWMR writing.");
+
+		/* Existing attributes can be changed, but nothing can be created */
+		df.setGain(0.25);
+		QVERIFY_EXCEPTION_THROWN(df.setAnalogOutputSize(10), std::logic_error);
+		QVERIFY_EXCEPTION_THROWN(df.setMeans(arma::vec(nchannels, arma::fill::zeros)),
+				std::logic_error);
+	}
+	int status = 0;
+	QVERIFY(waitpid(pid, &status, 0) == pid);
+	QVERIFY2(WIFEXITED(status) && (WEXITSTATUS(status) == 0),
+			"A SWMR reader did not read data as it was written.");
+
+	/* Once closed, the file holds its final metadata */
+	auto info = peek(filename.toStdString());
+	QVERIFY2( (info.nsamples == nblocks * blockSize) && !info.nsamplesStale &&
+			(info.gain == 0.25f) && (info.analogOutputSize == 0),
+			"Metadata of a file written with SWMR access is incorrect.");
+	DataFile df(filename.toStdString());
+	QVERIFY(df.stats().complete && (df.stats().count == nblocks * blockSize));
+	QVERIFY(df.means().n_elem == static_cast<arma::uword>(nchannels));
+	QVERIFY(df.refresh() == nblocks * blockSize);
+	QFile::remove(filename);
+}
+
+void DatafileTest::testRecordingSet()
+{
+	std::vector<QString> filenames { "test-set-0.h5", "test-set-1.h5", 
+		"test-set-2.h5", "test-set-3.h5", "test-set-mismatched.h5", 
+		"test-set-virtual.h5" };
+	QString mismatchedName = filenames[4];
+	QString virtualName = filenames[5];
+	for (auto& name : filenames) {
+		if (QFile::exists(name)) {
+			QFile::remove(name);
+		}
+	}
+
+	/* Segments of different lengths, one of them empty, with the data of
+	 * the whole recording split among them.
+	 */
+	const int nchannels = 16;
+	const std::vector<int> lengths { 7001, 0, 12345, 5000 };
+	const int nsamples = 7001 + 12345 + 5000;
+	arma::Mat<int16_t> raw(nsamples, nchannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>(static_cast<uint32_t>(i * 2654435761u) >> 16);
+	}
+	std::vector<std::string> names;
+	int start = 0;
+	for (size_t i = 0; i < lengths.size(); i++) {
+		names.push_back(filenames[i].toStdString());
+		DataFile df(names.back(), datafile::DefaultArray, nchannels);
+		df.setGain(0.5);
+		df.setOffset(-2.0);
+		df.setDate("unknown");
+		if (lengths[i] > 0) {
+			arma::Mat<int16_t> segment = raw.rows(start, start + lengths[i] - 1);
+			df.setData(0, lengths[i], segment);
+		}
+		start += lengths[i];
+	}
+	{
+		DataFile df(mismatchedName.toStdString(), datafile::DefaultArray, nchannels + 1);
+		df.setGain(0.5);
+		df.setOffset(-2.0);
+		df.setDate("unknown");
+		df.setData(0, 100, arma::Mat<int16_t>(100, nchannels + 1, arma::fill::zeros));
+	}
+
+	RecordingSet set(names);
+	QVERIFY( (set.nfiles() == names.size()) && (set.nsamples() == nsamples) &&
+			(set.nchannels() == nchannels) && (set.gain() == 0.5) &&
+			(set.offset() == -2.0) );
+	QVERIFY( (set.fileStart(1) == 7001) && (set.fileStart(2) == 7001) &&
+			(set.fileStart(3) == 7001 + 12345) );
+	QVERIFY( (set.fileAt(0) == 0) && (set.fileAt(7000) == 0) && 
+			(set.fileAt(7001) == 2) && (set.fileAt(nsamples - 1) == 3) );
+	QVERIFY_EXCEPTION_THROWN(set.fileAt(nsamples), std::logic_error);
+
+	/* Reads within one file, spanning every file, and spanning a boundary
+	 * over some channels, with and without a pool.
+	 */
+	ThreadPool pool(4);
+	for (auto p : { static_cast<ThreadPool*>(nullptr), &pool }) {
+		arma::Mat<int16_t> read;
+		set.data(0, nsamples, read, p);
+		QVERIFY2((read.n_rows == raw.n_rows) && arma::all(arma::vectorise(read == raw)),
+				"Data of a RecordingSet does not match the concatenated files.");
+		set.data(3, 11, 100, 200, read, p);
+		QVERIFY(arma::all(arma::vectorise(read == raw.submat(100, 3, 199, 10))));
+		set.data(3, 11, 6500, 7001 + 12345 + 10, read, p);
+		QVERIFY(arma::all(arma::vectorise(read == raw.submat(6500, 3, 
+							7001 + 12345 + 9, 10))));
+
+		arma::mat scaled;
+		set.dataScaled(2, 5, 7001 + 12345 - 20, 7001 + 12345 + 20, scaled, p);
+		arma::Mat<int16_t> block = raw.submat(7001 + 12345 - 20, 2, 7001 + 12345 + 19, 4);
+		arma::mat expected = arma::conv_to<arma::mat>::from(block);
+		expected = 0.5 * expected - 2.0;
+		QVERIFY2(arma::approx_equal(scaled, expected, "absdiff", 1e-9),
+				"Scaled data of a RecordingSet not converted correctly.");
+	}
+	arma::Mat<int16_t> read;
+	QVERIFY_EXCEPTION_THROWN(set.data(0, nsamples + 1, read), std::logic_error);
+	QVERIFY_EXCEPTION_THROWN(set.data(0, nchannels + 1, 0, 10, read), std::logic_error);
+	QVERIFY_EXCEPTION_THROWN(set.file(0).dataInto(0, nchannels, 0, 10, read, 
+				read.n_rows), std::logic_error);
+
+	names.push_back(mismatchedName.toStdString());
+	QVERIFY_EXCEPTION_THROWN(RecordingSet mismatched(names), std::invalid_argument);
+
+	/* The virtual file reads as a single recording with the same layout
+	 * as its sources.
+	 */
+	set.writeVirtual(virtualName.toStdString());
+	QVERIFY_EXCEPTION_THROWN(set.writeVirtual(virtualName.toStdString()), 
+			std::invalid_argument);
+	{
+		DataFile df(virtualName.toStdString());
+		QVERIFY( (df.nsamples() == nsamples) && (df.nchannels() == nchannels) &&
+				(df.gain() == 0.5) && (df.offset() == -2.0) &&
+				(df.array() == set.array()) && (df.date() == "unknown") );
+		QVERIFY(df.options().chunkSamples == set.file(0).options().chunkSamples);
+		df.data(0, nsamples, read);
+		QVERIFY2((read.n_rows == raw.n_rows) && arma::all(arma::vectorise(read == raw)),
+				"Data of a virtual file does not match the concatenated files.");
+
+		DataFile::ReadPlan plan(df);
+		plan.add(0, nchannels, 6990, 7010);
+		plan.add(4, 6, 7001 + 12345 - 1, 7001 + 12345 + 1);
+		std::vector<arma::Mat<int16_t> > windows;
+		plan.execute(windows);
+		QVERIFY(arma::all(arma::vectorise(windows[0] == raw.rows(6990, 7009))));
+		QVERIFY(arma::all(arma::vectorise(windows[1] == raw.submat(
+							7001 + 12345 - 1, 4, 7001 + 12345, 5))));
+	}
+
+	for (auto& name : filenames) {
+		QFile::remove(name);
+	}
+}
+
+void DatafileTest::testLargeSampleOffsets()
+{
+	QString filename = "test-large-offsets.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	/* A block written just past 2^31 samples, so that only the chunks
+	 * holding it are ever allocated.
+	 */
+	const int nchannels = 4, nwritten = 5000;
+	const int64_t start = (int64_t(1) << 31) + 123;
+	arma::Mat<int16_t> raw(nwritten, nchannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>(static_cast<uint32_t>(i * 2654435761u) >> 16);
+	}
+	{
+		DataFile df(filename.toStdString(), datafile::DefaultArray, nchannels);
+		df.setGain(0.5);
+		df.setOffset(-2.0);
+		df.setDate("unknown");
+		df.setData(start, start + nwritten, raw);
+		QVERIFY(df.nsamples() == start + nwritten);
+		QVERIFY_EXCEPTION_THROWN(df.setData(-1, 10, raw), std::logic_error);
+	}
+
+	{
+		DataFile df(filename.toStdString(), OpenMode::ReadOnly);
+		QVERIFY2( (df.nsamples() == start + nwritten) &&
+				(df.nsamples() > std::numeric_limits<int>::max()) &&
+				(peek(filename.toStdString()).nsamples == static_cast<uint64_t>(start + nwritten)),
+				"Number of samples past the range of an int not stored correctly.");
+
+		/* Read across 2^31, where unwritten samples are zero */
+		arma::Mat<int16_t> read;
+		df.data(start - 100, start + nwritten, read);
+		QVERIFY2( (read.n_rows == static_cast<arma::uword>(nwritten + 100)) &&
+				arma::all(arma::vectorise(read.rows(0, 99) == 0)) &&
+				arma::all(arma::vectorise(read.rows(100, read.n_rows - 1) == raw)),
+				"Data past 2^31 samples read incorrectly.");
+		df.data(1, 3, start + 10, start + 20, read);
+		QVERIFY(arma::all(arma::vectorise(read == raw.submat(10, 1, 19, 2))));
+		QVERIFY_EXCEPTION_THROWN(df.data(start, start + nwritten + 1, read),
+				std::logic_error);
+
+		/* A plan of windows past 2^31 */
+		DataFile::ReadPlan plan(df);
+		plan.add(0, nchannels, start + 1000, start + 1100);
+		plan.add(2, 3, start - 10, start + 10);
+		std::vector<arma::Mat<int16_t> > windows;
+		plan.execute(windows);
+		QVERIFY2( arma::all(arma::vectorise(windows[0] == raw.rows(1000, 1099))) &&
+				arma::all(arma::vectorise(windows[1].rows(0, 9) == 0)) &&
+				arma::all(arma::vectorise(windows[1].rows(10, 19) == raw.submat(0, 2, 9, 2))),
+				"ReadPlan read past 2^31 samples incorrectly.");
+	}
+	QFile::remove(filename);
+}
+
+void DatafileTest::testIOStats()
+{
+	QString filename = "test-iostats.h5";
+	if (QFile::exists(filename)) {
+		QFile::remove(filename);
+	}
+
+	const int nchannels = 8, nsamples = 4 * datafile::BlockSize;
+	arma::Mat<int16_t> raw(nsamples, nchannels);
+	for (arma::uword i = 0; i < raw.n_elem; i++) {
+		raw(i) = static_cast<int16_t>(static_cast<uint32_t>(i * 2654435761u) >> 16);
+	}
+	const uint64_t halfBytes = raw.n_elem * sizeof(int16_t) / 2;
+	{
+		DataFile df(filename.toStdString(), datafile::DefaultArray, nchannels);
+		df.setGain(0.5);
+		df.setOffset(-2.0);
+		df.setDate("unknown");
+		df.setData(0, nsamples / 2, raw.rows(0, nsamples / 2 - 1).eval());
+		auto stats = df.ioStats();
+		QVERIFY2(!stats.enabled && !df.ioStatsEnabled() &&
+				(stats[IOOperation::Write].calls == 0) &&
+				(stats[IOOperation::AttrWrite].calls == 0),
+				"I/O statistics collected without being enabled.");
+
+		df.setIOStatsEnabled(true);
+		df.setData(nsamples / 2, nsamples, raw.rows(nsamples / 2, nsamples - 1).eval());
+		df.flush();
+		stats = df.ioStats();
+		auto& writes = stats[IOOperation::Write];
+		QVERIFY2( stats.enabled && (writes.calls == 1) && (writes.bytes == halfBytes) &&
+				(stats[IOOperation::Extend].calls == 1) &&
+				(stats[IOOperation::Flush].calls == 1) &&
+				(stats[IOOperation::Read].calls == 0),
+				"Writes of data not counted correctly.");
+		QVERIFY2( (writes.maxSeconds <= writes.seconds) &&
+				(writes.meanSeconds() == writes.seconds) &&
+				(std::accumulate(writes.latency.begin(), writes.latency.end(),
+						uint64_t(0)) == writes.calls) &&
+				(writes.quantileSeconds(0.5) <= writes.maxSeconds) &&
+				(stats.chunkCacheBytes == df.options().chunkCacheBytes),
+				"Write latencies not recorded correctly.");
+
+		df.resetIOStats();
+		stats = df.ioStats();
+		for (auto& op : stats.operations) {
+			QVERIFY2( (op.calls == 0) && (op.bytes == 0) && (op.seconds == 0),
+					"I/O statistics not reset.");
+		}
+	}
+
+	/* Enabled from the start, counting the attributes read on opening,
+	 * and exactly counting reads from many threads at once.
+	 */
+	DataFileOptions options;
+	options.ioStats = true;
+	DataFile df(filename.toStdString(), OpenMode::ReadOnly, options);
+	auto opened = df.ioStats();
+	QVERIFY2( (opened[IOOperation::AttrRead].calls > 0) &&
+			(opened[IOOperation::AttrRead].bytes > 0) &&
+			(opened[IOOperation::Read].calls == 0),
+			"Attributes read on opening not counted.");
+
+	const int nthreads = 4, nreads = 25, length = 100;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < nthreads; t++) {
+		threads.emplace_back([&df, t]() {
+			arma::Mat<int16_t> read;
+			for (int i = 0; i < nreads; i++) {
+				auto start = static_cast<int64_t>((t * nreads + i) * length);
+				df.data(2, 6, start, start + length, read);
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	auto stats = df.ioStats();
+	auto& reads = stats[IOOperation::Read];
+	QVERIFY2( (reads.calls == static_cast<uint64_t>(nthreads * nreads)) &&
+			(reads.bytes == reads.calls * 4 * length * sizeof(int16_t)) &&
+			(std::accumulate(reads.latency.begin(), reads.latency.end(),
+					uint64_t(0)) == reads.calls) &&
+			(reads.quantileSeconds(0.99) <= reads.maxSeconds) &&
+			(reads.quantileSeconds(0.5) <= reads.quantileSeconds(0.99)),
+			"Concurrent reads not counted correctly.");
+	df.setIOStatsEnabled(false);
+	arma::Mat<int16_t> read;
+	df.data(0, length, read);
+	QVERIFY2(df.ioStats()[IOOperation::Read].calls == reads.calls,
+			"Reads counted after collection stopped.");
+
+	/* Snippet files count their own I/O */
+	QString snipname = "test-iostats.snip";
+	if (QFile::exists(snipname)) {
+		QFile::remove(snipname);
+	}
+	const arma::uword snipsize = 33, nsnips = 100;
+	{
+		SnipFile snipFile(snipname.toStdString(), df);
+		snipFile.setIOStatsEnabled(true);
+		snipFile.setChannels(arma::uvec({ 1, 2 }));
+		snipFile.setThresholds(arma::vec(2, arma::fill::ones));
+		arma::Mat<qint16> snips(snipsize, nsnips, arma::fill::zeros);
+		arma::uvec idx(nsnips);
+		for (arma::uword i = 0; i < nsnips; i++) {
+			idx(i) = 10 * i;
+		}
+		snipFile.appendSpikeSnips(1, idx, snips);
+		auto snipStats = snipFile.ioStats();
+		QVERIFY2( (snipStats[IOOperation::Extend].calls == 2) &&
+				(snipStats[IOOperation::Write].bytes >=
+					snips.n_elem * sizeof(qint16) + idx.n_elem * sizeof(uint64_t)) &&
+				(snipStats[IOOperation::AttrWrite].calls > 0),
+				"Snippet writes not counted correctly.");
+	}
+	SnipFile snipFile(snipname.toStdString());
+	QVERIFY(!snipFile.ioStatsEnabled());
+	snipFile.setIOStatsEnabled(true);
+	arma::uvec readIdx;
+	arma::Mat<qint16> readSnips;
+	snipFile.spikeSnips(1, readIdx, readSnips);
+	auto snipStats = snipFile.ioStats();
+	QVERIFY2( (readIdx.n_elem == nsnips) && (snipStats[IOOperation::Read].calls == 2) &&
+			(snipStats[IOOperation::Read].bytes ==
+				readSnips.n_elem * sizeof(qint16) + readIdx.n_elem * sizeof(uint64_t)),
+			"Snippet reads not counted correctly.");
+	snipFile.resetIOStats();
+	QVERIFY(snipFile.ioStats()[IOOperation::Read].calls == 0);
+	QFile::remove(snipname);
+	QFile::remove(filename);
+}
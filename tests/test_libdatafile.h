@@ -12,6 +12,16 @@
 #include "../include/hidensfile.h"
 #include "../include/snipfile.h"
 #include "../include/hidenssnipfile.h"
+#include "../include/asyncwriter.h"
+#include "../include/mappeddatafile.h"
+#include "../include/readerpool.h"
+#include "../include/readplan.h"
+#include "../include/blockiterator.h"
+#include "../include/chunkreader.h"
+#include "../include/extractor.h"
+#include "../include/noisesampler.h"
+#include "../include/rechunk.h"
+#include "../include/recordingset.h"
 
 #include <QtCore>
 #include <QtTest/QtTest>
@@ -78,12 +88,131 @@ class DatafileTest : public QObject {
 		/*! Test adding random snippets to the files and reading them back */
 		void testReadWriteSnippets();
 
+		/*! Test appending snippets to a file a block at a time, with 
+		 * compression, and reading them back.
+		 */
+		void testAppendSnippets();
+
+		/*! Test writing and reading snippets in the columnar layout */
+		void testColumnarSnippets();
+
+		/*! Test loading snippets of all channels on a thread pool, both
+		 * by direct chunk reads of compressed snippets and through HDF5.
+		 */
+		void testParallelSnippetLoad();
+
+		/*! Test reading the spike snippets in ranges of samples, from
+		 * files of each layout.
+		 */
+		void testSnippetTimeRange();
+
 		/*! Test reading writing means to the original raw data files. 
 		 * This process is done by the `extract` program, to save the mean
 		 * value of each channel.
 		 */
 		void testReadWriteMeans();
 
+		/*! Test appending data through the asynchronous writer, and
+		 * verify that it is written at the correct offsets.
+		 */
+		void testAsyncWriter();
+
+		/*! Test deferring writes of the number of samples, and recovering
+		 * the count from a file whose count was never written.
+		 */
+		void testDeferNumSamples();
+
+		/*! Test creating and re-opening a file with a non-default chunk
+		 * shape and chunk cache.
+		 */
+		void testChunkOptions();
+
+		/*! Test that compressed datasets are read back transparently,
+		 * and that requesting an unavailable filter throws.
+		 */
+		void testCompression();
+
+		/*! Test finalizing a recording to a contiguous layout and reading
+		 * it back through a memory-mapped view.
+		 */
+		void testMappedDataFile();
+
+		/*! Test reading data scaled to voltages through the fused
+		 * conversion kernels, against the plain Armadillo computation.
+		 */
+		void testDataScaled();
+
+		/*! Stress concurrent reads of one DataFile from many threads,
+		 * directly and through a ReaderPool, checking every result
+		 * is bit-exact.
+		 */
+		void testConcurrentReads();
+
+		/*! Test that a ReadPlan reads each chunk once for many overlapping
+		 * requests, and returns the same data as reading them one by one.
+		 */
+		void testReadPlan();
+
+		/*! Test iterating over overlapping blocks of a recording, read
+		 * ahead on a background thread.
+		 */
+		void testBlockIterator();
+
+		/*! Test building summary levels as data is written, querying them
+		 * at several resolutions, and building them for an existing file.
+		 */
+		void testSummary();
+
+		/*! Test the per-channel statistics accumulated as data is written,
+		 * stored in the file, and computed for an existing file.
+		 */
+		void testChannelStats();
+
+		/*! Test extracting spikes from a recording in blocks and groups of
+		 * channels, against a direct search of all of its data.
+		 */
+		void testExtractor();
+
+		/*! Test drawing random noise snippets reproducibly from a seed,
+		 * and writing them to a snippet file.
+		 */
+		void testNoiseSampler();
+
+		/*! Test streaming IIR and FIR filters against direct computations,
+		 * zero-phase filtering, and filtered datasets written to a file.
+		 */
+		void testFilter();
+
+		/*! Test rewriting recordings with new chunk shapes and filters,
+		 * preserving their data, attributes and configuration.
+		 */
+		void testRechunk();
+
+		/*! Test opening existing files read-only or for update, and
+		 * peeking at their headers without opening them.
+		 */
+		void testOpenModes();
+
+		/*! Test reading a file from another process while it is written
+		 * with SWMR access.
+		 */
+		void testSwmr();
+
+		/*! Test reading several consecutive files as one recording,
+		 * directly and through a virtual file.
+		 */
+		void testRecordingSet();
+
+		/*! Test writing and reading samples past the range of an int,
+		 * in a sparse file.
+		 */
+		void testLargeSampleOffsets();
+
+		/*! Test collecting I/O statistics of recordings and snippet files,
+		 * including from concurrent readers.
+		 */
+		void testIOStats();
+
 	private:
 		QString m_datafileName;
 		QString m_hidensfileName;
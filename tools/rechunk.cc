@@ -0,0 +1,113 @@
+/*! \file rechunk.cc
+ *
+ * Command-line tool to rewrite a recording with a new chunk shape or
+ * compression.
+ *
+ * (C) 2016 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "../include/rechunk.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+static void usage()
+{
+	std::cerr << "Usage: rechunk [options] source destination\n\n"
+		<< "Copy a recording into a new file with a different chunk shape or\n"
+		<< "compression. Options:\n"
+		<< "  --pattern channel|time|mixed  Start from the recommended layout\n"
+		<< "                                for the given access pattern\n"
+		<< "  --chunk CxS                   Chunks of C channels and S samples\n"
+		<< "  --deflate N                   Deflate level, 0 to disable\n"
+		<< "  --shuffle                     Apply the shuffle filter\n"
+		<< "  --no-shuffle                  Do not apply the shuffle filter\n"
+		<< "  --buffer MB                   Bound on memory for data in flight\n";
+}
+
+static unsigned long parseNumber(const std::string& value)
+{
+	size_t end;
+	auto n = std::stoul(value, &end);
+	if (end != value.size()) {
+		throw std::invalid_argument("Invalid number: " + value);
+	}
+	return n;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string pattern = "mixed", chunk, source, destination;
+	int deflate = -1, shuffle = -1;
+	size_t bufferBytes = datafile::DefaultRechunkBufferBytes;
+	datafile::DataFileOptions options;
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			bool hasValue = (i + 1 < argc);
+			if ((arg == "--pattern") && hasValue) {
+				pattern = argv[++i];
+			} else if ((arg == "--chunk") && hasValue) {
+				chunk = argv[++i];
+			} else if ((arg == "--deflate") && hasValue) {
+				deflate = static_cast<int>(parseNumber(argv[++i]));
+			} else if (arg == "--shuffle") {
+				shuffle = 1;
+			} else if (arg == "--no-shuffle") {
+				shuffle = 0;
+			} else if ((arg == "--buffer") && hasValue) {
+				bufferBytes = parseNumber(argv[++i]) * 1024 * 1024;
+			} else if ((arg.compare(0, 2, "--") != 0) && source.empty()) {
+				source = arg;
+			} else if ((arg.compare(0, 2, "--") != 0) && destination.empty()) {
+				destination = arg;
+			} else {
+				throw std::invalid_argument("Unexpected argument: " + arg);
+			}
+		}
+		if (source.empty() || destination.empty()) {
+			throw std::invalid_argument("A source and destination are required");
+		}
+
+		datafile::AccessPattern access;
+		if (pattern == "channel") {
+			access = datafile::AccessPattern::ChannelScan;
+		} else if (pattern == "time") {
+			access = datafile::AccessPattern::TimeWindow;
+		} else if (pattern == "mixed") {
+			access = datafile::AccessPattern::Mixed;
+		} else {
+			throw std::invalid_argument("Unknown access pattern: " + pattern);
+		}
+		options = datafile::recommendOptions(access,
+				datafile::DataFile(source, datafile::OpenMode::ReadOnly).nchannels());
+		if (!chunk.empty()) {
+			auto x = chunk.find('x');
+			if (x == std::string::npos) {
+				throw std::invalid_argument("Invalid chunk shape: " + chunk);
+			}
+			options.chunkChannels = parseNumber(chunk.substr(0, x));
+			options.chunkSamples = parseNumber(chunk.substr(x + 1));
+		}
+		if (deflate >= 0) {
+			options.deflate = static_cast<unsigned int>(deflate);
+		}
+		if (shuffle >= 0) {
+			options.shuffle = (shuffle == 1);
+		}
+	} catch (std::exception& e) {
+		std::cerr << e.what() << "\n\n";
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	try {
+		datafile::rechunk(source, destination, options, bufferBytes);
+	} catch (std::exception& e) {
+		std::cerr << "Could not rechunk " << source << ": " << e.what() << "\n";
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
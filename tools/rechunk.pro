@@ -0,0 +1,21 @@
+TEMPLATE = app
+TARGET = rechunk
+INCLUDEPATH += . \
+	/usr/local/include \
+	/usr/include \
+	../include \
+	../../libdata-source/include \
+	/usr/include/hdf5/serial
+
+LIBS += -L/usr/local/lib -L../lib/ \
+	-L/usr/lib/x86_64-linux-gnu/hdf5/serial \
+	-ldatafile -larmadillo -lhdf5_cpp -lhdf5
+
+QT -= gui
+CONFIG += console release c++11 thread
+CONFIG -= app_bundle
+
+QMAKE_RPATHDIR += ../lib/
+
+# Input
+SOURCES += rechunk.cc